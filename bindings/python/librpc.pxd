@@ -313,6 +313,7 @@ cdef extern from "rpc/query.h" nogil:
         bint reverse
         void *sort
         void *callback
+        uint32_t parallelism
 
     ctypedef struct rpc_query_iter:
         pass
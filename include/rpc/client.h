@@ -51,6 +51,31 @@ struct rpc_client;
  */
 typedef struct rpc_client *rpc_client_t;
 
+/**
+ * Shared client runtime structure.
+ */
+struct rpc_runtime;
+
+/**
+ * Shared client runtime handle.
+ *
+ * A runtime owns a fixed set of event loop threads and a callback
+ * thread pool. Clients created with rpc_client_create_with_runtime()
+ * run their timers, socket readers and callbacks on those threads
+ * instead of spawning their own.
+ */
+typedef struct rpc_runtime *rpc_runtime_t;
+
+/**
+ * Client pool structure.
+ */
+struct rpc_client_pool;
+
+/**
+ * Client pool handle.
+ */
+typedef struct rpc_client_pool *rpc_client_pool_t;
+
 /**
  * Creates a new, connected RPC client.
  *
@@ -67,6 +92,22 @@ typedef struct rpc_client *rpc_client_t;
 _Nullable rpc_client_t rpc_client_create(const char *_Nonnull uri,
     _Nullable rpc_object_t params);
 
+/**
+ * Creates a new, connected RPC client running on a shared runtime.
+ *
+ * Works like rpc_client_create(), except that the client does not
+ * start an event loop thread of its own. It is attached to the least
+ * loaded loop of @p runtime instead.
+ *
+ * @param runtime Runtime to run the client on
+ * @param uri Endpoint URI
+ * @param params Transport-specific parameters or NULL
+ * @return Connect RPC client handle
+ */
+_Nullable rpc_client_t rpc_client_create_with_runtime(
+    _Nonnull rpc_runtime_t runtime, const char *_Nonnull uri,
+    _Nullable rpc_object_t params);
+
 /**
  * Gets the connection object from a client.
  *
@@ -83,6 +124,125 @@ _Nonnull rpc_connection_t rpc_client_get_connection(
  */
 void rpc_client_close(_Nonnull rpc_client_t client);
 
+/**
+ * Creates a shared client runtime.
+ *
+ * Event loops only read frames and hand them off, so a slow peer or
+ * a blocking handler on one client does not hold up the others on the
+ * same loop. Callbacks and event handlers run on the callback pool, and
+ * methods served to the remote side (including inline ones) run on the
+ * connection's context thread pool. Callbacks still queued when their
+ * client is closed are dropped.
+ *
+ * @param nloops Number of event loop threads; 0 picks the number of CPUs
+ * @param nworkers Number of callback threads; 0 picks the number of CPUs
+ * @return Runtime handle or NULL on failure
+ */
+_Nullable rpc_runtime_t rpc_runtime_create(size_t nloops, size_t nworkers);
+
+/**
+ * Stops the runtime threads and frees the runtime.
+ *
+ * All clients created with the runtime must have been closed.
+ *
+ * @param runtime Runtime handle
+ * @return 0 on success, -1 if clients are still attached
+ */
+int rpc_runtime_free(_Nonnull rpc_runtime_t runtime);
+
+/**
+ * Creates a pool of client connections.
+ *
+ * The pool keeps @p size connections, spread round-robin over
+ * @p uris, which must all point at equivalent servers. Calls made
+ * through the pool go to the open connection with the fewest calls in
+ * flight. Connections that die are replaced in the background.
+ *
+ * @param uris NULL-terminated array of endpoint URIs
+ * @param size Number of connections to keep
+ * @param runtime Runtime to create the clients on, or NULL
+ * @param params Transport-specific parameters or NULL
+ * @return Pool handle or NULL if no URI could be connected to
+ */
+_Nullable rpc_client_pool_t rpc_client_pool_create(
+    const char *_Nonnull const *_Nonnull uris, size_t size,
+    _Nullable rpc_runtime_t runtime, _Nullable rpc_object_t params);
+
+/**
+ * Closes all pool connections and frees the pool.
+ *
+ * @param pool Pool handle
+ */
+void rpc_client_pool_free(_Nonnull rpc_client_pool_t pool);
+
+/**
+ * Returns the number of connections a pool keeps.
+ *
+ * @param pool Pool handle
+ * @return Number of connections
+ */
+size_t rpc_client_pool_get_size(_Nonnull rpc_client_pool_t pool);
+
+/**
+ * Calls a method on the least loaded pool connection.
+ *
+ * Works like rpc_connection_call(). The returned call stays bound to
+ * the connection it was made on. A call that cannot be sent because
+ * its connection just died is retried on another one.
+ *
+ * @param pool Pool handle
+ * @param path Object path or NULL
+ * @param interface Interface name or NULL
+ * @param name Method name
+ * @param args Method arguments or NULL
+ * @param callback Completion callback or NULL
+ * @return RPC call object
+ */
+_Nullable rpc_call_t rpc_client_pool_call(_Nonnull rpc_client_pool_t pool,
+    const char *_Nullable path, const char *_Nullable interface,
+    const char *_Nonnull name, _Nullable rpc_object_t args,
+    _Nullable rpc_callback_t callback);
+
+/**
+ * Starts a client-streaming call on the least loaded pool connection.
+ *
+ * Works like rpc_connection_call_stream(). All fragments of the call
+ * go through the same connection. Like rpc_client_pool_call(), a call
+ * that cannot be started because its connection just died is retried
+ * on another one.
+ *
+ * @param pool Pool handle
+ * @param path Object path or NULL
+ * @param interface Interface name or NULL
+ * @param name Method name
+ * @param args Method arguments or NULL
+ * @return RPC call object
+ */
+_Nullable rpc_call_t rpc_client_pool_call_stream(
+    _Nonnull rpc_client_pool_t pool, const char *_Nullable path,
+    const char *_Nullable interface, const char *_Nonnull name,
+    _Nullable rpc_object_t args);
+
+/**
+ * Calls a method synchronously on the least loaded pool connection.
+ *
+ * Works like rpc_connection_call_syncp(). A call that cannot be sent
+ * because its connection just died is retried on another one. A call
+ * whose connection dies after it was sent is not retried, since the
+ * server may already have run it; its error is returned instead.
+ *
+ * @param pool Pool handle
+ * @param path Object path or NULL
+ * @param interface Interface name or NULL
+ * @param method Method name
+ * @param fmt Arguments format string
+ * @return Call result or NULL
+ */
+_Nullable rpc_object_t rpc_client_pool_call_syncp(
+    _Nonnull rpc_client_pool_t pool, const char *_Nullable path,
+    const char *_Nullable interface, const char *_Nonnull method,
+    const char *_Nonnull fmt, ...);
+
 #ifdef __cplusplus
 }
 #endif
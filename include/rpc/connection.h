@@ -98,6 +98,25 @@ typedef struct rpc_connection *rpc_connection_t;
  */
 typedef struct rpc_call *rpc_call_t;
 
+/**
+ * Definition of RPC completion queue pointer.
+ */
+typedef struct rpc_completion_queue *rpc_completion_queue_t;
+
+/**
+ * Definition of RPC remote object proxy pointer.
+ */
+typedef struct rpc_proxy *rpc_proxy_t;
+
+/**
+ * A call status change delivered through a completion queue.
+ */
+struct rpc_cq_event
+{
+	rpc_call_t _Nonnull	call;	/**< Call that changed status */
+	rpc_call_status_t	status;	/**< Status it changed to */
+};
+
 /**
  * Definition of RPC event handler block type.
  */
@@ -110,6 +129,12 @@ typedef void (^rpc_handler_t)(const char *_Nullable path,
  */
 typedef void (^rpc_property_handler_t)(_Nonnull rpc_object_t value);
 
+/**
+ * Definition of RPC proxy property change handler block type.
+ */
+typedef void (^rpc_proxy_handler_t)(const char *_Nonnull interface,
+    const char *_Nonnull name, _Nonnull rpc_object_t value);
+
 /**
  * Definition of RPC error handler block type.
  */
@@ -281,6 +306,12 @@ int rpc_connection_set_dispatch_queue(_Nonnull rpc_connection_t conn,
  * Calls to rpc_connection_subscribe_event() must be paired with
  * rpc_connection_unsubscribe_event().
  *
+ * A "*" component of @p path matches any single path component and a
+ * trailing "**" component matches one or more of them, so "/jobs/\*"
+ * subscribes to events of every direct child of "/jobs" and
+ * "/jobs/\*\*" to events of all its descendants, but not of "/jobs"
+ * itself. A "**" that isn't the last component fails with EINVAL.
+ *
  * @param conn Connection to subscribe on
  * @param name Event name
  * @return 0 on success, -1 on failure
@@ -454,6 +485,53 @@ _Nullable rpc_call_t rpc_connection_call(_Nonnull rpc_connection_t conn,
     const char *_Nonnull name, _Nullable rpc_object_t args,
     _Nullable rpc_callback_t callback);
 
+/**
+ * Calls multiple methods using a single frame.
+ *
+ * @p calls is an array of [path, interface, method, args] arrays.
+ * Path and interface may be null. Entries are dispatched on the server
+ * as separate calls, possibly in parallel, but their results come
+ * back together.
+ *
+ * The returned call completes with an array of results, in the same
+ * order as @p calls. Entries that failed hold an error object, which
+ * can be checked using rpc_is_error(). Streaming methods can't be
+ * called in a batch.
+ *
+ * Each entry counts against the in-flight limit of the server
+ * connection on its own. rpc_call_abort() on the returned call aborts
+ * every entry that hasn't completed yet.
+ *
+ * @param conn Connection to do a call on
+ * @param calls Array of calls
+ * @param callback Optional callback invoked when results arrive
+ * @return Call handle or NULL on failure
+ */
+_Nullable rpc_call_t rpc_connection_call_batch(_Nonnull rpc_connection_t conn,
+    _Nonnull rpc_object_t calls, _Nullable rpc_callback_t callback);
+
+/**
+ * Performs a client-streaming RPC method call.
+ *
+ * Works like rpc_connection_call(), except that the method can receive
+ * further input after @p args: fragments sent with
+ * rpc_call_send_fragment() and read on the server side with
+ * rpc_function_next_fragment(), until rpc_call_end_stream() is called.
+ * The result is collected as for any other call; it may be a single
+ * response or a stream of fragments, making the call bidirectional.
+ *
+ * @param conn Connection to do a call on
+ * @param path Object path
+ * @param interface Interface name
+ * @param name Name of a method to be called
+ * @param args Initial method arguments
+ * @return RPC call object
+ */
+_Nullable rpc_call_t rpc_connection_call_stream(
+    _Nonnull rpc_connection_t conn, const char *_Nullable path,
+    const char *_Nullable interface, const char *_Nonnull name,
+    _Nullable rpc_object_t args);
+
 /**
  *
  * @param conn
@@ -525,6 +603,29 @@ void *_Nullable rpc_connection_watch_property(
     const char *_Nullable interface, const char *_Nonnull property,
     _Nonnull rpc_property_handler_t handler);
 
+/**
+ * Enables or disables the client-side property cache.
+ *
+ * With the cache enabled, the first rpc_connection_get_property() of
+ * a (path, interface, property) triple subscribes to its change events
+ * and remembers the value. Later reads are answered locally and change
+ * events update the cached value in place. Writes through
+ * rpc_connection_set_property() and connection loss invalidate it.
+ *
+ * Only properties whose server emits change events stay coherent. For
+ * others, @p max_age bounds how long a cached value may be served.
+ * Reads with a NULL path or interface always go to the server.
+ *
+ * Disabling the cache drops all entries and their subscriptions.
+ *
+ * @param conn Connection handle
+ * @param enable Whether to cache property reads
+ * @param max_age Maximum entry age in microseconds, 0 for no limit
+ * @return 0 on success, -1 on failure
+ */
+int rpc_connection_set_property_cache(_Nonnull rpc_connection_t conn,
+    bool enable, uint64_t max_age);
+
 /**
  * Sends an event.
  *
@@ -636,6 +737,85 @@ gid_t rpc_connection_get_remote_gid(_Nonnull rpc_connection_t conn);
  */
 pid_t rpc_connection_get_remote_pid(_Nonnull rpc_connection_t conn);
 
+/**
+ * Sets the scheduling weight of a connection.
+ *
+ * Inbound calls from all connections sharing a context are dispatched
+ * in deficit round robin order. A connection with weight N gets up to
+ * N calls dispatched per round. The default weight is 1.
+ *
+ * Typically called from a server event handler on
+ * RPC_SERVER_CLIENT_CONNECT.
+ *
+ * @param conn Connection handle
+ * @param weight Scheduling weight, must be greater than 0
+ * @return 0 on success, -1 on failure
+ */
+int rpc_connection_set_weight(_Nonnull rpc_connection_t conn,
+    unsigned int weight);
+
+/**
+ * Sets the maximum number of inbound calls in flight on a connection.
+ *
+ * Once the limit is reached, further calls are held back, in arrival
+ * order, until one of the running calls finishes. Frames for calls
+ * already in flight (stream continuations, uploads, aborts) are still
+ * processed while calls are held back. At most as many calls as set
+ * with rpc_connection_set_max_queued() are held back; calls arriving
+ * beyond that fail with EAGAIN. 0 means no limit (default).
+ *
+ * @param conn Connection handle
+ * @param max Maximum number of inbound calls in flight
+ * @return 0 on success, -1 on failure
+ */
+int rpc_connection_set_max_inflight(_Nonnull rpc_connection_t conn,
+    size_t max);
+
+/**
+ * Sets how many inbound calls a connection holds back at most.
+ *
+ * Calls over the in-flight limit wait for a free slot. Once this many
+ * of them are waiting, new calls are rejected with EAGAIN right away,
+ * so a client that floods the connection cannot grow server memory
+ * without bound. The reader keeps running, because the calls already
+ * in flight may need more frames from the peer to finish. Defaults
+ * to 1024.
+ *
+ * @param conn Connection handle
+ * @param max Maximum number of calls held back
+ * @return 0 on success, -1 on failure
+ */
+int rpc_connection_set_max_queued(_Nonnull rpc_connection_t conn,
+    size_t max);
+
+/**
+ * Sets the spin budget of synchronous calls on a connection.
+ *
+ * rpc_connection_call_sync() and friends wait for the response
+ * against a deadline instead of a timer source. With a non-zero budget
+ * the waiting thread first spins on the call status for up to
+ * @p usec microseconds before going to sleep, which saves a wakeup
+ * when the peer answers quickly. Spinning adapts to the observed
+ * response latency and stops once responses take longer than the
+ * budget. 0 disables spinning (default).
+ *
+ * @param conn Connection handle
+ * @param usec Spin budget in microseconds
+ * @return 0 on success, -1 on failure
+ */
+int rpc_connection_set_sync_spin(_Nonnull rpc_connection_t conn,
+    unsigned int usec);
+
+/**
+ * Reports the state of the outbound event queue of a connection.
+ *
+ * @param conn Connection handle
+ * @param depth Where to store the number of events currently queued
+ * @param hwm Where to store the largest number of events ever queued
+ */
+void rpc_connection_get_event_queue(_Nonnull rpc_connection_t conn,
+    size_t *_Nullable depth, size_t *_Nullable hwm);
+
 /**
  * Waits for a call to change status.
  *
@@ -665,6 +845,28 @@ int rpc_call_continue(_Nonnull rpc_call_t call, bool sync);
  */
 int rpc_call_abort(_Nonnull rpc_call_t call);
 
+/**
+ * Sends a fragment of input on a client-streaming call.
+ *
+ * Blocks while the server has not granted enough credit for it, which
+ * bounds the memory held by an upload on both sides. The function takes
+ * ownership of @p fragment.
+ *
+ * @param call Call opened with rpc_connection_call_stream()
+ * @param fragment Fragment to send
+ * @return 0 on success, -1 on failure
+ */
+int rpc_call_send_fragment(_Nonnull rpc_call_t call,
+    _Nonnull rpc_object_t fragment);
+
+/**
+ * Signals the end of input on a client-streaming call.
+ *
+ * @param call Call opened with rpc_connection_call_stream()
+ * @return 0 on success, -1 on failure
+ */
+int rpc_call_end_stream(_Nonnull rpc_call_t call);
+
 /**
  * Sets how many items librpc should prefetch in a streaming call.
  *
@@ -674,6 +876,36 @@ int rpc_call_abort(_Nonnull rpc_call_t call);
  */
 int rpc_call_set_prefetch(_Nonnull rpc_call_t call, size_t nitems);
 
+/**
+ * Switches a streaming call to byte-based credit flow control.
+ *
+ * Instead of granting a fixed number of items, the consumer grants the
+ * producer a window of (estimated) fragment bytes, optionally capped to
+ * @p nitems fragments as well. Credit is refilled once half of the window
+ * has been consumed, so a steadily consuming client never makes the
+ * server wait for a round trip.
+ *
+ * When @p max_bytes is larger than @p min_bytes, the window is tuned
+ * between the two from the observed consumer rate and round trip time.
+ * Passing 0 as @p min_bytes reverts to item-based prefetch.
+ *
+ * With @p nitems set to 0, only the byte window bounds the stream: the
+ * producer is granted an effectively unlimited (G_MAXINT32) number of
+ * items, and the prefetch set by @ref rpc_call_set_prefetch is ignored.
+ * Against a server that does not understand byte credits, such a call is
+ * therefore unbounded; set @p nitems to keep an item limit as well.
+ *
+ * Should be called before the first rpc_call_continue() on the call.
+ *
+ * @param call Streaming call
+ * @param min_bytes Initial (and minimum) window size in bytes
+ * @param max_bytes Maximum window size in bytes, or 0 to disable tuning
+ * @param nitems Maximum number of fragments in flight, or 0 for no limit
+ * @return 0 on success, -1 on failure
+ */
+int rpc_call_set_window(_Nonnull rpc_call_t call, size_t min_bytes,
+    size_t max_bytes, size_t nitems);
+
 /**
  * Waits for a call to change status.
  *
@@ -712,6 +944,23 @@ rpc_call_status_t rpc_call_status(_Nonnull rpc_call_t call);
  */
 _Nullable rpc_object_t rpc_call_result(_Nonnull rpc_call_t call);
 
+/**
+ * Takes all currently available fragments of a streaming call at once.
+ *
+ * Returns the fragments that arrived so far (up to @p max of them) as
+ * an array and advances the call past them, exactly as if
+ * rpc_call_result() and rpc_call_continue() were called for each one.
+ * The call status afterwards tells whether more fragments are pending,
+ * the stream has ended or has failed.
+ *
+ * @param call Streaming call
+ * @param max Maximum number of fragments to take, or 0 for no limit
+ * @return Array of fragments (to be released by the caller), or NULL
+ *         if no fragment is available
+ */
+_Nullable rpc_object_t rpc_call_result_batch(_Nonnull rpc_call_t call,
+    size_t max);
+
 /**
  * Frees a rpc_call_t object.
  *
@@ -719,6 +968,185 @@ _Nullable rpc_object_t rpc_call_result(_Nonnull rpc_call_t call);
  */
 void rpc_call_free(_Nonnull rpc_call_t call);
 
+/**
+ * Creates a completion queue.
+ *
+ * A completion queue collects status changes of outbound calls made
+ * on any number of connections (see
+ * rpc_connection_set_completion_queue()), so that a single thread can
+ * drive all of them without callback threads.
+ *
+ * @return Completion queue or NULL on failure
+ */
+_Nullable rpc_completion_queue_t rpc_cq_create(void);
+
+/**
+ * Shuts down and releases a completion queue.
+ *
+ * Connections and calls still using the queue keep it alive, but
+ * no further events are queued.
+ *
+ * @param cq Completion queue
+ */
+void rpc_cq_free(_Nonnull rpc_completion_queue_t cq);
+
+/**
+ * Shuts down a completion queue.
+ *
+ * Pending events are discarded and threads waiting in
+ * rpc_cq_next_batch() return immediately.
+ *
+ * @param cq Completion queue
+ */
+void rpc_cq_shutdown(_Nonnull rpc_completion_queue_t cq);
+
+/**
+ * Returns a file descriptor that polls readable while events are pending.
+ *
+ * The descriptor must not be read from; use rpc_cq_next_batch() instead.
+ *
+ * @param cq Completion queue
+ * @return File descriptor, or -1 if not supported on this platform
+ */
+int rpc_cq_get_fd(_Nonnull rpc_completion_queue_t cq);
+
+/**
+ * Takes a batch of events off a completion queue.
+ *
+ * Each event means the call now has a new status, and its result or
+ * current fragment can be read with rpc_call_result(). Streaming calls
+ * are advanced with rpc_call_continue() as usual, which produces the
+ * next event. Events are delivered in the order they occurred for any
+ * single call.
+ *
+ * Every event returned holds a reference to its call, so the call stays
+ * valid even if rpc_call_free() runs concurrently. The caller must drop
+ * it with rpc_cq_event_release() once done with the event.
+ *
+ * @param cq Completion queue
+ * @param events Where to store the events
+ * @param max Size of the @p events array
+ * @param timeout Microseconds to wait for the first event; 0 doesn't
+ *        wait, a negative value waits forever
+ * @return Number of events stored
+ */
+size_t rpc_cq_next_batch(_Nonnull rpc_completion_queue_t cq,
+    struct rpc_cq_event *_Nonnull events, size_t max, int64_t timeout);
+
+/**
+ * Takes a single event off a completion queue.
+ *
+ * The event must be released with rpc_cq_event_release().
+ *
+ * @param cq Completion queue
+ * @param event Where to store the event
+ * @param timeout Same as for rpc_cq_next_batch()
+ * @return 0 on success, -1 on timeout or shutdown
+ */
+int rpc_cq_next(_Nonnull rpc_completion_queue_t cq,
+    struct rpc_cq_event *_Nonnull event, int64_t timeout);
+
+/**
+ * Releases the call reference held by a completion queue event.
+ *
+ * Must be called exactly once for every event returned by
+ * rpc_cq_next_batch() or rpc_cq_next().
+ *
+ * @param event Event to release
+ */
+void rpc_cq_event_release(struct rpc_cq_event *_Nonnull event);
+
+/**
+ * Attaches a completion queue to a connection.
+ *
+ * Calls made after this on @p conn without a callback report their
+ * status changes to @p cq. Passing NULL detaches the queue; calls
+ * already made keep reporting to it.
+ *
+ * @param conn Connection
+ * @param cq Completion queue or NULL
+ */
+void rpc_connection_set_completion_queue(_Nonnull rpc_connection_t conn,
+    _Nullable rpc_completion_queue_t cq);
+
+/**
+ * Creates a proxy mirroring all properties of a remote instance.
+ *
+ * The proxy subscribes to property change events of @p path, then
+ * reads every property of every interface of the instance, one
+ * get_all call per interface. From then on, change events keep the
+ * local copy up to date and reads never leave the process.
+ *
+ * Properties that are not readable are left out.
+ *
+ * @param conn Connection handle
+ * @param path Instance path
+ * @return Proxy handle or NULL on failure
+ */
+_Nullable rpc_proxy_t rpc_proxy_create(_Nonnull rpc_connection_t conn,
+    const char *_Nonnull path);
+
+/**
+ * Frees a proxy and drops its subscription.
+ *
+ * Must not be called from within a proxy change handler.
+ *
+ * @param proxy Proxy handle
+ */
+void rpc_proxy_free(_Nonnull rpc_proxy_t proxy);
+
+/**
+ * Re-reads all properties of the remote instance.
+ *
+ * Useful after events may have been missed, for example when the
+ * instance gained an interface. Change handlers are invoked for
+ * every value that differs from the local copy, and properties that
+ * disappeared are dropped.
+ *
+ * @param proxy Proxy handle
+ * @return 0 on success, -1 on failure
+ */
+int rpc_proxy_refresh(_Nonnull rpc_proxy_t proxy);
+
+/**
+ * Returns the local copy of a property value.
+ *
+ * @param proxy Proxy handle
+ * @param interface Interface name
+ * @param name Property name
+ * @return Retained property value or NULL if not known
+ */
+_Nullable rpc_object_t rpc_proxy_get(_Nonnull rpc_proxy_t proxy,
+    const char *_Nonnull interface, const char *_Nonnull name);
+
+/**
+ * Registers a block called whenever a mirrored property changes.
+ *
+ * @p interface and @p name may be NULL to match any interface or any
+ * property. Handlers run on connection callback threads, one change
+ * at a time, and must not call proxy functions other than
+ * rpc_proxy_get().
+ *
+ * @param proxy Proxy handle
+ * @param interface Interface name or NULL
+ * @param name Property name or NULL
+ * @param handler Change handler
+ * @return Cookie for rpc_proxy_unwatch()
+ */
+void *_Nonnull rpc_proxy_watch(_Nonnull rpc_proxy_t proxy,
+    const char *_Nullable interface, const char *_Nullable name,
+    _Nonnull rpc_proxy_handler_t handler);
+
+/**
+ * Unregisters a change handler.
+ *
+ * Waits for the handler to return if it is running.
+ *
+ * @param proxy Proxy handle
+ * @param cookie Cookie returned by rpc_proxy_watch()
+ */
+void rpc_proxy_unwatch(_Nonnull rpc_proxy_t proxy, void *_Nonnull cookie);
+
 #ifdef __cplusplus
 }
 #endif
@@ -52,6 +52,39 @@ struct rpc_query_iter;
  */
 typedef struct rpc_query_iter *rpc_query_iter_t;
 
+/**
+ * Definition of the compiled query plan structure. Its contents are
+ * implementation detail.
+ */
+struct rpc_query_plan;
+
+/**
+ * Definition of rpc_query_plan pointer type.
+ */
+typedef struct rpc_query_plan *rpc_query_plan_t;
+
+/**
+ * Definition of the secondary index structure. Its contents are
+ * implementation detail.
+ */
+struct rpc_query_index;
+
+/**
+ * Definition of rpc_query_index pointer type.
+ */
+typedef struct rpc_query_index *rpc_query_index_t;
+
+/**
+ * Secondary index types.
+ *
+ * Hash indexes serve the "=" and "in" operators, sorted indexes serve
+ * ">", "<", ">=" and "<=".
+ */
+typedef enum rpc_query_index_type {
+	RPC_QUERY_INDEX_HASH,
+	RPC_QUERY_INDEX_SORTED
+} rpc_query_index_type_t;
+
 /**
  * Definition of query callback block type.
  *
@@ -85,18 +118,31 @@ typedef _Nullable rpc_object_t (^rpc_query_cb_t)(_Nonnull rpc_object_t object);
  *   yielding the first result.
  * - limit (unsigned int) - yield no more than a specified number of matching
  *   elements.
- * - sort (rpc_array_cmp_t) - sort the input array before yielding the
- *   results - the sorting function is taking a rpc_array_cmp_t block as
- *   an argument to figure out relations between input an array's elements
- *   (a > b, a = b, a < b).
- * - reverse (boolean) - reverse the order of elements of an input array
- *   (always done after eventual sorting) - be aware that this operation
- *   has to create an intermediate object to store elements in the reversed
- *   order, so it might be expensive for large data sets.
+ * - sort (rpc_array_cmp_t) - yield the results in the order defined by
+ *   a rpc_array_cmp_t block figuring out relations between the input
+ *   array's elements (a > b, a = b, a < b). Elements comparing equal keep
+ *   their relative order. The input array itself is left untouched. When
+ *   limit or single is set, only offset + limit matches are kept while
+ *   sorting, so a small limit is cheap even for large arrays.
+ * - reverse (boolean) - yield the results in the reversed order (always
+ *   applied after eventual sorting) - no intermediate copy is made.
  * - callback (rpc_query_cb_t) - for each of the matching elements run
  *   a callback function first - query will return an RPC object returned
  *   by a callback function, but will skip it if a callback function
  *   returns NULL instead of an RPC object.
+ * - parallelism (unsigned int) - split the evaluation of the rules into
+ *   up to that many slices. The calling thread evaluates one of them and
+ *   the rest go to a thread pool shared by all queries, which has one
+ *   thread per processor. The slices are contiguous, so the results keep
+ *   their order and all other options work as usual, but every element
+ *   is evaluated up front even if single or limit is set. Small arrays
+ *   are always evaluated on the calling thread. The source array must
+ *   not be modified while the query is being set up.
+ *
+ * The parallelism field was added at the end of this structure, which
+ * changes its size. Code that allocates it and was built against older
+ * headers must be rebuilt; code that zero-initializes it keeps the
+ * sequential behavior once rebuilt.
  */
 struct rpc_query_params {
 	bool 				single;
@@ -106,6 +152,7 @@ struct rpc_query_params {
 	bool				reverse;
 	_Nullable rpc_array_cmp_t	sort;
 	_Nullable rpc_query_cb_t	callback;
+	uint32_t			parallelism;
 };
 
 /**
@@ -260,6 +307,119 @@ _Nullable rpc_query_iter_t rpc_query(_Nonnull rpc_object_t object,
 _Nullable rpc_query_iter_t rpc_query_fmt(_Nonnull rpc_object_t object,
     _Nonnull rpc_query_params_t params, const char *_Nonnull rules_fmt, ...);
 
+/**
+ * Compiles a set of query rules into a reusable plan.
+ *
+ * rpc_query() compiles its rules on every call. A plan built once can
+ * instead be passed to rpc_query_compiled() or rpc_query_plan_match()
+ * any number of times, from any number of threads. The plan does not
+ * refer to @p rules after this function returns.
+ *
+ * @param rules Query rules, in the format described for rpc_query().
+ * @return Query plan or NULL if rules are not an array.
+ */
+_Nullable rpc_query_plan_t rpc_query_compile(_Nonnull rpc_object_t rules);
+
+/**
+ * Releases a query plan.
+ *
+ * Iterators created with rpc_query_compiled() keep the plan alive until
+ * they are freed themselves.
+ *
+ * @param plan Plan to be freed.
+ */
+void rpc_query_plan_free(_Nonnull rpc_query_plan_t plan);
+
+/**
+ * Checks if a given RPC object matches a compiled query plan.
+ *
+ * @param plan Query plan.
+ * @param object Object to be checked.
+ * @return Boolean result of the check.
+ */
+bool rpc_query_plan_match(_Nonnull rpc_query_plan_t plan,
+    _Nullable rpc_object_t object);
+
+/**
+ * Performs a query operation on a given object using a compiled plan.
+ *
+ * The function works exactly the same as the rpc_query function, but
+ * takes a plan returned by rpc_query_compile() instead of the rules.
+ *
+ * @param object Object to be queried.
+ * @param params Query parameters.
+ * @param plan Query plan.
+ * @return Query iterator.
+ */
+_Nullable rpc_query_iter_t rpc_query_compiled(_Nonnull rpc_object_t object,
+    _Nullable rpc_query_params_t params, _Nonnull rpc_query_plan_t plan);
+
+/**
+ * Reads the counters of the shared regular expression cache.
+ *
+ * Patterns used by the "~" operator and by string regex validators
+ * are compiled once and kept in a bounded, least recently used cache.
+ * Patterns from IDL constraints are pinned and never evicted. A plan
+ * keeps its own reference to the expressions it uses, so evicting
+ * them does not affect plans that are still alive.
+ *
+ * The counters are process-wide and only ever grow. Any of the
+ * pointers may be NULL. Applications can sample them to tell whether
+ * their working set of patterns fits the cache, which holds up to 128
+ * unpinned entries: a steadily rising eviction count means it does
+ * not and patterns are being recompiled.
+ *
+ * @param hits Number of lookups served from the cache.
+ * @param misses Number of lookups that had to compile the pattern.
+ * @param evictions Number of entries dropped to stay within the bound.
+ */
+void rpc_query_regex_stats(uint64_t *_Nullable hits,
+    uint64_t *_Nullable misses, uint64_t *_Nullable evictions);
+
+/**
+ * Builds a secondary index over the elements of an array.
+ *
+ * The index maps values found under @p path in each of the elements
+ * to their positions and stays attached to the array. Queries on
+ * that array whose top-level rules include an operator the index
+ * serves, on the same path, only visit the elements the index lists.
+ * If that rule is the only one, offset is applied without scanning
+ * the skipped elements.
+ *
+ * The index follows elements added, replaced or removed with the array
+ * API. Changing an element in place is not noticed - call
+ * rpc_query_index_rebuild() afterwards.
+ *
+ * Any number of threads may query an indexed array at the same time.
+ * The first one to find the index out of date rebuilds it while the
+ * others wait. Changing the array still has to be serialized with
+ * queries by the caller, as with any other array.
+ *
+ * @param array Array to be indexed.
+ * @param path Path to the indexed field, as in rpc_query_get().
+ * @param type Index type.
+ * @return Index or NULL if @p array is not an array.
+ */
+_Nullable rpc_query_index_t rpc_query_index_create(_Nonnull rpc_object_t array,
+    const char *_Nonnull path, rpc_query_index_type_t type);
+
+/**
+ * Rebuilds an index from the current contents of its array.
+ *
+ * @param index Index to be rebuilt.
+ */
+void rpc_query_index_rebuild(_Nonnull rpc_query_index_t index);
+
+/**
+ * Detaches an index from its array and releases it.
+ *
+ * Indexes still attached when their array is freed are detached
+ * automatically, but have to be freed with this function regardless.
+ *
+ * @param index Index to be freed.
+ */
+void rpc_query_index_free(_Nonnull rpc_query_index_t index);
+
 /**
  * Checks if a given RPC object does match a provided object representing
  * query rules (the same format as in the rpc_query function case).
@@ -134,6 +134,30 @@ void rpc_server_broadcast_event(_Nonnull rpc_server_t server,
     const char *_Nullable path, const char *_Nullable interface,
     const char *_Nonnull name, _Nullable rpc_object_t args);
 
+/**
+ * Sets the event coalescing window of a server.
+ *
+ * With a non-zero window, events sent to a connection are held for up
+ * to @p usec microseconds (or until roughly @p bytes of them pile up)
+ * and then go out together as a single events.event_burst frame.
+ * Events emitted through the context are also flushed as soon as the
+ * emitter runs out of work. A zero @p usec turns coalescing off, which
+ * is the default; a zero @p bytes puts no size limit on the window.
+ *
+ * @param server Server handle
+ * @param usec Maximum time an event may be held, in microseconds
+ * @param bytes Approximate maximum size of a burst
+ */
+void rpc_server_set_event_window(_Nonnull rpc_server_t server, uint64_t usec,
+    size_t bytes);
+
+/**
+ * Sends out all the events held in a server's coalescing window.
+ *
+ * @param server Server handle
+ */
+void rpc_server_flush_events(_Nonnull rpc_server_t server);
+
 /**
  * Creates an event handler internal to a server for an event of a given name.
  *
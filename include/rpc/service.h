@@ -191,6 +191,42 @@ typedef void (^rpc_abort_handler_t)(void);
                 }							\
 	}
 
+/**
+ * Same as @ref RPC_METHOD, but marks the method as non-blocking.
+ *
+ * Non-blocking methods are run directly on the thread that received
+ * the call, skipping the context thread pool. They must not sleep,
+ * wait on other calls, do blocking I/O or stream their results.
+ */
+#define	RPC_METHOD_INLINE(_name, _fn)					\
+	{								\
+		.rim_type = RPC_MEMBER_METHOD,				\
+		.rim_flags = RPC_MEMBER_INLINE,				\
+		.rim_name = (#_name),					\
+		.rim_method = {						\
+                        .rm_block = RPC_FUNCTION(_fn),			\
+			.rm_arg = NULL					\
+                }							\
+	}
+
+/**
+ * Same as @ref RPC_PROPERTY_RO, but marks the property as non-blocking.
+ *
+ * Reads of non-blocking properties are run directly on the thread that
+ * received the call. The getter must not block.
+ */
+#define	RPC_PROPERTY_RO_INLINE(_name, _getter)				\
+	{								\
+		.rim_type = RPC_MEMBER_PROPERTY,			\
+		.rim_flags = RPC_MEMBER_INLINE,				\
+		.rim_name = (#_name),					\
+		.rim_property = {					\
+                        .rp_getter = RPC_PROPERTY_GETTER(_getter),	\
+			.rp_setter = NULL,				\
+			.rp_arg = NULL					\
+                }							\
+	}
+
 /**
  * Same as @ref RPC_METHOD, but takes a block instead of a function
  * pointer.
@@ -216,6 +252,14 @@ enum rpc_if_member_type
 	RPC_MEMBER_METHOD,		/**< Method member */
 };
 
+/**
+ * Enumerates possible interface member flags.
+ */
+enum rpc_if_member_flags
+{
+	RPC_MEMBER_INLINE = (1 << 0),	/**< Member never blocks */
+};
+
 /**
  * Enumerates possible property right flags.
  */
@@ -226,6 +270,67 @@ enum rpc_property_rights
 };
 
 
+/**
+ * Admission control limits of a context.
+ *
+ * Zero value of any field disables the corresponding limit.
+ */
+struct rpc_context_limits
+{
+	size_t		max_queued;	/**< Max calls waiting for a worker */
+	size_t		max_inflight;	/**< Max calls in flight per interface */
+	uint64_t	target_delay;	/**< Target queue delay (usec) */
+	uint64_t	interval;	/**< Queue delay interval (usec) */
+};
+
+/**
+ * Admission control statistics of a context.
+ */
+struct rpc_context_stats
+{
+	uint64_t	dispatched;	/**< Calls admitted */
+	uint64_t	shed_queue_full;/**< Calls rejected, queue full */
+	uint64_t	shed_inflight;	/**< Calls rejected, interface busy */
+	uint64_t	shed_delay;	/**< Calls shed on queue delay */
+	uint64_t	shed_expired;	/**< Calls dropped past deadline */
+	size_t		queued;		/**< Calls currently queued */
+};
+
+/**
+ * Enumerates policies applied to event subscribers that fall behind.
+ */
+typedef enum rpc_slow_consumer_policy
+{
+	RPC_SLOW_CONSUMER_DROP_OLDEST,	/**< Drop the oldest queued event */
+	RPC_SLOW_CONSUMER_COALESCE,	/**< Replace a queued event of the same
+					     name, else drop the oldest */
+	RPC_SLOW_CONSUMER_DISCONNECT,	/**< Close the connection */
+} rpc_slow_consumer_policy_t;
+
+/**
+ * Event emitter settings of a context.
+ */
+struct rpc_context_emitter
+{
+	size_t		threads;	/**< Sender threads, 0 for default */
+	size_t		queue_limit;	/**< Max events queued per connection,
+					     0 for no limit (default) */
+	rpc_slow_consumer_policy_t policy; /**< Applied at queue_limit */
+};
+
+/**
+ * Event delivery statistics of a context.
+ */
+struct rpc_context_event_stats
+{
+	uint64_t	emitted;	/**< Events emitted */
+	uint64_t	queued;		/**< Events queued to connections */
+	uint64_t	dropped;	/**< Events dropped, queue full */
+	uint64_t	coalesced;	/**< Events replaced by a newer one */
+	uint64_t	disconnects;	/**< Connections closed, queue full */
+	size_t		queue_hwm;	/**< Deepest connection queue seen */
+};
+
 /**
  * Method descriptor.
  */
@@ -250,6 +355,11 @@ struct rpc_if_property
  * Interface member descriptor.
  *
  * Can be either a method, property or event.
+ *
+ * The rim_flags field was added at the end of this structure, which
+ * makes it larger. Vtables are arrays of it, so code built against
+ * older headers cannot be used with this library and has to be
+ * rebuilt; the library soname was bumped to librpc.so.2 accordingly.
  * */
 struct rpc_if_member {
 	const char *_Nonnull		rim_name;
@@ -258,6 +368,7 @@ struct rpc_if_member {
 		struct rpc_if_method 	rim_method;
 		struct rpc_if_property 	rim_property;
 	};
+	int				rim_flags;
 };
 
 /**
@@ -384,6 +495,75 @@ void rpc_context_set_pre_call_hook(_Nonnull rpc_context_t context,
 void rpc_context_set_post_call_hook(_Nonnull rpc_context_t context,
     _Nonnull rpc_function_t fn);
 
+/**
+ * Sets the maximum number of threads running calls in @p context.
+ *
+ * Calls waiting for a thread are picked in deficit round robin order
+ * across connections, see rpc_connection_set_weight(). Methods that
+ * wait for other calls made to the same context may deadlock with a
+ * low limit. 0 means no limit (default).
+ *
+ * @param context Target context
+ * @param threads Maximum number of threads
+ */
+void rpc_context_set_threads(_Nonnull rpc_context_t context,
+    unsigned int threads);
+
+/**
+ * Configures admission control for calls dispatched in @p context.
+ *
+ * Calls over max_queued or max_inflight limits are rejected right
+ * away. Once the queue delay of dispatched calls stays above
+ * target_delay for longer than interval, queued calls are shed at
+ * an increasing rate until the delay drops again (CoDel).
+ *
+ * Rejected and shed calls fail with EAGAIN, so clients can tell them
+ * apart from other errors and back off. Calls that are already past
+ * the deadline sent by the caller are dropped regardless of these
+ * limits and fail with ETIMEDOUT instead.
+ *
+ * @param context Target context
+ * @param limits Admission limits
+ */
+void rpc_context_set_limits(_Nonnull rpc_context_t context,
+    const struct rpc_context_limits *_Nonnull limits);
+
+/**
+ * Fills @p stats with admission control statistics of @p context.
+ *
+ * @param context Target context
+ * @param stats Statistics structure to fill
+ */
+void rpc_context_get_stats(_Nonnull rpc_context_t context,
+    struct rpc_context_stats *_Nonnull stats);
+
+/**
+ * Configures event delivery of a context.
+ *
+ * Emitted events are queued to every subscribed connection and sent out
+ * by a pool of sender threads, so that a slow subscriber only delays
+ * its own events. Once a connection has @p queue_limit events queued,
+ * @p policy decides what happens to the next one.
+ *
+ * By default queues are unbounded and no event is ever dropped, at the
+ * cost of memory held for subscribers that can't keep up. Setting a
+ * queue limit opts into losing events according to @p policy.
+ *
+ * @param context Target context
+ * @param emitter Emitter settings
+ */
+void rpc_context_set_emitter(_Nonnull rpc_context_t context,
+    const struct rpc_context_emitter *_Nonnull emitter);
+
+/**
+ * Fills @p stats with event delivery statistics of @p context.
+ *
+ * @param context Target context
+ * @param stats Statistics structure to fill
+ */
+void rpc_context_get_event_stats(_Nonnull rpc_context_t context,
+    struct rpc_context_event_stats *_Nonnull stats);
+
 /**
  *
  * @param context RPC context handle
@@ -458,6 +638,22 @@ const char *_Nonnull rpc_function_get_path(void *_Nonnull cookie);
  */
 const char *_Nonnull rpc_function_get_interface(void *_Nonnull cookie);
 
+/**
+ * Returns the deadline of a call.
+ *
+ * The deadline is derived from the remaining timeout budget sent by
+ * the caller and is expressed in g_get_monotonic_time() units
+ * (microseconds). Long running handlers may use it to abandon work
+ * the caller is not going to wait for anymore.
+ *
+ * Outbound calls made from within the handler automatically inherit
+ * the remaining budget.
+ *
+ * @param cookie Running call handle
+ * @return Call deadline or 0 if the caller didn't send one
+ */
+int64_t rpc_function_get_deadline(void *_Nonnull cookie);
+
 /**
  * Sends a response to a call.
  *
@@ -513,6 +709,52 @@ int rpc_function_start_stream(void *_Nonnull cookie);
  */
 int rpc_function_yield(void *_Nonnull cookie, _Nonnull rpc_object_t fragment);
 
+/**
+ * Enables batching of streaming response fragments.
+ *
+ * Fragments yielded by a call with batching enabled are sent together
+ * in a single "fragment_batch" frame once @p nitems of them are pending,
+ * the consumer's credit is exhausted, the stream ends or @p usec
+ * microseconds passed since the first one was yielded, whichever comes
+ * first. Setting @p nitems to 0 or 1 disables batching. The peer must
+ * understand "fragment_batch" frames.
+ *
+ * @param cookie Running call handle
+ * @param nitems Maximum number of fragments in a batch
+ * @param usec Maximum time a fragment may wait for a batch, or 0
+ */
+void rpc_function_set_fragment_batch(void *_Nonnull cookie, size_t nitems,
+    uint64_t usec);
+
+/**
+ * Returns the next fragment of a client-streaming call.
+ *
+ * Blocks until the client sends another fragment (see
+ * rpc_call_send_fragment()). The client is granted credit as fragments
+ * are consumed, so at most one upload window is ever buffered on the
+ * server. The method may keep yielding its own fragments in between,
+ * which makes the call bidirectional.
+ *
+ * @param cookie Running call handle
+ * @return Next fragment (to be released by the caller), or NULL once the
+ *         client has ended the stream. NULL is also returned if the call
+ *         was aborted or has no client stream, with the last error set.
+ */
+_Nullable rpc_object_t rpc_function_next_fragment(void *_Nonnull cookie);
+
+/**
+ * Sets the credit window of a client-streaming call.
+ *
+ * Must be called before the first rpc_function_next_fragment(). The
+ * default window is 256 KiB or 64 fragments, whichever fills first.
+ *
+ * @param cookie Running call handle
+ * @param bytes Window size in bytes
+ * @param nitems Window size in fragments
+ */
+void rpc_function_set_upload_window(void *_Nonnull cookie, size_t bytes,
+    size_t nitems);
+
 /**
  * Ends a streaming response.
  *
@@ -808,6 +1050,11 @@ int rpc_instance_register_event(_Nonnull rpc_instance_t instance,
  * If @p value is @p NULL, then librpc will internally query the getter
  * for the value.
  *
+ * If the property has a notification interval set (see
+ * @ref rpc_instance_set_property_interval), changes are coalesced:
+ * at most one notification per interval is sent, carrying the latest
+ * value, and the getter is queried on the emitter thread at that time.
+ *
  * @param instance Instance handle
  * @param interface Interface name
  * @param name Property name
@@ -817,6 +1064,25 @@ void rpc_instance_property_changed(_Nonnull rpc_instance_t instance,
     const char *_Nonnull interface, const char *_Nonnull name,
     _Nullable rpc_object_t value);
 
+/**
+ * Sets the minimum interval between change notifications of a property.
+ *
+ * Subscribers of a property that changes thousands of times per second
+ * usually only need the latest value every now and then. With a non-zero
+ * @p interval, @ref rpc_instance_property_changed calls are coalesced
+ * and the latest value is sent out at most once per @p interval.
+ * Zero (the default) sends a notification for every change.
+ *
+ * @param instance Instance handle
+ * @param interface Interface name
+ * @param name Property name
+ * @param interval Minimum notification interval, in microseconds
+ * @return 0 on success, -1 on failure
+ */
+int rpc_instance_set_property_interval(_Nonnull rpc_instance_t instance,
+    const char *_Nullable interface, const char *_Nonnull name,
+    uint64_t interval);
+
 /**
  * Returns instance associated with the getter or setter call.
  *
@@ -67,6 +67,7 @@ struct_read_member(const char *decl, rpc_object_t obj, struct rpct_type *type)
 		    rpc_object_t value) {
 			g_hash_table_insert(member->constraints, g_strdup(key),
 			    value);
+			rpc_prepare_validators(key, value);
 			return ((bool)true);
 		});
 	}
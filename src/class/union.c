@@ -59,6 +59,7 @@ static struct rpct_member *union_read_member(const char *decl,
 		rpc_dictionary_apply(constraints, ^(const char *key, rpc_object_t value) {
 			g_hash_table_insert(member->constraints, g_strdup(key),
 			    value);
+			rpc_prepare_validators(key, value);
 			return ((bool)true);
 		});
 	}
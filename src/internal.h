@@ -80,6 +80,7 @@
 #define	METHOD_REGEX	"method (\\w+)"
 #define	PROPERTY_REGEX	"property (\\w+)"
 #define	EVENT_REGEX	"event (\\w+)"
+#define	RPC_REGEX_CACHE_SIZE	128
 
 #define CONNECTION_OPEN		(0)
 #define CONNECTION_CLOSED	(1 << 0)
@@ -117,6 +118,7 @@ typedef rpc_object_t (*rpct_serialize_fn_t)(rpc_object_t);
 
 typedef bool (*rpct_validator_fn_t)(rpc_object_t, rpc_object_t,
     struct rpct_typei *, struct rpct_error_context *);
+typedef void (*rpct_validator_prepare_fn_t)(rpc_object_t);
 
 typedef void (*rpc_fn_respond_fn_t)(void *, rpc_object_t);
 typedef void (*rpc_fn_error_fn_t)(void *, int , const char *, va_list ap);
@@ -132,7 +134,11 @@ struct rpc_query_iter
 {
 	rpc_object_t 		rqi_source;
 	size_t 			rqi_idx;
-	rpc_object_t 		rqi_rules;
+	rpc_query_plan_t	rqi_plan;
+	GArray *		rqi_candidates;
+	size_t			rqi_end;
+	bool			rqi_exact;
+	bool			rqi_reverse;
 	rpc_query_params_t 	rqi_params;
 	bool			rqi_done;
 	bool			rqi_initialized;
@@ -187,6 +193,7 @@ struct rpc_object
 	size_t			ro_column;
 	union rpc_value		ro_value;
 	struct rpct_typei *	ro_typei;
+	GSList *		ro_indexes;
 };
 
 struct rpc_subscription
@@ -199,12 +206,47 @@ struct rpc_subscription
     	GPtrArray *		rsu_handlers;
 };
 
+struct rpc_sub_index;
+typedef bool (^rpc_sub_index_applier_t)(gpointer value);
+
 struct rpc_subscription_handler
 {
 	struct rpc_subscription *rsh_parent;
 	rpc_handler_t 		rsh_handler;
 };
 
+struct rpc_call_batch
+{
+	rpc_connection_t	rcb_conn;
+	rpc_object_t		rcb_id;
+	rpc_object_t		rcb_results;
+	GMutex			rcb_mtx;
+	size_t			rcb_pending;
+};
+
+typedef enum rpc_event_queue_result
+{
+	RPC_EVENT_SKIPPED,
+	RPC_EVENT_QUEUED,
+	RPC_EVENT_DROPPED,
+	RPC_EVENT_COALESCED,
+	RPC_EVENT_OVERFLOW,
+} rpc_event_queue_result_t;
+
+struct rpc_shared_frame
+{
+	volatile int		rsf_refcnt;
+	GMutex			rsf_mtx;
+	char *			rsf_path;
+	char *			rsf_interface;
+	char *			rsf_name;
+	rpc_object_t		rsf_args;
+	rpc_object_t		rsf_frame;
+	bool			rsf_has_fds;
+	void *			rsf_buf[2];	/* indexed by rpct serialization */
+	size_t			rsf_len[2];
+};
+
 struct rpc_call
 {
 	rpc_connection_t    	rc_conn;
@@ -227,6 +269,43 @@ struct rpc_call
 	atomic_int_fast64_t	rc_producer_seqno;
 	atomic_int_fast64_t	rc_consumer_seqno; /* also rc_seqno */
 	uint64_t 		rc_prefetch;
+	size_t			rc_window;	/* byte credit window, 0 = items */
+	size_t			rc_window_min;
+	size_t			rc_window_max;
+	size_t			rc_window_items;
+	int64_t			rc_granted_bytes;
+	int64_t			rc_received_bytes;
+	int64_t			rc_consumed_bytes;
+	int64_t			rc_grant_consumed;
+	int64_t			rc_grant_time;
+	int64_t			rc_rtt_probe;
+	int64_t			rc_rtt;
+	int64_t			rc_credit_bytes;
+	int64_t			rc_sent_bytes;
+	bool			rc_byte_credit;
+	GMutex			rc_frag_mtx;
+	rpc_object_t		rc_frag_pending;
+	int64_t			rc_frag_seqno;
+	size_t			rc_frag_batch;
+	uint64_t		rc_frag_window;
+	GSource *		rc_frag_flush;
+	bool			rc_upload;
+	bool			rc_upload_ended;
+	GCond			rc_upload_cv;
+	GQueue *		rc_upload_queue;
+	int64_t			rc_upload_seqno;	/* sent or consumed */
+	int64_t			rc_upload_bytes;	/* sent or consumed */
+	int64_t			rc_upload_credit;
+	int64_t			rc_upload_credit_bytes;
+	int64_t			rc_upload_received;	/* server side */
+	int64_t			rc_upload_received_bytes;
+	size_t			rc_upload_window;
+	size_t			rc_upload_window_items;
+	rpc_completion_queue_t	rc_cq;
+	bool			rc_sync;	/* waited on by rpc_call_wait_sync */
+	bool			rc_parked;
+	volatile int		rc_changes;
+	GCond			rc_sync_cv;
 	rpc_instance_t 		rc_instance;
 	rpc_abort_handler_t	rc_abort_handler;
 	struct rpc_if_method *	rc_if_method;
@@ -235,6 +314,12 @@ struct rpc_call
 	bool			rc_responded;
 	bool			rc_ended;
 	bool			rc_aborted;
+	bool			rc_inline;
+	bool			rc_admitted;
+	int64_t			rc_deadline;
+	int64_t			rc_queued_at;
+	struct rpc_call_batch *	rc_batch;
+	size_t			rc_batch_idx;
 };
 
 struct rpc_credentials
@@ -274,6 +359,7 @@ struct rpc_connection
 	GHashTable *		rco_calls;
 	GHashTable *		rco_inbound_calls;
     	GPtrArray *		rco_subscriptions;
+	struct rpc_sub_index *	rco_sub_index;
 	GRWLock			rco_subscription_rwlock;
 	GMutex			rco_mtx;
 	GMutex			rco_ref_mtx;
@@ -283,10 +369,52 @@ struct rpc_connection
 	GMainContext *		rco_main_context;
 	rpc_object_t            rco_error;
     	GThreadPool *		rco_callback_pool;
+	rpc_runtime_t		rco_runtime;
 	rpc_object_t 		rco_params;
     	int			rco_flags;
 	volatile uint		rco_state;
 	volatile int		rco_refcnt;
+
+	/* Inbound call scheduling */
+	GQueue *		rco_sched_queue;
+	bool			rco_sched_active;
+	guint			rco_weight;
+	guint			rco_deficit;
+	guint			rco_inflight;
+	guint			rco_max_inflight;
+	guint			rco_max_queued;
+	GQueue			rco_admit_queue;
+	GMutex			rco_inflight_mtx;
+
+	/* Synchronous call spinning, in microseconds */
+	volatile int		rco_sync_spin;
+	volatile int		rco_sync_latency;
+
+	/* Resolved method handles */
+	GHashTable *		rco_method_cache;
+	GQueue			rco_method_lru;
+	guint			rco_method_cache_gen;
+	uint64_t		rco_method_cache_hits;
+	GMutex			rco_method_cache_mtx;
+
+	/* Outbound event coalescing */
+	GMutex			rco_event_mtx;
+	rpc_object_t		rco_event_burst;
+	size_t			rco_event_burst_bytes;
+	GSource *		rco_event_flush;
+
+	/* Outbound event queue, protected by rco_event_mtx */
+	GQueue *		rco_event_queue;
+	size_t			rco_event_queue_hwm;
+	bool			rco_event_draining;
+	bool			rco_event_overflow;
+	GMutex			rco_cq_mtx;
+	rpc_completion_queue_t	rco_cq;
+
+	/* Client-side property cache, NULL when disabled */
+	GHashTable *		rco_prop_cache;
+	uint64_t		rco_prop_cache_max_age;
+	GMutex			rco_prop_cache_mtx;
 #if LIBDISPATCH_SUPPORT
 	dispatch_queue_t	rco_dispatch_queue;
 #endif
@@ -329,6 +457,8 @@ struct rpc_server
 	int			rs_conn_aborted;
 	rpc_object_t 		rs_params;
 	rpc_server_ev_handler_t rs_event_handler;
+	uint64_t		rs_event_window;
+	size_t			rs_event_window_bytes;
 
     	/* Callbacks */
 	rpc_valid_fn_t		rs_valid;
@@ -346,6 +476,24 @@ struct rpc_client
     	rpc_connection_t 	rci_connection;
     	const char *		rci_uri;
 	rpc_object_t 		rci_params;
+	rpc_runtime_t		rci_runtime;
+	struct rpc_runtime_loop *rci_runtime_loop;
+};
+
+struct rpc_runtime_loop
+{
+	GMainContext *		rrl_context;
+	GMainLoop *		rrl_loop;
+	GThread *		rrl_thread;
+	volatile int		rrl_clients;
+};
+
+struct rpc_runtime
+{
+	struct rpc_runtime_loop *rrt_loops;
+	size_t			rrt_nloops;
+	GThreadPool *		rrt_callback_pool;
+	volatile int		rrt_clients;
 };
 
 struct rpc_instance
@@ -368,6 +516,7 @@ struct rpc_interface_priv
 	char *			rip_description;
 	void *			rip_arg;
 	GHashTable *		rip_members;
+	GHashTable *		rip_intervals;
 	GRWLock			rip_rwlock;
 };
 
@@ -389,7 +538,32 @@ struct rpc_context
 	rpc_instance_t 		rcx_root;
 	GAsyncQueue *		rcx_emit_queue;
 	GThread *		rcx_emit_thread;
-	GHashTable *		rcx_event_watchers;
+
+	/*
+	 * Maps subscription patterns to sets of connections; protected
+	 * by rcx_rwlock. Connections update it with their own
+	 * rco_subscription_rwlock held, so that lock always comes
+	 * first: never take a subscription lock under rcx_rwlock.
+	 */
+	struct rpc_sub_index *	rcx_sub_index;
+	GThreadPool *		rcx_emit_pool;
+	GMutex			rcx_emit_mtx;
+	struct rpc_context_emitter rcx_emitter;
+	struct rpc_context_event_stats rcx_event_stats;
+	GMutex			rcx_prop_mtx;
+	GHashTable *		rcx_prop_changes;
+	GMutex			rcx_sched_mtx;
+	GQueue *		rcx_sched_active;
+	volatile gint		rcx_generation;
+
+	/* Admission control, protected by rcx_sched_mtx */
+	struct rpc_context_limits rcx_limits;
+	struct rpc_context_stats rcx_stats;
+	GHashTable *		rcx_iface_inflight;
+	int64_t			rcx_codel_first_above;
+	int64_t			rcx_codel_drop_next;
+	uint64_t		rcx_codel_count;
+	bool			rcx_codel_dropping;
 
 	/* Hooks */
 	rpc_function_t		rcx_pre_call_hook;
@@ -543,6 +717,7 @@ struct rpct_validator
 	const char *		type;
 	const char * 		name;
 	rpct_validator_fn_t 	validate;
+	rpct_validator_prepare_fn_t prepare;
 };
 
 INTERNAL_LINKAGE rpc_object_t rpc_prim_create(rpc_type_t type,
@@ -565,6 +740,17 @@ INTERNAL_LINKAGE char *rpc_generate_v4_uuid(void);
 INTERNAL_LINKAGE gboolean rpc_kill_main_loop(void *arg);
 INTERNAL_LINKAGE int rpc_ptr_array_string_index(GPtrArray *arr,
     const char *str);
+INTERNAL_LINKAGE GRegex *rpc_regex_get(const char *pattern);
+INTERNAL_LINKAGE void rpc_regex_pin(const char *pattern);
+INTERNAL_LINKAGE void rpc_prepare_validators(const char *name,
+    rpc_object_t params);
+INTERNAL_LINKAGE void rpc_query_index_appended(rpc_object_t array);
+INTERNAL_LINKAGE void rpc_query_index_replaced(rpc_object_t array,
+    size_t pos, rpc_object_t old, rpc_object_t value);
+INTERNAL_LINKAGE void rpc_query_index_removed(rpc_object_t array,
+    size_t pos);
+INTERNAL_LINKAGE void rpc_query_index_invalidate(rpc_object_t array);
+INTERNAL_LINKAGE void rpc_query_index_detach(rpc_object_t array);
 
 INTERNAL_LINKAGE const struct rpc_transport *rpc_find_transport(
     const char *scheme);
@@ -588,12 +774,17 @@ INTERNAL_LINKAGE int rpc_connection_retain(rpc_connection_t);
 INTERNAL_LINKAGE int rpc_connection_release(rpc_connection_t);
 INTERNAL_LINKAGE int rpc_connection_retain_if_valid(rpc_connection_t, bool);
 INTERNAL_LINKAGE int rpc_context_dispatch(rpc_context_t, struct rpc_call *);
+INTERNAL_LINKAGE void rpc_context_run_inline(rpc_context_t, struct rpc_call *);
+INTERNAL_LINKAGE GHashTable *rpc_method_cache_new(void);
+INTERNAL_LINKAGE int64_t rpc_context_current_deadline(void);
+INTERNAL_LINKAGE void rpc_context_call_done(rpc_context_t, struct rpc_call *);
 INTERNAL_LINKAGE int rpc_server_dispatch(rpc_server_t, struct rpc_call *);
 INTERNAL_LINKAGE void rpc_server_release(rpc_server_t);
 INTERNAL_LINKAGE void rpc_server_quit(rpc_server_t);
 INTERNAL_LINKAGE void rpc_server_disconnect(rpc_server_t, rpc_connection_t);
 INTERNAL_LINKAGE GMainContext *rpc_server_get_main_context(rpc_server_t);
 INTERNAL_LINKAGE GMainContext *rpc_client_get_main_context(rpc_client_t);
+INTERNAL_LINKAGE int rpc_runtime_run(rpc_runtime_t, GFunc, void *, void *);
 
 INTERNAL_LINKAGE void rpc_connection_send_err(rpc_connection_t, rpc_object_t,
     int, const char *descr, ...);
@@ -605,12 +796,66 @@ INTERNAL_LINKAGE void rpc_connection_send_start_stream(rpc_connection_t,
     rpc_object_t, int64_t);
 INTERNAL_LINKAGE void rpc_connection_send_fragment(rpc_connection_t,
     rpc_object_t, int64_t, rpc_object_t);
+INTERNAL_LINKAGE void rpc_connection_send_fragment_batch(rpc_connection_t,
+    rpc_object_t, int64_t, rpc_object_t);
 INTERNAL_LINKAGE void rpc_connection_send_end(rpc_connection_t, rpc_object_t,
     int64_t);
+INTERNAL_LINKAGE int rpc_connection_send_upload_continue(rpc_connection_t,
+    rpc_object_t, int64_t, int64_t);
 INTERNAL_LINKAGE void rpc_connection_close_inbound_call(struct rpc_call *);
+INTERNAL_LINKAGE void rpc_call_batch_store(struct rpc_call_batch *, size_t,
+    rpc_object_t);
 INTERNAL_LINKAGE int rpc_connection_call_retain(struct rpc_call *call);
 INTERNAL_LINKAGE int rpc_connection_call_release(struct rpc_call *call);
 INTERNAL_LINKAGE int rpc_connection_get_subscription_count(rpc_connection_t conn);
+INTERNAL_LINKAGE guint rpc_connection_get_load(rpc_connection_t conn);
+INTERNAL_LINKAGE int rpc_connection_flush_events(rpc_connection_t conn);
+INTERNAL_LINKAGE size_t rpc_object_size_estimate(rpc_object_t obj);
+INTERNAL_LINKAGE rpc_completion_queue_t rpc_cq_retain(
+    rpc_completion_queue_t cq);
+INTERNAL_LINKAGE void rpc_cq_release(rpc_completion_queue_t cq);
+INTERNAL_LINKAGE void rpc_cq_post(rpc_completion_queue_t cq, rpc_call_t call,
+    rpc_call_status_t status);
+INTERNAL_LINKAGE int rpc_connection_send_event_shared(rpc_connection_t conn,
+    const char *path, const char *interface, const char *name,
+    rpc_object_t args, struct rpc_shared_frame **framep);
+INTERNAL_LINKAGE struct rpc_shared_frame *rpc_shared_frame_new(
+    const char *path, const char *interface, const char *name,
+    rpc_object_t args);
+INTERNAL_LINKAGE struct rpc_shared_frame *rpc_shared_frame_retain(
+    struct rpc_shared_frame *frame);
+INTERNAL_LINKAGE void rpc_shared_frame_release(struct rpc_shared_frame *frame);
+INTERNAL_LINKAGE rpc_event_queue_result_t rpc_connection_enqueue_event(
+    rpc_connection_t conn, struct rpc_shared_frame *frame, size_t limit,
+    rpc_slow_consumer_policy_t policy, size_t *depth);
+INTERNAL_LINKAGE void rpc_connection_drain_events(rpc_connection_t conn);
+INTERNAL_LINKAGE void rpc_context_schedule_events(rpc_context_t context,
+    rpc_connection_t conn);
+INTERNAL_LINKAGE void rpc_context_watch_event(rpc_context_t context,
+    rpc_connection_t conn, const char *path, const char *interface,
+    const char *name);
+INTERNAL_LINKAGE void rpc_context_unwatch_event(rpc_context_t context,
+    rpc_connection_t conn, const char *path, const char *interface,
+    const char *name);
+INTERNAL_LINKAGE GPtrArray *rpc_context_find_watchers(rpc_context_t context,
+    rpc_server_t server, const char *path, const char *interface,
+    const char *name);
+
+INTERNAL_LINKAGE struct rpc_sub_index *rpc_sub_index_new(
+    GDestroyNotify value_free);
+INTERNAL_LINKAGE void rpc_sub_index_free(struct rpc_sub_index *index);
+INTERNAL_LINKAGE size_t rpc_sub_index_size(struct rpc_sub_index *index);
+INTERNAL_LINKAGE gpointer rpc_sub_index_lookup(struct rpc_sub_index *index,
+    const char *interface, const char *name, const char *path);
+INTERNAL_LINKAGE void rpc_sub_index_insert(struct rpc_sub_index *index,
+    const char *interface, const char *name, const char *path,
+    gpointer value);
+INTERNAL_LINKAGE void rpc_sub_index_remove(struct rpc_sub_index *index,
+    const char *interface, const char *name, const char *path);
+INTERNAL_LINKAGE bool rpc_sub_index_match(struct rpc_sub_index *index,
+    const char *interface, const char *name, const char *path,
+    rpc_sub_index_applier_t applier);
+INTERNAL_LINKAGE bool rpc_sub_index_path_valid(const char *path);
 
 INTERNAL_LINKAGE void rpc_bus_event(rpc_bus_event_t, struct rpc_bus_node *);
 
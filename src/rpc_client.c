@@ -25,11 +25,19 @@
  *
  */
 
+#include <errno.h>
 #include <rpc/client.h>
 #include <glib.h>
 #include <gio/gio.h>
 #include "internal.h"
 
+struct rpc_runtime_work
+{
+	GFunc			rrw_func;
+	void *			rrw_arg;
+	void *			rrw_data;
+};
+
 static void *
 rpc_client_worker(void *arg)
 {
@@ -46,16 +54,162 @@ rpc_client_worker(void *arg)
 	return (NULL);
 }
 
-rpc_client_t
-rpc_client_create(const char *uri, rpc_object_t params)
+static void *
+rpc_runtime_loop_worker(void *arg)
+{
+	sigset_t set;
+	struct rpc_runtime_loop *loop = arg;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	g_main_context_push_thread_default(loop->rrl_context);
+	g_main_loop_run(loop->rrl_loop);
+	return (NULL);
+}
+
+static void
+rpc_runtime_worker(void *arg, void *data __unused)
+{
+	struct rpc_runtime_work *work = arg;
+
+	work->rrw_func(work->rrw_arg, work->rrw_data);
+	g_free(work);
+}
+
+static struct rpc_runtime_loop *
+rpc_runtime_attach(rpc_runtime_t runtime)
+{
+	struct rpc_runtime_loop *loop = &runtime->rrt_loops[0];
+	size_t i;
+
+	/* Pick the loop with the fewest clients on it */
+	for (i = 1; i < runtime->rrt_nloops; i++) {
+		if (g_atomic_int_get(&runtime->rrt_loops[i].rrl_clients) <
+		    g_atomic_int_get(&loop->rrl_clients))
+			loop = &runtime->rrt_loops[i];
+	}
+
+	g_atomic_int_inc(&loop->rrl_clients);
+	g_atomic_int_inc(&runtime->rrt_clients);
+	return (loop);
+}
+
+static void
+rpc_runtime_detach(rpc_runtime_t runtime, struct rpc_runtime_loop *loop)
+{
+
+	g_atomic_int_add(&loop->rrl_clients, -1);
+	g_atomic_int_add(&runtime->rrt_clients, -1);
+}
+
+rpc_runtime_t
+rpc_runtime_create(size_t nloops, size_t nworkers)
+{
+	GError *err = NULL;
+	struct rpc_runtime_loop *loop;
+	rpc_runtime_t runtime;
+	size_t i;
+
+	if (nloops == 0)
+		nloops = g_get_num_processors();
+
+	if (nworkers == 0)
+		nworkers = g_get_num_processors();
+
+	runtime = g_malloc0(sizeof(*runtime));
+	runtime->rrt_callback_pool = g_thread_pool_new(rpc_runtime_worker,
+	    runtime, (gint)nworkers, false, &err);
+	if (err != NULL) {
+		rpc_set_last_gerror(err);
+		g_error_free(err);
+		g_free(runtime);
+		return (NULL);
+	}
+
+	runtime->rrt_nloops = nloops;
+	runtime->rrt_loops = g_malloc0_n(nloops, sizeof(*loop));
+
+	for (i = 0; i < nloops; i++) {
+		loop = &runtime->rrt_loops[i];
+		loop->rrl_context = g_main_context_new();
+		loop->rrl_loop = g_main_loop_new(loop->rrl_context, false);
+		loop->rrl_thread = g_thread_new("librpc runtime",
+		    rpc_runtime_loop_worker, loop);
+	}
+
+	return (runtime);
+}
+
+int
+rpc_runtime_free(rpc_runtime_t runtime)
+{
+	struct rpc_runtime_loop *loop;
+	size_t i;
+
+	if (g_atomic_int_get(&runtime->rrt_clients) > 0) {
+		rpc_set_last_error(EBUSY, "Runtime has active clients", NULL);
+		return (-1);
+	}
+
+	for (i = 0; i < runtime->rrt_nloops; i++) {
+		loop = &runtime->rrt_loops[i];
+		g_main_context_invoke(loop->rrl_context,
+		    (GSourceFunc)rpc_kill_main_loop, loop->rrl_loop);
+		g_thread_join(loop->rrl_thread);
+		g_main_loop_unref(loop->rrl_loop);
+		g_main_context_unref(loop->rrl_context);
+	}
+
+	g_thread_pool_free(runtime->rrt_callback_pool, false, true);
+	g_free(runtime->rrt_loops);
+	g_free(runtime);
+	return (0);
+}
+
+int
+rpc_runtime_run(rpc_runtime_t runtime, GFunc func, void *arg, void *data)
+{
+	GError *err = NULL;
+	struct rpc_runtime_work *work;
+
+	work = g_malloc(sizeof(*work));
+	work->rrw_func = func;
+	work->rrw_arg = arg;
+	work->rrw_data = data;
+
+	g_thread_pool_push(runtime->rrt_callback_pool, work, &err);
+	if (err != NULL) {
+		g_error_free(err);
+		g_free(work);
+		return (-1);
+	}
+
+	return (0);
+}
+
+static rpc_client_t
+rpc_client_create_impl(rpc_runtime_t runtime, const char *uri,
+    rpc_object_t params)
 {
 	rpc_client_t client;
 
 	client = g_malloc0(sizeof(*client));
-	client->rci_g_context = g_main_context_new();
-	client->rci_g_loop = g_main_loop_new(client->rci_g_context, false);
-	client->rci_thread = g_thread_new("librpc client", rpc_client_worker,
-	    client);
+	if (runtime != NULL) {
+		client->rci_runtime = runtime;
+		client->rci_runtime_loop = rpc_runtime_attach(runtime);
+		client->rci_g_context = g_main_context_ref(
+		    client->rci_runtime_loop->rrl_context);
+	} else {
+		client->rci_g_context = g_main_context_new();
+		client->rci_g_loop = g_main_loop_new(client->rci_g_context,
+		    false);
+		client->rci_thread = g_thread_new("librpc client",
+		    rpc_client_worker, client);
+	}
+
 	client->rci_uri = uri;
 	client->rci_params = params;
 
@@ -71,6 +225,21 @@ rpc_client_create(const char *uri, rpc_object_t params)
 	return (client);
 }
 
+rpc_client_t
+rpc_client_create(const char *uri, rpc_object_t params)
+{
+
+	return (rpc_client_create_impl(NULL, uri, params));
+}
+
+rpc_client_t
+rpc_client_create_with_runtime(rpc_runtime_t runtime, const char *uri,
+    rpc_object_t params)
+{
+
+	return (rpc_client_create_impl(runtime, uri, params));
+}
+
 GMainContext *
 rpc_client_get_main_context(rpc_client_t client)
 {
@@ -104,6 +273,15 @@ rpc_client_close(rpc_client_t client)
 		client->rci_connection = NULL;
         }
 
+	if (client->rci_runtime != NULL) {
+		/* The loop thread belongs to the runtime */
+		rpc_runtime_detach(client->rci_runtime,
+		    client->rci_runtime_loop);
+		g_main_context_unref(client->rci_g_context);
+		g_free(client);
+		return;
+	}
+
 	g_main_context_invoke(client->rci_g_context,
 	    (GSourceFunc)rpc_kill_main_loop, client->rci_g_loop);
 	g_thread_join(client->rci_thread);
@@ -0,0 +1,342 @@
+/*
+ * Copyright 2015-2017 Two Pore Guys, Inc.
+ * All rights reserved
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted providing that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <glib.h>
+#include <rpc/client.h>
+#include "internal.h"
+
+#define	RECONNECT_BACKOFF	(G_USEC_PER_SEC)
+
+/*
+ * Client pool.
+ *
+ * A pool keeps a fixed number of slots, each holding one client
+ * connected to one of the pool URIs (assigned round-robin). Unary calls
+ * go to the open connection with the fewest outbound calls in flight;
+ * a streaming call stays on the connection it was started on, since
+ * the call object is bound to it.
+ *
+ * Slots whose connection died are reconnected in the background the
+ * next time the pool looks at them, at most once per
+ * RECONNECT_BACKOFF while the endpoint stays unreachable.
+ */
+
+struct rpc_client_pool_slot
+{
+	rpc_client_t		rcps_client;
+	const char *		rcps_uri;
+	bool			rcps_reconnecting;
+	int64_t			rcps_retry_at;
+};
+
+struct rpc_client_pool
+{
+	GMutex			rcp_mtx;
+	struct rpc_client_pool_slot *rcp_slots;
+	size_t			rcp_nslots;
+	char **			rcp_uris;
+	rpc_object_t		rcp_params;
+	rpc_runtime_t		rcp_runtime;
+	GThreadPool *		rcp_reconnect_pool;
+	size_t			rcp_next;
+	bool			rcp_closed;
+};
+
+static rpc_client_t
+rpc_client_pool_connect(rpc_client_pool_t pool, const char *uri)
+{
+
+	if (pool->rcp_runtime != NULL) {
+		return (rpc_client_create_with_runtime(pool->rcp_runtime, uri,
+		    pool->rcp_params));
+	}
+
+	return (rpc_client_create(uri, pool->rcp_params));
+}
+
+static void
+rpc_client_pool_reconnect(void *arg, void *data)
+{
+	struct rpc_client_pool_slot *slot = arg;
+	rpc_client_pool_t pool = data;
+	rpc_client_t old;
+	rpc_client_t client;
+
+	g_mutex_lock(&pool->rcp_mtx);
+	old = slot->rcps_client;
+	slot->rcps_client = NULL;
+	g_mutex_unlock(&pool->rcp_mtx);
+
+	/* Callers that picked the old connection hold their own reference */
+	if (old != NULL)
+		rpc_client_close(old);
+
+	client = rpc_client_pool_connect(pool, slot->rcps_uri);
+
+	g_mutex_lock(&pool->rcp_mtx);
+	slot->rcps_client = client;
+	slot->rcps_reconnecting = false;
+	if (client == NULL)
+		slot->rcps_retry_at = g_get_monotonic_time() + RECONNECT_BACKOFF;
+	g_mutex_unlock(&pool->rcp_mtx);
+}
+
+static void
+rpc_client_pool_schedule_locked(rpc_client_pool_t pool,
+    struct rpc_client_pool_slot *slot)
+{
+
+	if (pool->rcp_closed || slot->rcps_reconnecting)
+		return;
+
+	if (g_get_monotonic_time() < slot->rcps_retry_at)
+		return;
+
+	slot->rcps_reconnecting = true;
+	g_thread_pool_push(pool->rcp_reconnect_pool, slot, NULL);
+}
+
+static rpc_connection_t
+rpc_client_pool_acquire(rpc_client_pool_t pool)
+{
+	struct rpc_client_pool_slot *slot;
+	rpc_connection_t best = NULL;
+	rpc_connection_t conn;
+	guint best_load = G_MAXUINT;
+	guint load;
+	size_t i;
+
+	g_mutex_lock(&pool->rcp_mtx);
+	for (i = 0; i < pool->rcp_nslots; i++) {
+		/* Rotate the starting slot so that ties are spread evenly */
+		slot = &pool->rcp_slots[(pool->rcp_next + i) % pool->rcp_nslots];
+		if (slot->rcps_client == NULL) {
+			rpc_client_pool_schedule_locked(pool, slot);
+			continue;
+		}
+
+		conn = rpc_client_get_connection(slot->rcps_client);
+		if (!rpc_connection_is_open(conn)) {
+			rpc_client_pool_schedule_locked(pool, slot);
+			continue;
+		}
+
+		load = rpc_connection_get_load(conn);
+		if (load < best_load) {
+			best = conn;
+			best_load = load;
+		}
+	}
+
+	pool->rcp_next++;
+	if (best != NULL)
+		rpc_connection_retain(best);
+	g_mutex_unlock(&pool->rcp_mtx);
+
+	if (best == NULL)
+		rpc_set_last_error(ENOTCONN, "No connection available", NULL);
+
+	return (best);
+}
+
+rpc_client_pool_t
+rpc_client_pool_create(const char *const *uris, size_t size,
+    rpc_runtime_t runtime, rpc_object_t params)
+{
+	GError *err = NULL;
+	struct rpc_client_pool_slot *slot;
+	rpc_client_pool_t pool;
+	size_t nuris;
+	size_t connected = 0;
+	size_t i;
+
+	nuris = uris != NULL ? g_strv_length((char **)uris) : 0;
+	if (nuris == 0 || size == 0) {
+		rpc_set_last_error(EINVAL, "No URIs or empty pool", NULL);
+		return (NULL);
+	}
+
+	pool = g_malloc0(sizeof(*pool));
+	g_mutex_init(&pool->rcp_mtx);
+	pool->rcp_uris = g_strdupv((char **)uris);
+	pool->rcp_params = params != NULL ? rpc_retain(params) : NULL;
+	pool->rcp_runtime = runtime;
+	pool->rcp_nslots = size;
+	pool->rcp_slots = g_malloc0_n(size, sizeof(*slot));
+	pool->rcp_reconnect_pool = g_thread_pool_new(rpc_client_pool_reconnect,
+	    pool, 1, false, &err);
+	if (err != NULL) {
+		rpc_set_last_gerror(err);
+		g_error_free(err);
+		rpc_client_pool_free(pool);
+		return (NULL);
+	}
+
+	for (i = 0; i < size; i++) {
+		slot = &pool->rcp_slots[i];
+		slot->rcps_uri = pool->rcp_uris[i % nuris];
+		slot->rcps_client = rpc_client_pool_connect(pool,
+		    slot->rcps_uri);
+		if (slot->rcps_client != NULL)
+			connected++;
+	}
+
+	/* Unreachable slots are retried later, but one must work now */
+	if (connected == 0) {
+		rpc_client_pool_free(pool);
+		rpc_set_last_error(ECONNREFUSED, "No URI reachable", NULL);
+		return (NULL);
+	}
+
+	return (pool);
+}
+
+void
+rpc_client_pool_free(rpc_client_pool_t pool)
+{
+	size_t i;
+
+	g_mutex_lock(&pool->rcp_mtx);
+	pool->rcp_closed = true;
+	g_mutex_unlock(&pool->rcp_mtx);
+
+	/* Let reconnects in progress finish before closing everything */
+	if (pool->rcp_reconnect_pool != NULL)
+		g_thread_pool_free(pool->rcp_reconnect_pool, false, true);
+
+	for (i = 0; i < pool->rcp_nslots; i++) {
+		if (pool->rcp_slots[i].rcps_client != NULL)
+			rpc_client_close(pool->rcp_slots[i].rcps_client);
+	}
+
+	if (pool->rcp_params != NULL)
+		rpc_release(pool->rcp_params);
+
+	g_strfreev(pool->rcp_uris);
+	g_free(pool->rcp_slots);
+	g_mutex_clear(&pool->rcp_mtx);
+	g_free(pool);
+}
+
+size_t
+rpc_client_pool_get_size(rpc_client_pool_t pool)
+{
+
+	return (pool->rcp_nslots);
+}
+
+rpc_call_t
+rpc_client_pool_call(rpc_client_pool_t pool, const char *path,
+    const char *interface, const char *name, rpc_object_t args,
+    rpc_callback_t callback)
+{
+	rpc_connection_t conn;
+	rpc_call_t call = NULL;
+	bool retry;
+	size_t i;
+
+	/* A connection may die between selection and the call; try another */
+	for (i = 0; i < pool->rcp_nslots; i++) {
+		conn = rpc_client_pool_acquire(pool);
+		if (conn == NULL)
+			break;
+
+		call = rpc_connection_call(conn, path, interface, name, args,
+		    callback);
+		retry = call == NULL && !rpc_connection_is_open(conn);
+		rpc_connection_release(conn);
+		if (!retry)
+			break;
+	}
+
+	return (call);
+}
+
+rpc_call_t
+rpc_client_pool_call_stream(rpc_client_pool_t pool, const char *path,
+    const char *interface, const char *name, rpc_object_t args)
+{
+	rpc_connection_t conn;
+	rpc_call_t call = NULL;
+	bool retry;
+	size_t i;
+
+	/* Same as rpc_client_pool_call(): only retry calls never sent */
+	for (i = 0; i < pool->rcp_nslots; i++) {
+		conn = rpc_client_pool_acquire(pool);
+		if (conn == NULL)
+			break;
+
+		call = rpc_connection_call_stream(conn, path, interface, name,
+		    args);
+		retry = call == NULL && !rpc_connection_is_open(conn);
+		rpc_connection_release(conn);
+		if (!retry)
+			break;
+	}
+
+	return (call);
+}
+
+rpc_object_t
+rpc_client_pool_call_syncp(rpc_client_pool_t pool, const char *path,
+    const char *interface, const char *method, const char *fmt, ...)
+{
+	rpc_connection_t conn;
+	rpc_object_t result = NULL;
+	va_list ap;
+	va_list aq;
+	bool retry;
+	size_t i;
+
+	/*
+	 * A call that failed to go out is retried on another connection.
+	 * One that went out but lost its connection is not, as the server
+	 * may have run it already; the caller gets the error instead.
+	 */
+	va_start(ap, fmt);
+	for (i = 0; i < pool->rcp_nslots; i++) {
+		conn = rpc_client_pool_acquire(pool);
+		if (conn == NULL)
+			break;
+
+		va_copy(aq, ap);
+		result = rpc_connection_call_syncpv(conn, path, interface,
+		    method, fmt, aq);
+		va_end(aq);
+
+		retry = result == NULL && !rpc_connection_is_open(conn);
+		rpc_connection_release(conn);
+		if (!retry)
+			break;
+	}
+
+	va_end(ap);
+	return (result);
+}
@@ -26,6 +26,7 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include <glib.h>
 #include <glib/gprintf.h>
@@ -41,7 +42,12 @@
 #include "serializer/msgpack.h"
 
 #define	DEFAULT_RPC_TIMEOUT	60
+#define	DEFAULT_CONNECTION_WEIGHT	1
 #define	MAX_FDS			128
+#define	DEFAULT_UPLOAD_WINDOW	(256 * 1024)
+#define	DEFAULT_UPLOAD_WINDOW_ITEMS	64
+#define	PROP_CACHE_UNWATCH_RETRY	1000
+#define	DEFAULT_MAX_QUEUED	1024
 
 typedef enum rpc_close_source
 {
@@ -59,10 +65,17 @@ static struct rpc_call *rpc_call_alloc(rpc_connection_t, rpc_object_t,
     const char *, const char *, const char *, rpc_object_t);
 static int rpc_send_frame(rpc_connection_t, rpc_object_t);
 static void on_rpc_call(rpc_connection_t, rpc_object_t, rpc_object_t);
+static void on_rpc_call_batch(rpc_connection_t, rpc_object_t, rpc_object_t);
 static void on_rpc_response(rpc_connection_t, rpc_object_t, rpc_object_t);
 static void on_rpc_start_stream(rpc_connection_t, rpc_object_t, rpc_object_t);
 static void on_rpc_fragment(rpc_connection_t, rpc_object_t, rpc_object_t);
+static void on_rpc_fragment_batch(rpc_connection_t, rpc_object_t,
+    rpc_object_t);
 static void on_rpc_continue(rpc_connection_t, rpc_object_t, rpc_object_t);
+static void on_rpc_upload(rpc_connection_t, rpc_object_t, rpc_object_t);
+static void on_rpc_upload_end(rpc_connection_t, rpc_object_t, rpc_object_t);
+static void on_rpc_upload_continue(rpc_connection_t, rpc_object_t,
+    rpc_object_t);
 static void on_rpc_end(rpc_connection_t, rpc_object_t, rpc_object_t);
 static void on_rpc_abort(rpc_connection_t, rpc_object_t, rpc_object_t);
 static void on_rpc_error(rpc_connection_t, rpc_object_t, rpc_object_t);
@@ -71,11 +84,14 @@ static void on_events_event_burst(rpc_connection_t, rpc_object_t, rpc_object_t);
 static void on_events_subscribe(rpc_connection_t, rpc_object_t, rpc_object_t);
 static void on_events_unsubscribe(rpc_connection_t, rpc_object_t, rpc_object_t);
 static void rpc_callback_worker(void *, void *);
+static void rpc_runtime_callback_worker(void *, void *);
 static inline rpc_call_status_t rpc_call_status_locked(rpc_call_t);
 static int rpc_call_wait_locked(rpc_call_t);
 static gboolean rpc_call_timeout(gpointer user_data);
 static struct rpc_subscription *rpc_connection_subscribe_event_locked(
     rpc_connection_t, const char *, const char *, const char *, bool);
+static bool rpc_connection_match_subscription(rpc_connection_t, const char *,
+    const char *, const char *);
 static struct rpc_subscription *rpc_connection_find_subscription(rpc_connection_t,
     const char *, const char *, const char *);
 static void rpc_connection_free_resources(rpc_connection_t);
@@ -86,11 +102,42 @@ static int rpc_connection_do_close(rpc_connection_t conn, rpc_close_source_t);
 static rpc_connection_t rpc_connection_init(int);
 static void rpc_abort_worker(void *arg, void *data);
 static void call_abort_locked(struct rpc_call *call);
+static void rpc_abort_inbound_call(rpc_connection_t, struct rpc_call *);
 static void rpc_subscription_release(struct rpc_subscription *sub);
 static void rpc_rsh_release(struct rpc_subscription_handler *rsh);
 static int rpc_set_creds(rpc_connection_t conn, pid_t pid, uid_t uid, gid_t gid);
+static void rpc_run_inbound_call(rpc_connection_t conn, struct rpc_call *call);
+static struct rpc_call *rpc_connection_admit_next(rpc_connection_t conn);
+static int64_t rpc_frame_deadline(rpc_object_t args);
+static void rpc_abort_inbound_call(rpc_connection_t, struct rpc_call *);
+static void rpc_dispatch_inbound_call(rpc_connection_t, struct rpc_call *);
+static void rpc_call_batch_release(struct rpc_call_batch *batch);
+static rpc_call_t rpc_connection_send_call(rpc_connection_t, struct rpc_call *,
+    const char *, rpc_object_t);
+static int rpc_connection_queue_event(rpc_connection_t, rpc_object_t);
+static int rpc_connection_flush_events_locked(rpc_connection_t);
+static bool rpc_object_has_fds(rpc_object_t obj);
+static int rpc_shared_frame_encode(struct rpc_shared_frame *, bool,
+    const void **, size_t *);
+static int rpc_connection_send_shared_frame(rpc_connection_t,
+    struct rpc_shared_frame *);
+static bool rpc_connection_wants_event(rpc_connection_t, const char *,
+    const char *, const char *);
 static int rpc_connection_unsubscribe_event_locked(rpc_connection_t conn,
     struct rpc_subscription *sub);
+static int rpc_call_grant_credit_locked(rpc_call_t call, size_t consumed);
+static size_t rpc_call_account_fragment_locked(rpc_call_t call,
+    rpc_object_t fragment);
+static int rpc_call_advance_locked(rpc_call_t call);
+static void rpc_call_changed_locked(rpc_call_t call, rpc_call_status_t status);
+static void rpc_call_expire_locked(rpc_call_t call);
+static int rpc_call_wait_sync(rpc_call_t call);
+static void prop_cache_entry_free(struct prop_cache_entry *entry);
+static void prop_cache_invalidate(rpc_connection_t conn, const char *key);
+static int prop_cache_unwatch(rpc_connection_t conn, void *watch);
+static rpc_call_t rpc_connection_call_impl(rpc_connection_t conn,
+    const char *path, const char *interface, const char *name,
+    rpc_object_t args, rpc_callback_t callback, bool sync);
 
 struct message_handler
 {
@@ -103,6 +150,20 @@ struct queue_item
 {
 	rpc_call_status_t status;
 	rpc_object_t item;
+	size_t size;	/* only valid for RPC_CALL_MORE_AVAILABLE */
+	rpc_object_t batch;	/* remaining fragments of a fragment_batch */
+	size_t next;
+};
+
+struct prop_cache_entry
+{
+	char *		key;
+	rpc_object_t	value;
+	void *		watch;
+	char *		watch_key;	/* referenced by the watch handler */
+	uint64_t	version;
+	int64_t		updated;
+	bool		valid;
 };
 
 struct work_item
@@ -113,10 +174,16 @@ struct work_item
 
 static const struct message_handler handlers[] = {
 	{ "rpc", "call", on_rpc_call },
+	{ "rpc", "call_batch", on_rpc_call_batch },
 	{ "rpc", "response", on_rpc_response },
+	{ "rpc", "response_batch", on_rpc_response },
 	{ "rpc", "start_stream", on_rpc_start_stream },
 	{ "rpc", "fragment", on_rpc_fragment },
+	{ "rpc", "fragment_batch", on_rpc_fragment_batch },
 	{ "rpc", "continue", on_rpc_continue },
+	{ "rpc", "upload", on_rpc_upload },
+	{ "rpc", "upload_end", on_rpc_upload_end },
+	{ "rpc", "upload_continue", on_rpc_upload_continue },
 	{ "rpc", "end", on_rpc_end },
 	{ "rpc", "abort", on_rpc_abort },
 	{ "rpc", "error", on_rpc_error },
@@ -224,6 +291,18 @@ rpc_run_callback(rpc_connection_t conn, struct work_item *item)
 		return (true);
 	}
 #endif
+	if (conn->rco_runtime != NULL) {
+		/* Dropped by rpc_runtime_callback_worker() */
+		rpc_connection_retain(conn);
+		if (rpc_runtime_run(conn->rco_runtime,
+		    rpc_runtime_callback_worker, item, conn) != 0) {
+			rpc_connection_release(conn);
+			return (false);
+		}
+
+		return (true);
+	}
+
 	g_thread_pool_push(conn->rco_callback_pool, item, &err);
 	if (err != NULL) {
 		g_error_free(err);
@@ -233,12 +312,34 @@ rpc_run_callback(rpc_connection_t conn, struct work_item *item)
 	return (true);
 }
 
+/*
+ * The runtime's callback pool is shared by many connections and outlives
+ * each of them, so its items hold a connection reference. Items still
+ * queued when the connection closes are dropped here, just like a
+ * connection's own pool discards them when it is freed.
+ */
+static void
+rpc_runtime_callback_worker(void *arg, void *data)
+{
+	struct work_item *item = arg;
+	rpc_connection_t conn = data;
+
+	if (g_atomic_int_get(&conn->rco_state) != CONNECTION_OPEN) {
+		rpc_release(item->event);
+		g_free(item);
+	} else
+		rpc_callback_worker(item, conn);
+
+	rpc_connection_release(conn);
+}
+
 static void
 rpc_callback_worker(void *arg, void *data)
 {
 	struct work_item *item = arg;
 	struct rpc_subscription *sub;
 	struct rpc_subscription_handler *handler;
+	GPtrArray *subs;
 	const char *path;
 	const char *interface;
 	const char *name;
@@ -247,9 +348,11 @@ rpc_callback_worker(void *arg, void *data)
 	rpc_call_status_t call_status;
 	bool ret;
 
-
-	if (rpc_connection_retain_if_valid(conn, true) != 0)
+	if (rpc_connection_retain_if_valid(conn, true) != 0) {
+		rpc_release(item->event);
+		g_free(item);
 		return;
+	}
 
 	if (item->call) {
 		call = item->call;
@@ -277,19 +380,39 @@ rpc_callback_worker(void *arg, void *data)
 		interface = rpc_dictionary_get_string(item->event, "interface");
 		name = rpc_dictionary_get_string(item->event, "name");
 		data = rpc_dictionary_get_value(item->event, "args");
+		subs = g_ptr_array_new();
 		g_rw_lock_writer_lock(&conn->rco_subscription_rwlock);
-		sub = rpc_connection_find_subscription(conn, path, interface, name);
+		rpc_sub_index_match(conn->rco_sub_index, interface, name, path,
+		    ^(gpointer value) {
+			for (guint i = 0; i < subs->len; i++) {
+				if (g_ptr_array_index(subs, i) == value)
+					return ((bool)true);
+			}
 
-		if (sub != NULL) {
+			g_ptr_array_add(subs, value);
+			return ((bool)true);
+		});
+
+		for (guint i = 0; i < subs->len; i++) {
+			sub = g_ptr_array_index(subs, i);
 			if (sub->rsu_busy) {
 				rpc_run_callback(conn, item);
 				g_rw_lock_writer_unlock(&conn->rco_subscription_rwlock);
+				g_ptr_array_free(subs, true);
 				rpc_connection_release(conn);
 				return;
 			}
+		}
+
+		for (guint i = 0; i < subs->len; i++) {
+			sub = g_ptr_array_index(subs, i);
 			sub->rsu_busy = true;
-			for (guint i = 0; i < sub->rsu_handlers->len; i++) {
-				handler = g_ptr_array_index(sub->rsu_handlers, i);
+		}
+
+		for (guint i = 0; i < subs->len; i++) {
+			sub = g_ptr_array_index(subs, i);
+			for (guint j = 0; j < sub->rsu_handlers->len; j++) {
+				handler = g_ptr_array_index(sub->rsu_handlers, j);
 				g_rw_lock_writer_unlock(&conn->rco_subscription_rwlock);
 				handler->rsh_handler(path, interface, name, data);
 				g_rw_lock_writer_lock(&conn->rco_subscription_rwlock);
@@ -297,6 +420,7 @@ rpc_callback_worker(void *arg, void *data)
 			sub->rsu_busy = false;
 		}
 		g_rw_lock_writer_unlock(&conn->rco_subscription_rwlock);
+		g_ptr_array_free(subs, true);
 
 		if (conn->rco_event_handler != NULL)
 			conn->rco_event_handler(path, interface, name, data);
@@ -355,6 +479,11 @@ rpc_connection_set_context(rpc_connection_t conn, rpc_context_t ctx)
 static int
 cancel_timeout_locked(rpc_call_t call)
 {
+
+	/* Synchronous calls have no timer; their waiter expires them */
+	if (call->rc_sync && call->rc_timedout)
+		return (-1);
+
 	/* Cancel timeout source */
 	if (call->rc_timeout != NULL) {
 		if (call->rc_timedout)
@@ -376,7 +505,6 @@ on_rpc_call(rpc_connection_t conn, rpc_object_t args, rpc_object_t id)
 	const char *path = NULL;
 	rpc_object_t call_args = NULL;
 	rpc_object_t err;
-	int res;
 
 	if (conn->rco_rpc_context == NULL) {
 		rpc_connection_send_err(conn, id, ENOTSUP, "Not supported");
@@ -398,13 +526,194 @@ on_rpc_call(rpc_connection_t conn, rpc_object_t args, rpc_object_t id)
 		return;
 	}
 
+	call->rc_deadline = rpc_frame_deadline(args);
+
+	/* Client-streaming call: arguments keep coming as "upload" frames */
+	if (rpc_dictionary_get_bool(args, "stream")) {
+		call->rc_upload = true;
+		call->rc_upload_queue = g_queue_new();
+		call->rc_upload_window = DEFAULT_UPLOAD_WINDOW;
+		call->rc_upload_window_items = DEFAULT_UPLOAD_WINDOW_ITEMS;
+	}
+
+	rpc_dispatch_inbound_call(conn, call);
+}
+
+static void
+on_rpc_call_batch(rpc_connection_t conn, rpc_object_t args, rpc_object_t id)
+{
+	struct rpc_call_batch *batch;
+	rpc_call_t call;
+	rpc_object_t calls;
+	rpc_object_t call_args;
+	rpc_object_t call_id;
+	const char *method;
+	const char *interface;
+	const char *path;
+	int64_t deadline;
+	size_t ncalls;
+	size_t i;
+
+	if (conn->rco_rpc_context == NULL) {
+		rpc_connection_send_err(conn, id, ENOTSUP, "Not supported");
+		return;
+	}
+
+	calls = rpc_dictionary_get_value(args, "calls");
+	if (calls == NULL || rpc_get_type(calls) != RPC_TYPE_ARRAY) {
+		rpc_connection_send_err(conn, id, EINVAL,
+		    "Batch calls must be an array");
+		return;
+	}
+
+	deadline = rpc_frame_deadline(args);
+	ncalls = rpc_array_get_count(calls);
+
+	rpc_connection_retain(conn);
+	batch = g_malloc0(sizeof(*batch));
+	batch->rcb_conn = conn;
+	batch->rcb_id = rpc_retain(id);
+	batch->rcb_results = rpc_array_create();
+	batch->rcb_pending = ncalls + 1; /* one for the loop below */
+	g_mutex_init(&batch->rcb_mtx);
+
+	for (i = 0; i < ncalls; i++) {
+		rpc_array_append_stolen_value(batch->rcb_results,
+		    rpc_error_create(ECANCELED, "Call not completed", NULL));
+	}
+
+	/*
+	 * Every entry becomes a regular inbound call with its own ID, so
+	 * entries are scheduled, admitted and run in parallel just like
+	 * separate calls would be. Only the responses are collected.
+	 */
+	for (i = 0; i < ncalls; i++) {
+		path = NULL;
+		interface = NULL;
+		method = NULL;
+		call_args = NULL;
+
+		rpc_object_unpack(rpc_array_get_value(calls, i), "[s,s,s,v]",
+		    &path, &interface, &method, &call_args);
+
+		call_id = rpc_string_create_with_format("%s.%zu",
+		    rpc_string_get_string_ptr(id), i);
+		call = rpc_call_alloc(conn, call_id, path, interface, method,
+		    call_args);
+
+		if (call == NULL) {
+			rpc_call_batch_store(batch, i,
+			    rpc_retain(rpc_get_last_error()));
+			rpc_release(call_id);
+			rpc_call_batch_release(batch);
+			continue;
+		}
+
+		call->rc_batch = batch;
+		call->rc_batch_idx = i;
+		call->rc_deadline = deadline;
+		rpc_dispatch_inbound_call(conn, call);
+	}
+
+	rpc_call_batch_release(batch);
+}
+
+static int64_t
+rpc_frame_deadline(rpc_object_t args)
+{
+	int64_t timeout;
+
+	/* Remaining budget of the caller, in milliseconds */
+	if (!rpc_dictionary_has_key(args, "timeout"))
+		return (0);
+
+	timeout = rpc_dictionary_get_int64(args, "timeout");
+	return (g_get_monotonic_time() + MAX(timeout, 0) * 1000);
+}
+
+void
+rpc_call_batch_store(struct rpc_call_batch *batch, size_t idx,
+    rpc_object_t result)
+{
+
+	g_mutex_lock(&batch->rcb_mtx);
+	rpc_array_steal_value(batch->rcb_results, idx, result);
+	g_mutex_unlock(&batch->rcb_mtx);
+}
+
+static void
+rpc_call_batch_release(struct rpc_call_batch *batch)
+{
+	rpc_object_t frame;
+
+	g_mutex_lock(&batch->rcb_mtx);
+	g_assert(batch->rcb_pending > 0);
+	if (--batch->rcb_pending > 0) {
+		g_mutex_unlock(&batch->rcb_mtx);
+		return;
+	}
+
+	g_mutex_unlock(&batch->rcb_mtx);
+
+	/* All entries are done, send the results out as a single frame */
+	frame = rpc_pack_frame("rpc", "response_batch", batch->rcb_id,
+	    batch->rcb_results);
+	rpc_send_frame(batch->rcb_conn, frame);
+
+	rpc_connection_release(batch->rcb_conn);
+	rpc_release(batch->rcb_id);
+	g_mutex_clear(&batch->rcb_mtx);
+	g_free(batch);
+}
+
+static void
+rpc_dispatch_inbound_call(rpc_connection_t conn, struct rpc_call *call)
+{
+
 	call->rc_type = RPC_INBOUND_CALL;
 
+	/*
+	 * The call is registered right away, so upload and abort frames
+	 * reach it even while it waits for admission below.
+	 */
 	g_rw_lock_writer_lock(&conn->rco_icall_rwlock);
 	g_hash_table_insert(conn->rco_inbound_calls,
-	    (gpointer)rpc_string_get_string_ptr(id), call);
+	    (gpointer)rpc_string_get_string_ptr(call->rc_id), call);
 	g_rw_lock_writer_unlock(&conn->rco_icall_rwlock);
 
+	/*
+	 * Over the in-flight cap, park the call instead of blocking the
+	 * reader: the calls already running still need their control
+	 * frames to get anywhere. Once the parking queue is full too, the
+	 * sender gets EAGAIN and has to back off.
+	 */
+	g_mutex_lock(&conn->rco_inflight_mtx);
+	if (conn->rco_max_inflight > 0 &&
+	    conn->rco_inflight >= conn->rco_max_inflight) {
+		if (conn->rco_admit_queue.length < conn->rco_max_queued) {
+			g_queue_push_tail(&conn->rco_admit_queue, call);
+			g_mutex_unlock(&conn->rco_inflight_mtx);
+			return;
+		}
+
+		/* Balances the decrement in close_inbound_call() */
+		conn->rco_inflight++;
+		g_mutex_unlock(&conn->rco_inflight_mtx);
+		rpc_function_error(call, EAGAIN, "Too many calls in flight");
+		rpc_connection_close_inbound_call(call);
+		return;
+	}
+
+	conn->rco_inflight++;
+	g_mutex_unlock(&conn->rco_inflight_mtx);
+	rpc_run_inbound_call(conn, call);
+}
+
+static void
+rpc_run_inbound_call(rpc_connection_t conn, struct rpc_call *call)
+{
+	int res;
+
 	if (conn->rco_server != NULL)
 		res = rpc_server_dispatch(conn->rco_server, call);
 	else
@@ -417,7 +726,11 @@ on_rpc_call(rpc_connection_t conn, rpc_object_t args, rpc_object_t id)
 			    rpc_error_get_message(call->rc_err));
 		}
 		rpc_connection_close_inbound_call(call);
+		return;
 	}
+
+	if (call->rc_inline)
+		rpc_context_run_inline(conn->rco_rpc_context, call);
 }
 
 static void
@@ -456,12 +769,14 @@ on_rpc_response(rpc_connection_t conn, rpc_object_t args, rpc_object_t id)
 			g_free(item);
 	}
 
-	q_item = g_malloc(sizeof(*q_item));
+	q_item = g_malloc0(sizeof(*q_item));
 	q_item->status = RPC_CALL_DONE;
 	q_item->item = rpc_retain(args);
 
 	g_queue_push_tail(call->rc_queue, q_item);
 	notify_signal(&call->rc_notify);
+	rpc_call_changed_locked(call, RPC_CALL_DONE);
+	g_cond_broadcast(&call->rc_upload_cv);
 	g_mutex_unlock(&call->rc_mtx);
 	rpc_connection_call_release(call);
 }
@@ -501,12 +816,13 @@ on_rpc_start_stream(rpc_connection_t conn, rpc_object_t args, rpc_object_t id)
 			g_free(item);
 	}
 
-	q_item = g_malloc(sizeof(*q_item));
+	q_item = g_malloc0(sizeof(*q_item));
 	q_item->status = RPC_CALL_STREAM_START;
 	q_item->item = rpc_null_create();
 
 	g_queue_push_tail(call->rc_queue, q_item);
 	notify_signal(&call->rc_notify);
+	rpc_call_changed_locked(call, RPC_CALL_STREAM_START);
 	g_mutex_unlock(&call->rc_mtx);
 	rpc_connection_call_release(call);
 }
@@ -556,12 +872,86 @@ on_rpc_fragment(rpc_connection_t conn, rpc_object_t args, rpc_object_t id)
 			g_free(item);
 	}
 
-	q_item = g_malloc(sizeof(*q_item));
+	q_item = g_malloc0(sizeof(*q_item));
 	q_item->status = RPC_CALL_MORE_AVAILABLE;
 	q_item->item = rpc_retain(payload);
+	q_item->size = rpc_call_account_fragment_locked(call, payload);
+
+	g_queue_push_tail(call->rc_queue, q_item);
+	notify_signal(&call->rc_notify);
+	rpc_call_changed_locked(call, RPC_CALL_MORE_AVAILABLE);
+	g_mutex_unlock(&call->rc_mtx);
+	rpc_connection_call_release(call);
+}
+
+static void
+on_rpc_fragment_batch(rpc_connection_t conn, rpc_object_t args,
+    rpc_object_t id)
+{
+	struct queue_item *q_item;
+	struct work_item *item;
+	rpc_call_t call;
+	rpc_object_t fragments;
+	size_t count;
+	size_t i;
+
+	fragments = rpc_dictionary_get_value(args, "fragments");
+	if (fragments == NULL || rpc_get_type(fragments) != RPC_TYPE_ARRAY ||
+	    rpc_array_get_count(fragments) == 0) {
+		debugf("Empty fragment batch received on %p", conn);
+		return;
+	}
+
+	g_rw_lock_reader_lock(&conn->rco_call_rwlock);
+	call = g_hash_table_lookup(conn->rco_calls,
+	    rpc_string_get_string_ptr(id));
+	if (call == NULL) {
+		g_rw_lock_reader_unlock(&conn->rco_call_rwlock);
+		return;
+	}
+
+	rpc_connection_call_retain(call);
+	g_mutex_lock(&call->rc_mtx);
+	if (cancel_timeout_locked(call) != 0) {
+		g_mutex_unlock(&call->rc_mtx);
+		g_rw_lock_reader_unlock(&conn->rco_call_rwlock);
+		rpc_connection_call_release(call);
+		return;
+	}
+
+	g_rw_lock_reader_unlock(&conn->rco_call_rwlock);
+	count = rpc_array_get_count(fragments);
+
+	/* Callbacks consume one fragment per invocation */
+	if (call->rc_callback) {
+		for (i = 0; i < count; i++) {
+			item = g_malloc0(sizeof(*item));
+			item->call = call;
+			if (!rpc_run_callback(conn, item))
+				g_free(item);
+		}
+	}
+
+	/*
+	 * The whole batch sits in a single queue item, which hands out
+	 * one fragment after another as the consumer advances.
+	 */
+	q_item = g_malloc0(sizeof(*q_item));
+	q_item->status = RPC_CALL_MORE_AVAILABLE;
+	q_item->item = rpc_retain(rpc_array_get_value(fragments, 0));
+	q_item->batch = rpc_retain(fragments);
+	q_item->next = 1;
+	q_item->size = rpc_call_account_fragment_locked(call, q_item->item);
+
+	for (i = 1; i < count; i++) {
+		rpc_call_account_fragment_locked(call,
+		    rpc_array_get_value(fragments, i));
+	}
 
 	g_queue_push_tail(call->rc_queue, q_item);
 	notify_signal(&call->rc_notify);
+	for (i = 0; i < count; i++)
+		rpc_call_changed_locked(call, RPC_CALL_MORE_AVAILABLE);
 	g_mutex_unlock(&call->rc_mtx);
 	rpc_connection_call_release(call);
 }
@@ -570,6 +960,7 @@ static void
 on_rpc_continue(rpc_connection_t conn, rpc_object_t args, rpc_object_t id)
 {
 	struct rpc_call *call;
+	rpc_object_t bytes;
 	int64_t seqno = 0;
 	int64_t increment = 1;
 
@@ -577,6 +968,9 @@ on_rpc_continue(rpc_connection_t conn, rpc_object_t args, rpc_object_t id)
 	    "seqno", &seqno,
 	    "increment", &increment);
 
+	/* Peers that predate byte credits only ever send item increments */
+	bytes = rpc_dictionary_get_value(args, "bytes");
+
 	g_rw_lock_reader_lock(&conn->rco_icall_rwlock);
 	call = g_hash_table_lookup(conn->rco_inbound_calls,
 	    rpc_string_get_string_ptr(id));
@@ -591,22 +985,36 @@ on_rpc_continue(rpc_connection_t conn, rpc_object_t args, rpc_object_t id)
 	g_mutex_lock(&call->rc_mtx);
 	g_rw_lock_reader_unlock(&conn->rco_icall_rwlock);
 	call->rc_consumer_seqno += increment;
+	if (bytes != NULL) {
+		call->rc_byte_credit = true;
+		call->rc_credit_bytes += rpc_int64_get_value(bytes);
+	}
 	notify_signal(&call->rc_notify);
 	g_mutex_unlock(&call->rc_mtx);
 	rpc_connection_call_release(call);
 }
 
 static void
-on_rpc_end(rpc_connection_t conn, rpc_object_t args __unused, rpc_object_t id)
+on_rpc_upload(rpc_connection_t conn, rpc_object_t args, rpc_object_t id)
 {
-	struct queue_item *q_item;
-	rpc_call_t call;
+	struct rpc_call *call;
+	rpc_object_t payload;
+	const char *violation = NULL;
+	int64_t seqno = -1;
 
-	g_rw_lock_reader_lock(&conn->rco_call_rwlock);
-	call = g_hash_table_lookup(conn->rco_calls,
+	payload = rpc_dictionary_get_value(args, "fragment");
+	if (payload == NULL) {
+		debugf("Upload with no payload received on %p", conn);
+		return;
+	}
+
+	rpc_object_unpack(args, "{i}", "seqno", &seqno);
+
+	g_rw_lock_reader_lock(&conn->rco_icall_rwlock);
+	call = g_hash_table_lookup(conn->rco_inbound_calls,
 	    rpc_string_get_string_ptr(id));
 	if (call == NULL) {
-		g_rw_lock_reader_unlock(&conn->rco_call_rwlock);
+		g_rw_lock_reader_unlock(&conn->rco_icall_rwlock);
 		if (conn->rco_error_handler != NULL)
 			conn->rco_error_handler(RPC_SPURIOUS_RESPONSE, id);
 		return;
@@ -614,27 +1022,43 @@ on_rpc_end(rpc_connection_t conn, rpc_object_t args __unused, rpc_object_t id)
 
 	rpc_connection_call_retain(call);
 	g_mutex_lock(&call->rc_mtx);
-	if (cancel_timeout_locked(call) != 0) {
+	g_rw_lock_reader_unlock(&conn->rco_icall_rwlock);
+
+	if (!call->rc_upload || call->rc_upload_ended) {
 		g_mutex_unlock(&call->rc_mtx);
-		g_rw_lock_reader_unlock(&conn->rco_call_rwlock);
 		rpc_connection_call_release(call);
 		return;
 	}
 
-	g_rw_lock_reader_unlock(&conn->rco_call_rwlock);
-
-	q_item = g_malloc(sizeof(*q_item));
-	q_item->status = RPC_CALL_ENDED;
-	q_item->item = rpc_retain(args);
+	/*
+	 * The client may only send what it was granted, in order. Like on
+	 * the response side, one fragment may overshoot the byte window.
+	 */
+	if (seqno != call->rc_upload_received)
+		violation = "Upload fragment out of sequence";
+	else if (call->rc_upload_received >= call->rc_upload_credit ||
+	    call->rc_upload_received_bytes >= call->rc_upload_credit_bytes)
+		violation = "Upload window exceeded";
+
+	if (violation != NULL) {
+		call->rc_responded = true;
+		g_mutex_unlock(&call->rc_mtx);
+		rpc_connection_send_err(conn, id, EPROTO, violation);
+		rpc_abort_inbound_call(conn, call);
+		return;
+	}
 
-	g_queue_push_tail(call->rc_queue, q_item);
-	notify_signal(&call->rc_notify);
+	call->rc_upload_received++;
+	call->rc_upload_received_bytes += rpc_object_size_estimate(payload);
+	g_queue_push_tail(call->rc_upload_queue, rpc_retain(payload));
+	g_cond_broadcast(&call->rc_upload_cv);
 	g_mutex_unlock(&call->rc_mtx);
 	rpc_connection_call_release(call);
 }
 
 static void
-on_rpc_abort(rpc_connection_t conn, rpc_object_t args __unused, rpc_object_t id)
+on_rpc_upload_end(rpc_connection_t conn, rpc_object_t args __unused,
+    rpc_object_t id)
 {
 	struct rpc_call *call;
 
@@ -651,20 +1075,53 @@ on_rpc_abort(rpc_connection_t conn, rpc_object_t args __unused, rpc_object_t id)
 	rpc_connection_call_retain(call);
 	g_mutex_lock(&call->rc_mtx);
 	g_rw_lock_reader_unlock(&conn->rco_icall_rwlock);
-	call->rc_ended = true;
-	call->rc_aborted = true;
-	notify_signal(&call->rc_notify);
-	if (call->rc_abort_handler) {
-		/* call_abort_locked() will cause the call release */
-		call_abort_locked(call);
-	} else {
+	call->rc_upload_ended = true;
+	g_cond_broadcast(&call->rc_upload_cv);
+	g_mutex_unlock(&call->rc_mtx);
+	rpc_connection_call_release(call);
+}
+
+static void
+on_rpc_upload_continue(rpc_connection_t conn, rpc_object_t args,
+    rpc_object_t id)
+{
+	rpc_call_t call;
+	int64_t increment = 0;
+	int64_t bytes = 0;
+
+	rpc_object_unpack(args, "{i,i}",
+	    "increment", &increment,
+	    "bytes", &bytes);
+
+	g_rw_lock_reader_lock(&conn->rco_call_rwlock);
+	call = g_hash_table_lookup(conn->rco_calls,
+	    rpc_string_get_string_ptr(id));
+	if (call == NULL) {
+		g_rw_lock_reader_unlock(&conn->rco_call_rwlock);
+		return;
+	}
+
+	rpc_connection_call_retain(call);
+	g_mutex_lock(&call->rc_mtx);
+
+	/* The server is alive and reading, so the call can't time out */
+	if (cancel_timeout_locked(call) != 0) {
 		g_mutex_unlock(&call->rc_mtx);
+		g_rw_lock_reader_unlock(&conn->rco_call_rwlock);
 		rpc_connection_call_release(call);
+		return;
 	}
+
+	g_rw_lock_reader_unlock(&conn->rco_call_rwlock);
+	call->rc_upload_credit += increment;
+	call->rc_upload_credit_bytes += bytes;
+	g_cond_broadcast(&call->rc_upload_cv);
+	g_mutex_unlock(&call->rc_mtx);
+	rpc_connection_call_release(call);
 }
 
 static void
-on_rpc_error(rpc_connection_t conn, rpc_object_t args, rpc_object_t id)
+on_rpc_end(rpc_connection_t conn, rpc_object_t args __unused, rpc_object_t id)
 {
 	struct queue_item *q_item;
 	rpc_call_t call;
@@ -674,25 +1131,6 @@ on_rpc_error(rpc_connection_t conn, rpc_object_t args, rpc_object_t id)
 	    rpc_string_get_string_ptr(id));
 	if (call == NULL) {
 		g_rw_lock_reader_unlock(&conn->rco_call_rwlock);
-
-		// Support for older clients that do not support stream_start message
-		if (rpc_error_get_code(args) == ENXIO) {
-			g_rw_lock_reader_lock(&conn->rco_icall_rwlock);
-			call = g_hash_table_lookup(conn->rco_inbound_calls,
-			    rpc_string_get_string_ptr(id));
-			if (call != NULL) {
-				rpc_connection_call_retain(call);
-				g_mutex_lock(&call->rc_mtx);
-				g_rw_lock_reader_unlock(&conn->rco_icall_rwlock);
-				call->rc_consumer_seqno++;
-				notify_signal(&call->rc_notify);
-				g_mutex_unlock(&call->rc_mtx);
-				rpc_connection_call_release(call);
-				return;
-			}
-			g_rw_lock_reader_unlock(&conn->rco_icall_rwlock);
-		}
-
 		if (conn->rco_error_handler != NULL)
 			conn->rco_error_handler(RPC_SPURIOUS_RESPONSE, id);
 		return;
@@ -709,24 +1147,162 @@ on_rpc_error(rpc_connection_t conn, rpc_object_t args, rpc_object_t id)
 
 	g_rw_lock_reader_unlock(&conn->rco_call_rwlock);
 
-	q_item = g_malloc(sizeof(*q_item));
-	q_item->status = RPC_CALL_ERROR;
+	q_item = g_malloc0(sizeof(*q_item));
+	q_item->status = RPC_CALL_ENDED;
 	q_item->item = rpc_retain(args);
 
 	g_queue_push_tail(call->rc_queue, q_item);
 	notify_signal(&call->rc_notify);
+	rpc_call_changed_locked(call, RPC_CALL_ENDED);
 	g_mutex_unlock(&call->rc_mtx);
 	rpc_connection_call_release(call);
 }
 
 static void
-on_events_event(rpc_connection_t conn, rpc_object_t args,
-    rpc_object_t id __unused)
+on_rpc_abort(rpc_connection_t conn, rpc_object_t args __unused, rpc_object_t id)
 {
-	struct work_item *item;
-
-	if (args == NULL)
-		return;
+	struct rpc_call *call;
+	GHashTableIter iter;
+	GPtrArray *entries;
+	guint i;
+
+	g_rw_lock_reader_lock(&conn->rco_icall_rwlock);
+	call = g_hash_table_lookup(conn->rco_inbound_calls,
+	    rpc_string_get_string_ptr(id));
+	if (call != NULL) {
+		rpc_connection_call_retain(call);
+		g_rw_lock_reader_unlock(&conn->rco_icall_rwlock);
+		rpc_abort_inbound_call(conn, call);
+		return;
+	}
+
+	/*
+	 * Aborting a whole batch aborts every entry still running. Each
+	 * entry is registered under its own ID, so look them up by the
+	 * batch they belong to.
+	 */
+	entries = g_ptr_array_new();
+	g_hash_table_iter_init(&iter, conn->rco_inbound_calls);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&call)) {
+		if (call->rc_batch == NULL ||
+		    !rpc_equal(call->rc_batch->rcb_id, id))
+			continue;
+
+		rpc_connection_call_retain(call);
+		g_ptr_array_add(entries, call);
+	}
+
+	g_rw_lock_reader_unlock(&conn->rco_icall_rwlock);
+
+	if (entries->len == 0 && conn->rco_error_handler != NULL)
+		conn->rco_error_handler(RPC_SPURIOUS_RESPONSE, id);
+
+	for (i = 0; i < entries->len; i++)
+		rpc_abort_inbound_call(conn, g_ptr_array_index(entries, i));
+
+	g_ptr_array_free(entries, true);
+}
+
+/* Called with a reference on call, which gets dropped */
+static void
+rpc_abort_inbound_call(rpc_connection_t conn, struct rpc_call *call)
+{
+	bool queued;
+
+	/* Not admitted yet: just drop it, nothing has run */
+	g_mutex_lock(&conn->rco_inflight_mtx);
+	queued = g_queue_remove(&conn->rco_admit_queue, call);
+	if (queued)
+		conn->rco_inflight++;
+	g_mutex_unlock(&conn->rco_inflight_mtx);
+
+	if (queued) {
+		call->rc_aborted = true;
+		rpc_connection_close_inbound_call(call);
+		rpc_connection_call_release(call);
+		return;
+	}
+
+	g_mutex_lock(&call->rc_mtx);
+	call->rc_ended = true;
+	call->rc_aborted = true;
+	notify_signal(&call->rc_notify);
+	g_cond_broadcast(&call->rc_upload_cv);
+	if (call->rc_abort_handler) {
+		/* call_abort_locked() will cause the call release */
+		call_abort_locked(call);
+	} else {
+		g_mutex_unlock(&call->rc_mtx);
+		rpc_connection_call_release(call);
+	}
+}
+
+static void
+on_rpc_error(rpc_connection_t conn, rpc_object_t args, rpc_object_t id)
+{
+	struct queue_item *q_item;
+	rpc_call_t call;
+
+	g_rw_lock_reader_lock(&conn->rco_call_rwlock);
+	call = g_hash_table_lookup(conn->rco_calls,
+	    rpc_string_get_string_ptr(id));
+	if (call == NULL) {
+		g_rw_lock_reader_unlock(&conn->rco_call_rwlock);
+
+		// Support for older clients that do not support stream_start message
+		if (rpc_error_get_code(args) == ENXIO) {
+			g_rw_lock_reader_lock(&conn->rco_icall_rwlock);
+			call = g_hash_table_lookup(conn->rco_inbound_calls,
+			    rpc_string_get_string_ptr(id));
+			if (call != NULL) {
+				rpc_connection_call_retain(call);
+				g_mutex_lock(&call->rc_mtx);
+				g_rw_lock_reader_unlock(&conn->rco_icall_rwlock);
+				call->rc_consumer_seqno++;
+				notify_signal(&call->rc_notify);
+				g_mutex_unlock(&call->rc_mtx);
+				rpc_connection_call_release(call);
+				return;
+			}
+			g_rw_lock_reader_unlock(&conn->rco_icall_rwlock);
+		}
+
+		if (conn->rco_error_handler != NULL)
+			conn->rco_error_handler(RPC_SPURIOUS_RESPONSE, id);
+		return;
+	}
+
+	rpc_connection_call_retain(call);
+	g_mutex_lock(&call->rc_mtx);
+	if (cancel_timeout_locked(call) != 0) {
+		g_mutex_unlock(&call->rc_mtx);
+		g_rw_lock_reader_unlock(&conn->rco_call_rwlock);
+		rpc_connection_call_release(call);
+		return;
+	}
+
+	g_rw_lock_reader_unlock(&conn->rco_call_rwlock);
+
+	q_item = g_malloc0(sizeof(*q_item));
+	q_item->status = RPC_CALL_ERROR;
+	q_item->item = rpc_retain(args);
+
+	g_queue_push_tail(call->rc_queue, q_item);
+	notify_signal(&call->rc_notify);
+	rpc_call_changed_locked(call, RPC_CALL_ERROR);
+	g_cond_broadcast(&call->rc_upload_cv);
+	g_mutex_unlock(&call->rc_mtx);
+	rpc_connection_call_release(call);
+}
+
+static void
+on_events_event(rpc_connection_t conn, rpc_object_t args,
+    rpc_object_t id __unused)
+{
+	struct work_item *item;
+
+	if (args == NULL)
+		return;
 
 	rpc_retain(args);
 	item = g_malloc0(sizeof(*item));
@@ -744,6 +1320,7 @@ on_events_event_burst(rpc_connection_t conn, rpc_object_t args,
 
 		rpc_retain(value);
 		item = g_malloc0(sizeof(*item));
+		item->event = value;
 		rpc_run_callback(conn, item);
 		return ((bool)true);
 	});
@@ -768,32 +1345,29 @@ on_events_subscribe(rpc_connection_t conn, rpc_object_t args,
 		    "path", &path) <1)
 	    		return ((bool)true);
 
+		/* Clients reject these already; don't index them */
+		if (!rpc_sub_index_path_valid(path))
+			return ((bool)true);
+
 		g_rw_lock_writer_lock(&conn->rco_subscription_rwlock);
-		if (conn->rco_subscriptions->len > 0)
-			sub = rpc_connection_find_subscription(conn, path,
-			    interface, name);
+		sub = rpc_connection_find_subscription(conn, path, interface,
+		    name);
 		if (sub == NULL) {
 			sub = g_malloc0(sizeof(*sub));
 			sub->rsu_path = g_strdup(path);
 			sub->rsu_interface = g_strdup(interface);
 			sub->rsu_name = g_strdup(name);
 			g_ptr_array_add(conn->rco_subscriptions, sub);
-		}
+			rpc_sub_index_insert(conn->rco_sub_index, interface,
+			    name, path, sub);
 
-		sub->rsu_refcount++;
-		if (conn->rco_subscriptions->len == 1) {
 			/* just added, add conn to context */
-			g_rw_lock_writer_unlock(&conn->rco_subscription_rwlock);
-			g_rw_lock_writer_lock(
-			    &conn->rco_rpc_context->rcx_rwlock);
-			g_hash_table_insert(
-			    conn->rco_rpc_context->rcx_event_watchers, conn, conn);
-			g_rw_lock_writer_unlock(
-			    &conn->rco_rpc_context->rcx_rwlock);
-		} else {
-			g_rw_lock_writer_unlock(&conn->rco_subscription_rwlock);
+			rpc_context_watch_event(conn->rco_rpc_context, conn,
+			    path, interface, name);
 		}
 
+		sub->rsu_refcount++;
+		g_rw_lock_writer_unlock(&conn->rco_subscription_rwlock);
 		return ((bool)true);
 	});
 }
@@ -846,16 +1420,11 @@ on_events_unsubscribe(rpc_connection_t conn, rpc_object_t args,
 
 		sub->rsu_refcount--;
 		if (sub->rsu_refcount == 0) {
+			rpc_context_unwatch_event(conn->rco_rpc_context, conn,
+			    path, interface, name);
+			rpc_sub_index_remove(conn->rco_sub_index, interface,
+			    name, path);
 			g_ptr_array_remove(conn->rco_subscriptions, sub);
-			if (conn->rco_subscriptions->len == 0) {
-				g_rw_lock_writer_unlock(&conn->rco_subscription_rwlock);
-				g_rw_lock_writer_lock(&conn->rco_rpc_context->rcx_rwlock);
-				g_assert(g_hash_table_remove(
-				    conn->rco_rpc_context->rcx_event_watchers,
-				    conn));
-				g_rw_lock_writer_unlock(&conn->rco_rpc_context->rcx_rwlock);
-				return ((bool)true);
-			}
 		}
 		g_rw_lock_writer_unlock(&conn->rco_subscription_rwlock);
 		return ((bool)true);
@@ -978,10 +1547,13 @@ static int
 rpc_close(rpc_connection_t conn)
 {
 	GHashTableIter iter;
+	struct rpc_subscription *sub;
 	struct rpc_call *call;
 	struct queue_item *q_item;
 	char *key;
 	GError *err = NULL;
+	GQueue admit;
+	bool queued;
 
 	g_mutex_lock(&conn->rco_mtx);
 
@@ -1016,13 +1588,22 @@ rpc_close(rpc_connection_t conn)
 		g_mutex_lock(&call->rc_mtx);
 		call->rc_aborted = true;
 		notify_signal(&call->rc_notify);
+		g_cond_broadcast(&call->rc_upload_cv);
 
 		if (call->rc_abort_handler) {
 			rpc_connection_call_retain(call);
 			g_mutex_unlock(&call->rc_mtx);
-			g_thread_pool_push(conn->rco_callback_pool, call, &err);
-			if (err != NULL) {
-				g_error_free(err);
+			if (conn->rco_runtime != NULL)
+				queued = rpc_runtime_run(conn->rco_runtime,
+				    rpc_abort_worker, call, conn) == 0;
+			else {
+				g_thread_pool_push(conn->rco_callback_pool,
+				    call, &err);
+				queued = err == NULL;
+				g_clear_error(&err);
+			}
+
+			if (!queued) {
 				Block_release(call->rc_abort_handler);
 				call->rc_abort_handler = NULL;
 				rpc_connection_call_release(call);
@@ -1042,18 +1623,53 @@ rpc_close(rpc_connection_t conn)
 			continue;
 		}
 
-		q_item = g_malloc(sizeof(*q_item));
+		q_item = g_malloc0(sizeof(*q_item));
 		q_item->status = RPC_CALL_ERROR;
 		q_item->item = rpc_error_create(ECONNABORTED,
 		    "Connection closed", NULL);
 
 		g_queue_push_tail(call->rc_queue, q_item);
 		notify_signal(&call->rc_notify);
+		rpc_call_changed_locked(call, RPC_CALL_ERROR);
+		g_cond_broadcast(&call->rc_upload_cv);
 		g_mutex_unlock(&call->rc_mtx);
 	}
 
 	g_rw_lock_reader_unlock(&conn->rco_call_rwlock);
 
+	/* Stop the context from routing events to this connection */
+	if (conn->rco_server != NULL && conn->rco_rpc_context != NULL) {
+		g_rw_lock_reader_lock(&conn->rco_subscription_rwlock);
+		for (guint i = 0; i < conn->rco_subscriptions->len; i++) {
+			sub = g_ptr_array_index(conn->rco_subscriptions, i);
+			rpc_context_unwatch_event(conn->rco_rpc_context, conn,
+			    sub->rsu_path, sub->rsu_interface, sub->rsu_name);
+		}
+		g_rw_lock_reader_unlock(&conn->rco_subscription_rwlock);
+	}
+
+	/* Disarm the event window; pending events go away with the conn */
+	g_mutex_lock(&conn->rco_event_mtx);
+	if (conn->rco_event_flush != NULL) {
+		g_source_destroy(conn->rco_event_flush);
+		g_source_unref(conn->rco_event_flush);
+		conn->rco_event_flush = NULL;
+	}
+	g_mutex_unlock(&conn->rco_event_mtx);
+
+	/* Cached property values can't be kept coherent anymore */
+	prop_cache_invalidate(conn, NULL);
+
+	/* Calls still waiting for admission are never going to run */
+	g_mutex_lock(&conn->rco_inflight_mtx);
+	admit = conn->rco_admit_queue;
+	g_queue_init(&conn->rco_admit_queue);
+	conn->rco_inflight += admit.length;
+	g_mutex_unlock(&conn->rco_inflight_mtx);
+
+	while ((call = g_queue_pop_head(&admit)) != NULL)
+		rpc_connection_close_inbound_call(call);
+
 	if ((g_atomic_int_get(&conn->rco_state) & CONNECTION_CLOSED) != 0)
 		rpc_connection_do_close(conn, RPC_ABORTED);
 	rpc_connection_release(conn);
@@ -1105,6 +1721,9 @@ rpc_call_alloc(rpc_connection_t conn, rpc_object_t id, const char *path,
 	call->rc_id = id != NULL ? id : rpc_new_id();
 	g_mutex_init(&call->rc_mtx);
 	g_mutex_init(&call->rc_ref_mtx);
+	g_mutex_init(&call->rc_frag_mtx);
+	g_cond_init(&call->rc_upload_cv);
+	g_cond_init(&call->rc_sync_cv);
 	notify_init(&call->rc_notify);
 
 	return (call);
@@ -1155,25 +1774,21 @@ static struct rpc_subscription *
 rpc_connection_find_subscription(rpc_connection_t conn, const char *path,
     const char *interface, const char *name)
 {
-	struct rpc_subscription *result;
-	guint i;
-
-	for (i = 0; i < conn->rco_subscriptions->len; i++) {
-		result = g_ptr_array_index(conn->rco_subscriptions, i);
-
-		if (g_strcmp0(result->rsu_path, path) != 0)
-			continue;
-
-		if (g_strcmp0(result->rsu_interface, interface) != 0)
-			continue;
 
-		if (g_strcmp0(result->rsu_name, name) != 0)
-			continue;
+	return (rpc_sub_index_lookup(conn->rco_sub_index, interface, name,
+	    path));
+}
 
-		return (result);
-	}
+static bool
+rpc_connection_match_subscription(rpc_connection_t conn, const char *path,
+    const char *interface, const char *name)
+{
 
-	return (NULL);
+	/* Any subscription, including wildcard ones, covering the event */
+	return (!rpc_sub_index_match(conn->rco_sub_index, interface, name,
+	    path, ^(gpointer value __unused) {
+		return ((bool)false);
+	}));
 }
 
 void
@@ -1216,7 +1831,6 @@ rpc_call_wait_locked(rpc_call_t call)
 static gboolean
 rpc_call_timeout(gpointer user_data)
 {
-	struct queue_item *q_item;
 	rpc_call_t call = user_data;
 
 	if (g_source_is_destroyed(g_main_current_source()))
@@ -1232,12 +1846,7 @@ rpc_call_timeout(gpointer user_data)
 		return false;
 	}
 
-	q_item = g_malloc(sizeof(*q_item));
-	q_item->status = RPC_CALL_ERROR;
-	q_item->item = rpc_error_create(ETIMEDOUT, "Call timed out", NULL);
-
-	g_queue_push_tail(call->rc_queue, q_item);
-	notify_signal(&call->rc_notify);
+	rpc_call_expire_locked(call);
 	g_mutex_unlock(&call->rc_mtx);
 
 	return (false);
@@ -1293,6 +1902,20 @@ rpc_connection_send_fragment(rpc_connection_t conn, rpc_object_t id,
 	rpc_send_frame(conn, frame);
 }
 
+void
+rpc_connection_send_fragment_batch(rpc_connection_t conn, rpc_object_t id,
+    int64_t seqno, rpc_object_t fragments)
+{
+	rpc_object_t frame;
+	rpc_object_t args;
+
+	args = rpc_dictionary_create();
+	rpc_dictionary_set_int64(args, "seqno", seqno);
+	rpc_dictionary_steal_value(args, "fragments", fragments);
+	frame = rpc_pack_frame("rpc", "fragment_batch", id, args);
+	rpc_send_frame(conn, frame);
+}
+
 void
 rpc_connection_send_end(rpc_connection_t conn, rpc_object_t id, int64_t seqno)
 {
@@ -1305,6 +1928,20 @@ rpc_connection_send_end(rpc_connection_t conn, rpc_object_t id, int64_t seqno)
 	rpc_send_frame(conn, frame);
 }
 
+int
+rpc_connection_send_upload_continue(rpc_connection_t conn, rpc_object_t id,
+    int64_t increment, int64_t bytes)
+{
+	rpc_object_t frame;
+
+	frame = rpc_pack_frame("rpc", "upload_continue", id, rpc_object_pack(
+	    "{i,i}",
+	    "increment", increment,
+	    "bytes", bytes));
+
+	return (rpc_send_frame(conn, frame));
+}
+
 int
 rpc_connection_call_retain(struct rpc_call *call)
 {
@@ -1350,16 +1987,29 @@ rpc_connection_call_release(struct rpc_call *call)
 	rpc_release(call->rc_err);
 	rpc_release(call->rc_id);
 	rpc_release(call->rc_args);
+	rpc_release(call->rc_frag_pending);
+	if (call->rc_cq != NULL)
+		rpc_cq_release(call->rc_cq);
 	g_free(call->rc_path);
 	g_free(call->rc_interface);
 	g_free(call->rc_method_name);
 	notify_free(&call->rc_notify);
 	g_mutex_clear(&call->rc_mtx);
 	g_mutex_clear(&call->rc_ref_mtx);
+	g_mutex_clear(&call->rc_frag_mtx);
+	g_cond_clear(&call->rc_upload_cv);
+	g_cond_clear(&call->rc_sync_cv);
 
 	if (call->rc_queue != NULL)
 		g_queue_free(call->rc_queue);
 
+	if (call->rc_upload_queue != NULL) {
+		while (!g_queue_is_empty(call->rc_upload_queue))
+			rpc_release(g_queue_pop_head(call->rc_upload_queue));
+
+		g_queue_free(call->rc_upload_queue);
+	}
+
 	rpc_connection_release(call->rc_conn); /*drop the call's ref */
 	g_free(call);
 	return (0);
@@ -1369,6 +2019,7 @@ void
 rpc_connection_close_inbound_call(struct rpc_call *call)
 {
 	rpc_connection_t conn = call->rc_conn;
+	struct rpc_call *next;
 
 	rpc_connection_retain(conn);
 
@@ -1383,10 +2034,42 @@ rpc_connection_close_inbound_call(struct rpc_call *call)
 
 	g_rw_lock_writer_unlock(&conn->rco_icall_rwlock);
 
+	g_mutex_lock(&conn->rco_inflight_mtx);
+	conn->rco_inflight--;
+	next = rpc_connection_admit_next(conn);
+	g_mutex_unlock(&conn->rco_inflight_mtx);
+
+	if (call->rc_admitted)
+		rpc_context_call_done(conn->rco_rpc_context, call);
+
+	if (call->rc_batch != NULL)
+		rpc_call_batch_release(call->rc_batch);
+
 	rpc_connection_call_release(call);
+
+	if (next != NULL)
+		rpc_run_inbound_call(conn, next);
+
 	rpc_connection_release(conn);
 }
 
+/* called with rco_inflight_mtx held */
+static struct rpc_call *
+rpc_connection_admit_next(rpc_connection_t conn)
+{
+	struct rpc_call *call;
+
+	if (conn->rco_max_inflight > 0 &&
+	    conn->rco_inflight >= conn->rco_max_inflight)
+		return (NULL);
+
+	call = g_queue_pop_head(&conn->rco_admit_queue);
+	if (call != NULL)
+		conn->rco_inflight++;
+
+	return (call);
+}
+
 static rpc_object_t
 rpc_new_id(void)
 {
@@ -1424,11 +2107,24 @@ rpc_connection_init(int flags)
 	g_rw_lock_init(&conn->rco_subscription_rwlock);
 	g_rw_lock_init(&conn->rco_call_rwlock);
 	g_rw_lock_init(&conn->rco_icall_rwlock);
+	g_mutex_init(&conn->rco_inflight_mtx);
+	g_queue_init(&conn->rco_admit_queue);
+	conn->rco_max_queued = DEFAULT_MAX_QUEUED;
+	g_mutex_init(&conn->rco_method_cache_mtx);
+	g_queue_init(&conn->rco_method_lru);
+	g_mutex_init(&conn->rco_event_mtx);
+	g_mutex_init(&conn->rco_cq_mtx);
+	g_mutex_init(&conn->rco_prop_cache_mtx);
 
 	conn->rco_calls = g_hash_table_new(g_str_hash, g_str_equal);
 	conn->rco_inbound_calls = g_hash_table_new(g_str_hash, g_str_equal);
 	conn->rco_subscriptions = g_ptr_array_new_with_free_func((GDestroyNotify)rpc_subscription_release);
+	conn->rco_sub_index = rpc_sub_index_new(NULL);
 	conn->rco_rpc_timeout = DEFAULT_RPC_TIMEOUT;
+	conn->rco_sched_queue = g_queue_new();
+	conn->rco_event_queue = g_queue_new();
+	conn->rco_method_cache = rpc_method_cache_new();
+	conn->rco_weight = DEFAULT_CONNECTION_WEIGHT;
 	conn->rco_recv_msg = rpc_recv_msg;
 	conn->rco_close = rpc_close;
 
@@ -1501,9 +2197,13 @@ rpc_connection_create(void *cookie, rpc_object_t params)
 	conn->rco_params = params;
 	conn->rco_uri = client->rci_uri;
 	conn->rco_main_context = rpc_client_get_main_context(client);
+	conn->rco_runtime = client->rci_runtime;
 
-	conn->rco_callback_pool = g_thread_pool_new(&rpc_callback_worker, conn,
-	    g_get_num_processors(), false, &err);
+	/* Runtime clients share the runtime's callback pool */
+	if (conn->rco_runtime == NULL)
+		conn->rco_callback_pool = g_thread_pool_new(
+		    &rpc_callback_worker, conn, g_get_num_processors(), false,
+		    &err);
 	rpc_connection_set_default_fn_handlers(conn);
 
 	if (err != NULL) {
@@ -1550,15 +2250,35 @@ int rpc_connection_get_subscription_count(rpc_connection_t conn)
 	    rpc_connection_is_open(conn) ? conn->rco_subscriptions->len : -1);
 }
 
+guint
+rpc_connection_get_load(rpc_connection_t conn)
+{
+	guint ret;
+
+	g_rw_lock_reader_lock(&conn->rco_call_rwlock);
+	ret = g_hash_table_size(conn->rco_calls);
+	g_rw_lock_reader_unlock(&conn->rco_call_rwlock);
+	return (ret);
+}
+
 static void
 rpc_connection_free_resources(rpc_connection_t conn)
 {
+	GHashTableIter iter;
+	struct prop_cache_entry *entry;
 
 	g_assert_cmpint(g_hash_table_size(conn->rco_calls), ==, 0);
 	g_assert_cmpint(g_hash_table_size(conn->rco_inbound_calls), ==, 0);
 	g_hash_table_destroy(conn->rco_calls);
 	g_hash_table_destroy(conn->rco_inbound_calls);
-
+	g_assert(g_queue_is_empty(conn->rco_sched_queue));
+	g_queue_free(conn->rco_sched_queue);
+	g_queue_free_full(conn->rco_event_queue,
+	    (GDestroyNotify)rpc_shared_frame_release);
+	g_queue_clear(&conn->rco_method_lru);
+	g_hash_table_destroy(conn->rco_method_cache);
+
+	rpc_sub_index_free(conn->rco_sub_index);
 	if (conn->rco_subscriptions != NULL)
 		g_ptr_array_free(conn->rco_subscriptions, true);
 
@@ -1568,10 +2288,26 @@ rpc_connection_free_resources(rpc_connection_t conn)
 	}
 
 	rpc_release(conn->rco_error);
+	rpc_release(conn->rco_event_burst);
+	if (conn->rco_cq != NULL)
+		rpc_cq_release(conn->rco_cq);
+	if (conn->rco_prop_cache != NULL) {
+		/* No callbacks can run anymore; watch keys are free to go */
+		g_hash_table_iter_init(&iter, conn->rco_prop_cache);
+		while (g_hash_table_iter_next(&iter, NULL, (gpointer)&entry))
+			prop_cache_entry_free(entry);
+
+		g_hash_table_destroy(conn->rco_prop_cache);
+	}
 	g_free(conn->rco_endpoint_address);
 	g_rw_lock_clear(&conn->rco_call_rwlock);
 	g_rw_lock_clear(&conn->rco_icall_rwlock);
 	g_rw_lock_clear(&conn->rco_subscription_rwlock);
+	g_mutex_clear(&conn->rco_inflight_mtx);
+	g_mutex_clear(&conn->rco_method_cache_mtx);
+	g_mutex_clear(&conn->rco_event_mtx);
+	g_mutex_clear(&conn->rco_cq_mtx);
+	g_mutex_clear(&conn->rco_prop_cache_mtx);
 }
 
 int
@@ -1831,6 +2567,8 @@ rpc_connection_subscribe_event_locked(rpc_connection_t conn, const char *path,
 		}
 		sub->rsu_refcount = 1;
 		g_ptr_array_add(conn->rco_subscriptions, sub);
+		rpc_sub_index_insert(conn->rco_sub_index, interface, name,
+		    path, sub);
 	} else {
 		if (!check_busy || !sub->rsu_busy)
 			sub->rsu_refcount++;
@@ -1844,6 +2582,12 @@ rpc_connection_subscribe_event(rpc_connection_t conn, const char *path,
 {
 	struct rpc_subscription *sub;
 
+	if (!rpc_sub_index_path_valid(path)) {
+		rpc_set_last_error(EINVAL,
+		    "\"**\" must be the last path component", NULL);
+		return (-1);
+	}
+
 	if (rpc_connection_retain_if_valid(conn, true) != 0) {
 		rpc_set_last_error(ECONNRESET, "Connection closed", NULL);
 		return (-1);
@@ -1909,6 +2653,8 @@ rpc_connection_unsubscribe_event_locked(rpc_connection_t conn,
 	frame = rpc_pack_frame("events", "unsubscribe", NULL, args);
 	ret = rpc_send_frame(conn, frame);
 
+	rpc_sub_index_remove(conn->rco_sub_index, sub->rsu_interface,
+	    sub->rsu_name, sub->rsu_path);
 	g_ptr_array_remove(conn->rco_subscriptions, sub);
 
 	return (ret);
@@ -1942,6 +2688,12 @@ rpc_connection_register_event_handler(rpc_connection_t conn, const char *path,
 	struct rpc_subscription *sub;
 	struct rpc_subscription_handler *rsh = NULL;
 
+	if (!rpc_sub_index_path_valid(path)) {
+		rpc_set_last_error(EINVAL,
+		    "\"**\" must be the last path component", NULL);
+		return (NULL);
+	}
+
 	if (rpc_connection_retain_if_valid(conn, true) != 0) {
 		rpc_set_last_error(ECONNRESET, "Connection closed", NULL);
 		return (NULL);
@@ -2019,10 +2771,12 @@ rpc_connection_call_syncv(rpc_connection_t conn, const char *path,
 		rpc_array_append_stolen_value(args, i);
 	}
 
-	if ((call = rpc_connection_call(conn, path, interface, method, args, NULL)) == NULL)
+	call = rpc_connection_call_impl(conn, path, interface, method, args,
+	    NULL, true);
+	if (call == NULL)
 		return (NULL);
 
-	rpc_call_wait(call);
+	rpc_call_wait_sync(call);
 	result = rpc_call_result_save(call);
 	rpc_call_free(call);
 	return (result);
@@ -2065,12 +2819,13 @@ rpc_object_t rpc_connection_call_syncpv(rpc_connection_t conn,
 	rpc_object_t result;
 
 	args = rpc_object_vpack(fmt, ap);
-	call = rpc_connection_call(conn, path, interface, method, args, NULL);
+	call = rpc_connection_call_impl(conn, path, interface, method, args,
+	    NULL, true);
 
 	if (call == NULL)
 		return (NULL);
 
-	rpc_call_wait(call);
+	rpc_call_wait_sync(call);
 	result = rpc_call_result_save(call);
 	rpc_call_free(call);
 	return (result);
@@ -2095,15 +2850,24 @@ rpc_connection_call(rpc_connection_t conn, const char *path,
     const char *interface, const char *name, rpc_object_t args,
     rpc_callback_t callback)
 {
+
+	return (rpc_connection_call_impl(conn, path, interface, name, args,
+	    callback, false));
+}
+
+static rpc_call_t
+rpc_connection_call_impl(rpc_connection_t conn, const char *path,
+    const char *interface, const char *name, rpc_object_t args,
+    rpc_callback_t callback, bool sync)
+{
 	struct rpc_call *call;
 	rpc_object_t payload;
-	rpc_object_t frame;
 
 	call = rpc_call_alloc(conn, NULL, path, interface, name, args);
 	if (call == NULL)
 		return (NULL);
 
-	call->rc_type = RPC_OUTBOUND_CALL;
+	call->rc_sync = sync;
 	call->rc_callback = callback != NULL ? Block_copy(callback) : NULL;
 	payload = rpc_dictionary_create();
 
@@ -2115,46 +2879,376 @@ rpc_connection_call(rpc_connection_t conn, const char *path,
 
 	rpc_dictionary_set_string(payload, "method", name);
 	rpc_dictionary_set_value(payload, "args", call->rc_args);
-	frame = rpc_pack_frame("rpc", "call", call->rc_id, payload);
-
-	g_mutex_lock(&call->rc_mtx);
-	g_rw_lock_writer_lock(&conn->rco_call_rwlock);
-	g_hash_table_insert(conn->rco_calls,
-	    (gpointer)rpc_string_get_string_ptr(call->rc_id), call);
-	g_rw_lock_writer_unlock(&conn->rco_call_rwlock);
+	return (rpc_connection_send_call(conn, call, "call", payload));
+}
 
-	call->rc_timeout = g_timeout_source_new_seconds(conn->rco_rpc_timeout);
-	g_source_set_callback(call->rc_timeout, &rpc_call_timeout, call, NULL);
-	g_source_attach(call->rc_timeout, conn->rco_main_context);
-	g_mutex_unlock(&call->rc_mtx);
+rpc_call_t
+rpc_connection_call_stream(rpc_connection_t conn, const char *path,
+    const char *interface, const char *name, rpc_object_t args)
+{
+	struct rpc_call *call;
+	rpc_object_t payload;
 
-	if (rpc_send_frame(conn, frame) != 0) {
-		rpc_call_free(call);
+	call = rpc_call_alloc(conn, NULL, path, interface, name, args);
+	if (call == NULL)
 		return (NULL);
-	}
 
-	return (call);
-}
+	call->rc_upload = true;
+	payload = rpc_dictionary_create();
 
-rpc_object_t
-rpc_connection_get_property(rpc_connection_t conn, const char *path,
-    const char *interface, const char *name)
-{
+	if (path != NULL)
+		rpc_dictionary_set_string(payload, "path", path);
 
-	return (rpc_connection_call_syncp(conn, path, RPC_OBSERVABLE_INTERFACE,
-	    "get", "[s,s]", interface, name));
-}
+	if (interface != NULL)
+		rpc_dictionary_set_string(payload, "interface", interface);
 
+	rpc_dictionary_set_string(payload, "method", name);
+	rpc_dictionary_set_value(payload, "args", call->rc_args);
+	rpc_dictionary_set_bool(payload, "stream", true);
+	return (rpc_connection_send_call(conn, call, "call", payload));
+}
 
-rpc_object_t
-rpc_connection_set_property(rpc_connection_t conn, const char *path,
-    const char *interface, const char *name, rpc_object_t value)
+rpc_call_t
+rpc_connection_call_batch(rpc_connection_t conn, rpc_object_t calls,
+    rpc_callback_t callback)
 {
+	struct rpc_call *call;
+	rpc_object_t payload;
+
+	if (rpc_get_type(calls) != RPC_TYPE_ARRAY) {
+		rpc_set_last_error(EINVAL, "Batch calls must be an array",
+		    NULL);
+		return (NULL);
+	}
+
+	call = rpc_call_alloc(conn, NULL, NULL, NULL, "call_batch", NULL);
+	if (call == NULL)
+		return (NULL);
+
+	call->rc_callback = callback != NULL ? Block_copy(callback) : NULL;
+	payload = rpc_dictionary_create();
+	rpc_dictionary_set_value(payload, "calls", calls);
+	return (rpc_connection_send_call(conn, call, "call_batch", payload));
+}
+
+static rpc_call_t
+rpc_connection_send_call(rpc_connection_t conn, struct rpc_call *call,
+    const char *name, rpc_object_t payload)
+{
+	rpc_object_t frame;
+	int64_t budget;
+	int64_t deadline;
+
+	/*
+	 * A call made from within a method handler can't outlive
+	 * the deadline of the call being handled.
+	 */
+	budget = (int64_t)conn->rco_rpc_timeout * 1000;
+	deadline = rpc_context_current_deadline();
+	if (deadline != 0) {
+		budget = MIN(budget,
+		    MAX(deadline - g_get_monotonic_time(), 0) / 1000);
+	}
+
+	call->rc_type = RPC_OUTBOUND_CALL;
+	rpc_dictionary_set_int64(payload, "timeout", budget);
+
+	g_mutex_lock(&conn->rco_cq_mtx);
+	if (conn->rco_cq != NULL && call->rc_callback == NULL &&
+	    !call->rc_sync)
+		call->rc_cq = rpc_cq_retain(conn->rco_cq);
+	g_mutex_unlock(&conn->rco_cq_mtx);
+
+	frame = rpc_pack_frame("rpc", name, call->rc_id, payload);
+
+	g_mutex_lock(&call->rc_mtx);
+	g_rw_lock_writer_lock(&conn->rco_call_rwlock);
+	g_hash_table_insert(conn->rco_calls,
+	    (gpointer)rpc_string_get_string_ptr(call->rc_id), call);
+	g_rw_lock_writer_unlock(&conn->rco_call_rwlock);
+
+	if (call->rc_sync) {
+		/* The waiting thread enforces the deadline itself */
+		call->rc_deadline = g_get_monotonic_time() + budget * 1000;
+		g_mutex_unlock(&call->rc_mtx);
+		goto send;
+	}
+
+	if (deadline != 0)
+		call->rc_timeout = g_timeout_source_new((guint)budget);
+	else {
+		call->rc_timeout = g_timeout_source_new_seconds(
+		    conn->rco_rpc_timeout);
+	}
+	g_source_set_callback(call->rc_timeout, &rpc_call_timeout, call, NULL);
+	g_source_attach(call->rc_timeout, conn->rco_main_context);
+	g_mutex_unlock(&call->rc_mtx);
+
+send:
+	if (rpc_send_frame(conn, frame) != 0) {
+		rpc_call_free(call);
+		return (NULL);
+	}
+
+	return (call);
+}
+
+static void
+prop_cache_entry_free(struct prop_cache_entry *entry)
+{
+
+	rpc_release(entry->value);
+	g_free(entry->watch_key);
+	g_free(entry->key);
+	g_free(entry);
+}
+
+static void
+prop_cache_update(rpc_connection_t conn, const char *key, rpc_object_t value)
+{
+	struct prop_cache_entry *entry = NULL;
+
+	g_mutex_lock(&conn->rco_prop_cache_mtx);
+	if (conn->rco_prop_cache != NULL)
+		entry = g_hash_table_lookup(conn->rco_prop_cache, key);
+
+	if (entry != NULL) {
+		rpc_release(entry->value);
+		entry->value = rpc_retain(value);
+		entry->updated = g_get_monotonic_time();
+		entry->valid = true;
+		entry->version++;
+	}
+	g_mutex_unlock(&conn->rco_prop_cache_mtx);
+}
+
+static void
+prop_cache_invalidate(rpc_connection_t conn, const char *key)
+{
+	GHashTableIter iter;
+	struct prop_cache_entry *entry;
+
+	g_mutex_lock(&conn->rco_prop_cache_mtx);
+	if (conn->rco_prop_cache == NULL) {
+		g_mutex_unlock(&conn->rco_prop_cache_mtx);
+		return;
+	}
+
+	if (key != NULL) {
+		entry = g_hash_table_lookup(conn->rco_prop_cache, key);
+		if (entry != NULL) {
+			entry->valid = false;
+			entry->version++;
+		}
+	} else {
+		g_hash_table_iter_init(&iter, conn->rco_prop_cache);
+		while (g_hash_table_iter_next(&iter, NULL, (gpointer)&entry)) {
+			entry->valid = false;
+			entry->version++;
+		}
+	}
+	g_mutex_unlock(&conn->rco_prop_cache_mtx);
+}
+
+/*
+ * Drops a cache watch. A handler being dispatched right now keeps it
+ * busy, so retry like rpc_proxy_free() does. Returns -1 if the handler
+ * is still registered, in which case its key must be left alone.
+ */
+static int
+prop_cache_unwatch(rpc_connection_t conn, void *watch)
+{
+	rpc_object_t error;
+
+	for (;;) {
+		if (rpc_connection_unregister_event_handler(conn, watch) == 0)
+			return (0);
+
+		error = rpc_get_last_error();
+		if (error == NULL || rpc_error_get_code(error) != EBUSY)
+			return (-1);
+
+		g_usleep(PROP_CACHE_UNWATCH_RETRY);
+	}
+}
+
+static int
+prop_cache_watch(rpc_connection_t conn, const char *key, const char *path,
+    const char *interface, const char *name)
+{
+	struct prop_cache_entry *entry = NULL;
+	char *watch_key;
+	void *watch;
+
+	watch_key = g_strdup(key);
+	watch = rpc_connection_watch_property(conn, path, interface, name,
+	    ^(rpc_object_t value) {
+		prop_cache_update(conn, watch_key, value);
+	    });
+
+	g_mutex_lock(&conn->rco_prop_cache_mtx);
+	if (conn->rco_prop_cache != NULL)
+		entry = g_hash_table_lookup(conn->rco_prop_cache, key);
+
+	if (watch == NULL) {
+		/* Nothing would keep the entry up to date, so drop it */
+		if (entry != NULL && entry->watch == NULL) {
+			g_hash_table_remove(conn->rco_prop_cache, key);
+			prop_cache_entry_free(entry);
+		}
+
+		g_mutex_unlock(&conn->rco_prop_cache_mtx);
+		g_free(watch_key);
+		return (-1);
+	}
+
+	if (entry != NULL && entry->watch == NULL) {
+		entry->watch = watch;
+		entry->watch_key = watch_key;
+		g_mutex_unlock(&conn->rco_prop_cache_mtx);
+		return (0);
+	}
+	g_mutex_unlock(&conn->rco_prop_cache_mtx);
+
+	/* The entry went away in the meantime */
+	if (prop_cache_unwatch(conn, watch) == 0)
+		g_free(watch_key);
+
+	return (0);
+}
+
+rpc_object_t
+rpc_connection_get_property(rpc_connection_t conn, const char *path,
+    const char *interface, const char *name)
+{
+	struct prop_cache_entry *entry;
+	rpc_object_t result;
+	uint64_t version;
+	uint64_t max_age;
+	char *key;
+	bool watch = false;
+
+	if (path == NULL || interface == NULL)
+		goto uncached;
+
+	key = g_strjoin("\x1f", path, interface, name, NULL);
+
+	g_mutex_lock(&conn->rco_prop_cache_mtx);
+	if (conn->rco_prop_cache == NULL) {
+		g_mutex_unlock(&conn->rco_prop_cache_mtx);
+		g_free(key);
+		goto uncached;
+	}
+
+	max_age = conn->rco_prop_cache_max_age;
+	entry = g_hash_table_lookup(conn->rco_prop_cache, key);
+	if (entry != NULL && entry->valid && (max_age == 0 ||
+	    g_get_monotonic_time() - entry->updated < (int64_t)max_age)) {
+		result = rpc_retain(entry->value);
+		g_mutex_unlock(&conn->rco_prop_cache_mtx);
+		g_free(key);
+		return (result);
+	}
+
+	if (entry == NULL) {
+		entry = g_malloc0(sizeof(*entry));
+		entry->key = g_strdup(key);
+		g_hash_table_insert(conn->rco_prop_cache, entry->key, entry);
+		watch = true;
+	}
+
+	version = entry->version;
+	g_mutex_unlock(&conn->rco_prop_cache_mtx);
+
+	/*
+	 * Subscribe before reading, so that a change racing with the
+	 * read is not lost. A change that lands first bumps the version
+	 * and wins over the (older) read result.
+	 */
+	if (watch && prop_cache_watch(conn, key, path, interface, name) != 0) {
+		g_free(key);
+		goto uncached;
+	}
+
+	result = rpc_connection_call_syncp(conn, path, RPC_OBSERVABLE_INTERFACE,
+	    "get", "[s,s]", interface, name);
+
+	if (result != NULL && !rpc_is_error(result)) {
+		g_mutex_lock(&conn->rco_prop_cache_mtx);
+		entry = conn->rco_prop_cache != NULL ?
+		    g_hash_table_lookup(conn->rco_prop_cache, key) : NULL;
+		if (entry != NULL && entry->version == version) {
+			rpc_release(entry->value);
+			entry->value = rpc_retain(result);
+			entry->updated = g_get_monotonic_time();
+			entry->valid = true;
+		}
+		g_mutex_unlock(&conn->rco_prop_cache_mtx);
+	}
+
+	g_free(key);
+	return (result);
+
+uncached:
+	return (rpc_connection_call_syncp(conn, path, RPC_OBSERVABLE_INTERFACE,
+	    "get", "[s,s]", interface, name));
+}
+
+
+rpc_object_t
+rpc_connection_set_property(rpc_connection_t conn, const char *path,
+    const char *interface, const char *name, rpc_object_t value)
+{
+	rpc_object_t result;
+	char *key;
+
+	result = rpc_connection_call_syncp(conn, path, RPC_OBSERVABLE_INTERFACE,
+	    "set", "[s,s,v]", interface, name, value);
+
+	if (path != NULL && interface != NULL) {
+		key = g_strjoin("\x1f", path, interface, name, NULL);
+		prop_cache_invalidate(conn, key);
+		g_free(key);
+	}
+
+	return (result);
+}
+
+int
+rpc_connection_set_property_cache(rpc_connection_t conn, bool enable,
+    uint64_t max_age)
+{
+	GHashTable *old = NULL;
+	GHashTableIter iter;
+	struct prop_cache_entry *entry;
+
+	g_mutex_lock(&conn->rco_prop_cache_mtx);
+	conn->rco_prop_cache_max_age = max_age;
+	if (enable && conn->rco_prop_cache == NULL)
+		conn->rco_prop_cache = g_hash_table_new(g_str_hash, g_str_equal);
+	else if (!enable) {
+		old = conn->rco_prop_cache;
+		conn->rco_prop_cache = NULL;
+	}
+	g_mutex_unlock(&conn->rco_prop_cache_mtx);
+
+	if (old == NULL)
+		return (0);
+
+	g_hash_table_iter_init(&iter, old);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer)&entry)) {
+		/* The handler refers to watch_key until it's unregistered */
+		if (entry->watch != NULL &&
+		    prop_cache_unwatch(conn, entry->watch) != 0)
+			entry->watch_key = NULL;
+
+		prop_cache_entry_free(entry);
+	}
+
+	g_hash_table_destroy(old);
+	return (0);
+}
 
-	return (rpc_connection_call_syncp(conn, path, RPC_OBSERVABLE_INTERFACE,
-	    "set", "[s,s,v]", interface, name, value));
-}
-
 
 rpc_object_t
 rpc_connection_set_propertyp(rpc_connection_t conn, const char *path,
@@ -2222,7 +3316,6 @@ rpc_connection_send_event(rpc_connection_t conn, const char *path,
 {
 	rpc_object_t frame;
 	rpc_object_t event;
-	struct rpc_subscription *sub;
 	int ret = 0;
 
 	if (rpc_connection_retain_if_valid(conn, true) != 0)
@@ -2233,8 +3326,7 @@ rpc_connection_send_event(rpc_connection_t conn, const char *path,
 	if (rpc_connection_get_subscription_count(conn) < 1)
 		goto done;
 
-	sub = rpc_connection_find_subscription(conn, path, interface, name);
-	if (sub == NULL)
+	if (!rpc_connection_match_subscription(conn, path, interface, name))
 		goto done;
 
 	event = rpc_object_pack("{s,s,s,v}",
@@ -2243,11 +3335,458 @@ rpc_connection_send_event(rpc_connection_t conn, const char *path,
 	    "name", name,
 	    "args", rpc_retain(args));
 
-	frame = rpc_pack_frame("events", "event", NULL, event);
-	ret = rpc_send_frame(conn, frame);
+	if (conn->rco_server != NULL && conn->rco_server->rs_event_window > 0) {
+		ret = rpc_connection_queue_event(conn, event);
+		goto done;
+	}
+
+	frame = rpc_pack_frame("events", "event", NULL, event);
+	ret = rpc_send_frame(conn, frame);
+
+done:
+	g_rw_lock_reader_unlock(&conn->rco_subscription_rwlock);
+	rpc_connection_release(conn);
+	return (ret);
+}
+
+static bool
+rpc_object_has_fds(rpc_object_t obj)
+{
+	__block bool ret = false;
+
+	switch (rpc_get_type(obj)) {
+	case RPC_TYPE_FD:
+#if defined(__linux__)
+	case RPC_TYPE_SHMEM:
+#endif
+		return (true);
+
+	case RPC_TYPE_ARRAY:
+		rpc_array_apply(obj, ^(size_t idx __unused, rpc_object_t v) {
+			ret = rpc_object_has_fds(v);
+			return ((bool)!ret);
+		});
+		return (ret);
+
+	case RPC_TYPE_DICTIONARY:
+		rpc_dictionary_apply(obj, ^(const char *k __unused,
+		    rpc_object_t v) {
+			ret = rpc_object_has_fds(v);
+			return ((bool)!ret);
+		});
+		return (ret);
+
+	default:
+		return (false);
+	}
+}
+
+struct rpc_shared_frame *
+rpc_shared_frame_new(const char *path, const char *interface, const char *name,
+    rpc_object_t args)
+{
+	struct rpc_shared_frame *result;
+
+	result = g_malloc0(sizeof(*result));
+	result->rsf_refcnt = 1;
+	result->rsf_path = g_strdup(path);
+	result->rsf_interface = g_strdup(interface);
+	result->rsf_name = g_strdup(name);
+	result->rsf_args = rpc_retain(args);
+	result->rsf_frame = rpc_pack_frame("events", "event", NULL,
+	    rpc_object_pack("{s,s,s,v}",
+	    "path", path,
+	    "interface", interface,
+	    "name", name,
+	    "args", rpc_retain(args)));
+	result->rsf_has_fds = rpc_object_has_fds(result->rsf_frame);
+	g_mutex_init(&result->rsf_mtx);
+	return (result);
+}
+
+struct rpc_shared_frame *
+rpc_shared_frame_retain(struct rpc_shared_frame *frame)
+{
+
+	g_atomic_int_inc(&frame->rsf_refcnt);
+	return (frame);
+}
+
+void
+rpc_shared_frame_release(struct rpc_shared_frame *frame)
+{
+
+	if (frame == NULL)
+		return;
+
+	if (!g_atomic_int_dec_and_test(&frame->rsf_refcnt))
+		return;
+
+	rpc_release(frame->rsf_frame);
+	rpc_release(frame->rsf_args);
+	g_free(frame->rsf_path);
+	g_free(frame->rsf_interface);
+	g_free(frame->rsf_name);
+	free(frame->rsf_buf[0]);
+	free(frame->rsf_buf[1]);
+	g_mutex_clear(&frame->rsf_mtx);
+	g_free(frame);
+}
+
+static int
+rpc_shared_frame_encode(struct rpc_shared_frame *frame, bool rpct,
+    const void **buf, size_t *len)
+{
+	rpc_object_t tmp;
+	int idx = rpct ? 1 : 0;
+	int ret = 0;
+
+	/* Encoded lazily, once per flavor, then shared by every sender */
+	g_mutex_lock(&frame->rsf_mtx);
+	if (frame->rsf_buf[idx] == NULL) {
+		tmp = rpct ? rpct_serialize(frame->rsf_frame) :
+		    rpc_retain(frame->rsf_frame);
+		if (rpc_msgpack_serialize(tmp, &frame->rsf_buf[idx],
+		    &frame->rsf_len[idx]) != 0) {
+			frame->rsf_buf[idx] = NULL;
+			ret = -1;
+		}
+		rpc_release(tmp);
+	}
+
+	*buf = frame->rsf_buf[idx];
+	*len = frame->rsf_len[idx];
+	g_mutex_unlock(&frame->rsf_mtx);
+	return (ret);
+}
+
+static int
+rpc_connection_send_shared_frame(rpc_connection_t conn,
+    struct rpc_shared_frame *frame)
+{
+	const void *buf;
+	size_t len;
+	bool rpct;
+	int ret;
+
+	if (!rpc_connection_is_open(conn))
+		return (-1);
+
+	/*
+	 * Coalesced or unserialized events need a frame of their own and
+	 * so do file descriptors, which get renumbered on every send.
+	 */
+	if ((conn->rco_flags & RPC_TRANSPORT_NO_SERIALIZE) != 0 ||
+	    (conn->rco_server != NULL &&
+	    conn->rco_server->rs_event_window > 0) || frame->rsf_has_fds)
+		return (rpc_connection_send_event(conn, frame->rsf_path,
+		    frame->rsf_interface, frame->rsf_name, frame->rsf_args));
+
+	rpct = (conn->rco_flags & RPC_TRANSPORT_NO_RPCT_SERIALIZE) == 0;
+	if (rpc_shared_frame_encode(frame, rpct, &buf, &len) != 0)
+		return (-1);
+
+#ifdef RPC_TRACE
+	rpc_trace("SEND", conn->rco_uri, frame->rsf_frame);
+#endif
+
+	g_mutex_lock(&conn->rco_send_mtx);
+	ret = conn->rco_send_msg(conn->rco_arg, buf, len, NULL, 0);
+	g_mutex_unlock(&conn->rco_send_mtx);
+	return (ret);
+}
+
+static bool
+rpc_connection_wants_event(rpc_connection_t conn, const char *path,
+    const char *interface, const char *name)
+{
+	bool ret = false;
+
+	g_rw_lock_reader_lock(&conn->rco_subscription_rwlock);
+	if (rpc_connection_get_subscription_count(conn) > 0)
+		ret = rpc_connection_match_subscription(conn, path, interface,
+		    name);
+	g_rw_lock_reader_unlock(&conn->rco_subscription_rwlock);
+	return (ret);
+}
+
+int
+rpc_connection_send_event_shared(rpc_connection_t conn, const char *path,
+    const char *interface, const char *name, rpc_object_t args,
+    struct rpc_shared_frame **framep)
+{
+	int ret = 0;
+
+	if (rpc_connection_retain_if_valid(conn, true) != 0)
+		return (-1);
+
+	if (rpc_connection_wants_event(conn, path, interface, name)) {
+		if (*framep == NULL)
+			*framep = rpc_shared_frame_new(path, interface, name,
+			    args);
+
+		ret = rpc_connection_send_shared_frame(conn, *framep);
+	}
+
+	rpc_connection_release(conn);
+	return (ret);
+}
+
+rpc_event_queue_result_t
+rpc_connection_enqueue_event(rpc_connection_t conn,
+    struct rpc_shared_frame *frame, size_t limit,
+    rpc_slow_consumer_policy_t policy, size_t *depth)
+{
+	struct rpc_shared_frame *queued;
+	rpc_event_queue_result_t ret = RPC_EVENT_QUEUED;
+	GList *iter;
+
+	/* Subscriptions were already matched by the context index */
+	*depth = 0;
+	if (rpc_connection_retain_if_valid(conn, true) != 0)
+		return (RPC_EVENT_SKIPPED);
+
+	g_mutex_lock(&conn->rco_event_mtx);
+	if (conn->rco_event_overflow) {
+		g_mutex_unlock(&conn->rco_event_mtx);
+		rpc_connection_release(conn);
+		return (RPC_EVENT_SKIPPED);
+	}
+
+	if (limit > 0 && g_queue_get_length(conn->rco_event_queue) >= limit) {
+		switch (policy) {
+		case RPC_SLOW_CONSUMER_COALESCE:
+			for (iter = conn->rco_event_queue->head; iter != NULL;
+			    iter = iter->next) {
+				queued = iter->data;
+				if (g_strcmp0(queued->rsf_path,
+				    frame->rsf_path) == 0 &&
+				    g_strcmp0(queued->rsf_interface,
+				    frame->rsf_interface) == 0 &&
+				    g_strcmp0(queued->rsf_name,
+				    frame->rsf_name) == 0)
+					break;
+			}
+
+			if (iter != NULL) {
+				/* Latest value wins, in the old one's place */
+				rpc_shared_frame_release(iter->data);
+				iter->data = rpc_shared_frame_retain(frame);
+				ret = RPC_EVENT_COALESCED;
+				goto done;
+			}
+			/* FALLTHROUGH */
+
+		case RPC_SLOW_CONSUMER_DROP_OLDEST:
+			rpc_shared_frame_release(
+			    g_queue_pop_head(conn->rco_event_queue));
+			ret = RPC_EVENT_DROPPED;
+			break;
+
+		case RPC_SLOW_CONSUMER_DISCONNECT:
+			/* The sender thread tears the connection down */
+			conn->rco_event_overflow = true;
+			ret = RPC_EVENT_OVERFLOW;
+			goto schedule;
+		}
+	}
+
+	g_queue_push_tail(conn->rco_event_queue,
+	    rpc_shared_frame_retain(frame));
+
+done:
+	*depth = g_queue_get_length(conn->rco_event_queue);
+	if (*depth > conn->rco_event_queue_hwm)
+		conn->rco_event_queue_hwm = *depth;
+
+schedule:
+	if (!conn->rco_event_draining) {
+		conn->rco_event_draining = true;
+		rpc_connection_retain(conn);
+		g_mutex_unlock(&conn->rco_event_mtx);
+		rpc_context_schedule_events(conn->rco_rpc_context, conn);
+		rpc_connection_release(conn);
+		return (ret);
+	}
+
+	g_mutex_unlock(&conn->rco_event_mtx);
+	rpc_connection_release(conn);
+	return (ret);
+}
+
+void
+rpc_connection_drain_events(rpc_connection_t conn)
+{
+	struct rpc_shared_frame *frame;
+	bool overflow;
+
+	for (;;) {
+		g_mutex_lock(&conn->rco_event_mtx);
+		overflow = conn->rco_event_overflow;
+		frame = overflow ? NULL :
+		    g_queue_pop_head(conn->rco_event_queue);
+		if (frame == NULL) {
+			conn->rco_event_draining = false;
+			g_mutex_unlock(&conn->rco_event_mtx);
+			break;
+		}
+		g_mutex_unlock(&conn->rco_event_mtx);
+
+		rpc_connection_send_shared_frame(conn, frame);
+		rpc_shared_frame_release(frame);
+	}
+
+	if (overflow) {
+		rpc_connection_close(conn);
+		return;
+	}
+
+	/* Caught up with the emitter, nothing to coalesce with anymore */
+	rpc_connection_flush_events(conn);
+}
+
+void
+rpc_connection_get_event_queue(rpc_connection_t conn, size_t *depth,
+    size_t *hwm)
+{
+
+	g_mutex_lock(&conn->rco_event_mtx);
+	if (depth != NULL)
+		*depth = g_queue_get_length(conn->rco_event_queue);
+
+	if (hwm != NULL)
+		*hwm = conn->rco_event_queue_hwm;
+	g_mutex_unlock(&conn->rco_event_mtx);
+}
+
+size_t
+rpc_object_size_estimate(rpc_object_t obj)
+{
+	__block size_t size = 1;
+
+	if (obj == NULL)
+		return (size);
+
+	switch (rpc_get_type(obj)) {
+	case RPC_TYPE_STRING:
+		return (size + rpc_string_get_length(obj));
+
+	case RPC_TYPE_BINARY:
+		return (size + rpc_data_get_length(obj));
+
+	case RPC_TYPE_ARRAY:
+		rpc_array_apply(obj, ^(size_t idx __unused, rpc_object_t v) {
+			size += rpc_object_size_estimate(v);
+			return ((bool)true);
+		});
+		return (size);
+
+	case RPC_TYPE_DICTIONARY:
+		rpc_dictionary_apply(obj, ^(const char *k, rpc_object_t v) {
+			size += strlen(k) + rpc_object_size_estimate(v);
+			return ((bool)true);
+		});
+		return (size);
+
+	default:
+		return (size + sizeof(uint64_t));
+	}
+}
+
+static gboolean
+rpc_connection_event_window_expired(gpointer user_data)
+{
+	rpc_connection_t conn = user_data;
+
+	rpc_connection_flush_events(conn);
+	return (G_SOURCE_REMOVE);
+}
+
+static int
+rpc_connection_queue_event(rpc_connection_t conn, rpc_object_t event)
+{
+	rpc_server_t server = conn->rco_server;
+	guint interval;
+	int ret = 0;
+
+	g_mutex_lock(&conn->rco_event_mtx);
+	if (conn->rco_event_burst == NULL)
+		conn->rco_event_burst = rpc_array_create();
+
+	conn->rco_event_burst_bytes += rpc_object_size_estimate(event);
+	rpc_array_append_stolen_value(conn->rco_event_burst, event);
+
+	if (server->rs_event_window_bytes > 0 &&
+	    conn->rco_event_burst_bytes >= server->rs_event_window_bytes) {
+		ret = rpc_connection_flush_events_locked(conn);
+		g_mutex_unlock(&conn->rco_event_mtx);
+		return (ret);
+	}
+
+	/* First event in the window arms the flush timer */
+	if (conn->rco_event_flush == NULL) {
+		interval = (guint)((server->rs_event_window + 999) / 1000);
+		rpc_connection_retain(conn);
+		conn->rco_event_flush = g_timeout_source_new(interval);
+		g_source_set_callback(conn->rco_event_flush,
+		    rpc_connection_event_window_expired, conn,
+		    (GDestroyNotify)rpc_connection_release);
+		g_source_attach(conn->rco_event_flush, conn->rco_main_context);
+	}
+
+	g_mutex_unlock(&conn->rco_event_mtx);
+	return (ret);
+}
+
+static int
+rpc_connection_flush_events_locked(rpc_connection_t conn)
+{
+	rpc_object_t burst = conn->rco_event_burst;
+	rpc_object_t frame;
+
+	if (conn->rco_event_flush != NULL) {
+		g_source_destroy(conn->rco_event_flush);
+		g_source_unref(conn->rco_event_flush);
+		conn->rco_event_flush = NULL;
+	}
+
+	if (burst == NULL)
+		return (0);
+
+	conn->rco_event_burst = NULL;
+	conn->rco_event_burst_bytes = 0;
+
+	if (!rpc_connection_is_open(conn)) {
+		rpc_release(burst);
+		return (-1);
+	}
+
+	/*
+	 * A lone event goes out as a plain events.event frame, so peers
+	 * which never see a burst keep working unchanged.
+	 */
+	if (rpc_array_get_count(burst) == 1) {
+		frame = rpc_pack_frame("events", "event", NULL,
+		    rpc_retain(rpc_array_get_value(burst, 0)));
+		rpc_release(burst);
+	} else
+		frame = rpc_pack_frame("events", "event_burst", NULL, burst);
+
+	/* Sent under rco_event_mtx so that bursts can't be reordered */
+	return (rpc_send_frame(conn, frame));
+}
+
+int
+rpc_connection_flush_events(rpc_connection_t conn)
+{
+	int ret;
 
-done:
-	g_rw_lock_reader_unlock(&conn->rco_subscription_rwlock);
+	if (rpc_connection_retain_if_valid(conn, false) != 0)
+		return (-1);
+
+	g_mutex_lock(&conn->rco_event_mtx);
+	ret = rpc_connection_flush_events_locked(conn);
+	g_mutex_unlock(&conn->rco_event_mtx);
 	rpc_connection_release(conn);
 	return (ret);
 }
@@ -2346,6 +3885,85 @@ rpc_connection_get_remote_gid(rpc_connection_t conn)
 	return (conn->rco_creds.rcc_gid);
 }
 
+int
+rpc_connection_set_weight(rpc_connection_t conn, unsigned int weight)
+{
+	rpc_context_t context = conn->rco_rpc_context;
+
+	if (weight == 0) {
+		rpc_set_last_error(EINVAL, "Weight must be positive", NULL);
+		return (-1);
+	}
+
+	if (context == NULL) {
+		conn->rco_weight = weight;
+		return (0);
+	}
+
+	g_mutex_lock(&context->rcx_sched_mtx);
+	conn->rco_weight = weight;
+	g_mutex_unlock(&context->rcx_sched_mtx);
+	return (0);
+}
+
+int
+rpc_connection_set_max_inflight(rpc_connection_t conn, size_t max)
+{
+
+	struct rpc_call *call;
+
+	g_mutex_lock(&conn->rco_inflight_mtx);
+	conn->rco_max_inflight = (guint)max;
+	g_mutex_unlock(&conn->rco_inflight_mtx);
+
+	/* A higher cap lets parked calls in */
+	for (;;) {
+		g_mutex_lock(&conn->rco_inflight_mtx);
+		call = rpc_connection_admit_next(conn);
+		g_mutex_unlock(&conn->rco_inflight_mtx);
+		if (call == NULL)
+			break;
+
+		rpc_run_inbound_call(conn, call);
+	}
+
+	return (0);
+}
+
+int
+rpc_connection_set_max_queued(rpc_connection_t conn, size_t max)
+{
+
+	g_mutex_lock(&conn->rco_inflight_mtx);
+	conn->rco_max_queued = (guint)MIN(max, G_MAXUINT);
+	g_mutex_unlock(&conn->rco_inflight_mtx);
+	return (0);
+}
+
+int
+rpc_connection_set_sync_spin(rpc_connection_t conn, unsigned int usec)
+{
+
+	g_atomic_int_set(&conn->rco_sync_spin, (int)MIN(usec, G_MAXINT));
+	g_atomic_int_set(&conn->rco_sync_latency, 0);
+	return (0);
+}
+
+void
+rpc_connection_set_completion_queue(rpc_connection_t conn,
+    rpc_completion_queue_t cq)
+{
+	rpc_completion_queue_t old;
+
+	g_mutex_lock(&conn->rco_cq_mtx);
+	old = conn->rco_cq;
+	conn->rco_cq = cq != NULL ? rpc_cq_retain(cq) : NULL;
+	g_mutex_unlock(&conn->rco_cq_mtx);
+
+	if (old != NULL)
+		rpc_cq_release(old);
+}
+
 pid_t
 rpc_connection_get_remote_pid(rpc_connection_t conn)
 {
@@ -2366,24 +3984,27 @@ rpc_call_wait(rpc_call_t call)
 	return (ret);
 }
 
-int
-rpc_call_continue(rpc_call_t call, bool sync)
+static int
+rpc_call_advance_locked(rpc_call_t call)
 {
 	struct queue_item *q_item;
-	rpc_call_status_t status;
 	rpc_object_t frame;
 	int64_t seqno;
 	int ret = 0;
 
-	g_mutex_lock(&call->rc_mtx);
-	status = rpc_call_status_locked(call);
+	if (call->rc_window != 0) {
+		q_item = g_queue_peek_head(call->rc_queue);
+		if (rpc_call_grant_credit_locked(call, q_item != NULL &&
+		    q_item->status == RPC_CALL_MORE_AVAILABLE ?
+		    q_item->size : 0) != 0) {
+			q_item = g_malloc0(sizeof(*q_item));
+			q_item->status = RPC_CALL_ERROR;
+			q_item->item = rpc_retain(rpc_get_last_error());
+			g_queue_push_tail(call->rc_queue, q_item);
+			ret = -1;
+		}
 
-	if (status != RPC_CALL_IN_PROGRESS &&
-	    status != RPC_CALL_MORE_AVAILABLE &&
-	    status != RPC_CALL_STREAM_START) {
-		rpc_set_last_errorf(ENXIO, "Not an open streaming call");
-		g_mutex_unlock(&call->rc_mtx);
-		return (-1);
+		goto pop;
 	}
 
 	if (call->rc_consumer_seqno == call->rc_producer_seqno) {
@@ -2406,10 +4027,46 @@ rpc_call_continue(rpc_call_t call, bool sync)
 
 	call->rc_consumer_seqno++;
 
+pop:
 	/* It is assumed that the caller retains q_item->item if it is needed */
-	q_item = g_queue_pop_head(call->rc_queue);
+	q_item = g_queue_peek_head(call->rc_queue);
+	if (q_item == NULL)
+		return (ret);
+
 	rpc_release(q_item->item);
+	if (q_item->batch != NULL &&
+	    q_item->next < rpc_array_get_count(q_item->batch)) {
+		q_item->item = rpc_retain(rpc_array_get_value(q_item->batch,
+		    q_item->next++));
+		q_item->size = call->rc_window != 0 ?
+		    rpc_object_size_estimate(q_item->item) : 0;
+		return (ret);
+	}
+
+	g_queue_pop_head(call->rc_queue);
+	rpc_release(q_item->batch);
 	g_free(q_item);
+	return (ret);
+}
+
+int
+rpc_call_continue(rpc_call_t call, bool sync)
+{
+	rpc_call_status_t status;
+	int ret;
+
+	g_mutex_lock(&call->rc_mtx);
+	status = rpc_call_status_locked(call);
+
+	if (status != RPC_CALL_IN_PROGRESS &&
+	    status != RPC_CALL_MORE_AVAILABLE &&
+	    status != RPC_CALL_STREAM_START) {
+		rpc_set_last_errorf(ENXIO, "Not an open streaming call");
+		g_mutex_unlock(&call->rc_mtx);
+		return (-1);
+	}
+
+	ret = rpc_call_advance_locked(call);
 
 	if (sync && ret == 0) {
 		if (rpc_call_wait_locked(call) < 0) {
@@ -2425,6 +4082,104 @@ rpc_call_continue(rpc_call_t call, bool sync)
 	return (ret);
 }
 
+static bool
+rpc_call_upload_closed_locked(rpc_call_t call)
+{
+
+	if (!rpc_connection_is_open(call->rc_conn))
+		return (true);
+
+	switch (rpc_call_status_locked(call)) {
+	case RPC_CALL_DONE:
+	case RPC_CALL_ERROR:
+	case RPC_CALL_ABORTED:
+		return (true);
+
+	default:
+		return (false);
+	}
+}
+
+int
+rpc_call_send_fragment(rpc_call_t call, rpc_object_t fragment)
+{
+	rpc_object_t frame;
+	rpc_object_t args;
+	size_t size;
+	int ret;
+
+	/*
+	 * rc_frag_mtx keeps concurrent senders in seqno order, while rc_mtx
+	 * is dropped for the (possibly blocking) send, so that credit and
+	 * abort frames for this call are never held up behind it.
+	 */
+	g_mutex_lock(&call->rc_frag_mtx);
+	g_mutex_lock(&call->rc_mtx);
+	if (!call->rc_upload || call->rc_upload_ended) {
+		rpc_set_last_errorf(ENXIO, "Not an open client stream");
+		goto error;
+	}
+
+	/* Backpressure: wait for the server to hand out credit */
+	while (call->rc_upload_seqno >= call->rc_upload_credit ||
+	    call->rc_upload_bytes >= call->rc_upload_credit_bytes) {
+		if (rpc_call_upload_closed_locked(call))
+			break;
+
+		g_cond_wait(&call->rc_upload_cv, &call->rc_mtx);
+	}
+
+	if (rpc_call_upload_closed_locked(call)) {
+		rpc_set_last_errorf(ECONNRESET, "Call no longer accepts input");
+		goto error;
+	}
+
+	size = rpc_object_size_estimate(fragment);
+	args = rpc_dictionary_create();
+	rpc_dictionary_set_int64(args, "seqno", call->rc_upload_seqno);
+	rpc_dictionary_steal_value(args, "fragment", fragment);
+	frame = rpc_pack_frame("rpc", "upload", call->rc_id, args);
+
+	call->rc_upload_seqno++;
+	call->rc_upload_bytes += size;
+	g_mutex_unlock(&call->rc_mtx);
+
+	ret = rpc_send_frame(call->rc_conn, frame);
+	g_mutex_unlock(&call->rc_frag_mtx);
+	return (ret);
+
+error:
+	g_mutex_unlock(&call->rc_mtx);
+	g_mutex_unlock(&call->rc_frag_mtx);
+	rpc_release(fragment);
+	return (-1);
+}
+
+int
+rpc_call_end_stream(rpc_call_t call)
+{
+	rpc_object_t frame;
+	int ret;
+
+	g_mutex_lock(&call->rc_frag_mtx);
+	g_mutex_lock(&call->rc_mtx);
+	if (!call->rc_upload || call->rc_upload_ended) {
+		rpc_set_last_errorf(ENXIO, "Not an open client stream");
+		g_mutex_unlock(&call->rc_mtx);
+		g_mutex_unlock(&call->rc_frag_mtx);
+		return (-1);
+	}
+
+	call->rc_upload_ended = true;
+	frame = rpc_pack_frame("rpc", "upload_end", call->rc_id,
+	    rpc_object_pack("{i}", "seqno", call->rc_upload_seqno));
+	g_mutex_unlock(&call->rc_mtx);
+
+	ret = rpc_send_frame(call->rc_conn, frame);
+	g_mutex_unlock(&call->rc_frag_mtx);
+	return (ret);
+}
+
 int
 rpc_call_abort(rpc_call_t call)
 {
@@ -2450,12 +4205,14 @@ rpc_call_abort(rpc_call_t call)
 	}
 
 	if (cancel_timeout_locked(call) == 0) {
-		q_item = g_malloc(sizeof(*q_item));
+		q_item = g_malloc0(sizeof(*q_item));
 		q_item->status = RPC_CALL_ABORTED;
 		q_item->item = NULL;
 		g_queue_push_tail(call->rc_queue, q_item);
 	}
 
+	g_cond_broadcast(&call->rc_upload_cv);
+
 	g_mutex_unlock(&call->rc_mtx);
 	return (0);
 }
@@ -2470,6 +4227,214 @@ rpc_call_set_prefetch(_Nonnull rpc_call_t call, size_t nitems)
 	return (0);
 }
 
+int
+rpc_call_set_window(_Nonnull rpc_call_t call, size_t min_bytes,
+    size_t max_bytes, size_t nitems)
+{
+
+	if (max_bytes != 0 && max_bytes < min_bytes) {
+		rpc_set_last_errorf(EINVAL,
+		    "Maximum window smaller than minimum window");
+		return (-1);
+	}
+
+	g_mutex_lock(&call->rc_mtx);
+	call->rc_window = min_bytes;
+	call->rc_window_min = min_bytes;
+	call->rc_window_max = MAX(min_bytes, max_bytes);
+	call->rc_window_items = nitems;
+	g_mutex_unlock(&call->rc_mtx);
+	return (0);
+}
+
+static void
+rpc_call_tune_window_locked(rpc_call_t call, int64_t now)
+{
+	double rate;
+	double target;
+
+	if (call->rc_window_max <= call->rc_window_min || call->rc_rtt == 0 ||
+	    now <= call->rc_grant_time)
+		return;
+
+	/*
+	 * Size the window to twice the bandwidth-delay product seen by
+	 * the consumer, so that the half-window refill lands before the
+	 * producer runs dry. A window-limited consumer measures a rate of
+	 * about window/RTT and thus keeps doubling until either the
+	 * consumer itself or max_bytes becomes the limit; a slow consumer
+	 * shrinks it back. Change by at most a factor of two per grant.
+	 */
+	rate = (double)(call->rc_consumed_bytes - call->rc_grant_consumed) /
+	    (double)(now - call->rc_grant_time);
+	target = 2 * rate * (double)call->rc_rtt;
+	target = CLAMP(target, call->rc_window / 2.0, call->rc_window * 2.0);
+	target = CLAMP(target, (double)call->rc_window_min,
+	    (double)call->rc_window_max);
+	call->rc_window = (size_t)target;
+}
+
+static int
+rpc_call_grant_credit_locked(rpc_call_t call, size_t consumed)
+{
+	rpc_object_t frame;
+	int64_t window_items;
+	int64_t items;
+	int64_t bytes;
+	int64_t now;
+
+	/* No item cap means the byte window alone throttles the producer */
+	window_items = call->rc_window_items != 0 ?
+	    (int64_t)call->rc_window_items : G_MAXINT32;
+
+	call->rc_consumer_seqno++;
+	call->rc_consumed_bytes += consumed;
+
+	/*
+	 * The producer always gets one item (the stream start) for free,
+	 * hence the credit it still holds is off by one from our counters.
+	 * Only refill once half of either window has been consumed.
+	 */
+	items = call->rc_producer_seqno - call->rc_consumer_seqno + 1;
+	bytes = call->rc_granted_bytes - call->rc_consumed_bytes;
+	if (call->rc_granted_bytes != 0 && items > window_items / 2 &&
+	    bytes > (int64_t)call->rc_window / 2)
+		return (0);
+
+	now = g_get_monotonic_time();
+	if (call->rc_granted_bytes != 0)
+		rpc_call_tune_window_locked(call, now);
+
+	/* Producer used up its credit, so time how long it takes to resume */
+	if (call->rc_received_bytes >= call->rc_granted_bytes)
+		call->rc_rtt_probe = now;
+
+	items = MAX(window_items - items, 0);
+	bytes = MAX(call->rc_consumed_bytes + (int64_t)call->rc_window -
+	    call->rc_granted_bytes, 0);
+
+	frame = rpc_pack_frame("rpc", "continue", call->rc_id, rpc_object_pack(
+	    "{i,i,i}",
+	    "seqno", call->rc_producer_seqno + 1,
+	    "increment", items,
+	    "bytes", bytes));
+
+	call->rc_producer_seqno += items;
+	call->rc_granted_bytes += bytes;
+	call->rc_grant_consumed = call->rc_consumed_bytes;
+	call->rc_grant_time = now;
+
+	return (rpc_send_frame(call->rc_conn, frame));
+}
+
+static void
+rpc_call_changed_locked(rpc_call_t call, rpc_call_status_t status)
+{
+
+	/* Read without the lock by spinning synchronous waiters */
+	g_atomic_int_inc(&call->rc_changes);
+	if (call->rc_parked)
+		g_cond_signal(&call->rc_sync_cv);
+
+	if (call->rc_cq != NULL)
+		rpc_cq_post(call->rc_cq, call, status);
+}
+
+static void
+rpc_call_expire_locked(rpc_call_t call)
+{
+	struct queue_item *q_item;
+
+	q_item = g_malloc0(sizeof(*q_item));
+	q_item->status = RPC_CALL_ERROR;
+	q_item->item = rpc_error_create(ETIMEDOUT, "Call timed out", NULL);
+
+	g_queue_push_tail(call->rc_queue, q_item);
+	notify_signal(&call->rc_notify);
+	rpc_call_changed_locked(call, RPC_CALL_ERROR);
+	g_cond_broadcast(&call->rc_upload_cv);
+}
+
+static inline void
+rpc_spin_pause(void)
+{
+
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+
+static int
+rpc_call_wait_sync(rpc_call_t call)
+{
+	rpc_connection_t conn = call->rc_conn;
+	gint64 start;
+	gint64 elapsed;
+	gint64 spin_until;
+	int budget;
+	int latency;
+
+	start = g_get_monotonic_time();
+	budget = g_atomic_int_get(&conn->rco_sync_spin);
+	latency = g_atomic_int_get(&conn->rco_sync_latency);
+
+	/*
+	 * Spin only while responses usually make it within the budget;
+	 * there's no point burning the CPU on a slow peer.
+	 */
+	if (budget > 0 && latency <= budget) {
+		spin_until = start + (latency > 0 ?
+		    MIN(budget, 2 * latency) : budget);
+		while (g_atomic_int_get(&call->rc_changes) == 0 &&
+		    g_get_monotonic_time() < spin_until)
+			rpc_spin_pause();
+	}
+
+	g_mutex_lock(&call->rc_mtx);
+	while (g_queue_is_empty(call->rc_queue)) {
+		call->rc_parked = true;
+		if (!g_cond_wait_until(&call->rc_sync_cv, &call->rc_mtx,
+		    call->rc_deadline) && g_queue_is_empty(call->rc_queue)) {
+			call->rc_timedout = true;
+			rpc_call_expire_locked(call);
+		}
+	}
+
+	call->rc_parked = false;
+	g_mutex_unlock(&call->rc_mtx);
+
+	if (budget > 0) {
+		elapsed = MIN(g_get_monotonic_time() - start, G_MAXINT / 8);
+		g_atomic_int_set(&conn->rco_sync_latency, latency > 0 ?
+		    (int)((latency * 7 + elapsed) / 8) : (int)elapsed);
+	}
+
+	return (0);
+}
+
+static size_t
+rpc_call_account_fragment_locked(rpc_call_t call, rpc_object_t fragment)
+{
+	int64_t sample;
+	size_t size;
+
+	if (call->rc_window == 0)
+		return (0);
+
+	size = rpc_object_size_estimate(fragment);
+	call->rc_received_bytes += size;
+
+	/* First fragment after unblocking the producer: RTT sample */
+	if (call->rc_rtt_probe != 0) {
+		sample = g_get_monotonic_time() - call->rc_rtt_probe;
+		call->rc_rtt = call->rc_rtt == 0 ? sample :
+		    (7 * call->rc_rtt + sample) / 8;
+		call->rc_rtt_probe = 0;
+	}
+
+	return (size);
+}
+
 inline int
 rpc_call_timedwait(rpc_call_t call, const struct timespec *ts)
 {
@@ -2532,6 +4497,38 @@ rpc_call_result(rpc_call_t call)
 	return (q_item != NULL ? q_item->item : NULL);
 }
 
+rpc_object_t
+rpc_call_result_batch(rpc_call_t call, size_t max)
+{
+	struct queue_item *q_item;
+	rpc_object_t result;
+	size_t count = 0;
+
+	g_mutex_lock(&call->rc_mtx);
+	if (rpc_call_status_locked(call) != RPC_CALL_MORE_AVAILABLE) {
+		rpc_set_last_errorf(ENXIO, "No stream fragments available");
+		g_mutex_unlock(&call->rc_mtx);
+		return (NULL);
+	}
+
+	result = rpc_array_create();
+
+	while (max == 0 || count < max) {
+		q_item = g_queue_peek_head(call->rc_queue);
+		if (q_item == NULL || q_item->status != RPC_CALL_MORE_AVAILABLE)
+			break;
+
+		rpc_array_append_value(result, q_item->item);
+		count++;
+
+		if (rpc_call_advance_locked(call) != 0)
+			break;
+	}
+
+	g_mutex_unlock(&call->rc_mtx);
+	return (result);
+}
+
 static inline rpc_object_t
 rpc_call_result_save(rpc_call_t call)
 {
@@ -2559,6 +4556,7 @@ rpc_call_free(rpc_call_t call)
 	while (!g_queue_is_empty(call->rc_queue)) {
 		q_item = g_queue_pop_head(call->rc_queue);
 		rpc_release(q_item->item);
+		rpc_release(q_item->batch);
 		g_free(q_item);
 	}
 	g_mutex_unlock(&call->rc_mtx);
@@ -0,0 +1,269 @@
+/*
+ * Copyright 2015-2017 Two Pore Guys, Inc.
+ * All rights reserved
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted providing that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <glib.h>
+#ifndef _WIN32
+#include <glib-unix.h>
+#endif
+#include <rpc/connection.h>
+#include "internal.h"
+
+/*
+ * Completion queue.
+ *
+ * Outbound calls without a callback, made on a connection that has
+ * a completion queue attached, post an event to it on every status
+ * change instead of waking up a callback thread. Any number of
+ * connections may share a queue.
+ *
+ * Each queued event holds a reference to its call, which is handed
+ * over to whoever takes the event off the queue and dropped with
+ * rpc_cq_event_release(). The read end of
+ * rcq_pipe holds exactly one byte while the queue is non-empty, so
+ * the descriptor can be watched with poll(2) and friends.
+ */
+
+struct rpc_cq_entry
+{
+	rpc_call_t		rce_call;
+	rpc_call_status_t	rce_status;
+};
+
+struct rpc_completion_queue
+{
+	volatile int		rcq_refcnt;
+	GMutex			rcq_mtx;
+	GCond			rcq_cv;
+	GQueue			rcq_events;
+	int			rcq_pipe[2];
+	bool			rcq_signalled;
+	bool			rcq_shutdown;
+};
+
+static void rpc_cq_signal_locked(rpc_completion_queue_t cq, bool pending);
+
+rpc_completion_queue_t
+rpc_cq_create(void)
+{
+	rpc_completion_queue_t cq;
+
+	cq = g_malloc0(sizeof(*cq));
+	cq->rcq_refcnt = 1;
+	cq->rcq_pipe[0] = -1;
+	cq->rcq_pipe[1] = -1;
+	g_mutex_init(&cq->rcq_mtx);
+	g_cond_init(&cq->rcq_cv);
+	g_queue_init(&cq->rcq_events);
+
+#ifndef _WIN32
+	if (!g_unix_open_pipe(cq->rcq_pipe, FD_CLOEXEC, NULL)) {
+		rpc_set_last_error(errno, "Cannot create pipe", NULL);
+		g_mutex_clear(&cq->rcq_mtx);
+		g_cond_clear(&cq->rcq_cv);
+		g_free(cq);
+		return (NULL);
+	}
+
+	g_unix_set_fd_nonblocking(cq->rcq_pipe[0], true, NULL);
+	g_unix_set_fd_nonblocking(cq->rcq_pipe[1], true, NULL);
+#endif
+	return (cq);
+}
+
+rpc_completion_queue_t
+rpc_cq_retain(rpc_completion_queue_t cq)
+{
+
+	g_atomic_int_inc(&cq->rcq_refcnt);
+	return (cq);
+}
+
+void
+rpc_cq_release(rpc_completion_queue_t cq)
+{
+	struct rpc_cq_entry *entry;
+
+	if (!g_atomic_int_dec_and_test(&cq->rcq_refcnt))
+		return;
+
+	while ((entry = g_queue_pop_head(&cq->rcq_events)) != NULL) {
+		rpc_connection_call_release(entry->rce_call);
+		g_free(entry);
+	}
+
+	if (cq->rcq_pipe[0] != -1) {
+		close(cq->rcq_pipe[0]);
+		close(cq->rcq_pipe[1]);
+	}
+
+	g_mutex_clear(&cq->rcq_mtx);
+	g_cond_clear(&cq->rcq_cv);
+	g_free(cq);
+}
+
+void
+rpc_cq_free(rpc_completion_queue_t cq)
+{
+
+	rpc_cq_shutdown(cq);
+	rpc_cq_release(cq);
+}
+
+void
+rpc_cq_shutdown(rpc_completion_queue_t cq)
+{
+	struct rpc_cq_entry *entry;
+	GQueue events = G_QUEUE_INIT;
+
+	g_mutex_lock(&cq->rcq_mtx);
+	cq->rcq_shutdown = true;
+	events = cq->rcq_events;
+	g_queue_init(&cq->rcq_events);
+	rpc_cq_signal_locked(cq, true);
+	g_cond_broadcast(&cq->rcq_cv);
+	g_mutex_unlock(&cq->rcq_mtx);
+
+	/* Queued events hold calls, which in turn hold the queue */
+	while ((entry = g_queue_pop_head(&events)) != NULL) {
+		rpc_connection_call_release(entry->rce_call);
+		g_free(entry);
+	}
+}
+
+int
+rpc_cq_get_fd(rpc_completion_queue_t cq)
+{
+
+	return (cq->rcq_pipe[0]);
+}
+
+static void
+rpc_cq_signal_locked(rpc_completion_queue_t cq, bool pending)
+{
+	char byte = 0;
+
+	if (cq->rcq_pipe[0] == -1 || cq->rcq_signalled == pending)
+		return;
+
+	if (pending) {
+		if (write(cq->rcq_pipe[1], &byte, 1) != 1)
+			return;
+	} else {
+		if (read(cq->rcq_pipe[0], &byte, 1) != 1)
+			return;
+	}
+
+	cq->rcq_signalled = pending;
+}
+
+void
+rpc_cq_post(rpc_completion_queue_t cq, rpc_call_t call,
+    rpc_call_status_t status)
+{
+	struct rpc_cq_entry *entry;
+
+	g_mutex_lock(&cq->rcq_mtx);
+	if (cq->rcq_shutdown) {
+		g_mutex_unlock(&cq->rcq_mtx);
+		return;
+	}
+
+	entry = g_malloc(sizeof(*entry));
+	entry->rce_call = call;
+	entry->rce_status = status;
+	rpc_connection_call_retain(call);
+	g_queue_push_tail(&cq->rcq_events, entry);
+	rpc_cq_signal_locked(cq, true);
+	g_cond_signal(&cq->rcq_cv);
+	g_mutex_unlock(&cq->rcq_mtx);
+}
+
+size_t
+rpc_cq_next_batch(rpc_completion_queue_t cq, struct rpc_cq_event *events,
+    size_t max, int64_t timeout)
+{
+	struct rpc_cq_entry *entry;
+	gint64 deadline;
+	size_t count = 0;
+
+	deadline = g_get_monotonic_time() + timeout;
+
+	g_mutex_lock(&cq->rcq_mtx);
+	while (g_queue_is_empty(&cq->rcq_events) && !cq->rcq_shutdown) {
+		if (timeout == 0)
+			break;
+
+		if (timeout < 0) {
+			g_cond_wait(&cq->rcq_cv, &cq->rcq_mtx);
+			continue;
+		}
+
+		if (!g_cond_wait_until(&cq->rcq_cv, &cq->rcq_mtx, deadline))
+			break;
+	}
+
+	/* The call reference of each entry moves over to the event */
+	while (count < max &&
+	    (entry = g_queue_pop_head(&cq->rcq_events)) != NULL) {
+		events[count].call = entry->rce_call;
+		events[count].status = entry->rce_status;
+		g_free(entry);
+		count++;
+	}
+
+	if (g_queue_is_empty(&cq->rcq_events) && !cq->rcq_shutdown)
+		rpc_cq_signal_locked(cq, false);
+
+	g_mutex_unlock(&cq->rcq_mtx);
+	return (count);
+}
+
+void
+rpc_cq_event_release(struct rpc_cq_event *event)
+{
+
+	rpc_connection_call_release(event->call);
+	event->call = NULL;
+}
+
+int
+rpc_cq_next(rpc_completion_queue_t cq, struct rpc_cq_event *event,
+    int64_t timeout)
+{
+
+	if (rpc_cq_next_batch(cq, event, 1, timeout) == 0) {
+		rpc_set_last_error(cq->rcq_shutdown ? ESHUTDOWN : ETIMEDOUT,
+		    cq->rcq_shutdown ? "Completion queue shut down" :
+		    "No completion available", NULL);
+		return (-1);
+	}
+
+	return (0);
+}
@@ -509,6 +509,9 @@ rpc_release_impl(rpc_object_t object)
 			return (0);
 
 		case RPC_TYPE_ARRAY:
+			if (object->ro_indexes != NULL)
+				rpc_query_index_detach(object);
+
 			g_ptr_array_unref(object->ro_value.rv_list);
 			break;
 
@@ -1705,6 +1708,9 @@ rpc_array_steal_value(rpc_object_t array, size_t index, rpc_object_t value)
 	}
 
 	ro = (rpc_object_t *)&g_ptr_array_index(array->ro_value.rv_list, index);
+	if (array->ro_indexes != NULL)
+		rpc_query_index_replaced(array, index, *ro, value);
+
 	rpc_release_impl(*ro);
 	*ro = value;
 }
@@ -1719,6 +1725,9 @@ rpc_array_remove_index(rpc_object_t array, size_t index)
 	if (index >= rpc_array_get_count(array))
 		return;
 
+	if (array->ro_indexes != NULL)
+		rpc_query_index_removed(array, index);
+
 	g_ptr_array_remove_index(array->ro_value.rv_list, (guint)index);
 }
 
@@ -1734,6 +1743,9 @@ rpc_array_remove_all(rpc_object_t array)
 	if (cnt == 0)
 		return;
 
+	if (array->ro_indexes != NULL)
+		rpc_query_index_invalidate(array);
+
 	g_ptr_array_remove_range(array->ro_value.rv_list, 0, (guint)cnt);
 }
 
@@ -1753,6 +1765,8 @@ rpc_array_append_stolen_value(rpc_object_t array, rpc_object_t value)
 		rpc_abort("Trying array API on non-array object");
 
 	g_ptr_array_add(array->ro_value.rv_list, value);
+	if (array->ro_indexes != NULL)
+		rpc_query_index_appended(array);
 }
 
 inline rpc_object_t
@@ -1804,6 +1818,9 @@ rpc_array_map(rpc_object_t array, rpc_array_mapper_t mapper)
 		g_ptr_array_index(array->ro_value.rv_list, i) = newv;
 		rpc_release(oldv);
 	}
+
+	if (array->ro_indexes != NULL)
+		rpc_query_index_invalidate(array);
 }
 
 inline bool
@@ -1854,6 +1871,9 @@ rpc_array_sort(rpc_object_t array, rpc_array_cmp_t comparator)
 
 	g_ptr_array_sort_with_data(array->ro_value.rv_list,
 	    &rpc_array_comparator_converter, (void *)comparator);
+
+	if (array->ro_indexes != NULL)
+		rpc_query_index_invalidate(array);
 }
 
 rpc_object_t
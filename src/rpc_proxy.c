@@ -0,0 +1,430 @@
+/*
+ * Copyright 2015-2017 Two Pore Guys, Inc.
+ * All rights reserved
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted providing that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <Block.h>
+#include <glib.h>
+#include <rpc/object.h>
+#include <rpc/connection.h>
+#include <rpc/service.h>
+#include "internal.h"
+
+#define	PROXY_UNSUBSCRIBE_RETRY	1000
+
+/*
+ * Remote object proxy.
+ *
+ * A proxy keeps a local copy of every readable property of one remote
+ * instance, keyed by "interface\x1fname". A single subscription to the
+ * instance's Observable "changed" event keeps the copy current.
+ *
+ * The subscription is made before the snapshot is read, so no change
+ * can fall in between. Keys touched by an event while a snapshot is
+ * in flight are recorded in rpx_pending, and the (older) snapshot
+ * value is discarded for them.
+ */
+
+struct rpc_proxy_watcher
+{
+	char *			rpw_interface;
+	char *			rpw_name;
+	rpc_proxy_handler_t	rpw_handler;
+};
+
+struct rpc_proxy
+{
+	rpc_connection_t	rpx_conn;
+	char *			rpx_path;
+	void *			rpx_subscription;
+	GRWLock			rpx_rwlock;
+	GHashTable *		rpx_values;
+	GHashTable *		rpx_pending;
+	GMutex			rpx_refresh_mtx;
+	GMutex			rpx_watch_mtx;
+	GPtrArray *		rpx_watchers;
+};
+
+static char *
+rpc_proxy_key(const char *interface, const char *name)
+{
+
+	return (g_strjoin("\x1f", interface, name, NULL));
+}
+
+static void
+rpc_proxy_notify(rpc_proxy_t proxy, const char *interface, const char *name,
+    rpc_object_t value)
+{
+	struct rpc_proxy_watcher *watcher;
+
+	g_mutex_lock(&proxy->rpx_watch_mtx);
+	for (guint i = 0; i < proxy->rpx_watchers->len; i++) {
+		watcher = g_ptr_array_index(proxy->rpx_watchers, i);
+		if (watcher->rpw_interface != NULL &&
+		    g_strcmp0(watcher->rpw_interface, interface) != 0)
+			continue;
+
+		if (watcher->rpw_name != NULL &&
+		    g_strcmp0(watcher->rpw_name, name) != 0)
+			continue;
+
+		watcher->rpw_handler(interface, name, value);
+	}
+	g_mutex_unlock(&proxy->rpx_watch_mtx);
+}
+
+static void
+rpc_proxy_notify_key(rpc_proxy_t proxy, const char *key, rpc_object_t value)
+{
+	char **parts;
+
+	parts = g_strsplit(key, "\x1f", 2);
+	if (parts[0] != NULL && parts[1] != NULL)
+		rpc_proxy_notify(proxy, parts[0], parts[1], value);
+
+	g_strfreev(parts);
+}
+
+static void
+rpc_proxy_changed(rpc_proxy_t proxy, rpc_object_t args)
+{
+	rpc_object_t old;
+	rpc_object_t value;
+	const char *interface;
+	const char *name;
+	char *key;
+	bool changed;
+
+	if (rpc_object_unpack(args, "{s,s,v}",
+	    "interface", &interface,
+	    "name", &name,
+	    "value", &value) < 3)
+		return;
+
+	key = rpc_proxy_key(interface, name);
+
+	g_rw_lock_writer_lock(&proxy->rpx_rwlock);
+	old = g_hash_table_lookup(proxy->rpx_values, key);
+	changed = old == NULL || !rpc_equal(old, value);
+	if (proxy->rpx_pending != NULL)
+		g_hash_table_add(proxy->rpx_pending, g_strdup(key));
+
+	g_hash_table_insert(proxy->rpx_values, key, rpc_retain(value));
+	g_rw_lock_writer_unlock(&proxy->rpx_rwlock);
+
+	if (changed)
+		rpc_proxy_notify(proxy, interface, name, value);
+}
+
+static int
+rpc_proxy_fetch(rpc_proxy_t proxy, GHashTable *snapshot)
+{
+	rpc_object_t interfaces;
+	__block int ret = 0;
+
+	interfaces = rpc_connection_call_syncp(proxy->rpx_conn,
+	    proxy->rpx_path, RPC_INTROSPECTABLE_INTERFACE, "get_interfaces",
+	    "[]");
+
+	if (interfaces == NULL)
+		return (-1);
+
+	if (rpc_is_error(interfaces)) {
+		rpc_set_last_rpc_error(interfaces);
+		rpc_release(interfaces);
+		return (-1);
+	}
+
+	rpc_array_apply(interfaces, ^(size_t idx __unused, rpc_object_t i) {
+		const char *interface = rpc_string_get_string_ptr(i);
+		rpc_object_t props;
+
+		if (interface == NULL)
+			return ((bool)true);
+
+		props = rpc_connection_call_syncp(proxy->rpx_conn,
+		    proxy->rpx_path, RPC_OBSERVABLE_INTERFACE, "get_all",
+		    "[s]", interface);
+
+		if (props == NULL) {
+			ret = -1;
+			return ((bool)false);
+		}
+
+		/* The interface may have gone away in the meantime */
+		if (rpc_is_error(props)) {
+			rpc_release(props);
+			return ((bool)true);
+		}
+
+		rpc_array_apply(props, ^(size_t pidx __unused,
+		    rpc_object_t prop) {
+			rpc_object_t value;
+			const char *name;
+
+			if (rpc_object_unpack(prop, "{s,v}",
+			    "name", &name,
+			    "value", &value) < 2)
+				return ((bool)true);
+
+			if (value == NULL || rpc_is_error(value))
+				return ((bool)true);
+
+			g_hash_table_insert(snapshot,
+			    rpc_proxy_key(interface, name), rpc_retain(value));
+			return ((bool)true);
+		});
+
+		rpc_release(props);
+		return ((bool)true);
+	});
+
+	rpc_release(interfaces);
+	return (ret);
+}
+
+rpc_proxy_t
+rpc_proxy_create(rpc_connection_t conn, const char *path)
+{
+	rpc_proxy_t proxy;
+
+	if (path == NULL) {
+		rpc_set_last_error(EINVAL, "Proxy path cannot be NULL", NULL);
+		return (NULL);
+	}
+
+	proxy = g_malloc0(sizeof(*proxy));
+	proxy->rpx_conn = conn;
+	proxy->rpx_path = g_strdup(path);
+	proxy->rpx_values = g_hash_table_new_full(g_str_hash, g_str_equal,
+	    g_free, (GDestroyNotify)rpc_release_impl);
+	proxy->rpx_watchers = g_ptr_array_new();
+	g_rw_lock_init(&proxy->rpx_rwlock);
+	g_mutex_init(&proxy->rpx_refresh_mtx);
+	g_mutex_init(&proxy->rpx_watch_mtx);
+	rpc_connection_retain(conn);
+
+	proxy->rpx_subscription = rpc_connection_register_event_handler(conn,
+	    path, RPC_OBSERVABLE_INTERFACE, "changed",
+	    ^(const char *_p __unused, const char *_i __unused,
+	    const char *_n __unused, rpc_object_t args) {
+		rpc_proxy_changed(proxy, args);
+	    });
+
+	if (proxy->rpx_subscription == NULL) {
+		rpc_proxy_free(proxy);
+		return (NULL);
+	}
+
+	if (rpc_proxy_refresh(proxy) != 0) {
+		rpc_proxy_free(proxy);
+		return (NULL);
+	}
+
+	return (proxy);
+}
+
+static void
+rpc_proxy_clear_watchers(rpc_proxy_t proxy)
+{
+	struct rpc_proxy_watcher *watcher;
+
+	g_mutex_lock(&proxy->rpx_watch_mtx);
+	for (guint i = 0; i < proxy->rpx_watchers->len; i++) {
+		watcher = g_ptr_array_index(proxy->rpx_watchers, i);
+		Block_release(watcher->rpw_handler);
+		g_free(watcher->rpw_interface);
+		g_free(watcher->rpw_name);
+		g_free(watcher);
+	}
+
+	g_ptr_array_set_size(proxy->rpx_watchers, 0);
+	g_mutex_unlock(&proxy->rpx_watch_mtx);
+}
+
+void
+rpc_proxy_free(rpc_proxy_t proxy)
+{
+	rpc_object_t error;
+	bool subscribed = proxy->rpx_subscription != NULL;
+
+	/* A handler that is being dispatched right now keeps it busy */
+	while (subscribed) {
+		if (rpc_connection_unregister_event_handler(proxy->rpx_conn,
+		    proxy->rpx_subscription) == 0) {
+			subscribed = false;
+			break;
+		}
+
+		error = rpc_get_last_error();
+		if (error == NULL || rpc_error_get_code(error) != EBUSY)
+			break;
+
+		g_usleep(PROXY_UNSUBSCRIBE_RETRY);
+	}
+
+	rpc_proxy_clear_watchers(proxy);
+
+	/*
+	 * The handler could not be removed and still refers to the proxy,
+	 * so the proxy must outlive it. With no watchers left it only
+	 * keeps its value table current until the connection goes away.
+	 */
+	if (subscribed)
+		return;
+
+	g_ptr_array_free(proxy->rpx_watchers, true);
+	g_hash_table_destroy(proxy->rpx_values);
+	g_rw_lock_clear(&proxy->rpx_rwlock);
+	g_mutex_clear(&proxy->rpx_refresh_mtx);
+	g_mutex_clear(&proxy->rpx_watch_mtx);
+	rpc_connection_release(proxy->rpx_conn);
+	g_free(proxy->rpx_path);
+	g_free(proxy);
+}
+
+int
+rpc_proxy_refresh(rpc_proxy_t proxy)
+{
+	GHashTableIter iter;
+	GHashTable *snapshot;
+	GPtrArray *changed;
+	rpc_object_t old;
+	rpc_object_t value;
+	char *key;
+	int ret;
+
+	snapshot = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+	    (GDestroyNotify)rpc_release_impl);
+	changed = g_ptr_array_new_with_free_func(g_free);
+
+	g_mutex_lock(&proxy->rpx_refresh_mtx);
+	g_rw_lock_writer_lock(&proxy->rpx_rwlock);
+	proxy->rpx_pending = g_hash_table_new_full(g_str_hash, g_str_equal,
+	    g_free, NULL);
+	g_rw_lock_writer_unlock(&proxy->rpx_rwlock);
+
+	ret = rpc_proxy_fetch(proxy, snapshot);
+
+	g_rw_lock_writer_lock(&proxy->rpx_rwlock);
+	if (ret == 0) {
+		/* Drop properties that are no longer there */
+		g_hash_table_iter_init(&iter, proxy->rpx_values);
+		while (g_hash_table_iter_next(&iter, (gpointer)&key, NULL)) {
+			if (!g_hash_table_contains(snapshot, key) &&
+			    !g_hash_table_contains(proxy->rpx_pending, key))
+				g_hash_table_iter_remove(&iter);
+		}
+
+		g_hash_table_iter_init(&iter, snapshot);
+		while (g_hash_table_iter_next(&iter, (gpointer)&key,
+		    (gpointer)&value)) {
+			if (g_hash_table_contains(proxy->rpx_pending, key))
+				continue;
+
+			old = g_hash_table_lookup(proxy->rpx_values, key);
+			if (old != NULL && rpc_equal(old, value))
+				continue;
+
+			g_ptr_array_add(changed, g_strdup(key));
+			g_hash_table_insert(proxy->rpx_values, g_strdup(key),
+			    rpc_retain(value));
+		}
+	}
+
+	g_hash_table_destroy(proxy->rpx_pending);
+	proxy->rpx_pending = NULL;
+	g_rw_lock_writer_unlock(&proxy->rpx_rwlock);
+	g_mutex_unlock(&proxy->rpx_refresh_mtx);
+
+	for (guint i = 0; i < changed->len; i++) {
+		key = g_ptr_array_index(changed, i);
+		rpc_proxy_notify_key(proxy, key,
+		    g_hash_table_lookup(snapshot, key));
+	}
+
+	g_ptr_array_free(changed, true);
+	g_hash_table_destroy(snapshot);
+	return (ret);
+}
+
+rpc_object_t
+rpc_proxy_get(rpc_proxy_t proxy, const char *interface, const char *name)
+{
+	rpc_object_t result;
+	char *key;
+
+	key = rpc_proxy_key(interface, name);
+	g_rw_lock_reader_lock(&proxy->rpx_rwlock);
+	result = g_hash_table_lookup(proxy->rpx_values, key);
+	if (result != NULL)
+		rpc_retain(result);
+	g_rw_lock_reader_unlock(&proxy->rpx_rwlock);
+	g_free(key);
+
+	if (result == NULL)
+		rpc_set_last_error(ENOENT, "Property not found", NULL);
+
+	return (result);
+}
+
+void *
+rpc_proxy_watch(rpc_proxy_t proxy, const char *interface, const char *name,
+    rpc_proxy_handler_t handler)
+{
+	struct rpc_proxy_watcher *watcher;
+
+	watcher = g_malloc0(sizeof(*watcher));
+	watcher->rpw_interface = g_strdup(interface);
+	watcher->rpw_name = g_strdup(name);
+	watcher->rpw_handler = Block_copy(handler);
+
+	g_mutex_lock(&proxy->rpx_watch_mtx);
+	g_ptr_array_add(proxy->rpx_watchers, watcher);
+	g_mutex_unlock(&proxy->rpx_watch_mtx);
+	return (watcher);
+}
+
+void
+rpc_proxy_unwatch(rpc_proxy_t proxy, void *cookie)
+{
+	struct rpc_proxy_watcher *watcher = cookie;
+	bool found;
+
+	g_mutex_lock(&proxy->rpx_watch_mtx);
+	found = g_ptr_array_remove(proxy->rpx_watchers, watcher);
+	g_mutex_unlock(&proxy->rpx_watch_mtx);
+
+	if (!found)
+		return;
+
+	Block_release(watcher->rpw_handler);
+	g_free(watcher->rpw_interface);
+	g_free(watcher->rpw_name);
+	g_free(watcher);
+}
@@ -34,7 +34,150 @@
 #endif
 #include "internal.h"
 
-static bool eval_rule(rpc_object_t obj, rpc_object_t rule);
+#define	RPC_QUERY_PARALLEL_MIN	4096
+
+static GMutex rpc_query_pool_mtx;
+static GThreadPool *rpc_query_pool;
+
+/*
+ * Compiled query plans.
+ *
+ * Rules are translated once into a tree of nodes: logic operators
+ * become AND/OR/NOR nodes with their operands ordered cheapest first,
+ * field operators get an operator enum, a pre-split path and, where
+ * applicable, a precomputed hash of the constant operand or a compiled
+ * regular expression. Malformed rules compile into a node that never
+ * matches.
+ *
+ * Plans are immutable once built, so one plan can be matched against
+ * objects from any number of threads at a time.
+ */
+
+enum rpc_query_op
+{
+	RPC_QUERY_OP_FALSE,
+	RPC_QUERY_OP_ALL,
+	RPC_QUERY_OP_AND,
+	RPC_QUERY_OP_OR,
+	RPC_QUERY_OP_NOR,
+	RPC_QUERY_OP_EQ,
+	RPC_QUERY_OP_NE,
+	RPC_QUERY_OP_GT,
+	RPC_QUERY_OP_LT,
+	RPC_QUERY_OP_GE,
+	RPC_QUERY_OP_LE,
+	RPC_QUERY_OP_REGEX,
+	RPC_QUERY_OP_IN,
+	RPC_QUERY_OP_NIN,
+	RPC_QUERY_OP_MATCH
+};
+
+struct rpc_query_segment
+{
+	char *			rqs_key;
+	size_t			rqs_idx;
+};
+
+struct rpc_query_node
+{
+	enum rpc_query_op	rqn_op;
+	unsigned int		rqn_cost;
+	bool			rqn_has_path;
+	char *			rqn_path_str;
+	struct rpc_query_segment *rqn_path;
+	size_t			rqn_path_len;
+	rpc_object_t		rqn_value;
+	rpc_type_t		rqn_type;
+	int			rqn_hash;
+	GRegex *		rqn_regex;
+	struct rpc_query_node **rqn_children;
+	size_t			rqn_nchildren;
+};
+
+struct rpc_query_plan
+{
+	volatile int		rqp_refcnt;
+	struct rpc_query_node *	rqp_root;
+};
+
+/* Completion of the slices handed to the pool by one query */
+struct rpc_query_join
+{
+	GMutex			rqj_mtx;
+	GCond			rqj_cv;
+	size_t			rqj_pending;
+};
+
+/* Slice of the source evaluated by one rpc_query_parallel() worker */
+struct rpc_query_chunk
+{
+	rpc_query_iter_t	rqc_iter;
+	struct rpc_query_join *	rqc_join;
+	size_t			rqc_start;
+	size_t			rqc_end;
+	GArray *		rqc_matches;
+};
+
+/*
+ * Secondary indexes.
+ *
+ * An index is attached to the array it was built over (ro_indexes) and
+ * maps the value found under its path in each element to the element
+ * positions. Hash indexes key on the value itself (rpc_hash() and
+ * rpc_equal()), sorted ones on its hash, which is what the ordering
+ * operators compare.
+ *
+ * Appending, replacing and removing elements update indexes in place;
+ * a removal also moves the positions past it down by one. Anything
+ * that reorders elements marks them stale instead, and they are
+ * rebuilt the next time a query uses them.
+ *
+ * rqx_lock guards the index contents. Queries hold it as readers while
+ * collecting candidates; a query that finds the index stale rebuilds
+ * it as a writer first, so concurrent queries never see it half built.
+ */
+
+struct rpc_query_index_entry
+{
+	int			rqe_hash;
+	int64_t			rqe_pos;
+};
+
+struct rpc_query_index
+{
+	volatile int		rqx_refcnt;
+	rpc_object_t		rqx_array;
+	rpc_query_index_type_t	rqx_type;
+	struct rpc_query_node *	rqx_key;
+	GHashTable *		rqx_hash;
+	GSequence *		rqx_sorted;
+	bool			rqx_stale;
+	GRWLock			rqx_lock;
+};
+
+static const struct {
+	const char *		name;
+	enum rpc_query_op	op;
+	unsigned int		cost;
+} rpc_query_ops[] = {
+	{ "=", RPC_QUERY_OP_EQ, 1 },
+	{ "!=", RPC_QUERY_OP_NE, 1 },
+	{ ">", RPC_QUERY_OP_GT, 1 },
+	{ "<", RPC_QUERY_OP_LT, 1 },
+	{ ">=", RPC_QUERY_OP_GE, 1 },
+	{ "<=", RPC_QUERY_OP_LE, 1 },
+	{ "in", RPC_QUERY_OP_IN, 4 },
+	{ "contains", RPC_QUERY_OP_IN, 4 },
+	{ "nin", RPC_QUERY_OP_NIN, 4 },
+	{ "ncontains", RPC_QUERY_OP_NIN, 4 },
+#ifndef _WIN32
+	{ "match", RPC_QUERY_OP_MATCH, 8 },
+#endif
+	{ "~", RPC_QUERY_OP_REGEX, 16 },
+	{ NULL, RPC_QUERY_OP_FALSE, 0 }
+};
+
+static struct rpc_query_node *rpc_query_compile_rule(rpc_object_t rule);
 
 static rpc_object_t
 rpc_query_get_parent(rpc_object_t object, const char *path,
@@ -62,86 +205,269 @@ rpc_query_get_parent(rpc_object_t object, const char *path,
 	return (parent);
 }
 
-static bool
-eval_logic_and(rpc_object_t obj, rpc_object_t lst)
+static struct rpc_query_node *
+rpc_query_node_new(enum rpc_query_op op)
 {
-	__block bool result = false;
+	struct rpc_query_node *node;
 
-	if (rpc_get_type(lst) != RPC_TYPE_ARRAY)
-		return (false);
+	node = g_malloc0(sizeof(*node));
+	node->rqn_op = op;
+	node->rqn_cost = 1;
+	return (node);
+}
+
+static void
+rpc_query_node_free(struct rpc_query_node *node)
+{
+	size_t i;
 
-	rpc_array_apply(lst, ^(size_t idx __unused, rpc_object_t v) {
-		result = eval_rule(obj, v);
-		return ((bool)result);
-	});
+	for (i = 0; i < node->rqn_nchildren; i++)
+		rpc_query_node_free(node->rqn_children[i]);
 
-	return (result);
+	for (i = 0; i < node->rqn_path_len; i++)
+		g_free(node->rqn_path[i].rqs_key);
+
+	if (node->rqn_regex != NULL)
+		g_regex_unref(node->rqn_regex);
+
+	rpc_release(node->rqn_value);
+	g_free(node->rqn_children);
+	g_free(node->rqn_path_str);
+	g_free(node->rqn_path);
+	g_free(node);
 }
 
-static bool
-eval_logic_or(rpc_object_t obj, rpc_object_t lst)
+static int
+rpc_query_node_cmp(const void *a, const void *b)
+{
+	const struct rpc_query_node *n1 = *(struct rpc_query_node *const *)a;
+	const struct rpc_query_node *n2 = *(struct rpc_query_node *const *)b;
+
+	if (n1->rqn_cost == n2->rqn_cost)
+		return (0);
+
+	return (n1->rqn_cost < n2->rqn_cost ? -1 : 1);
+}
+
+static struct rpc_query_node *
+rpc_query_compile_list(enum rpc_query_op op, rpc_object_t lst)
 {
-	__block bool result = false;
+	struct rpc_query_node *node;
+	size_t i;
 
 	if (rpc_get_type(lst) != RPC_TYPE_ARRAY)
-		return (false);
+		return (rpc_query_node_new(RPC_QUERY_OP_FALSE));
 
-	rpc_array_apply(lst, ^(size_t idx __unused, rpc_object_t v) {
-	    result = eval_rule(obj, v);
-	    return ((bool)!result);
-	});
+	node = rpc_query_node_new(op);
+	node->rqn_nchildren = rpc_array_get_count(lst);
+	node->rqn_children = g_new0(struct rpc_query_node *,
+	    node->rqn_nchildren);
 
-	return (result);
+	for (i = 0; i < node->rqn_nchildren; i++) {
+		node->rqn_children[i] = rpc_query_compile_rule(
+		    rpc_array_get_value(lst, i));
+		node->rqn_cost += node->rqn_children[i]->rqn_cost;
+	}
+
+	/* Operands have no side effects, so cheap ones can go first */
+	qsort(node->rqn_children, node->rqn_nchildren,
+	    sizeof(*node->rqn_children), rpc_query_node_cmp);
+
+	return (node);
 }
 
-static bool
-eval_logic_nor(rpc_object_t obj, rpc_object_t lst)
+static void
+rpc_query_compile_path(struct rpc_query_node *node, const char *path)
 {
-	__block bool result = false;
+	char **tokens;
+	size_t i;
 
-	if (rpc_get_type(lst) != RPC_TYPE_ARRAY)
-		return (false);
+	if (path == NULL)
+		return;
 
-	rpc_array_apply(lst, ^(size_t idx __unused, rpc_object_t v) {
-	    result = !eval_rule(obj, v);
-	    return ((bool)result);
-	});
+	tokens = g_strsplit(path, ".", 0);
+	node->rqn_has_path = true;
+	node->rqn_path_str = g_strdup(path);
+	node->rqn_path = g_new0(struct rpc_query_segment,
+	    g_strv_length(tokens));
+
+	/* Same as the strtok() loop in rpc_query_get(): skip empty tokens */
+	for (i = 0; tokens[i] != NULL; i++) {
+		if (*tokens[i] == '\0')
+			continue;
+
+		node->rqn_path[node->rqn_path_len].rqs_key =
+		    g_strdup(tokens[i]);
+		node->rqn_path[node->rqn_path_len].rqs_idx =
+		    (size_t)atoi(tokens[i]);
+		node->rqn_path_len++;
+	}
 
-	return (result);
+	g_strfreev(tokens);
 }
 
-static bool
-eval_logic_operator(rpc_object_t obj, rpc_object_t rule)
+static struct rpc_query_node *
+rpc_query_compile_field(rpc_object_t rule)
 {
+	struct rpc_query_node *node;
 	const char *op;
-	rpc_object_t lst;
+	rpc_object_t right;
+	size_t i;
+
+	op = rpc_array_get_string(rule, 1);
+	right = rpc_array_get_value(rule, 2);
+
+	for (i = 0; rpc_query_ops[i].name != NULL; i++) {
+		if (g_strcmp0(op, rpc_query_ops[i].name) == 0)
+			break;
+	}
+
+	if (rpc_query_ops[i].name == NULL)
+		return (rpc_query_node_new(RPC_QUERY_OP_FALSE));
+
+	switch (rpc_query_ops[i].op) {
+	case RPC_QUERY_OP_REGEX:
+	case RPC_QUERY_OP_MATCH:
+		if (rpc_get_type(right) != RPC_TYPE_STRING)
+			return (rpc_query_node_new(RPC_QUERY_OP_FALSE));
+		break;
+
+	default:
+		break;
+	}
+
+	node = rpc_query_node_new(rpc_query_ops[i].op);
+	node->rqn_cost = rpc_query_ops[i].cost;
+	node->rqn_value = rpc_retain(right);
+	node->rqn_type = rpc_get_type(right);
+	rpc_query_compile_path(node, rpc_array_get_string(rule, 0));
+
+	switch (node->rqn_op) {
+	case RPC_QUERY_OP_NE:
+	case RPC_QUERY_OP_GT:
+	case RPC_QUERY_OP_LT:
+	case RPC_QUERY_OP_GE:
+	case RPC_QUERY_OP_LE:
+		/* Ordering is by hash, as in rpc_cmp(); this one is fixed */
+		node->rqn_hash = (int)rpc_hash(right);
+		break;
+
+	case RPC_QUERY_OP_REGEX:
+		node->rqn_regex = rpc_regex_get(
+		    rpc_string_get_string_ptr(right));
+		if (node->rqn_regex == NULL) {
+			rpc_query_node_free(node);
+			return (rpc_query_node_new(RPC_QUERY_OP_FALSE));
+		}
+		break;
+
+	default:
+		break;
+	}
+
+	return (node);
+}
+
+static struct rpc_query_node *
+rpc_query_compile_rule(rpc_object_t rule)
+{
 	rpc_object_t op_val;
+	const char *op;
 
 	if (rpc_get_type(rule) != RPC_TYPE_ARRAY)
-		return (false);
+		return (rpc_query_node_new(RPC_QUERY_OP_FALSE));
 
-	op_val = rpc_array_get_value(rule, 0);
-	if (rpc_get_type(op_val) == RPC_TYPE_ARRAY)
-		return (eval_logic_and(obj, rule));
+	switch (rpc_array_get_count(rule)) {
+	case 2:
+		op_val = rpc_array_get_value(rule, 0);
+		if (rpc_get_type(op_val) == RPC_TYPE_ARRAY)
+			return (rpc_query_compile_list(RPC_QUERY_OP_AND, rule));
+
+		op = rpc_string_get_string_ptr(op_val);
+		if (!g_strcmp0(op, "or")) {
+			return (rpc_query_compile_list(RPC_QUERY_OP_OR,
+			    rpc_array_get_value(rule, 1)));
+		}
 
-	op = rpc_string_get_string_ptr(op_val);
-	lst = rpc_array_get_value(rule, 1);
+		if (!g_strcmp0(op, "and")) {
+			return (rpc_query_compile_list(RPC_QUERY_OP_AND,
+			    rpc_array_get_value(rule, 1)));
+		}
 
-	if (!g_strcmp0(op, "or"))
-		return (eval_logic_or(obj, lst));
+		if (!g_strcmp0(op, "nor")) {
+			return (rpc_query_compile_list(RPC_QUERY_OP_NOR,
+			    rpc_array_get_value(rule, 1)));
+		}
 
-	if (!g_strcmp0(op, "and"))
-		return (eval_logic_and(obj, lst));
+		return (rpc_query_node_new(RPC_QUERY_OP_FALSE));
 
-	if (!g_strcmp0(op, "nor"))
-		return (eval_logic_nor(obj, lst));
+	case 3:
+		return (rpc_query_compile_field(rule));
 
-	return (false);
+	default:
+		return (rpc_query_node_new(RPC_QUERY_OP_FALSE));
+	}
+}
+
+static rpc_query_plan_t
+rpc_query_compile_impl(rpc_object_t rules)
+{
+	rpc_query_plan_t plan;
+
+	plan = g_malloc0(sizeof(*plan));
+	plan->rqp_refcnt = 1;
+
+	/* Top-level rules are ANDed, and an empty set matches everything */
+	if (rpc_get_type(rules) == RPC_TYPE_ARRAY) {
+		plan->rqp_root = rpc_query_compile_list(RPC_QUERY_OP_ALL,
+		    rules);
+	} else
+		plan->rqp_root = rpc_query_node_new(RPC_QUERY_OP_FALSE);
+
+	return (plan);
+}
+
+static rpc_query_plan_t
+rpc_query_plan_retain(rpc_query_plan_t plan)
+{
+
+	g_atomic_int_inc(&plan->rqp_refcnt);
+	return (plan);
+}
+
+static rpc_object_t
+rpc_query_resolve(struct rpc_query_node *node, rpc_object_t obj)
+{
+	rpc_object_t leaf = obj;
+	size_t i;
+
+	if (!node->rqn_has_path)
+		return (NULL);
+
+	for (i = 0; i < node->rqn_path_len && leaf != NULL; i++) {
+		switch (leaf->ro_type) {
+		case RPC_TYPE_DICTIONARY:
+			leaf = g_hash_table_lookup(leaf->ro_value.rv_dict,
+			    node->rqn_path[i].rqs_key);
+			break;
+
+		case RPC_TYPE_ARRAY:
+			leaf = rpc_array_get_value(leaf,
+			    node->rqn_path[i].rqs_idx);
+			break;
+
+		default:
+			return (NULL);
+		}
+	}
+
+	return (leaf);
 }
 
 static bool
-op_in(rpc_object_t o1, rpc_object_t o2)
+rpc_query_in(rpc_object_t o1, rpc_object_t o2)
 {
+
 	if (rpc_get_type(o2) == RPC_TYPE_ARRAY)
 		return (rpc_array_contains(o2, o1));
 
@@ -152,128 +478,618 @@ op_in(rpc_object_t o1, rpc_object_t o2)
 }
 
 static bool
-eval_field_operator(rpc_object_t obj, rpc_object_t rule)
+rpc_query_eval_field(struct rpc_query_node *node, rpc_object_t item)
 {
-	const char *left;
-	const char *op;
-	rpc_object_t right;
-	rpc_object_t item;
-
-	if (rpc_get_type(rule) != RPC_TYPE_ARRAY)
-		return (false);
 
-	left = rpc_array_get_string(rule, 0);
-	op = rpc_array_get_string(rule, 1);
-	right = rpc_array_get_value(rule, 2);
+	/* A missing field satisfies only the negative operators */
+	if (item == NULL)
+		return (node->rqn_op == RPC_QUERY_OP_NE ||
+		    node->rqn_op == RPC_QUERY_OP_NIN);
 
-	item = rpc_query_get(obj, left, NULL);
-
-	if (!g_strcmp0(op, "="))
-		return (rpc_equal(item, right));
+	switch (node->rqn_op) {
+	case RPC_QUERY_OP_EQ:
+		if (item->ro_type != node->rqn_type)
+			return (false);
 
-	if (!g_strcmp0(op, "!="))
-		return (rpc_cmp(item, right) != 0);
+		return (rpc_equal(item, node->rqn_value));
 
-	if (!g_strcmp0(op, ">"))
-		return (rpc_cmp(item, right) > 0);
+	case RPC_QUERY_OP_NE:
+		return ((int)rpc_hash(item) != node->rqn_hash);
 
-	if (!g_strcmp0(op, "<"))
-		return (rpc_cmp(item, right) < 0);
+	case RPC_QUERY_OP_GT:
+		return ((int)rpc_hash(item) > node->rqn_hash);
 
-	if (!g_strcmp0(op, ">="))
-		return (rpc_cmp(item, right) >= 0);
+	case RPC_QUERY_OP_LT:
+		return ((int)rpc_hash(item) < node->rqn_hash);
 
-	if (!g_strcmp0(op, "<="))
-		return (rpc_cmp(item, right) <= 0);
+	case RPC_QUERY_OP_GE:
+		return ((int)rpc_hash(item) >= node->rqn_hash);
 
-	if (!g_strcmp0(op, "~")) {
-		if (rpc_get_type(right) != RPC_TYPE_STRING)
-			return (false);
+	case RPC_QUERY_OP_LE:
+		return ((int)rpc_hash(item) <= node->rqn_hash);
 
-		if (rpc_get_type(item) != RPC_TYPE_STRING)
+	case RPC_QUERY_OP_REGEX:
+		if (item->ro_type != RPC_TYPE_STRING)
 			return (false);
 
-		return ((bool)g_regex_match_simple(
-		    rpc_string_get_string_ptr(right),
-		    rpc_string_get_string_ptr(item), 0, 0));
-
-	}
+		return ((bool)g_regex_match(node->rqn_regex,
+		    item->ro_value.rv_str->str, 0, NULL));
 
-	if ((!g_strcmp0(op, "in")) || (!g_strcmp0(op, "contains")))
-		return (op_in(item, right));
+	case RPC_QUERY_OP_IN:
+		return (rpc_query_in(item, node->rqn_value));
 
-	if ((!g_strcmp0(op, "nin")) || (!g_strcmp0(op, "ncontains")))
-		return (!op_in(item, right));
+	case RPC_QUERY_OP_NIN:
+		return (!rpc_query_in(item, node->rqn_value));
 
 #ifndef _WIN32
-	if (!g_strcmp0(op, "match")) {
-		if (rpc_get_type(right) != RPC_TYPE_STRING)
-			return (false);
-
-		if (rpc_get_type(item) != RPC_TYPE_STRING)
+	case RPC_QUERY_OP_MATCH:
+		if (item->ro_type != RPC_TYPE_STRING)
 			return (false);
 
-		return (fnmatch(rpc_string_get_string_ptr(right),
-		    rpc_string_get_string_ptr(item), 0) == 0);
-	}
+		return (fnmatch(rpc_string_get_string_ptr(node->rqn_value),
+		    item->ro_value.rv_str->str, 0) == 0);
 #endif
 
-	return (false);
+	default:
+		return (false);
+	}
 }
 
 static bool
-eval_rule(rpc_object_t obj, rpc_object_t rule)
+rpc_query_eval(struct rpc_query_node *node, rpc_object_t obj)
 {
-	if (rpc_get_type(rule) != RPC_TYPE_ARRAY)
+	size_t i;
+
+	switch (node->rqn_op) {
+	case RPC_QUERY_OP_FALSE:
 		return (false);
 
-	switch (rule->ro_value.rv_list->len) {
-	case 2:
-		return (eval_logic_operator(obj, rule));
-	case 3:
-		return (eval_field_operator(obj, rule));
-	default:
+	case RPC_QUERY_OP_ALL:
+		for (i = 0; i < node->rqn_nchildren; i++) {
+			if (!rpc_query_eval(node->rqn_children[i], obj))
+				return (false);
+		}
+
+		return (true);
+
+	case RPC_QUERY_OP_AND:
+		for (i = 0; i < node->rqn_nchildren; i++) {
+			if (!rpc_query_eval(node->rqn_children[i], obj))
+				return (false);
+		}
+
+		return (node->rqn_nchildren > 0);
+
+	case RPC_QUERY_OP_OR:
+		for (i = 0; i < node->rqn_nchildren; i++) {
+			if (rpc_query_eval(node->rqn_children[i], obj))
+				return (true);
+		}
+
 		return (false);
+
+	case RPC_QUERY_OP_NOR:
+		for (i = 0; i < node->rqn_nchildren; i++) {
+			if (rpc_query_eval(node->rqn_children[i], obj))
+				return (false);
+		}
+
+		return (node->rqn_nchildren > 0);
+
+	default:
+		return (rpc_query_eval_field(node,
+		    rpc_query_resolve(node, obj)));
 	}
 }
 
-static rpc_object_t
-rpc_query_steal_apply(rpc_object_t object, rpc_object_t rules)
+static guint
+rpc_query_index_hash(gconstpointer key)
 {
-	__block bool fail = false;
 
-	if (object == NULL)
+	return ((guint)rpc_hash((rpc_object_t)key));
+}
+
+static gboolean
+rpc_query_index_equal(gconstpointer a, gconstpointer b)
+{
+
+	return (rpc_equal((rpc_object_t)a, (rpc_object_t)b));
+}
+
+static void
+rpc_query_index_bucket_free(GArray *bucket)
+{
+
+	g_array_free(bucket, true);
+}
+
+static gint
+rpc_query_index_entry_cmp(gconstpointer a, gconstpointer b,
+    gpointer data __unused)
+{
+	const struct rpc_query_index_entry *e1 = a;
+	const struct rpc_query_index_entry *e2 = b;
+
+	if (e1->rqe_hash != e2->rqe_hash)
+		return (e1->rqe_hash < e2->rqe_hash ? -1 : 1);
+
+	if (e1->rqe_pos == e2->rqe_pos)
+		return (0);
+
+	return (e1->rqe_pos < e2->rqe_pos ? -1 : 1);
+}
+
+static gint
+rpc_query_pos_cmp(gconstpointer a, gconstpointer b)
+{
+	size_t p1 = *(const size_t *)a;
+	size_t p2 = *(const size_t *)b;
+
+	if (p1 == p2)
+		return (0);
+
+	return (p1 < p2 ? -1 : 1);
+}
+
+/* Position of the first bucket item not smaller than pos */
+static guint
+rpc_query_bucket_find(GArray *bucket, size_t pos)
+{
+	guint lo = 0;
+	guint hi = bucket->len;
+	guint mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (g_array_index(bucket, size_t, mid) < pos)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return (lo);
+}
+
+static void
+rpc_query_index_add(rpc_query_index_t index, size_t pos, rpc_object_t elem)
+{
+	struct rpc_query_index_entry *entry;
+	rpc_object_t key;
+	GArray *bucket;
+
+	key = rpc_query_resolve(index->rqx_key, elem);
+	if (key == NULL)
+		return;
+
+	if (index->rqx_type == RPC_QUERY_INDEX_SORTED) {
+		entry = g_malloc(sizeof(*entry));
+		entry->rqe_hash = (int)rpc_hash(key);
+		entry->rqe_pos = (int64_t)pos;
+		g_sequence_insert_sorted(index->rqx_sorted, entry,
+		    rpc_query_index_entry_cmp, NULL);
+		return;
+	}
+
+	bucket = g_hash_table_lookup(index->rqx_hash, key);
+	if (bucket == NULL) {
+		bucket = g_array_new(false, false, sizeof(size_t));
+		g_hash_table_insert(index->rqx_hash, rpc_retain(key), bucket);
+	}
+
+	g_array_insert_val(bucket, rpc_query_bucket_find(bucket, pos), pos);
+}
+
+static void
+rpc_query_index_del(rpc_query_index_t index, size_t pos, rpc_object_t elem)
+{
+	struct rpc_query_index_entry probe;
+	GSequenceIter *iter;
+	rpc_object_t key;
+	GArray *bucket;
+	guint i;
+
+	key = rpc_query_resolve(index->rqx_key, elem);
+	if (key == NULL)
+		return;
+
+	if (index->rqx_type == RPC_QUERY_INDEX_SORTED) {
+		probe.rqe_hash = (int)rpc_hash(key);
+		probe.rqe_pos = (int64_t)pos;
+		iter = g_sequence_lookup(index->rqx_sorted, &probe,
+		    rpc_query_index_entry_cmp, NULL);
+		if (iter != NULL)
+			g_sequence_remove(iter);
+
+		return;
+	}
+
+	bucket = g_hash_table_lookup(index->rqx_hash, key);
+	if (bucket == NULL)
+		return;
+
+	i = rpc_query_bucket_find(bucket, pos);
+	if (i < bucket->len && g_array_index(bucket, size_t, i) == pos)
+		g_array_remove_index(bucket, i);
+
+	if (bucket->len == 0)
+		g_hash_table_remove(index->rqx_hash, key);
+}
+
+/* Closes the gap left by the element removed from pos */
+static void
+rpc_query_index_shift(rpc_query_index_t index, size_t pos)
+{
+	struct rpc_query_index_entry *entry;
+	GHashTableIter hiter;
+	GSequenceIter *iter;
+	GArray *bucket;
+	guint i;
+
+	/* Entries keep their relative order, so nothing is resorted */
+	if (index->rqx_type == RPC_QUERY_INDEX_SORTED) {
+		iter = g_sequence_get_begin_iter(index->rqx_sorted);
+		for (; !g_sequence_iter_is_end(iter);
+		    iter = g_sequence_iter_next(iter)) {
+			entry = g_sequence_get(iter);
+			if (entry->rqe_pos > (int64_t)pos)
+				entry->rqe_pos--;
+		}
+
+		return;
+	}
+
+	g_hash_table_iter_init(&hiter, index->rqx_hash);
+	while (g_hash_table_iter_next(&hiter, NULL, (gpointer *)&bucket)) {
+		i = rpc_query_bucket_find(bucket, pos + 1);
+		for (; i < bucket->len; i++)
+			g_array_index(bucket, size_t, i)--;
+	}
+}
+
+static void
+rpc_query_index_refresh_locked(rpc_query_index_t index)
+{
+	rpc_object_t array = index->rqx_array;
+	size_t i;
+
+	if (!index->rqx_stale || array == NULL)
+		return;
+
+	if (index->rqx_type == RPC_QUERY_INDEX_SORTED) {
+		g_sequence_remove_range(
+		    g_sequence_get_begin_iter(index->rqx_sorted),
+		    g_sequence_get_end_iter(index->rqx_sorted));
+	} else
+		g_hash_table_remove_all(index->rqx_hash);
+
+	for (i = 0; i < rpc_array_get_count(array); i++)
+		rpc_query_index_add(index, i, rpc_array_get_value(array, i));
+
+	index->rqx_stale = false;
+}
+
+/* Takes the reader lock on an index that is up to date */
+static void
+rpc_query_index_lock(rpc_query_index_t index)
+{
+
+	for (;;) {
+		g_rw_lock_reader_lock(&index->rqx_lock);
+		if (!index->rqx_stale || index->rqx_array == NULL)
+			return;
+
+		/* Somebody may get to it first; check again as a reader */
+		g_rw_lock_reader_unlock(&index->rqx_lock);
+		g_rw_lock_writer_lock(&index->rqx_lock);
+		rpc_query_index_refresh_locked(index);
+		g_rw_lock_writer_unlock(&index->rqx_lock);
+	}
+}
+
+static void
+rpc_query_index_release(rpc_query_index_t index)
+{
+
+	if (!g_atomic_int_dec_and_test(&index->rqx_refcnt))
+		return;
+
+	g_rw_lock_clear(&index->rqx_lock);
+
+	if (index->rqx_hash != NULL)
+		g_hash_table_destroy(index->rqx_hash);
+
+	if (index->rqx_sorted != NULL)
+		g_sequence_free(index->rqx_sorted);
+
+	rpc_query_node_free(index->rqx_key);
+	g_free(index);
+}
+
+void
+rpc_query_index_appended(rpc_object_t array)
+{
+	rpc_query_index_t index;
+	size_t pos;
+
+	pos = rpc_array_get_count(array) - 1;
+	for (GSList *l = array->ro_indexes; l != NULL; l = l->next) {
+		index = l->data;
+		g_rw_lock_writer_lock(&index->rqx_lock);
+		if (!index->rqx_stale) {
+			rpc_query_index_add(index, pos,
+			    rpc_array_get_value(array, pos));
+		}
+		g_rw_lock_writer_unlock(&index->rqx_lock);
+	}
+}
+
+void
+rpc_query_index_replaced(rpc_object_t array, size_t pos, rpc_object_t old,
+    rpc_object_t value)
+{
+	rpc_query_index_t index;
+
+	for (GSList *l = array->ro_indexes; l != NULL; l = l->next) {
+		index = l->data;
+		g_rw_lock_writer_lock(&index->rqx_lock);
+		if (!index->rqx_stale) {
+			rpc_query_index_del(index, pos, old);
+			rpc_query_index_add(index, pos, value);
+		}
+		g_rw_lock_writer_unlock(&index->rqx_lock);
+	}
+}
+
+void
+rpc_query_index_removed(rpc_object_t array, size_t pos)
+{
+	rpc_query_index_t index;
+	bool last;
+
+	last = pos + 1 == rpc_array_get_count(array);
+	for (GSList *l = array->ro_indexes; l != NULL; l = l->next) {
+		index = l->data;
+		g_rw_lock_writer_lock(&index->rqx_lock);
+		if (!index->rqx_stale) {
+			rpc_query_index_del(index, pos,
+			    rpc_array_get_value(array, pos));
+			if (!last)
+				rpc_query_index_shift(index, pos);
+		}
+		g_rw_lock_writer_unlock(&index->rqx_lock);
+	}
+}
+
+void
+rpc_query_index_invalidate(rpc_object_t array)
+{
+	rpc_query_index_t index;
+
+	for (GSList *l = array->ro_indexes; l != NULL; l = l->next) {
+		index = l->data;
+		g_rw_lock_writer_lock(&index->rqx_lock);
+		index->rqx_stale = true;
+		g_rw_lock_writer_unlock(&index->rqx_lock);
+	}
+}
+
+void
+rpc_query_index_detach(rpc_object_t array)
+{
+	rpc_query_index_t index;
+
+	for (GSList *l = array->ro_indexes; l != NULL; l = l->next) {
+		index = l->data;
+		g_rw_lock_writer_lock(&index->rqx_lock);
+		index->rqx_array = NULL;
+		g_rw_lock_writer_unlock(&index->rqx_lock);
+		rpc_query_index_release(index);
+	}
+
+	g_slist_free(array->ro_indexes);
+	array->ro_indexes = NULL;
+}
+
+static rpc_query_index_t
+rpc_query_index_find(rpc_object_t array, struct rpc_query_node *node)
+{
+	rpc_query_index_type_t type;
+	rpc_query_index_t index;
+
+	switch (node->rqn_op) {
+	case RPC_QUERY_OP_EQ:
+		type = RPC_QUERY_INDEX_HASH;
+		break;
+
+	case RPC_QUERY_OP_IN:
+		if (rpc_get_type(node->rqn_value) != RPC_TYPE_ARRAY)
+			return (NULL);
+
+		type = RPC_QUERY_INDEX_HASH;
+		break;
+
+	case RPC_QUERY_OP_GT:
+	case RPC_QUERY_OP_LT:
+	case RPC_QUERY_OP_GE:
+	case RPC_QUERY_OP_LE:
+		type = RPC_QUERY_INDEX_SORTED;
+		break;
+
+	default:
 		return (NULL);
+	}
 
-	if (rules == NULL)
+	if (node->rqn_path_str == NULL)
 		return (NULL);
 
-	if (rpc_get_type(rules) != RPC_TYPE_ARRAY)
+	for (GSList *l = array->ro_indexes; l != NULL; l = l->next) {
+		index = l->data;
+		if (index->rqx_type == type && g_strcmp0(node->rqn_path_str,
+		    index->rqx_key->rqn_path_str) == 0)
+			return (index);
+	}
+
+	return (NULL);
+}
+
+static void
+rpc_query_index_collect_range(rpc_query_index_t index,
+    struct rpc_query_node *node, GArray *result)
+{
+	struct rpc_query_index_entry probe;
+	struct rpc_query_index_entry *entry;
+	GSequenceIter *iter;
+	GSequenceIter *end;
+	size_t pos;
+
+	/* Probe positions never match an entry, so bounds are exact */
+	probe.rqe_hash = node->rqn_hash;
+	probe.rqe_pos = (node->rqn_op == RPC_QUERY_OP_GT ||
+	    node->rqn_op == RPC_QUERY_OP_LE) ? G_MAXINT64 : -1;
+
+	iter = g_sequence_get_begin_iter(index->rqx_sorted);
+	end = g_sequence_get_end_iter(index->rqx_sorted);
+
+	if (node->rqn_op == RPC_QUERY_OP_GT || node->rqn_op == RPC_QUERY_OP_GE)
+		iter = g_sequence_search(index->rqx_sorted, &probe,
+		    rpc_query_index_entry_cmp, NULL);
+	else
+		end = g_sequence_search(index->rqx_sorted, &probe,
+		    rpc_query_index_entry_cmp, NULL);
+
+	for (; iter != end; iter = g_sequence_iter_next(iter)) {
+		entry = g_sequence_get(iter);
+		pos = (size_t)entry->rqe_pos;
+		g_array_append_val(result, pos);
+	}
+}
+
+/*
+ * Returns the positions of the elements that can possibly match the
+ * plan, in ascending order, or NULL if no index helps. *exact is set
+ * if every one of them is known to match.
+ */
+static GArray *
+rpc_query_index_candidates(rpc_object_t array, rpc_query_plan_t plan,
+    bool *exact)
+{
+	struct rpc_query_node *root = plan->rqp_root;
+	struct rpc_query_node *node = NULL;
+	rpc_query_index_t index = NULL;
+	rpc_query_index_t found;
+	GArray *result;
+	GArray *bucket;
+	rpc_object_t value;
+	size_t i;
+
+	if (array->ro_indexes == NULL || root->rqn_op != RPC_QUERY_OP_ALL)
+		return (NULL);
+
+	/* Prefer equality lookups over range scans */
+	for (i = 0; i < root->rqn_nchildren; i++) {
+		found = rpc_query_index_find(array, root->rqn_children[i]);
+		if (found == NULL)
+			continue;
+
+		if (index == NULL || (index->rqx_type != RPC_QUERY_INDEX_HASH &&
+		    found->rqx_type == RPC_QUERY_INDEX_HASH)) {
+			index = found;
+			node = root->rqn_children[i];
+		}
+	}
+
+	if (index == NULL)
 		return (NULL);
 
-	rpc_array_apply(rules, ^(size_t idx __unused, rpc_object_t v) {
-		if (!eval_rule(object, v)) {
-			fail = true;
-			return ((bool)false);
+	rpc_query_index_lock(index);
+	result = g_array_new(false, false, sizeof(size_t));
+
+	switch (node->rqn_op) {
+	case RPC_QUERY_OP_EQ:
+		bucket = g_hash_table_lookup(index->rqx_hash, node->rqn_value);
+		if (bucket != NULL)
+			g_array_append_vals(result, bucket->data, bucket->len);
+		break;
+
+	case RPC_QUERY_OP_IN:
+		for (i = 0; i < rpc_array_get_count(node->rqn_value); i++) {
+			value = rpc_array_get_value(node->rqn_value, i);
+			bucket = g_hash_table_lookup(index->rqx_hash, value);
+			if (bucket != NULL) {
+				g_array_append_vals(result, bucket->data,
+				    bucket->len);
+			}
+		}
+
+		g_array_sort(result, rpc_query_pos_cmp);
+		break;
+
+	default:
+		rpc_query_index_collect_range(index, node, result);
+		g_array_sort(result, rpc_query_pos_cmp);
+		break;
+	}
+
+	/* The same value may be listed more than once on the right side */
+	if (node->rqn_op == RPC_QUERY_OP_IN) {
+		for (i = 1; i < result->len; i++) {
+			if (g_array_index(result, size_t, i) ==
+			    g_array_index(result, size_t, i - 1))
+				g_array_remove_index(result, i--);
 		}
-	    	return (bool)true;
-	});
+	}
+
+	g_rw_lock_reader_unlock(&index->rqx_lock);
+	*exact = root->rqn_nchildren == 1;
+	return (result);
+}
 
-	return (fail ? NULL : object);
+/* Maps the iteration step to a source position */
+static bool
+rpc_query_position(rpc_query_iter_t iter, size_t *pos)
+{
+	GArray *candidates = iter->rqi_candidates;
+	size_t step = iter->rqi_idx;
+	size_t len;
+
+	len = candidates != NULL ? candidates->len : iter->rqi_end;
+	if (step >= len)
+		return (false);
+
+	if (iter->rqi_reverse)
+		step = len - step - 1;
+
+	*pos = candidates != NULL ? g_array_index(candidates, size_t, step) :
+	    step;
+	return (true);
 }
 
 static rpc_object_t
-rpc_query_find_next(rpc_query_iter_t iter)
+rpc_query_scan(rpc_query_iter_t iter, size_t *pos)
 {
-	rpc_object_t current = NULL;
-	rpc_object_t result = NULL;
+	rpc_object_t current;
 
-	do {
-		current = rpc_array_get_value(iter->rqi_source, iter->rqi_idx);
+	while (rpc_query_position(iter, pos)) {
+		current = rpc_array_get_value(iter->rqi_source, *pos);
 		iter->rqi_idx++;
-		result = rpc_query_steal_apply(current, iter->rqi_rules);
+		if (current == NULL)
+			continue;
+
+		if (iter->rqi_exact ||
+		    rpc_query_eval(iter->rqi_plan->rqp_root, current))
+			return (current);
+	}
+
+	return (NULL);
+}
+
+static rpc_object_t
+rpc_query_find_next(rpc_query_iter_t iter)
+{
+	rpc_object_t result;
+	size_t pos;
 
-	} while ((current != NULL) && (result == NULL));
+	result = rpc_query_scan(iter, &pos);
 
 	if (iter->rqi_params->limit > 0) {
 		if ((result != NULL) && (iter->rqi_initialized)) {
@@ -287,6 +1103,353 @@ rpc_query_find_next(rpc_query_iter_t iter)
 	return (result);
 }
 
+/* Output order: the sort block, then source position, maybe reversed */
+static gint
+rpc_query_order_cmp(gconstpointer a, gconstpointer b, gpointer data)
+{
+	rpc_query_iter_t iter = data;
+	size_t p1 = *(const size_t *)a;
+	size_t p2 = *(const size_t *)b;
+	int ret;
+
+	ret = iter->rqi_params->sort(
+	    rpc_array_get_value(iter->rqi_source, p1),
+	    rpc_array_get_value(iter->rqi_source, p2));
+
+	if (ret == 0 && p1 != p2)
+		ret = p1 < p2 ? -1 : 1;
+
+	return (iter->rqi_params->reverse ? -ret : ret);
+}
+
+static void
+rpc_query_heap_swap(GArray *heap, size_t i, size_t j)
+{
+	size_t tmp;
+
+	tmp = g_array_index(heap, size_t, i);
+	g_array_index(heap, size_t, i) = g_array_index(heap, size_t, j);
+	g_array_index(heap, size_t, j) = tmp;
+}
+
+static void
+rpc_query_heap_up(rpc_query_iter_t iter, GArray *heap, size_t i)
+{
+	size_t parent;
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (rpc_query_order_cmp(&g_array_index(heap, size_t, i),
+		    &g_array_index(heap, size_t, parent), iter) <= 0)
+			break;
+
+		rpc_query_heap_swap(heap, i, parent);
+		i = parent;
+	}
+}
+
+static void
+rpc_query_heap_down(rpc_query_iter_t iter, GArray *heap, size_t i)
+{
+	size_t largest;
+	size_t child;
+
+	for (;;) {
+		largest = i;
+		for (child = 2 * i + 1; child <= 2 * i + 2; child++) {
+			if (child < heap->len && rpc_query_order_cmp(
+			    &g_array_index(heap, size_t, child),
+			    &g_array_index(heap, size_t, largest), iter) > 0)
+				largest = child;
+		}
+
+		if (largest == i)
+			break;
+
+		rpc_query_heap_swap(heap, i, largest);
+		i = largest;
+	}
+}
+
+/*
+ * Puts the matches in sort order without touching the source array.
+ *
+ * Only the first offset + limit matches can ever be yielded, so when
+ * that is bounded they are selected with a max-heap holding the ones
+ * seen so far, which makes it O(n log k) instead of O(n log n).
+ */
+static void
+rpc_query_order(rpc_query_iter_t iter)
+{
+	rpc_query_params_t params = iter->rqi_params;
+	GArray *matches;
+	size_t keep = 0;
+	size_t pos;
+
+	if (params->single)
+		keep = 1;
+	else if (params->limit > 0)
+		keep = (size_t)MIN(params->limit, G_MAXSIZE);
+
+	if (keep > 0) {
+		if (params->offset > G_MAXSIZE - keep)
+			keep = 0;
+		else
+			keep += params->offset;
+	}
+
+	matches = g_array_new(false, false, sizeof(size_t));
+	while (rpc_query_scan(iter, &pos) != NULL) {
+		if (keep == 0 || matches->len < keep) {
+			g_array_append_val(matches, pos);
+			if (keep > 0)
+				rpc_query_heap_up(iter, matches,
+				    matches->len - 1);
+
+			continue;
+		}
+
+		if (rpc_query_order_cmp(&pos,
+		    &g_array_index(matches, size_t, 0), iter) < 0) {
+			g_array_index(matches, size_t, 0) = pos;
+			rpc_query_heap_down(iter, matches, 0);
+		}
+	}
+
+	g_array_sort_with_data(matches, rpc_query_order_cmp, iter);
+
+	if (iter->rqi_candidates != NULL)
+		g_array_free(iter->rqi_candidates, true);
+
+	iter->rqi_candidates = matches;
+	iter->rqi_exact = true;
+	iter->rqi_idx = 0;
+}
+
+static void
+rpc_query_chunk_run(gpointer data, gpointer user_data __unused)
+{
+	struct rpc_query_chunk *chunk = data;
+	rpc_query_iter_t iter = chunk->rqc_iter;
+	GArray *candidates = iter->rqi_candidates;
+	rpc_object_t current;
+	size_t pos;
+	size_t i;
+
+	for (i = chunk->rqc_start; i < chunk->rqc_end; i++) {
+		pos = candidates != NULL ?
+		    g_array_index(candidates, size_t, i) : i;
+		current = rpc_array_get_value(iter->rqi_source, pos);
+		if (current != NULL &&
+		    rpc_query_eval(iter->rqi_plan->rqp_root, current))
+			g_array_append_val(chunk->rqc_matches, pos);
+	}
+}
+
+static void
+rpc_query_chunk_worker(gpointer data, gpointer user_data __unused)
+{
+	struct rpc_query_chunk *chunk = data;
+	struct rpc_query_join *join = chunk->rqc_join;
+
+	rpc_query_chunk_run(chunk, NULL);
+
+	g_mutex_lock(&join->rqj_mtx);
+	if (--join->rqj_pending == 0)
+		g_cond_signal(&join->rqj_cv);
+	g_mutex_unlock(&join->rqj_mtx);
+}
+
+/* One pool, sized to the machine, serves all parallel queries */
+static GThreadPool *
+rpc_query_get_pool(void)
+{
+	GThreadPool *pool;
+
+	g_mutex_lock(&rpc_query_pool_mtx);
+	if (rpc_query_pool == NULL) {
+		rpc_query_pool = g_thread_pool_new(rpc_query_chunk_worker,
+		    NULL, (gint)g_get_num_processors(), false, NULL);
+	}
+
+	pool = rpc_query_pool;
+	g_mutex_unlock(&rpc_query_pool_mtx);
+	return (pool);
+}
+
+/*
+ * Evaluates the rules over contiguous slices of the source on a thread
+ * pool and replaces the positions to visit with the matching ones, in
+ * source order. Ordering, offset, limit and callbacks then run on the
+ * calling thread as usual.
+ */
+static void
+rpc_query_parallel(rpc_query_iter_t iter)
+{
+	struct rpc_query_join join;
+	struct rpc_query_chunk *chunks;
+	GThreadPool *pool;
+	GArray *matches;
+	size_t nchunks;
+	size_t len;
+	size_t i;
+
+	/* Nothing left to evaluate */
+	if (iter->rqi_exact)
+		return;
+
+	len = iter->rqi_candidates != NULL ? iter->rqi_candidates->len :
+	    iter->rqi_end;
+	nchunks = MIN(iter->rqi_params->parallelism,
+	    len / RPC_QUERY_PARALLEL_MIN);
+	if (nchunks < 2)
+		return;
+
+	pool = rpc_query_get_pool();
+	chunks = g_new0(struct rpc_query_chunk, nchunks);
+	g_mutex_init(&join.rqj_mtx);
+	g_cond_init(&join.rqj_cv);
+	join.rqj_pending = nchunks - 1;
+
+	for (i = 0; i < nchunks; i++) {
+		chunks[i].rqc_iter = iter;
+		chunks[i].rqc_join = &join;
+		chunks[i].rqc_start = len * i / nchunks;
+		chunks[i].rqc_end = len * (i + 1) / nchunks;
+		chunks[i].rqc_matches = g_array_new(false, false,
+		    sizeof(size_t));
+
+		if (i > 0 && !g_thread_pool_push(pool, &chunks[i], NULL))
+			rpc_query_chunk_worker(&chunks[i], NULL);
+	}
+
+	/* The calling thread takes the first slice itself */
+	rpc_query_chunk_run(&chunks[0], NULL);
+
+	g_mutex_lock(&join.rqj_mtx);
+	while (join.rqj_pending > 0)
+		g_cond_wait(&join.rqj_cv, &join.rqj_mtx);
+	g_mutex_unlock(&join.rqj_mtx);
+
+	g_mutex_clear(&join.rqj_mtx);
+	g_cond_clear(&join.rqj_cv);
+
+	matches = chunks[0].rqc_matches;
+	for (i = 1; i < nchunks; i++) {
+		g_array_append_vals(matches, chunks[i].rqc_matches->data,
+		    chunks[i].rqc_matches->len);
+		g_array_free(chunks[i].rqc_matches, true);
+	}
+
+	g_free(chunks);
+
+	if (iter->rqi_candidates != NULL)
+		g_array_free(iter->rqi_candidates, true);
+
+	iter->rqi_candidates = matches;
+	iter->rqi_exact = true;
+}
+
+rpc_query_plan_t
+rpc_query_compile(rpc_object_t rules)
+{
+
+	if (rpc_get_type(rules) != RPC_TYPE_ARRAY) {
+		rpc_set_last_error(EINVAL, "Query rules must be an array",
+		    NULL);
+		return (NULL);
+	}
+
+	return (rpc_query_compile_impl(rules));
+}
+
+void
+rpc_query_plan_free(rpc_query_plan_t plan)
+{
+
+	if (!g_atomic_int_dec_and_test(&plan->rqp_refcnt))
+		return;
+
+	rpc_query_node_free(plan->rqp_root);
+	g_free(plan);
+}
+
+rpc_query_index_t
+rpc_query_index_create(rpc_object_t array, const char *path,
+    rpc_query_index_type_t type)
+{
+	rpc_query_index_t index;
+
+	if (rpc_get_type(array) != RPC_TYPE_ARRAY) {
+		rpc_set_last_error(EINVAL,
+		    "Indexes can be built on arrays only", NULL);
+		return (NULL);
+	}
+
+	if (path == NULL || *path == '\0') {
+		rpc_set_last_error(EINVAL, "Index path is empty", NULL);
+		return (NULL);
+	}
+
+	index = g_malloc0(sizeof(*index));
+	index->rqx_refcnt = 2;
+	index->rqx_array = array;
+	index->rqx_type = type;
+	index->rqx_key = rpc_query_node_new(RPC_QUERY_OP_EQ);
+	index->rqx_stale = true;
+	g_rw_lock_init(&index->rqx_lock);
+	rpc_query_compile_path(index->rqx_key, path);
+
+	if (type == RPC_QUERY_INDEX_SORTED)
+		index->rqx_sorted = g_sequence_new(g_free);
+	else {
+		index->rqx_hash = g_hash_table_new_full(rpc_query_index_hash,
+		    rpc_query_index_equal, (GDestroyNotify)rpc_release_impl,
+		    (GDestroyNotify)rpc_query_index_bucket_free);
+	}
+
+	/* One reference belongs to the array, the other to the caller */
+	rpc_query_index_refresh_locked(index);
+	array->ro_indexes = g_slist_prepend(array->ro_indexes, index);
+	return (index);
+}
+
+void
+rpc_query_index_rebuild(rpc_query_index_t index)
+{
+
+	g_rw_lock_writer_lock(&index->rqx_lock);
+	index->rqx_stale = true;
+	rpc_query_index_refresh_locked(index);
+	g_rw_lock_writer_unlock(&index->rqx_lock);
+}
+
+void
+rpc_query_index_free(rpc_query_index_t index)
+{
+	rpc_object_t array = index->rqx_array;
+
+	if (array != NULL) {
+		array->ro_indexes = g_slist_remove(array->ro_indexes, index);
+		g_rw_lock_writer_lock(&index->rqx_lock);
+		index->rqx_array = NULL;
+		g_rw_lock_writer_unlock(&index->rqx_lock);
+		rpc_query_index_release(index);
+	}
+
+	rpc_query_index_release(index);
+}
+
+bool
+rpc_query_plan_match(rpc_query_plan_t plan, rpc_object_t object)
+{
+
+	if (object == NULL)
+		return (false);
+
+	return (rpc_query_eval(plan->rqp_root, object));
+}
+
 rpc_object_t
 rpc_query_get(rpc_object_t object, const char *path, rpc_object_t default_val)
 {
@@ -486,20 +1649,15 @@ rpc_query_contains(rpc_object_t object, const char *path)
 	return (target != NULL);
 }
 
-rpc_query_iter_t
-rpc_query(rpc_object_t object, rpc_query_params_t params, rpc_object_t rules)
+static rpc_query_iter_t
+rpc_query_impl(rpc_object_t object, rpc_query_params_t params,
+    rpc_query_plan_t plan)
 {
 	rpc_query_iter_t iter;
 	rpc_query_params_t local_params;
 
-	if (rpc_get_type(object) != RPC_TYPE_ARRAY) {
-		rpc_set_last_error(EINVAL, "Query can operate on arrays only",
-		    NULL);
-		return (NULL);
-	}
-
 	iter = g_malloc(sizeof(*iter));
-	local_params = g_malloc(sizeof(*local_params));
+	local_params = g_malloc0(sizeof(*local_params));
 
 	if (params != NULL)
 		*local_params = *params;
@@ -507,16 +1665,46 @@ rpc_query(rpc_object_t object, rpc_query_params_t params, rpc_object_t rules)
 	iter->rqi_source = object;
 	iter->rqi_idx = 0;
 	iter->rqi_params = local_params;
-	iter->rqi_rules = rules;
+	iter->rqi_plan = plan;
+	iter->rqi_candidates = NULL;
+	iter->rqi_end = 0;
+	iter->rqi_exact = false;
+	iter->rqi_reverse = false;
 	iter->rqi_done = false;
 	iter->rqi_initialized = false;
 	iter->rqi_limit = 0;
 
-	rpc_retain(rules);
 	rpc_retain(object);
 	return (iter);
 }
 
+rpc_query_iter_t
+rpc_query(rpc_object_t object, rpc_query_params_t params, rpc_object_t rules)
+{
+
+	if (rpc_get_type(object) != RPC_TYPE_ARRAY) {
+		rpc_set_last_error(EINVAL, "Query can operate on arrays only",
+		    NULL);
+		return (NULL);
+	}
+
+	return (rpc_query_impl(object, params, rpc_query_compile_impl(rules)));
+}
+
+rpc_query_iter_t
+rpc_query_compiled(rpc_object_t object, rpc_query_params_t params,
+    rpc_query_plan_t plan)
+{
+
+	if (rpc_get_type(object) != RPC_TYPE_ARRAY) {
+		rpc_set_last_error(EINVAL, "Query can operate on arrays only",
+		    NULL);
+		return (NULL);
+	}
+
+	return (rpc_query_impl(object, params, rpc_query_plan_retain(plan)));
+}
+
 rpc_query_iter_t
 rpc_query_fmt(rpc_object_t object, rpc_query_params_t params,
     const char *rules_fmt, ...)
@@ -537,17 +1725,17 @@ rpc_query_fmt(rpc_object_t object, rpc_query_params_t params,
 rpc_object_t
 rpc_query_apply(rpc_object_t object, rpc_object_t rules)
 {
-	rpc_object_t result;
+	rpc_query_plan_t plan;
+	bool match;
 
 	if (rpc_get_type(rules) != RPC_TYPE_ARRAY)
 		return (NULL);
 
-	result = rpc_query_steal_apply(object, rules);
-
-	if (result != NULL)
-		rpc_retain(result);
+	plan = rpc_query_compile_impl(rules);
+	match = rpc_query_plan_match(plan, object);
+	rpc_query_plan_free(plan);
 
-	return (result);
+	return (match ? rpc_retain(object) : NULL);
 }
 
 bool
@@ -563,25 +1751,28 @@ rpc_query_next(rpc_query_iter_t iter, rpc_object_t *chunk)
 	}
 
 	if (!iter->rqi_initialized) {
-		if (iter->rqi_params->sort)
-			rpc_array_sort(iter->rqi_source, iter->rqi_params->sort);
-
-		if (iter->rqi_params->reverse) {
-			temp_obj = rpc_array_create();
-			rpc_array_reverse_apply(iter->rqi_source,
-			    ^(size_t idx __unused, rpc_object_t v) {
-				rpc_array_append_value(temp_obj, v);
-				return ((bool) true);
-			});
-
-			rpc_release(iter->rqi_source);
-			iter->rqi_source = temp_obj;
-		}
+		iter->rqi_end = rpc_array_get_count(iter->rqi_source);
+		iter->rqi_candidates = rpc_query_index_candidates(
+		    iter->rqi_source, iter->rqi_plan, &iter->rqi_exact);
 
-		for (i = 0; i < iter->rqi_params->offset; i++) {
-			temp_obj = rpc_query_find_next(iter);
-			if (temp_obj == NULL)
-				break;
+		if (iter->rqi_params->parallelism > 1)
+			rpc_query_parallel(iter);
+
+		/* Ordering does not change how many elements match */
+		if (iter->rqi_params->sort != NULL && !iter->rqi_params->count)
+			rpc_query_order(iter);
+		else
+			iter->rqi_reverse = iter->rqi_params->reverse;
+
+		if (iter->rqi_exact) {
+			iter->rqi_idx = MIN(iter->rqi_params->offset,
+			    iter->rqi_candidates->len);
+		} else {
+			for (i = 0; i < iter->rqi_params->offset; i++) {
+				temp_obj = rpc_query_find_next(iter);
+				if (temp_obj == NULL)
+					break;
+			}
 		}
 
 		iter->rqi_initialized = true;
@@ -634,7 +1825,10 @@ void
 rpc_query_iter_free(rpc_query_iter_t iter)
 {
 
-	rpc_release(iter->rqi_rules);
+	if (iter->rqi_candidates != NULL)
+		g_array_free(iter->rqi_candidates, true);
+
+	rpc_query_plan_free(iter->rqi_plan);
 	rpc_release(iter->rqi_source);
 	g_free(iter->rqi_params);
 	g_free(iter);
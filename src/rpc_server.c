@@ -258,7 +258,9 @@ rpc_server_broadcast_event(rpc_server_t server, const char *path,
     const char *interface, const char *name, rpc_object_t args)
 {
 
-	GList *item;
+	struct rpc_shared_frame *frame = NULL;
+	GPtrArray *conns;
+	guint i;
 
 	g_rw_lock_reader_lock(&server->rs_connections_rwlock);
         if (server->rs_closed) {
@@ -266,11 +268,37 @@ rpc_server_broadcast_event(rpc_server_t server, const char *path,
 		return;
 	}
 
-	for (item = g_list_first(server->rs_connections); item;
-	     item = item->next) {
-		rpc_connection_t conn = item->data;
-		rpc_connection_send_event(conn, path, interface, name, args);
+	g_rw_lock_reader_unlock(&server->rs_connections_rwlock);
+
+	/* Only visit connections with a matching subscription */
+	conns = rpc_context_find_watchers(server->rs_context, server, path,
+	    interface, name);
+	for (i = 0; i < conns->len; i++) {
+		rpc_connection_send_event_shared(g_ptr_array_index(conns, i),
+		    path, interface, name, args, &frame);
 	}
+
+	g_ptr_array_free(conns, true);
+	rpc_shared_frame_release(frame);
+}
+
+void
+rpc_server_set_event_window(rpc_server_t server, uint64_t usec, size_t bytes)
+{
+
+	server->rs_event_window = usec;
+	server->rs_event_window_bytes = bytes;
+}
+
+void
+rpc_server_flush_events(rpc_server_t server)
+{
+	GList *item;
+
+	g_rw_lock_reader_lock(&server->rs_connections_rwlock);
+	for (item = g_list_first(server->rs_connections); item;
+	     item = item->next)
+		rpc_connection_flush_events(item->data);
 	g_rw_lock_reader_unlock(&server->rs_connections_rwlock);
 }
 
@@ -322,8 +350,13 @@ server_queue_purge(rpc_server_t server)
 
 		if (!server->rs_closed) {
 			if (rpc_context_dispatch(server->rs_context,
-			    icall) == 0)
+			    icall) == 0) {
+				if (icall->rc_inline) {
+					rpc_context_run_inline(
+					    server->rs_context, icall);
+				}
 				continue;
+			}
 		} else {
 			icall->rc_err = rpc_error_create(ECONNRESET,
 			    "Server not active", NULL);
@@ -48,21 +48,43 @@ static rpc_object_t rpc_observable_property_set(void *, rpc_object_t);
 void rpc_interface_free(struct rpc_interface_priv *);
 void rpc_if_member_free(struct rpc_if_member *);
 static gpointer emit_events(gpointer data);
+static int64_t rpc_context_flush_properties(rpc_context_t);
+struct property_change;
+static void rpc_property_change_free(struct property_change *);
+static void rpc_instance_property_emit(rpc_instance_t, const char *,
+    const char *, rpc_object_t);
+static void rpc_context_emit_worker(gpointer data, gpointer user_data);
+static void rpc_context_sched_enqueue(rpc_context_t, struct rpc_call *);
+static void rpc_context_sched_remove(rpc_context_t, struct rpc_call *);
+static struct rpc_call *rpc_context_sched_next(rpc_context_t, bool *);
+static int rpc_context_admit(rpc_context_t, struct rpc_call *);
+static bool rpc_context_codel_shed(rpc_context_t, int64_t, int64_t);
+static void rpc_context_run_call(rpc_context_t, struct rpc_call *);
+static struct rpc_if_member *rpc_context_resolve(rpc_context_t,
+    struct rpc_call *, rpc_instance_t *);
+static void rpc_instance_bump_generation(rpc_instance_t);
+static bool rpc_context_call_is_inline(rpc_instance_t, struct rpc_call *,
+    struct rpc_if_member *);
+static void rpc_function_flush_fragments(struct rpc_call *);
+static void rpc_function_flush_fragments_locked(struct rpc_call *);
+static void rpc_function_queue_fragment_locked(struct rpc_call *,
+    rpc_object_t);
+static inline bool rpc_function_has_credit_locked(struct rpc_call *);
 
 static const struct rpc_if_member rpc_discoverable_vtable[] = {
 	RPC_EVENT(instance_added),
 	RPC_EVENT(instance_removed),
-	RPC_METHOD(get_instances, rpc_get_objects),
+	RPC_METHOD_INLINE(get_instances, rpc_get_objects),
 	RPC_MEMBER_END
 };
 
 static const struct rpc_if_member rpc_introspectable_vtable[] = {
 	RPC_EVENT(interface_added),
 	RPC_EVENT(interface_removed),
-	RPC_METHOD(get_interfaces, rpc_get_interfaces),
-	RPC_METHOD(get_methods, rpc_get_methods),
-	RPC_METHOD(get_events, rpc_get_events),
-	RPC_METHOD(interface_exists, rpc_interface_exists),
+	RPC_METHOD_INLINE(get_interfaces, rpc_get_interfaces),
+	RPC_METHOD_INLINE(get_methods, rpc_get_methods),
+	RPC_METHOD_INLINE(get_events, rpc_get_events),
+	RPC_METHOD_INLINE(interface_exists, rpc_interface_exists),
 	RPC_MEMBER_END
 };
 
@@ -82,6 +104,16 @@ struct emit_item {
 	rpc_object_t	args;
 };
 
+struct property_change {
+	rpc_instance_t	instance;
+	char *		interface;
+	char *		name;
+	rpc_object_t	value;		/* NULL means "ask the getter" */
+	bool		dirty;
+	int64_t		last;
+	uint64_t	interval;
+};
+
 enum tp_type {
 	TYPE_CALL,
 	TYPE_INSTANCE,
@@ -92,6 +124,20 @@ struct tp_item {
 	enum tp_type type;
 };
 
+#define	DEFAULT_CODEL_INTERVAL	100000
+#define	METHOD_CACHE_SIZE		128
+
+static GPrivate rpc_current_call = G_PRIVATE_INIT(NULL);
+
+struct method_cache_entry {
+	char *			path;
+	char *			interface;
+	char *			name;
+	rpc_instance_t		instance;
+	struct rpc_if_member *	member;
+	GList			link;
+};
+
 static void
 rpc_context_tp_handler(gpointer data, gpointer user_data)
 {
@@ -99,8 +145,7 @@ rpc_context_tp_handler(gpointer data, gpointer user_data)
 	struct tp_item *item = data;
 	struct rpc_call *call;
 	rpc_instance_t instance;
-	struct rpc_if_method *method;
-	rpc_object_t result;
+	bool shed;
 
 	if (item->type == TYPE_INSTANCE) {
 		instance = item->data;
@@ -111,6 +156,16 @@ rpc_context_tp_handler(gpointer data, gpointer user_data)
 			g_cond_wait(&instance->ri_cv, &instance->ri_mtx);
 
 		g_mutex_unlock(&instance->ri_mtx);
+
+		/*
+		 * Method caches may still hold a pointer to this instance.
+		 * They only retain it under the rcx_rwlock reader lock and
+		 * after checking the generation that rpc_instance_free()
+		 * bumped, so once we get past the writer lock nobody can
+		 * touch the instance anymore.
+		 */
+		g_rw_lock_writer_lock(&context->rcx_rwlock);
+		g_rw_lock_writer_unlock(&context->rcx_rwlock);
 		g_cond_clear(&instance->ri_cv);
 		g_mutex_clear(&instance->ri_mtx);
 		g_rw_lock_clear(&instance->ri_rwlock);
@@ -121,9 +176,34 @@ rpc_context_tp_handler(gpointer data, gpointer user_data)
 		return;
 	}
 
-	call = item->data;
-	method = call->rc_if_method;
 	g_free(item);
+	call = rpc_context_sched_next(context, &shed);
+	if (call == NULL)
+		return;
+
+	if (shed) {
+		if (rpc_connection_call_retain(call) < 0) {
+			debugf("Can't shed call %p, not valid", call);
+			return;
+		}
+
+		if (!call->rc_aborted)
+			rpc_function_error(call, EAGAIN, "Server overloaded");
+
+		rpc_connection_call_release(call);
+		rpc_connection_close_inbound_call(call);
+		return;
+	}
+
+	rpc_context_run_call(context, call);
+}
+
+static void
+rpc_context_run_call(rpc_context_t context, struct rpc_call *call)
+{
+	struct rpc_if_method *method = call->rc_if_method;
+	struct rpc_call *prev;
+	rpc_object_t result;
 
 	if (rpc_connection_call_retain(call) < 0) {
 		debugf("Can't dispatch call %p, not valid", call);
@@ -145,6 +225,19 @@ rpc_context_tp_handler(gpointer data, gpointer user_data)
 		return;
 	}
 
+	/* The caller has given up on this one already */
+	if (call->rc_deadline != 0 &&
+	    g_get_monotonic_time() >= call->rc_deadline) {
+		debugf("Call %p expired before dispatch", call);
+		g_mutex_lock(&context->rcx_sched_mtx);
+		context->rcx_stats.shed_expired++;
+		g_mutex_unlock(&context->rcx_sched_mtx);
+		rpc_function_error(call, ETIMEDOUT, "Call deadline exceeded");
+		rpc_connection_call_release(call);
+		rpc_connection_close_inbound_call(call);
+		return;
+	}
+
 	g_assert(call->rc_type == RPC_INBOUND_CALL);
 
 	call->rc_m_arg = method->rm_arg;
@@ -153,6 +246,10 @@ rpc_context_tp_handler(gpointer data, gpointer user_data)
 
 	debugf("method=%p", method);
 
+	/* Lets outbound calls made by the method inherit its deadline */
+	prev = g_private_get(&rpc_current_call);
+	g_private_set(&rpc_current_call, call);
+
 	if (context->rcx_pre_call_hook != NULL) {
 		context->rcx_pre_call_hook(call, call->rc_args);
 		if (call->rc_responded)
@@ -175,13 +272,23 @@ rpc_context_tp_handler(gpointer data, gpointer user_data)
 	else if (!call->rc_ended)
 		rpc_function_end(call);
 done:
+	g_private_set(&rpc_current_call, prev);
 	rpc_connection_call_release(call);
 }
 
+int64_t
+rpc_context_current_deadline(void)
+{
+	struct rpc_call *call;
+
+	call = g_private_get(&rpc_current_call);
+	return (call != NULL ? call->rc_deadline : 0);
+}
+
 rpc_context_t
 rpc_context_create(void)
 {
-	GError *err;
+	GError *err = NULL;
 	rpc_context_t result;
 
 	rpct_init(true);
@@ -193,9 +300,23 @@ rpc_context_create(void)
 	result->rcx_threadpool = g_thread_pool_new(rpc_context_tp_handler,
 	    result, -1, false, &err);
 	result->rcx_emit_queue = g_async_queue_new();
-	result->rcx_emit_thread = g_thread_new("emitter", emit_events,
-	    result->rcx_emit_queue);
-	result->rcx_event_watchers = g_hash_table_new(NULL, NULL);
+	result->rcx_prop_changes = g_hash_table_new_full(g_str_hash,
+	    g_str_equal, g_free, (GDestroyNotify)rpc_property_change_free);
+	g_mutex_init(&result->rcx_prop_mtx);
+	result->rcx_emit_thread = g_thread_new("emitter", emit_events, result);
+	result->rcx_sub_index = rpc_sub_index_new(
+	    (GDestroyNotify)g_hash_table_destroy);
+	result->rcx_emitter.threads = g_get_num_processors();
+	/* Lossless unless the user opts into a slow consumer policy */
+	result->rcx_emitter.queue_limit = 0;
+	result->rcx_emitter.policy = RPC_SLOW_CONSUMER_DROP_OLDEST;
+	result->rcx_emit_pool = g_thread_pool_new(rpc_context_emit_worker,
+	    result, (gint)result->rcx_emitter.threads, false, &err);
+	g_mutex_init(&result->rcx_emit_mtx);
+	result->rcx_sched_active = g_queue_new();
+	result->rcx_iface_inflight = g_hash_table_new_full(g_str_hash,
+	    g_str_equal, g_free, NULL);
+	g_mutex_init(&result->rcx_sched_mtx);
 
 	rpc_instance_set_description(result->rcx_root, "Root object");
 	rpc_context_register_instance(result, result->rcx_root);
@@ -210,6 +331,11 @@ rpc_context_free(rpc_context_t context)
 	if (context == NULL)
 		return;
 
+	/* pending property changes hold instance references */
+	g_mutex_lock(&context->rcx_prop_mtx);
+	g_hash_table_remove_all(context->rcx_prop_changes);
+	g_mutex_unlock(&context->rcx_prop_mtx);
+
 	/* free the instance before taking down the tp */
 	rpc_instance_free(context->rcx_root);
 	g_thread_pool_free(context->rcx_threadpool, true, true);
@@ -219,7 +345,14 @@ rpc_context_free(rpc_context_t context)
 	g_async_queue_push(context->rcx_emit_queue, item);
 	g_thread_join(context->rcx_emit_thread);
 	g_async_queue_unref(context->rcx_emit_queue);
-	g_hash_table_destroy(context->rcx_event_watchers);
+	g_thread_pool_free(context->rcx_emit_pool, false, true);
+	g_mutex_clear(&context->rcx_emit_mtx);
+	g_hash_table_destroy(context->rcx_prop_changes);
+	g_mutex_clear(&context->rcx_prop_mtx);
+	rpc_sub_index_free(context->rcx_sub_index);
+	g_queue_free(context->rcx_sched_active);
+	g_hash_table_destroy(context->rcx_iface_inflight);
+	g_mutex_clear(&context->rcx_sched_mtx);
 	g_free(context);
 }
 
@@ -238,49 +371,553 @@ rpc_context_dispatch(rpc_context_t context, struct rpc_call *call)
 		return (-1);
 	}
 
+	if (call->rc_deadline != 0 &&
+	    g_get_monotonic_time() >= call->rc_deadline) {
+		g_mutex_lock(&context->rcx_sched_mtx);
+		context->rcx_stats.shed_expired++;
+		g_mutex_unlock(&context->rcx_sched_mtx);
+		call->rc_err = rpc_error_create(ETIMEDOUT,
+		    "Call deadline exceeded", NULL);
+		return (-1);
+	}
+
+	member = rpc_context_resolve(context, call, &instance);
+	if (member == NULL)
+		return (-1);
+
+	if (rpc_context_admit(context, call) != 0) {
+		rpc_instance_release(instance);
+		return (-1);
+	}
+
+	call->rc_instance = instance;
+	call->rc_if_method = &member->rim_method;
+
+	/*
+	 * Non-blocking members are run by the caller on the receiving
+	 * thread, see rpc_context_run_inline().
+	 */
+	if (rpc_context_call_is_inline(instance, call, member)) {
+		call->rc_inline = true;
+		return (0);
+	}
+
+	/*
+	 * The call itself goes to its connection's run queue. Thread pool
+	 * items only carry a token - the worker picks whichever call is
+	 * next in the deficit round robin order across connections.
+	 */
+	rpc_context_sched_enqueue(context, call);
+	item = g_malloc(sizeof(*item));
+	item->type = TYPE_CALL;
+	item->data = NULL;
+	g_thread_pool_push(context->rcx_threadpool, item, &err);
+	if (err != NULL) {
+		call->rc_err = rpc_error_create(EFAULT, "Cannot submit call",
+		    NULL);
+		rpc_context_sched_remove(context, call);
+		g_free(item);
+		g_error_free(err);
+		rpc_instance_release(instance);
+		return (-1);
+	}
+
+	return (0);
+}
+
+static guint
+method_cache_hash(gconstpointer key)
+{
+	const struct method_cache_entry *entry = key;
+	guint hash;
+
+	hash = entry->path != NULL ? g_str_hash(entry->path) : 0;
+	hash = hash * 31 + (entry->interface != NULL
+	    ? g_str_hash(entry->interface) : 0);
+	hash = hash * 31 + g_str_hash(entry->name);
+	return (hash);
+}
+
+static gboolean
+method_cache_equal(gconstpointer a, gconstpointer b)
+{
+	const struct method_cache_entry *ea = a;
+	const struct method_cache_entry *eb = b;
+
+	return (g_strcmp0(ea->name, eb->name) == 0 &&
+	    g_strcmp0(ea->interface, eb->interface) == 0 &&
+	    g_strcmp0(ea->path, eb->path) == 0);
+}
+
+static void
+method_cache_entry_free(struct method_cache_entry *entry)
+{
+
+	g_free(entry->path);
+	g_free(entry->interface);
+	g_free(entry->name);
+	g_free(entry);
+}
+
+GHashTable *
+rpc_method_cache_new(void)
+{
+
+	return (g_hash_table_new_full(method_cache_hash, method_cache_equal,
+	    (GDestroyNotify)method_cache_entry_free, NULL));
+}
+
+/* Called with rco_method_cache_mtx held */
+static void
+rpc_method_cache_flush(rpc_connection_t conn)
+{
+
+	g_queue_clear(&conn->rco_method_lru);
+	g_hash_table_remove_all(conn->rco_method_cache);
+}
+
+/* Called with rco_method_cache_mtx held */
+static void
+rpc_method_cache_insert(rpc_connection_t conn,
+    struct method_cache_entry *entry)
+{
+	struct method_cache_entry *old;
+
+	old = g_hash_table_lookup(conn->rco_method_cache, entry);
+	if (old != NULL) {
+		g_queue_unlink(&conn->rco_method_lru, &old->link);
+		g_hash_table_remove(conn->rco_method_cache, old);
+	}
+
+	/* Evict the least recently used entry once the cache is full */
+	while (g_hash_table_size(conn->rco_method_cache) >=
+	    METHOD_CACHE_SIZE) {
+		old = g_queue_peek_tail(&conn->rco_method_lru);
+		g_queue_unlink(&conn->rco_method_lru, &old->link);
+		g_hash_table_remove(conn->rco_method_cache, old);
+	}
+
+	entry->link.data = entry;
+	g_hash_table_add(conn->rco_method_cache, entry);
+	g_queue_push_head_link(&conn->rco_method_lru, &entry->link);
+}
+
+static struct rpc_if_member *
+rpc_context_resolve(rpc_context_t context, struct rpc_call *call,
+    rpc_instance_t *instancep)
+{
+	rpc_connection_t conn = call->rc_conn;
+	struct method_cache_entry key;
+	struct method_cache_entry *entry;
+	struct rpc_if_member *member;
+	rpc_instance_t instance;
+	guint generation;
+	bool missing = false;
+
+	key.path = call->rc_path;
+	key.interface = call->rc_interface;
+	key.name = call->rc_method_name;
+
+	/*
+	 * Each connection keeps (path, interface, method) -> member handles
+	 * resolved by previous calls, up to METHOD_CACHE_SIZE entries in
+	 * LRU order. The whole cache is dropped whenever the registry
+	 * generation changes, that is, on any instance or member
+	 * (un)registration in this context.
+	 */
+	g_mutex_lock(&conn->rco_method_cache_mtx);
+	generation = (guint)g_atomic_int_get(&context->rcx_generation);
+	if (conn->rco_method_cache_gen != generation) {
+		rpc_method_cache_flush(conn);
+		conn->rco_method_cache_gen = generation;
+	}
+
+	entry = g_hash_table_lookup(conn->rco_method_cache, &key);
+	if (entry != NULL) {
+		/*
+		 * The cache doesn't hold a reference on the instance.
+		 * Unregistering it bumps the generation under the
+		 * rcx_rwlock writer lock and the instance isn't freed
+		 * before taking that lock once more, so checking the
+		 * generation again under the reader lock makes the
+		 * cached pointer safe to retain.
+		 */
+		g_rw_lock_reader_lock(&context->rcx_rwlock);
+		instance = NULL;
+		if ((guint)g_atomic_int_get(&context->rcx_generation) ==
+		    generation)
+			instance = rpc_instance_retain(entry->instance);
+		g_rw_lock_reader_unlock(&context->rcx_rwlock);
+
+		if (instance != NULL) {
+			member = entry->member;
+			g_queue_unlink(&conn->rco_method_lru, &entry->link);
+			g_queue_push_head_link(&conn->rco_method_lru,
+			    &entry->link);
+			conn->rco_method_cache_hits++;
+			g_mutex_unlock(&conn->rco_method_cache_mtx);
+			*instancep = instance;
+			return (member);
+		}
+
+		g_queue_unlink(&conn->rco_method_lru, &entry->link);
+		g_hash_table_remove(conn->rco_method_cache, entry);
+	}
+
+	g_mutex_unlock(&conn->rco_method_cache_mtx);
+
 	instance = rpc_instance_find_and_retain(context,
 	    call->rc_path == NULL ? "/" : call->rc_path);
 
 	if (instance == NULL) {
 		call->rc_err = rpc_error_create(ENOENT, "No valid instance found",
 		    NULL);
-		return (-1);
+		return (NULL);
 	}
 
-	call->rc_instance = instance;
-
 	member = rpc_instance_find_member(instance,
 	    call->rc_interface, call->rc_method_name);
 
 	if (member == NULL) {
 		member = rpc_instance_find_member(instance,
 		    RPC_DEFAULT_INTERFACE, "method_missing");
+		missing = true;
 	}
 
 	if (member == NULL || member->rim_type != RPC_MEMBER_METHOD) {
 		call->rc_err = rpc_error_create(ENOENT, "Member not found",
 		    NULL);
 		rpc_instance_release(instance);
+		return (NULL);
+	}
+
+	/*
+	 * Don't cache lookups that fell back to method_missing. Clients
+	 * can make up any number of names and they would just push the
+	 * real methods out of the cache.
+	 */
+	if (missing) {
+		*instancep = instance;
+		return (member);
+	}
+
+	/*
+	 * If the registry changed while we were resolving, the entry
+	 * is stored under a stale generation and gets dropped on the
+	 * next lookup.
+	 */
+	entry = g_malloc(sizeof(*entry));
+	entry->path = g_strdup(call->rc_path);
+	entry->interface = g_strdup(call->rc_interface);
+	entry->name = g_strdup(call->rc_method_name);
+	entry->instance = instance;
+	entry->member = member;
+
+	g_mutex_lock(&conn->rco_method_cache_mtx);
+	if (conn->rco_method_cache_gen == generation)
+		rpc_method_cache_insert(conn, entry);
+	else
+		method_cache_entry_free(entry);
+	g_mutex_unlock(&conn->rco_method_cache_mtx);
+
+	*instancep = instance;
+	return (member);
+}
+
+static void
+rpc_instance_bump_generation(rpc_instance_t instance)
+{
+
+	if (instance->ri_context != NULL)
+		g_atomic_int_inc(&instance->ri_context->rcx_generation);
+}
+
+void
+rpc_context_run_inline(rpc_context_t context, struct rpc_call *call)
+{
+
+	g_assert(call->rc_inline);
+	rpc_context_run_call(context, call);
+}
+
+static bool
+rpc_context_call_is_inline(rpc_instance_t instance, struct rpc_call *call,
+    struct rpc_if_member *member)
+{
+	struct rpc_if_member *prop;
+	const char *interface;
+	const char *name;
+
+	/* Inline calls run on the reader thread that delivers fragments */
+	if (call->rc_upload)
+		return (false);
+
+	/* A shared runtime loop reads for other clients as well */
+	if (call->rc_conn->rco_runtime != NULL)
+		return (false);
+
+	if (member->rim_flags & RPC_MEMBER_INLINE)
+		return (true);
+
+	/*
+	 * Property reads go through the observable interface, so look at
+	 * the flags of the property itself. Only the getter is known not
+	 * to block; "set" always goes through the pool.
+	 */
+	if (g_strcmp0(call->rc_interface, RPC_OBSERVABLE_INTERFACE) != 0)
+		return (false);
+
+	if (g_strcmp0(call->rc_method_name, "get") != 0)
+		return (false);
+
+	if (rpc_object_unpack(call->rc_args, "[s,s]", &interface, &name) < 2)
+		return (false);
+
+	prop = rpc_instance_find_member(instance, interface, name);
+	if (prop == NULL || prop->rim_type != RPC_MEMBER_PROPERTY)
+		return (false);
+
+	return ((prop->rim_flags & RPC_MEMBER_INLINE) != 0);
+}
+
+static const char *
+rpc_context_call_iface(struct rpc_call *call)
+{
+
+	return (call->rc_interface != NULL
+	    ? call->rc_interface
+	    : RPC_DEFAULT_INTERFACE);
+}
+
+static int
+rpc_context_admit(rpc_context_t context, struct rpc_call *call)
+{
+	struct rpc_context_limits *limits = &context->rcx_limits;
+	const char *iface = rpc_context_call_iface(call);
+	guint inflight;
+
+	g_mutex_lock(&context->rcx_sched_mtx);
+	if (limits->max_queued != 0 &&
+	    context->rcx_stats.queued >= limits->max_queued) {
+		context->rcx_stats.shed_queue_full++;
+		g_mutex_unlock(&context->rcx_sched_mtx);
+		call->rc_err = rpc_error_create(EAGAIN,
+		    "Server overloaded: too many queued calls", NULL);
 		return (-1);
 	}
 
-	call->rc_if_method = &member->rim_method;
-	item = g_malloc(sizeof(*item));
-	item->type = TYPE_CALL;
-	item->data = call;
-	g_thread_pool_push(context->rcx_threadpool, item, &err);
-	if (err != NULL) {
-		call->rc_err = rpc_error_create(EFAULT, "Cannot submit call",
-		    NULL);
-		g_free(item);
-		g_error_free(err);
-		rpc_instance_release(instance);
+	inflight = GPOINTER_TO_UINT(g_hash_table_lookup(
+	    context->rcx_iface_inflight, iface));
+
+	if (limits->max_inflight != 0 && inflight >= limits->max_inflight) {
+		context->rcx_stats.shed_inflight++;
+		g_mutex_unlock(&context->rcx_sched_mtx);
+		call->rc_err = rpc_error_create(EAGAIN,
+		    "Server overloaded: too many calls in flight", NULL);
 		return (-1);
 	}
 
+	g_hash_table_insert(context->rcx_iface_inflight, g_strdup(iface),
+	    GUINT_TO_POINTER(inflight + 1));
+	context->rcx_stats.dispatched++;
+	call->rc_admitted = true;
+	g_mutex_unlock(&context->rcx_sched_mtx);
 	return (0);
 }
 
+void
+rpc_context_call_done(rpc_context_t context, struct rpc_call *call)
+{
+	const char *iface = rpc_context_call_iface(call);
+	guint inflight;
+
+	g_mutex_lock(&context->rcx_sched_mtx);
+	inflight = GPOINTER_TO_UINT(g_hash_table_lookup(
+	    context->rcx_iface_inflight, iface));
+
+	g_assert(inflight > 0);
+	if (inflight == 1)
+		g_hash_table_remove(context->rcx_iface_inflight, iface);
+	else {
+		g_hash_table_insert(context->rcx_iface_inflight,
+		    g_strdup(iface), GUINT_TO_POINTER(inflight - 1));
+	}
+
+	call->rc_admitted = false;
+	g_mutex_unlock(&context->rcx_sched_mtx);
+}
+
+static uint64_t
+isqrt(uint64_t n)
+{
+	uint64_t x = n;
+	uint64_t y = (x + 1) / 2;
+
+	while (y < x) {
+		x = y;
+		y = (x + n / x) / 2;
+	}
+
+	return (x);
+}
+
+/* called with rcx_sched_mtx held */
+static bool
+rpc_context_codel_shed(rpc_context_t context, int64_t now, int64_t sojourn)
+{
+	struct rpc_context_limits *limits = &context->rcx_limits;
+
+	if (limits->target_delay == 0)
+		return (false);
+
+	/*
+	 * Queue delay is fine, or the queue is about to drain anyway:
+	 * leave the dropping state.
+	 */
+	if (sojourn < (int64_t)limits->target_delay ||
+	    context->rcx_stats.queued == 0) {
+		context->rcx_codel_first_above = 0;
+		context->rcx_codel_dropping = false;
+		return (false);
+	}
+
+	if (context->rcx_codel_first_above == 0) {
+		context->rcx_codel_first_above = now + limits->interval;
+		return (false);
+	}
+
+	if (!context->rcx_codel_dropping) {
+		if (now < context->rcx_codel_first_above)
+			return (false);
+
+		context->rcx_codel_dropping = true;
+		context->rcx_codel_count = 1;
+		context->rcx_codel_drop_next = now + limits->interval;
+		return (true);
+	}
+
+	if (now < context->rcx_codel_drop_next)
+		return (false);
+
+	/* Shed faster the longer the queue stays above target */
+	context->rcx_codel_count++;
+	context->rcx_codel_drop_next = now +
+	    limits->interval / isqrt(context->rcx_codel_count);
+	return (true);
+}
+
+void
+rpc_context_set_threads(rpc_context_t context, unsigned int threads)
+{
+
+	g_thread_pool_set_max_threads(context->rcx_threadpool,
+	    threads > 0 ? (gint)MIN(threads, G_MAXINT) : -1, NULL);
+}
+
+void
+rpc_context_set_limits(rpc_context_t context,
+    const struct rpc_context_limits *limits)
+{
+
+	g_mutex_lock(&context->rcx_sched_mtx);
+	context->rcx_limits = *limits;
+	if (context->rcx_limits.target_delay != 0 &&
+	    context->rcx_limits.interval == 0)
+		context->rcx_limits.interval = DEFAULT_CODEL_INTERVAL;
+
+	context->rcx_codel_first_above = 0;
+	context->rcx_codel_dropping = false;
+	g_mutex_unlock(&context->rcx_sched_mtx);
+}
+
+void
+rpc_context_get_stats(rpc_context_t context, struct rpc_context_stats *stats)
+{
+
+	g_mutex_lock(&context->rcx_sched_mtx);
+	*stats = context->rcx_stats;
+	g_mutex_unlock(&context->rcx_sched_mtx);
+}
+
+static void
+rpc_context_sched_enqueue(rpc_context_t context, struct rpc_call *call)
+{
+	rpc_connection_t conn = call->rc_conn;
+
+	g_mutex_lock(&context->rcx_sched_mtx);
+	call->rc_queued_at = g_get_monotonic_time();
+	context->rcx_stats.queued++;
+	g_queue_push_tail(conn->rco_sched_queue, call);
+	if (!conn->rco_sched_active) {
+		conn->rco_sched_active = true;
+		conn->rco_deficit = 0;
+		g_queue_push_tail(context->rcx_sched_active, conn);
+	}
+	g_mutex_unlock(&context->rcx_sched_mtx);
+}
+
+static void
+rpc_context_sched_remove(rpc_context_t context, struct rpc_call *call)
+{
+	rpc_connection_t conn = call->rc_conn;
+
+	g_mutex_lock(&context->rcx_sched_mtx);
+	if (g_queue_remove(conn->rco_sched_queue, call))
+		context->rcx_stats.queued--;
+
+	if (conn->rco_sched_active && g_queue_is_empty(conn->rco_sched_queue)) {
+		conn->rco_sched_active = false;
+		g_queue_remove(context->rcx_sched_active, conn);
+	}
+	g_mutex_unlock(&context->rcx_sched_mtx);
+}
+
+static struct rpc_call *
+rpc_context_sched_next(rpc_context_t context, bool *shed)
+{
+	rpc_connection_t conn;
+	struct rpc_call *call;
+	int64_t now;
+
+	/*
+	 * Deficit round robin over connections with pending calls. Every
+	 * call costs one unit, so a connection may run up to rco_weight
+	 * calls before it has to yield to the next one in the ring.
+	 * Queued calls hold a connection reference, so the connection
+	 * can't go away while it sits on the active list.
+	 */
+	g_mutex_lock(&context->rcx_sched_mtx);
+	conn = g_queue_peek_head(context->rcx_sched_active);
+	if (conn == NULL) {
+		g_mutex_unlock(&context->rcx_sched_mtx);
+		return (NULL);
+	}
+
+	if (conn->rco_deficit == 0)
+		conn->rco_deficit = conn->rco_weight;
+
+	call = g_queue_pop_head(conn->rco_sched_queue);
+	context->rcx_stats.queued--;
+	conn->rco_deficit--;
+
+	if (g_queue_is_empty(conn->rco_sched_queue)) {
+		g_queue_pop_head(context->rcx_sched_active);
+		conn->rco_sched_active = false;
+		conn->rco_deficit = 0;
+	} else if (conn->rco_deficit == 0) {
+		g_queue_pop_head(context->rcx_sched_active);
+		g_queue_push_tail(context->rcx_sched_active, conn);
+	}
+
+	now = g_get_monotonic_time();
+	*shed = rpc_context_codel_shed(context, now, now - call->rc_queued_at);
+	if (*shed)
+		context->rcx_stats.shed_delay++;
+
+	g_mutex_unlock(&context->rcx_sched_mtx);
+	return (call);
+}
+
 rpc_instance_t
 rpc_context_find_instance(rpc_context_t context, const char *path)
 {
@@ -349,6 +986,7 @@ rpc_instance_register_property(rpc_instance_t instance, const char *interface,
 {
 	struct rpc_if_member member;
 
+	memset(&member, 0, sizeof(member));
 	member.rim_name = name;
 	member.rim_type = RPC_MEMBER_PROPERTY;
 	member.rim_property.rp_getter = getter;
@@ -389,6 +1027,7 @@ rpc_context_register_instance(rpc_context_t context, rpc_instance_t instance)
 	instance->ri_context = context;
 
 	g_hash_table_insert(context->rcx_instances, instance->ri_path, instance);
+	g_atomic_int_inc(&context->rcx_generation);
 	g_rw_lock_writer_unlock(&context->rcx_rwlock);
 	return (0);
 }
@@ -403,6 +1042,7 @@ rpc_context_unregister_instance(rpc_context_t context, const char *path)
 		rpc_context_emit_event(context, "/",
 		    RPC_DISCOVERABLE_INTERFACE, "instance_removed",
 		    rpc_string_create(path));
+		g_atomic_int_inc(&context->rcx_generation);
 	}
 
 	g_rw_lock_writer_unlock(&context->rcx_rwlock);
@@ -436,45 +1076,248 @@ rpc_context_register_func(rpc_context_t context, const char *interface,
 	return (rpc_context_register_block(context, interface, name, arg, fn));
 }
 
-int
-rpc_context_unregister_member(rpc_context_t context, const char *interface,
-    const char *name)
+int
+rpc_context_unregister_member(rpc_context_t context, const char *interface,
+    const char *name)
+{
+
+	return (rpc_instance_unregister_member(context->rcx_root, interface,
+	    name));
+}
+
+static gpointer
+emit_events(gpointer data)
+{
+	struct emit_item *item;
+	struct rpc_shared_frame *frame;
+	struct rpc_context_event_stats delta;
+	struct rpc_context_emitter emitter;
+	rpc_context_t context = data;
+	GAsyncQueue *q = context->rcx_emit_queue;
+	GHashTable *targets;
+	rpc_connection_t conn;
+	GHashTableIter iter;
+	int64_t timeout;
+	size_t depth;
+
+	for (;;) {
+		/* Coalesced property changes are due on our own clock */
+		timeout = rpc_context_flush_properties(context);
+		item = timeout < 0 ? g_async_queue_pop(q) :
+		    g_async_queue_timeout_pop(q, (guint64)timeout);
+		if (item == NULL)
+			continue;
+
+		if (item->context == NULL)
+			break;
+
+		if (item->name == NULL) {
+			/* just a wakeup */
+			g_free(item);
+			continue;
+		}
+
+		frame = rpc_shared_frame_new(item->path, item->interface,
+		    item->name, item->args);
+		memset(&delta, 0, sizeof(delta));
+
+		g_mutex_lock(&context->rcx_emit_mtx);
+		emitter = context->rcx_emitter;
+		g_mutex_unlock(&context->rcx_emit_mtx);
+
+		/*
+		 * Only queue the event here; the sender threads do the
+		 * actual writes, so a slow subscriber can't stall the rest.
+		 */
+		targets = g_hash_table_new(NULL, NULL);
+		g_rw_lock_reader_lock(&context->rcx_rwlock);
+		rpc_sub_index_match(context->rcx_sub_index, item->interface,
+		    item->name, item->path, ^(gpointer value) {
+			GHashTableIter it;
+			gpointer c;
+
+			g_hash_table_iter_init(&it, value);
+			while (g_hash_table_iter_next(&it, &c, NULL))
+				g_hash_table_add(targets, c);
+
+			return ((bool)true);
+		});
+
+		g_hash_table_iter_init(&iter, targets);
+		while (g_hash_table_iter_next(&iter, (gpointer)&conn, NULL)) {
+			switch (rpc_connection_enqueue_event(conn, frame,
+			    emitter.queue_limit, emitter.policy, &depth)) {
+			case RPC_EVENT_SKIPPED:
+				continue;
+
+			case RPC_EVENT_QUEUED:
+				delta.queued++;
+				break;
+
+			case RPC_EVENT_DROPPED:
+				delta.queued++;
+				delta.dropped++;
+				break;
+
+			case RPC_EVENT_COALESCED:
+				delta.coalesced++;
+				break;
+
+			case RPC_EVENT_OVERFLOW:
+				delta.disconnects++;
+				break;
+			}
+
+			if (depth > delta.queue_hwm)
+				delta.queue_hwm = depth;
+		}
+		g_rw_lock_reader_unlock(&context->rcx_rwlock);
+		g_hash_table_destroy(targets);
+
+		g_mutex_lock(&context->rcx_emit_mtx);
+		context->rcx_event_stats.emitted++;
+		context->rcx_event_stats.queued += delta.queued;
+		context->rcx_event_stats.dropped += delta.dropped;
+		context->rcx_event_stats.coalesced += delta.coalesced;
+		context->rcx_event_stats.disconnects += delta.disconnects;
+		if (delta.queue_hwm > context->rcx_event_stats.queue_hwm)
+			context->rcx_event_stats.queue_hwm = delta.queue_hwm;
+		g_mutex_unlock(&context->rcx_emit_mtx);
+
+		rpc_shared_frame_release(frame);
+		rpc_release(item->args);
+		g_free(item->path);
+		g_free(item->interface);
+		g_free(item->name);
+		g_free(item);
+	}
+	return (NULL);
+}
+
+static void
+rpc_context_emit_worker(gpointer data, gpointer user_data __unused)
+{
+	rpc_connection_t conn = data;
+
+	rpc_connection_drain_events(conn);
+	rpc_connection_release(conn);
+}
+
+void
+rpc_context_watch_event(rpc_context_t context, rpc_connection_t conn,
+    const char *path, const char *interface, const char *name)
+{
+	GHashTable *conns;
+
+	g_rw_lock_writer_lock(&context->rcx_rwlock);
+	conns = rpc_sub_index_lookup(context->rcx_sub_index, interface, name,
+	    path);
+	if (conns == NULL) {
+		conns = g_hash_table_new(NULL, NULL);
+		rpc_sub_index_insert(context->rcx_sub_index, interface, name,
+		    path, conns);
+	}
+
+	g_hash_table_add(conns, conn);
+	g_rw_lock_writer_unlock(&context->rcx_rwlock);
+}
+
+GPtrArray *
+rpc_context_find_watchers(rpc_context_t context, rpc_server_t server,
+    const char *path, const char *interface, const char *name)
+{
+	GPtrArray *result;
+	GHashTable *seen;
+
+	result = g_ptr_array_new_with_free_func(
+	    (GDestroyNotify)rpc_connection_release);
+	seen = g_hash_table_new(NULL, NULL);
+
+	/*
+	 * Connections are only retained here; the caller sends to them
+	 * after rcx_rwlock is dropped, since sending takes their
+	 * subscription locks.
+	 */
+	g_rw_lock_reader_lock(&context->rcx_rwlock);
+	rpc_sub_index_match(context->rcx_sub_index, interface, name, path,
+	    ^(gpointer value) {
+		GHashTableIter iter;
+		rpc_connection_t conn;
+
+		g_hash_table_iter_init(&iter, value);
+		while (g_hash_table_iter_next(&iter, (gpointer *)&conn, NULL)) {
+			if (server != NULL && conn->rco_server != server)
+				continue;
+
+			if (!g_hash_table_add(seen, conn))
+				continue;
+
+			if (rpc_connection_retain_if_valid(conn, true) == 0)
+				g_ptr_array_add(result, conn);
+		}
+
+		return ((bool)true);
+	});
+	g_rw_lock_reader_unlock(&context->rcx_rwlock);
+
+	g_hash_table_destroy(seen);
+	return (result);
+}
+
+void
+rpc_context_unwatch_event(rpc_context_t context, rpc_connection_t conn,
+    const char *path, const char *interface, const char *name)
+{
+	GHashTable *conns;
+
+	g_rw_lock_writer_lock(&context->rcx_rwlock);
+	conns = rpc_sub_index_lookup(context->rcx_sub_index, interface, name,
+	    path);
+	if (conns != NULL && g_hash_table_remove(conns, conn) &&
+	    g_hash_table_size(conns) == 0) {
+		rpc_sub_index_remove(context->rcx_sub_index, interface, name,
+		    path);
+		g_hash_table_destroy(conns);
+	}
+	g_rw_lock_writer_unlock(&context->rcx_rwlock);
+}
+
+void
+rpc_context_schedule_events(rpc_context_t context, rpc_connection_t conn)
 {
+	GError *err = NULL;
 
-	return (rpc_instance_unregister_member(context->rcx_root, interface,
-	    name));
+	g_thread_pool_push(context->rcx_emit_pool, conn, &err);
+	if (err != NULL) {
+		g_error_free(err);
+		rpc_connection_drain_events(conn);
+		rpc_connection_release(conn);
+	}
 }
 
-static gpointer
-emit_events(gpointer data)
+void
+rpc_context_set_emitter(rpc_context_t context,
+    const struct rpc_context_emitter *emitter)
 {
-	struct emit_item *item;
-	GAsyncQueue *q = data;
-	rpc_connection_t conn;
-	rpc_context_t context;
-	GHashTableIter iter;
 
-	for (;;) {
-		item = g_async_queue_pop(q);
-		if (item->context == NULL)
-			break;
-		context = item->context;
+	g_mutex_lock(&context->rcx_emit_mtx);
+	context->rcx_emitter = *emitter;
+	if (context->rcx_emitter.threads == 0)
+		context->rcx_emitter.threads = g_get_num_processors();
 
-		g_rw_lock_reader_lock(&context->rcx_rwlock);
-		g_hash_table_iter_init(&iter, context->rcx_event_watchers);
-		while (g_hash_table_iter_next(&iter, (gpointer)&conn, NULL)) {
-			rpc_connection_send_event(conn, item->path,
-			    item->interface, item->name, item->args);
-		}
+	g_thread_pool_set_max_threads(context->rcx_emit_pool,
+	    (gint)context->rcx_emitter.threads, NULL);
+	g_mutex_unlock(&context->rcx_emit_mtx);
+}
 
-		g_rw_lock_reader_unlock(&context->rcx_rwlock);
-		rpc_release(item->args);
-		g_free(item->path);
-		g_free(item->interface);
-		g_free(item->name);
-		g_free(item);
-	}
-	return (NULL);
+void
+rpc_context_get_event_stats(rpc_context_t context,
+    struct rpc_context_event_stats *stats)
+{
+
+	g_mutex_lock(&context->rcx_emit_mtx);
+	*stats = context->rcx_event_stats;
+	g_mutex_unlock(&context->rcx_emit_mtx);
 }
 
 void
@@ -548,6 +1391,14 @@ rpc_function_get_interface(void *cookie)
 	return (call->rc_interface);
 }
 
+int64_t
+rpc_function_get_deadline(void *cookie)
+{
+	struct rpc_call *call = cookie;
+
+	return (call->rc_deadline);
+}
+
 void
 rpc_function_respond(void *cookie, rpc_object_t object)
 {
@@ -562,9 +1413,15 @@ rpc_function_respond_impl(void *cookie, rpc_object_t object)
 	struct rpc_call *call = cookie;
 
 	g_assert(call->rc_type == RPC_INBOUND_CALL);
-	if (!call->rc_responded)
-		rpc_connection_send_response(call->rc_conn,
-		    call->rc_id, object);
+	if (!call->rc_responded) {
+		if (call->rc_batch != NULL) {
+			rpc_call_batch_store(call->rc_batch, call->rc_batch_idx,
+			    object != NULL ? object : rpc_null_create());
+		} else {
+			rpc_connection_send_response(call->rc_conn,
+			    call->rc_id, object);
+		}
+	}
 
 	rpc_connection_close_inbound_call(call);
 }
@@ -587,7 +1444,15 @@ rpc_function_error_impl(void *cookie, int code, const char *message, va_list ap)
 	char *msg;
 
 	g_vasprintf(&msg, message, ap);
-	rpc_connection_send_err(call->rc_conn, call->rc_id, code, msg);
+	if (call->rc_batch != NULL) {
+		rpc_call_batch_store(call->rc_batch, call->rc_batch_idx,
+		    rpc_error_create(code, msg, NULL));
+	} else {
+		/* Fragments yielded before the error go out first */
+		rpc_function_flush_fragments(call);
+		rpc_connection_send_err(call->rc_conn, call->rc_id, code, msg);
+	}
+
 	call->rc_responded = true;
 	g_free(msg);
 }
@@ -605,7 +1470,14 @@ rpc_function_error_ex_impl(void *cookie, rpc_object_t exception)
 {
 	struct rpc_call *call = cookie;
 
-	rpc_connection_send_errx(call->rc_conn, call->rc_id, exception);
+	if (call->rc_batch != NULL) {
+		rpc_call_batch_store(call->rc_batch, call->rc_batch_idx,
+		    exception);
+	} else {
+		rpc_function_flush_fragments(call);
+		rpc_connection_send_errx(call->rc_conn, call->rc_id, exception);
+	}
+
 	call->rc_responded = true;
 }
 
@@ -623,6 +1495,12 @@ rpc_function_start_stream_impl(void *cookie)
 	struct rpc_call *call = cookie;
 	struct rpc_context *context = call->rc_context;
 
+	if (call->rc_batch != NULL) {
+		rpc_function_error(call, ENOTSUP,
+		    "Streaming not supported in batch calls");
+		return (-1);
+	}
+
 	g_mutex_lock(&call->rc_mtx);
 
 	while (call->rc_producer_seqno == call->rc_consumer_seqno &&
@@ -662,16 +1540,142 @@ rpc_function_yield(void *cookie, rpc_object_t fragment)
 	return (call->rc_conn->rco_fn_cbs.rcf_fn_yield(cookie, fragment));
 }
 
+void
+rpc_function_set_fragment_batch(void *cookie, size_t nitems, uint64_t usec)
+{
+	struct rpc_call *call = cookie;
+
+	g_mutex_lock(&call->rc_frag_mtx);
+	call->rc_frag_batch = nitems;
+	call->rc_frag_window = usec;
+	g_mutex_unlock(&call->rc_frag_mtx);
+}
+
+static void
+rpc_function_flush_fragments_locked(struct rpc_call *call)
+{
+	rpc_object_t pending = call->rc_frag_pending;
+
+	if (call->rc_frag_flush != NULL) {
+		g_source_destroy(call->rc_frag_flush);
+		g_source_unref(call->rc_frag_flush);
+		call->rc_frag_flush = NULL;
+	}
+
+	if (pending == NULL)
+		return;
+
+	call->rc_frag_pending = NULL;
+
+	/* Don't wrap a lone fragment */
+	if (rpc_array_get_count(pending) == 1) {
+		rpc_connection_send_fragment(call->rc_conn, call->rc_id,
+		    call->rc_frag_seqno,
+		    rpc_retain(rpc_array_get_value(pending, 0)));
+		rpc_release(pending);
+		return;
+	}
+
+	rpc_connection_send_fragment_batch(call->rc_conn, call->rc_id,
+	    call->rc_frag_seqno, pending);
+}
+
+static void
+rpc_function_flush_fragments(struct rpc_call *call)
+{
+
+	g_mutex_lock(&call->rc_frag_mtx);
+	rpc_function_flush_fragments_locked(call);
+	g_mutex_unlock(&call->rc_frag_mtx);
+}
+
+static gboolean
+rpc_function_fragment_window_expired(gpointer user_data)
+{
+	struct rpc_call *call = user_data;
+
+	if (g_source_is_destroyed(g_main_current_source()))
+		return (G_SOURCE_REMOVE);
+
+	rpc_function_flush_fragments(call);
+	return (G_SOURCE_REMOVE);
+}
+
+static inline bool
+rpc_function_has_credit_locked(struct rpc_call *call)
+{
+
+	if (call->rc_producer_seqno == call->rc_consumer_seqno)
+		return (false);
+
+	/*
+	 * A fragment may overshoot the byte window, as otherwise a single
+	 * fragment larger than the whole window would never be sent.
+	 */
+	return (!call->rc_byte_credit ||
+	    call->rc_sent_bytes < call->rc_credit_bytes);
+}
+
+static void
+rpc_function_queue_fragment_locked(struct rpc_call *call,
+    rpc_object_t fragment)
+{
+	guint interval;
+
+	g_mutex_lock(&call->rc_frag_mtx);
+	if (call->rc_frag_pending == NULL) {
+		call->rc_frag_pending = rpc_array_create();
+		call->rc_frag_seqno = call->rc_producer_seqno;
+	}
+
+	rpc_array_append_stolen_value(call->rc_frag_pending, fragment);
+	call->rc_producer_seqno++;
+	call->rc_streaming = true;
+
+	/*
+	 * Holding on to fragments the consumer has no credit beyond would
+	 * stall both sides, so the batch also goes out when credit runs out.
+	 */
+	if (rpc_array_get_count(call->rc_frag_pending) >= call->rc_frag_batch ||
+	    !rpc_function_has_credit_locked(call)) {
+		rpc_function_flush_fragments_locked(call);
+		g_mutex_unlock(&call->rc_frag_mtx);
+		return;
+	}
+
+	/* First fragment of a batch arms the flush timer */
+	if (call->rc_frag_flush == NULL && call->rc_frag_window != 0) {
+		interval = (guint)((call->rc_frag_window + 999) / 1000);
+		rpc_connection_call_retain(call);
+		call->rc_frag_flush = g_timeout_source_new(interval);
+		g_source_set_callback(call->rc_frag_flush,
+		    rpc_function_fragment_window_expired, call,
+		    (GDestroyNotify)rpc_connection_call_release);
+		g_source_attach(call->rc_frag_flush,
+		    call->rc_conn->rco_main_context);
+	}
+
+	g_mutex_unlock(&call->rc_frag_mtx);
+}
+
 int
 rpc_function_yield_impl(void *cookie, rpc_object_t fragment)
 {
 	struct rpc_call *call = cookie;
 	struct rpc_context *context = call->rc_context;
 
+	if (call->rc_batch != NULL) {
+		if (!call->rc_responded) {
+			rpc_function_error(call, ENOTSUP,
+			    "Streaming not supported in batch calls");
+		}
+		rpc_release(fragment);
+		return (-1);
+	}
+
 	g_mutex_lock(&call->rc_mtx);
 
-	while (call->rc_producer_seqno == call->rc_consumer_seqno &&
-	    !call->rc_aborted) {
+	while (!rpc_function_has_credit_locked(call) && !call->rc_aborted) {
 		g_mutex_unlock(&call->rc_mtx);
 		notify_wait(&call->rc_notify);
 		g_mutex_lock(&call->rc_mtx);
@@ -691,6 +1695,17 @@ rpc_function_yield_impl(void *cookie, rpc_object_t fragment)
 	if (context->rcx_pre_call_hook != NULL) {
 
 	}
+
+	/* Must be sized before sending, which steals the fragment */
+	if (call->rc_byte_credit)
+		call->rc_sent_bytes += rpc_object_size_estimate(fragment);
+
+	if (call->rc_frag_batch > 1) {
+		rpc_function_queue_fragment_locked(call, fragment);
+		g_mutex_unlock(&call->rc_mtx);
+		return (0);
+	}
+
 	rpc_connection_send_fragment(call->rc_conn, call->rc_id,
 	    call->rc_producer_seqno, fragment);
 
@@ -700,6 +1715,80 @@ rpc_function_yield_impl(void *cookie, rpc_object_t fragment)
 	return (0);
 }
 
+void
+rpc_function_set_upload_window(void *cookie, size_t bytes, size_t nitems)
+{
+	struct rpc_call *call = cookie;
+
+	g_mutex_lock(&call->rc_mtx);
+	call->rc_upload_window = MAX(bytes, 1);
+	call->rc_upload_window_items = MAX(nitems, 1);
+	g_mutex_unlock(&call->rc_mtx);
+}
+
+static void
+rpc_function_grant_upload_locked(struct rpc_call *call)
+{
+	int64_t items;
+	int64_t bytes;
+
+	/* Same half-window refill as rpc_call_continue() on the other side */
+	items = call->rc_upload_credit - call->rc_upload_seqno;
+	bytes = call->rc_upload_credit_bytes - call->rc_upload_bytes;
+	if (call->rc_upload_credit != 0 &&
+	    items > (int64_t)call->rc_upload_window_items / 2 &&
+	    bytes > (int64_t)call->rc_upload_window / 2)
+		return;
+
+	items = MAX(call->rc_upload_seqno +
+	    (int64_t)call->rc_upload_window_items - call->rc_upload_credit, 0);
+	bytes = MAX(call->rc_upload_bytes + (int64_t)call->rc_upload_window -
+	    call->rc_upload_credit_bytes, 0);
+
+	call->rc_upload_credit += items;
+	call->rc_upload_credit_bytes += bytes;
+	rpc_connection_send_upload_continue(call->rc_conn, call->rc_id, items,
+	    bytes);
+}
+
+rpc_object_t
+rpc_function_next_fragment(void *cookie)
+{
+	struct rpc_call *call = cookie;
+	rpc_object_t fragment;
+
+	if (!call->rc_upload) {
+		rpc_set_last_error(ENXIO, "Call has no client stream", NULL);
+		return (NULL);
+	}
+
+	g_mutex_lock(&call->rc_mtx);
+
+	/* The client holds off sending until it is granted the first window */
+	if (call->rc_upload_credit == 0)
+		rpc_function_grant_upload_locked(call);
+
+	while (g_queue_is_empty(call->rc_upload_queue) &&
+	    !call->rc_upload_ended && !call->rc_aborted)
+		g_cond_wait(&call->rc_upload_cv, &call->rc_mtx);
+
+	if (call->rc_aborted) {
+		g_mutex_unlock(&call->rc_mtx);
+		rpc_set_last_error(ECONNRESET, "Call aborted", NULL);
+		return (NULL);
+	}
+
+	fragment = g_queue_pop_head(call->rc_upload_queue);
+	if (fragment != NULL) {
+		call->rc_upload_seqno++;
+		call->rc_upload_bytes += rpc_object_size_estimate(fragment);
+		rpc_function_grant_upload_locked(call);
+	}
+
+	g_mutex_unlock(&call->rc_mtx);
+	return (fragment);
+}
+
 int
 rpc_function_retain(void *cookie)
 {
@@ -750,9 +1839,11 @@ rpc_function_end_impl(void *cookie)
 		return;
 	}
 
-	if (!call->rc_ended)
+	if (!call->rc_ended) {
+		rpc_function_flush_fragments(call);
 		rpc_connection_send_end(call->rc_conn, call->rc_id,
 		    call->rc_producer_seqno);
+	}
 
 	call->rc_producer_seqno++;
 	call->rc_streaming = true;
@@ -777,6 +1868,7 @@ rpc_function_kill_impl(void *cookie)
 	g_mutex_lock(&call->rc_mtx);
 	call->rc_aborted = true;
 	notify_signal(&call->rc_notify);
+	g_cond_broadcast(&call->rc_upload_cv);
 	g_mutex_unlock(&call->rc_mtx);
 }
 
@@ -898,6 +1990,7 @@ rpc_instance_free(rpc_instance_t instance)
 	item->type = TYPE_INSTANCE;
 	item->data = instance;
 	instance->ri_destroyed = true;
+	rpc_instance_bump_generation(instance);
 
 	/* wait on any outstanding calls to complete in another thread. */
 	g_thread_pool_push(instance->ri_context->rcx_threadpool, item, NULL);
@@ -960,6 +2053,8 @@ rpc_instance_register_interface(rpc_instance_t instance,
 	g_rw_lock_init(&priv->rip_rwlock);
 	priv->rip_members = g_hash_table_new_full(g_str_hash, g_str_equal,
 	    g_free, (GDestroyNotify)rpc_if_member_free);
+	priv->rip_intervals = g_hash_table_new_full(g_str_hash, g_str_equal,
+	    g_free, g_free);
 	priv->rip_arg = arg;
 	priv->rip_name = g_strdup(interface);
 
@@ -986,6 +2081,7 @@ rpc_instance_unregister_interface(rpc_instance_t instance,
 {
 	g_rw_lock_writer_lock(&instance->ri_rwlock);
 	g_hash_table_remove(instance->ri_interfaces, interface);
+	rpc_instance_bump_generation(instance);
 	g_rw_lock_writer_unlock(&instance->ri_rwlock);
 
 	rpc_instance_emit_event(instance, RPC_INTROSPECTABLE_INTERFACE,
@@ -997,6 +2093,7 @@ rpc_interface_free(struct rpc_interface_priv *priv)
 {
 
 	g_hash_table_destroy(priv->rip_members);
+	g_hash_table_destroy(priv->rip_intervals);
 	g_rw_lock_clear(&priv->rip_rwlock);
 	g_free(priv->rip_description);
 	g_free(priv);
@@ -1067,6 +2164,7 @@ int rpc_instance_register_member(rpc_instance_t instance, const char *interface,
 
 	g_rw_lock_writer_lock(&priv->rip_rwlock);
 	g_hash_table_insert(priv->rip_members, g_strdup(member->rim_name), copy);
+	rpc_instance_bump_generation(instance);
 	g_rw_lock_writer_unlock(&priv->rip_rwlock);
 	return (0);
 }
@@ -1077,6 +2175,7 @@ rpc_instance_register_block(rpc_instance_t instance, const char *interface,
 {
 	struct rpc_if_member member;
 
+	memset(&member, 0, sizeof(member));
 	member.rim_name = name;
 	member.rim_type = RPC_MEMBER_METHOD;
 	member.rim_method.rm_block = func;
@@ -1120,6 +2219,8 @@ rpc_instance_unregister_member(rpc_instance_t instance, const char *interface,
 	}
 
 	g_hash_table_remove(priv->rip_members, name);
+	g_hash_table_remove(priv->rip_intervals, name);
+	rpc_instance_bump_generation(instance);
 	g_rw_lock_writer_unlock(&priv->rip_rwlock);
 
 	debugf("unregistered %s", name);
@@ -1163,19 +2264,20 @@ rpc_instance_get_property_rights(rpc_instance_t instance, const char *interface,
 	return (rights);
 }
 
-void
-rpc_instance_property_changed(rpc_instance_t instance, const char *interface,
+static void
+rpc_instance_property_emit(rpc_instance_t instance, const char *interface,
     const char *name, rpc_object_t value)
 {
 	struct rpc_if_member *prop;
 	struct rpc_property_cookie cookie;
 	bool release = false;
 
-	prop = rpc_instance_find_member(instance, interface, name);
-	g_assert(prop != NULL);
-	g_assert(prop->rim_type == RPC_MEMBER_PROPERTY);
-
 	if (value == NULL) {
+		prop = rpc_instance_find_member(instance, interface, name);
+		if (prop == NULL || prop->rim_type != RPC_MEMBER_PROPERTY ||
+		    prop->rim_property.rp_getter == NULL)
+			return;
+
 		cookie.instance = instance;
 		cookie.name = name;
 		cookie.arg = prop->rim_property.rp_arg;
@@ -1198,6 +2300,230 @@ rpc_instance_property_changed(rpc_instance_t instance, const char *interface,
 		rpc_release(value);
 }
 
+static void
+rpc_property_change_free(struct property_change *change)
+{
+
+	rpc_instance_release(change->instance);
+	rpc_release(change->value);
+	g_free(change->interface);
+	g_free(change->name);
+	g_free(change);
+}
+
+static int64_t
+rpc_context_flush_properties(rpc_context_t context)
+{
+	GHashTableIter iter;
+	GPtrArray *due;
+	struct property_change *change;
+	struct property_change *copy;
+	int64_t now = g_get_monotonic_time();
+	int64_t next = -1;
+	int64_t at;
+
+	due = g_ptr_array_new();
+	g_mutex_lock(&context->rcx_prop_mtx);
+	g_hash_table_iter_init(&iter, context->rcx_prop_changes);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer)&change)) {
+		at = change->last + (int64_t)change->interval;
+		if (!change->dirty) {
+			/* Quiet for a whole interval, let the instance go */
+			if (at <= now || change->instance->ri_destroyed) {
+				g_hash_table_iter_remove(&iter);
+				continue;
+			}
+		} else if (at <= now) {
+			copy = g_malloc0(sizeof(*copy));
+			copy->instance = rpc_instance_retain(change->instance);
+			copy->interface = g_strdup(change->interface);
+			copy->name = g_strdup(change->name);
+			copy->value = change->value;
+			change->value = NULL;
+			change->dirty = false;
+			change->last = now;
+			g_ptr_array_add(due, copy);
+			at = now + (int64_t)change->interval;
+		}
+
+		if (next < 0 || at < next)
+			next = at;
+	}
+	g_mutex_unlock(&context->rcx_prop_mtx);
+
+	/* Latest value wins; the getter runs once per flush, here */
+	for (guint i = 0; i < due->len; i++) {
+		copy = g_ptr_array_index(due, i);
+		if (copy->instance != NULL)
+			rpc_instance_property_emit(copy->instance,
+			    copy->interface, copy->name, copy->value);
+
+		rpc_property_change_free(copy);
+	}
+
+	g_ptr_array_free(due, true);
+	return (next < 0 ? -1 : MAX(next - now, 0));
+}
+
+static uint64_t
+rpc_instance_get_property_interval(rpc_instance_t instance,
+    const char *interface, const char *name)
+{
+	struct rpc_interface_priv *priv;
+	uint64_t *interval;
+	uint64_t result = 0;
+
+	if (interface == NULL)
+		interface = RPC_DEFAULT_INTERFACE;
+
+	g_rw_lock_reader_lock(&instance->ri_rwlock);
+	priv = g_hash_table_lookup(instance->ri_interfaces, interface);
+	if (priv != NULL) {
+		g_rw_lock_reader_lock(&priv->rip_rwlock);
+		interval = g_hash_table_lookup(priv->rip_intervals, name);
+		if (interval != NULL)
+			result = *interval;
+		g_rw_lock_reader_unlock(&priv->rip_rwlock);
+	}
+	g_rw_lock_reader_unlock(&instance->ri_rwlock);
+
+	return (result);
+}
+
+static char *
+rpc_property_change_key(rpc_instance_t instance, const char *interface,
+    const char *name)
+{
+
+	if (interface == NULL)
+		interface = RPC_DEFAULT_INTERFACE;
+
+	return (g_strdup_printf("%p\x1f%s\x1f%s", (void *)instance,
+	    interface, name));
+}
+
+void
+rpc_instance_property_changed(rpc_instance_t instance, const char *interface,
+    const char *name, rpc_object_t value)
+{
+	struct rpc_if_member *prop;
+	struct property_change *change;
+	struct emit_item *item;
+	rpc_context_t context;
+	uint64_t interval;
+	bool wakeup;
+	char *key;
+
+	prop = rpc_instance_find_member(instance, interface, name);
+	g_assert(prop != NULL);
+	g_assert(prop->rim_type == RPC_MEMBER_PROPERTY);
+
+	context = instance->ri_context;
+	interval = rpc_instance_get_property_interval(instance, interface,
+	    name);
+	if (interval == 0 || context == NULL) {
+		rpc_instance_property_emit(instance, interface, name, value);
+		return;
+	}
+
+	key = rpc_property_change_key(instance, interface, name);
+
+	g_mutex_lock(&context->rcx_prop_mtx);
+	change = g_hash_table_lookup(context->rcx_prop_changes, key);
+	if (change == NULL) {
+		if (rpc_instance_retain(instance) == NULL) {
+			g_mutex_unlock(&context->rcx_prop_mtx);
+			g_free(key);
+			return;
+		}
+
+		change = g_malloc0(sizeof(*change));
+		change->instance = instance;
+		change->interface = g_strdup(interface);
+		change->name = g_strdup(name);
+		g_hash_table_insert(context->rcx_prop_changes, key, change);
+	} else
+		g_free(key);
+
+	rpc_release(change->value);
+	change->value = value != NULL ? rpc_retain(value) : NULL;
+	change->interval = interval;
+	wakeup = !change->dirty;
+	change->dirty = true;
+	g_mutex_unlock(&context->rcx_prop_mtx);
+
+	if (wakeup) {
+		/* Let the emitter reconsider when to flush next */
+		item = g_malloc0(sizeof(*item));
+		item->context = context;
+		g_async_queue_push(context->rcx_emit_queue, item);
+	}
+}
+
+int
+rpc_instance_set_property_interval(rpc_instance_t instance,
+    const char *interface, const char *name, uint64_t interval)
+{
+	struct rpc_interface_priv *priv;
+	struct rpc_if_member *prop;
+	struct property_change *change;
+	struct emit_item *item;
+	rpc_context_t context;
+	bool wakeup;
+	char *key;
+
+	if (interface == NULL)
+		interface = RPC_DEFAULT_INTERFACE;
+
+	g_rw_lock_reader_lock(&instance->ri_rwlock);
+	priv = g_hash_table_lookup(instance->ri_interfaces, interface);
+	if (priv == NULL) {
+		g_rw_lock_reader_unlock(&instance->ri_rwlock);
+		rpc_set_last_error(ENOENT, "Property not found", NULL);
+		return (-1);
+	}
+
+	g_rw_lock_writer_lock(&priv->rip_rwlock);
+	prop = g_hash_table_lookup(priv->rip_members, name);
+	if (prop == NULL || prop->rim_type != RPC_MEMBER_PROPERTY) {
+		g_rw_lock_writer_unlock(&priv->rip_rwlock);
+		g_rw_lock_reader_unlock(&instance->ri_rwlock);
+		rpc_set_last_error(ENOENT, "Property not found", NULL);
+		return (-1);
+	}
+
+	if (interval == 0)
+		g_hash_table_remove(priv->rip_intervals, name);
+	else
+		g_hash_table_insert(priv->rip_intervals, g_strdup(name),
+		    g_memdup(&interval, sizeof(interval)));
+
+	g_rw_lock_writer_unlock(&priv->rip_rwlock);
+	g_rw_lock_reader_unlock(&instance->ri_rwlock);
+
+	/* A change already pending is flushed on the new schedule */
+	context = instance->ri_context;
+	if (context == NULL)
+		return (0);
+
+	key = rpc_property_change_key(instance, interface, name);
+	g_mutex_lock(&context->rcx_prop_mtx);
+	change = g_hash_table_lookup(context->rcx_prop_changes, key);
+	if (change != NULL)
+		change->interval = interval;
+	wakeup = change != NULL && change->dirty;
+	g_mutex_unlock(&context->rcx_prop_mtx);
+	g_free(key);
+
+	if (wakeup) {
+		item = g_malloc0(sizeof(*item));
+		item->context = context;
+		g_async_queue_push(context->rcx_emit_queue, item);
+	}
+
+	return (0);
+}
+
 rpc_instance_t
 rpc_property_get_instance(void *cookie)
 {
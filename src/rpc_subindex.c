@@ -0,0 +1,334 @@
+/*
+ * Copyright 2015-2017 Two Pore Guys, Inc.
+ * All rights reserved
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted providing that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <string.h>
+#include <glib.h>
+#include "internal.h"
+
+/*
+ * Subscription index.
+ *
+ * Maps (interface, name) to a trie of path components. A subscription
+ * path is stored component by component; "*" matches any single path
+ * component and a trailing "**" matches one or more of them, so "/a/**"
+ * matches "/a/b" and "/a/b/c", but not "/a" itself. "**" anywhere else
+ * is rejected by rpc_sub_index_path_valid(). Subscriptions without a
+ * path only match events without a path.
+ *
+ * Leading and trailing slashes are ignored, but empty components in
+ * the middle are kept: "/a//b" and "/a/b" are different paths.
+ *
+ * Removing a value hands it back to the caller; values still in the
+ * index when it's freed are passed to its value_free function.
+ */
+
+struct rpc_sub_node
+{
+	GHashTable *		rsn_children;
+	gpointer		rsn_value;
+	GDestroyNotify		rsn_value_free;
+};
+
+struct rpc_sub_index
+{
+	GHashTable *		rsi_roots;
+	GDestroyNotify		rsi_value_free;
+	size_t			rsi_count;
+};
+
+static void rpc_sub_node_free(struct rpc_sub_node *node);
+
+static struct rpc_sub_node *
+rpc_sub_node_new(GDestroyNotify value_free)
+{
+	struct rpc_sub_node *node;
+
+	node = g_malloc0(sizeof(*node));
+	node->rsn_value_free = value_free;
+	node->rsn_children = g_hash_table_new_full(g_str_hash, g_str_equal,
+	    g_free, (GDestroyNotify)rpc_sub_node_free);
+	return (node);
+}
+
+static void
+rpc_sub_node_free(struct rpc_sub_node *node)
+{
+
+	if (node->rsn_value != NULL && node->rsn_value_free != NULL)
+		node->rsn_value_free(node->rsn_value);
+
+	g_hash_table_destroy(node->rsn_children);
+	g_free(node);
+}
+
+static char *
+rpc_sub_index_key(const char *interface, const char *name, const char *path)
+{
+
+	return (g_strdup_printf("%c%s\x1f%c%s\x1f%c",
+	    interface != NULL ? 's' : 'n', interface != NULL ? interface : "",
+	    name != NULL ? 's' : 'n', name != NULL ? name : "",
+	    path != NULL ? 's' : 'n'));
+}
+
+static char **
+rpc_sub_index_split(const char *path)
+{
+	char **comps;
+	size_t len;
+
+	if (path == NULL)
+		return (g_new0(char *, 1));
+
+	comps = g_strsplit(path, "/", -1);
+	len = g_strv_length(comps);
+
+	/* Drop the empty components around a leading or trailing slash */
+	if (len > 0 && comps[len - 1][0] == '\0' && len > 1) {
+		g_free(comps[len - 1]);
+		comps[--len] = NULL;
+	}
+
+	if (len > 0 && comps[0][0] == '\0') {
+		g_free(comps[0]);
+		memmove(comps, comps + 1, len * sizeof(*comps));
+	}
+
+	return (comps);
+}
+
+bool
+rpc_sub_index_path_valid(const char *path)
+{
+	char **comps;
+	bool ret = true;
+	size_t i;
+
+	comps = rpc_sub_index_split(path);
+	for (i = 0; comps[i] != NULL; i++) {
+		if (strcmp(comps[i], "**") == 0 && comps[i + 1] != NULL) {
+			ret = false;
+			break;
+		}
+	}
+
+	g_strfreev(comps);
+	return (ret);
+}
+
+struct rpc_sub_index *
+rpc_sub_index_new(GDestroyNotify value_free)
+{
+	struct rpc_sub_index *index;
+
+	index = g_malloc0(sizeof(*index));
+	index->rsi_value_free = value_free;
+	index->rsi_roots = g_hash_table_new_full(g_str_hash, g_str_equal,
+	    g_free, (GDestroyNotify)rpc_sub_node_free);
+	return (index);
+}
+
+void
+rpc_sub_index_free(struct rpc_sub_index *index)
+{
+
+	if (index == NULL)
+		return;
+
+	g_hash_table_destroy(index->rsi_roots);
+	g_free(index);
+}
+
+size_t
+rpc_sub_index_size(struct rpc_sub_index *index)
+{
+
+	return (index->rsi_count);
+}
+
+gpointer
+rpc_sub_index_lookup(struct rpc_sub_index *index, const char *interface,
+    const char *name, const char *path)
+{
+	struct rpc_sub_node *node;
+	char **comps;
+	char *key;
+	size_t i;
+
+	key = rpc_sub_index_key(interface, name, path);
+	node = g_hash_table_lookup(index->rsi_roots, key);
+	g_free(key);
+
+	comps = rpc_sub_index_split(path);
+	for (i = 0; node != NULL && comps[i] != NULL; i++)
+		node = g_hash_table_lookup(node->rsn_children, comps[i]);
+
+	g_strfreev(comps);
+	return (node != NULL ? node->rsn_value : NULL);
+}
+
+void
+rpc_sub_index_insert(struct rpc_sub_index *index, const char *interface,
+    const char *name, const char *path, gpointer value)
+{
+	struct rpc_sub_node *node;
+	struct rpc_sub_node *child;
+	char **comps;
+	char *key;
+	size_t i;
+
+	g_assert_nonnull(value);
+
+	key = rpc_sub_index_key(interface, name, path);
+	node = g_hash_table_lookup(index->rsi_roots, key);
+	if (node == NULL) {
+		node = rpc_sub_node_new(index->rsi_value_free);
+		g_hash_table_insert(index->rsi_roots, key, node);
+	} else
+		g_free(key);
+
+	comps = rpc_sub_index_split(path);
+	for (i = 0; comps[i] != NULL; i++) {
+		child = g_hash_table_lookup(node->rsn_children, comps[i]);
+		if (child == NULL) {
+			child = rpc_sub_node_new(index->rsi_value_free);
+			g_hash_table_insert(node->rsn_children,
+			    g_strdup(comps[i]), child);
+		}
+
+		node = child;
+	}
+
+	g_strfreev(comps);
+	if (node->rsn_value == NULL)
+		index->rsi_count++;
+
+	node->rsn_value = value;
+}
+
+static bool
+rpc_sub_node_remove(struct rpc_sub_node *node, char **comps, bool *removed)
+{
+	struct rpc_sub_node *child;
+
+	if (*comps == NULL) {
+		*removed = node->rsn_value != NULL;
+		node->rsn_value = NULL;
+	} else {
+		child = g_hash_table_lookup(node->rsn_children, *comps);
+		if (child == NULL)
+			return (false);
+
+		if (rpc_sub_node_remove(child, comps + 1, removed))
+			g_hash_table_remove(node->rsn_children, *comps);
+	}
+
+	/* Tell the parent whether this node can be pruned */
+	return (node->rsn_value == NULL &&
+	    g_hash_table_size(node->rsn_children) == 0);
+}
+
+void
+rpc_sub_index_remove(struct rpc_sub_index *index, const char *interface,
+    const char *name, const char *path)
+{
+	struct rpc_sub_node *node;
+	bool removed = false;
+	char **comps;
+	char *key;
+
+	key = rpc_sub_index_key(interface, name, path);
+	node = g_hash_table_lookup(index->rsi_roots, key);
+	if (node != NULL) {
+		comps = rpc_sub_index_split(path);
+		if (rpc_sub_node_remove(node, comps, &removed))
+			g_hash_table_remove(index->rsi_roots, key);
+
+		g_strfreev(comps);
+	}
+
+	if (removed)
+		index->rsi_count--;
+
+	g_free(key);
+}
+
+static bool
+rpc_sub_node_match(struct rpc_sub_node *node, char **comps,
+    rpc_sub_index_applier_t applier)
+{
+	struct rpc_sub_node *child;
+
+	if (*comps == NULL) {
+		if (node->rsn_value != NULL && !applier(node->rsn_value))
+			return (false);
+	} else {
+		child = g_hash_table_lookup(node->rsn_children, *comps);
+		if (child != NULL &&
+		    !rpc_sub_node_match(child, comps + 1, applier))
+			return (false);
+
+		child = strcmp(*comps, "*") != 0 ?
+		    g_hash_table_lookup(node->rsn_children, "*") : NULL;
+		if (child != NULL &&
+		    !rpc_sub_node_match(child, comps + 1, applier))
+			return (false);
+
+		/* "**" needs at least one component to match */
+		child = g_hash_table_lookup(node->rsn_children, "**");
+		if (child != NULL && child->rsn_value != NULL &&
+		    !applier(child->rsn_value))
+			return (false);
+	}
+
+	return (true);
+}
+
+bool
+rpc_sub_index_match(struct rpc_sub_index *index, const char *interface,
+    const char *name, const char *path, rpc_sub_index_applier_t applier)
+{
+	struct rpc_sub_node *node;
+	char **comps;
+	char *key;
+	bool ret;
+
+	if (index->rsi_count == 0)
+		return (true);
+
+	key = rpc_sub_index_key(interface, name, path);
+	node = g_hash_table_lookup(index->rsi_roots, key);
+	g_free(key);
+
+	if (node == NULL)
+		return (true);
+
+	comps = rpc_sub_index_split(path);
+	ret = rpc_sub_node_match(node, comps, applier);
+	g_strfreev(comps);
+	return (ret);
+}
@@ -41,6 +41,7 @@
 #include "../internal.h"
 
 #define SC_ABORT_TIMEOUT 30
+#define SC_READER_BATCH 64
 
 static GSocketAddress *socket_parse_uri(const char *);
 static int socket_connect(struct rpc_connection *, const char *, rpc_object_t);
@@ -51,6 +52,8 @@ static int socket_abort(void *);
 static int socket_get_fd(void *);
 static void socket_release(void *);
 static void *socket_reader(void *);
+static gboolean socket_reader_ready(GSocket *, GIOCondition, gpointer);
+static gboolean socket_reader_stop(gpointer);
 static gboolean socket_abort_timeout(gpointer user_data);
 static bool socket_supports_fd_passing(struct rpc_connection *);
 
@@ -85,6 +88,14 @@ struct socket_connection
 	GCancellable *			sc_cancellable;
 	GSource *			sc_abort_timeout;
 	bool				sc_creds_sent;
+	GSource *			sc_reader_source;
+	GCond				sc_abort_cv;
+	bool				sc_reader_stopped;
+	uint32_t			sc_rx_header[4];
+	size_t				sc_rx_done;
+	void *				sc_rx_frame;
+	int *				sc_rx_fds;
+	size_t				sc_rx_nfds;
 };
 
 static GSocketAddress *
@@ -204,6 +215,7 @@ socket_accept(GObject *source __unused, GAsyncResult *result, void *data)
 	conn->sc_conn = gconn;
 	conn->sc_socket = g_object_ref(g_socket_connection_get_socket(gconn));
 	g_mutex_init(&conn->sc_abort_mtx);
+	g_cond_init(&conn->sc_abort_cv);
 
 	rco = rpc_connection_alloc(srv);
 	rco->rco_send_msg = socket_send_msg;
@@ -287,6 +299,7 @@ socket_connect(struct rpc_connection *rco, const char *uri,
 	conn->sc_parent = rco;
 	conn->sc_uri = strdup(uri);
 	g_mutex_init(&conn->sc_abort_mtx);
+	g_cond_init(&conn->sc_abort_cv);
 
 	rco->rco_release = socket_release;
 	rco->rco_abort = socket_abort;
@@ -296,8 +309,17 @@ socket_connect(struct rpc_connection *rco, const char *uri,
 	rco->rco_send_msg = socket_send_msg;
 	rco->rco_get_fd = socket_get_fd;
 	conn->sc_cancellable = g_cancellable_new ();
-	conn->sc_reader_thread = g_thread_new("socket reader thread",
-	    socket_reader, (gpointer)conn);
+
+	if (rco->rco_runtime != NULL) {
+		/* Runtime clients are read from the runtime's event loop */
+		conn->sc_reader_source = g_socket_create_source(sock,
+		    G_IO_IN | G_IO_HUP | G_IO_ERR, NULL);
+		g_source_set_callback(conn->sc_reader_source,
+		    (GSourceFunc)socket_reader_ready, conn, NULL);
+		g_source_attach(conn->sc_reader_source, rco->rco_main_context);
+	} else
+		conn->sc_reader_thread = g_thread_new("socket reader thread",
+		    socket_reader, (gpointer)conn);
 
 	g_object_unref(addr);
 	return (0);
@@ -478,6 +500,56 @@ done:
 	return (ret);
 }
 
+static void
+socket_process_cmsgs(struct socket_connection *conn,
+    GSocketControlMessage **cmsg, int ncmsg, int **fds, size_t *nfds)
+{
+#ifndef _WIN32
+	int i;
+	int nfds_i;
+#if defined(__linux__)
+	GError *err = NULL;
+	int ret;
+	uid_t uid;
+	pid_t pid;
+	GCredentials *cr;
+#endif
+
+	for (i = 0; i < ncmsg; i++) {
+#if defined(__linux__)
+		if (G_IS_UNIX_CREDENTIALS_MESSAGE(cmsg[i])) {
+			cr = g_unix_credentials_message_get_credentials(
+			    G_UNIX_CREDENTIALS_MESSAGE(cmsg[i]));
+			pid = g_credentials_get_unix_pid(cr, &err);
+			uid = g_credentials_get_unix_user(cr, &err);
+			g_assert(pid != -1 && (int)uid != -1);
+			g_assert(conn->sc_parent->rco_set_creds != NULL);
+
+			ret = conn->sc_parent->rco_set_creds(conn->sc_parent,
+			    pid, uid, (gid_t)-1);
+			g_assert(ret == 0);
+
+			if (!g_socket_set_option(conn->sc_socket, SOL_SOCKET,
+			    SO_PASSCRED, false, &err)) {
+				debugf("Couldn't disable passcreds %s", err->message);
+				g_error_free(err);
+			}
+
+			debugf("remote pid=%d, uid=%d, gid=%d", pid, uid, -1);
+		}
+#endif
+
+		if (G_IS_UNIX_FD_MESSAGE(cmsg[i])) {
+			*fds = g_unix_fd_message_steal_fds(
+			    G_UNIX_FD_MESSAGE(cmsg[i]), &nfds_i);
+			*nfds = (size_t)nfds_i;
+		}
+
+		g_object_unref(cmsg[i]);
+	}
+#endif
+}
+
 static int
 socket_recv_msg(struct socket_connection *conn, void **frame, size_t *size,
     int **fds, size_t *nfds)
@@ -492,13 +564,6 @@ socket_recv_msg(struct socket_connection *conn, void **frame, size_t *size,
 	size_t tmp;
 	bool have_header = false;
 	int ncmsg = 0, i;
-	int nfds_i;
-#if defined(__linux__)
-	int ret;
-	uid_t uid;
-	pid_t pid;
-	GCredentials *cr;
-#endif
 
 	*nfds = 0;
 	iov[0] = (GInputVector){ .buffer = header, .size = sizeof(header) };
@@ -551,46 +616,103 @@ socket_recv_msg(struct socket_connection *conn, void **frame, size_t *size,
 			break;
 	}
 
-#ifndef _WIN32
-	for (i = 0; i < ncmsg; i++) {
-#if defined(__linux__)
-		if (G_IS_UNIX_CREDENTIALS_MESSAGE(cmsg[i])) {
-			cr = g_unix_credentials_message_get_credentials(
-			    G_UNIX_CREDENTIALS_MESSAGE(cmsg[i]));
-			pid = g_credentials_get_unix_pid(cr, &err);
-			uid = g_credentials_get_unix_user(cr, &err);
-			g_assert(pid != -1 && (int)uid != -1);
-			g_assert(conn->sc_parent->rco_set_creds != NULL);
+	socket_process_cmsgs(conn, cmsg, ncmsg, fds, nfds);
+	if (cmsg != NULL)
+		g_free(cmsg);
 
-			ret = conn->sc_parent->rco_set_creds(conn->sc_parent,
-			    pid, uid, (gid_t)-1);
-			g_assert(ret == 0);
+	g_cancellable_reset(conn->sc_cancellable);
+	return (0);
+}
 
-			if (!g_socket_set_option(conn->sc_socket, SOL_SOCKET,
-			    SO_PASSCRED, false, &err)) {
-				debugf("Couldn't disable passcreds %s", err->message);
-				g_error_free(err);
-			}
+/*
+ * Non-blocking counterpart of socket_recv_msg() used by the runtime
+ * reader source. Only reads what is already buffered in the kernel and
+ * keeps partial frames in the connection. Returns 1 when a frame is
+ * complete, 0 when more data is needed and -1 on error or hangup.
+ */
+static int
+socket_recv_step(struct socket_connection *conn, bool readable,
+    void **frame, size_t *size, int **fds, size_t *nfds)
+{
+	GError *err = NULL;
+	GSocketControlMessage **cmsg = NULL;
+	GInputVector iov;
+	const size_t hdrlen = sizeof(conn->sc_rx_header);
+	size_t length = conn->sc_rx_header[1];
+	size_t want;
+	gssize avail;
+	gssize step;
+	int ncmsg = 0;
+	bool have_header;
 
-			debugf("remote pid=%d, uid=%d, gid=%d", pid, uid, -1);
-		}
-#endif
+	have_header = conn->sc_rx_done >= hdrlen;
+	if (have_header) {
+		iov.buffer = (char *)conn->sc_rx_frame + conn->sc_rx_done -
+		    hdrlen;
+		want = length + hdrlen - conn->sc_rx_done;
+	} else {
+		iov.buffer = (char *)conn->sc_rx_header + conn->sc_rx_done;
+		want = hdrlen - conn->sc_rx_done;
+	}
 
-		if (G_IS_UNIX_FD_MESSAGE(cmsg[i])) {
-			*fds = g_unix_fd_message_steal_fds(
-			    G_UNIX_FD_MESSAGE(cmsg[i]), &nfds_i);
-			*nfds = (size_t)nfds_i;
-		}
+	avail = g_socket_get_available_bytes(conn->sc_socket);
+	if (avail < 0) {
+		conn->sc_parent->rco_error = rpc_error_create(ECONNRESET,
+		    "Cannot query socket", NULL);
+		return (-1);
+	}
 
-		g_object_unref(cmsg[i]);
+	/* Nothing buffered and no readiness reported: wait for more */
+	if (avail == 0 && !readable)
+		return (0);
+
+	/* Readable with nothing buffered means hangup; the read returns 0 */
+	iov.size = avail > 0 ? MIN(want, (size_t)avail) : want;
+	step = g_socket_receive_message(conn->sc_socket, NULL, &iov, 1,
+	    have_header ? NULL : &cmsg, have_header ? NULL : &ncmsg,
+	    NULL, NULL, &err);
+	if (err != NULL) {
+		conn->sc_parent->rco_error = rpc_error_create_from_gerror(err);
+		g_error_free(err);
+		return (-1);
 	}
-#endif
 
-	if (cmsg != NULL)
+	if (step == 0) {
+		conn->sc_parent->rco_error = rpc_error_create(
+		    ECONNRESET, "Connection terminated", NULL);
+		return (-1);
+	}
+
+	if (cmsg != NULL) {
+		socket_process_cmsgs(conn, cmsg, ncmsg, &conn->sc_rx_fds,
+		    &conn->sc_rx_nfds);
 		g_free(cmsg);
+	}
 
-	g_cancellable_reset(conn->sc_cancellable);
-	return (0);
+	conn->sc_rx_done += step;
+	if (conn->sc_rx_done < hdrlen)
+		return (0);
+
+	if (!have_header) {
+		if (conn->sc_rx_header[0] != 0xdeadbeef)
+			return (-1);
+
+		length = conn->sc_rx_header[1];
+		conn->sc_rx_frame = g_malloc(length);
+	}
+
+	if (conn->sc_rx_done < length + hdrlen)
+		return (0);
+
+	*frame = conn->sc_rx_frame;
+	*size = length;
+	*fds = conn->sc_rx_fds;
+	*nfds = conn->sc_rx_nfds;
+	conn->sc_rx_frame = NULL;
+	conn->sc_rx_fds = NULL;
+	conn->sc_rx_nfds = 0;
+	conn->sc_rx_done = 0;
+	return (1);
 }
 
 static int
@@ -604,6 +726,23 @@ socket_abort(void *arg)
 		g_mutex_unlock(&conn->sc_abort_mtx);
 
 		g_socket_shutdown(conn->sc_socket, true, true, NULL);
+
+		if (conn->sc_reader_source != NULL) {
+			/*
+			 * Detach the reader on its own loop, so that it is
+			 * never torn down in the middle of a dispatch.
+			 */
+			g_main_context_invoke(
+			    conn->sc_parent->rco_main_context,
+			    socket_reader_stop, conn);
+
+			g_mutex_lock(&conn->sc_abort_mtx);
+			while (!conn->sc_reader_stopped)
+				g_cond_wait(&conn->sc_abort_cv,
+				    &conn->sc_abort_mtx);
+			g_mutex_unlock(&conn->sc_abort_mtx);
+		}
+
 		g_socket_close(conn->sc_socket, NULL);
 
 		if (conn->sc_reader_thread) {
@@ -658,6 +797,14 @@ socket_release(void *arg)
 			g_source_destroy(conn->sc_abort_timeout);
 		g_source_unref(conn->sc_abort_timeout);
 	}
+	if (conn->sc_reader_source) {
+		if (!g_source_is_destroyed(conn->sc_reader_source))
+			g_source_destroy(conn->sc_reader_source);
+		g_source_unref(conn->sc_reader_source);
+	}
+	g_free(conn->sc_rx_frame);
+	g_free(conn->sc_rx_fds);
+	g_cond_clear(&conn->sc_abort_cv);
 	g_free(conn);
 }
 
@@ -701,6 +848,66 @@ socket_reader(void *arg)
 	return (NULL);
 }
 
+static gboolean
+socket_reader_ready(GSocket *sock __unused, GIOCondition cond __unused,
+    gpointer arg)
+{
+	struct socket_connection *conn = arg;
+	struct rpc_connection *rco = conn->sc_parent;
+	GSource *source = g_main_current_source();
+	void *frame;
+	int *fds;
+	size_t len, nfds;
+	int ret = 0;
+	int i;
+
+	/* Bounded, so that one busy peer doesn't starve the loop */
+	for (i = 0; i < SC_READER_BATCH; i++) {
+		ret = socket_recv_step(conn, i == 0, &frame, &len, &fds,
+		    &nfds);
+		if (ret <= 0)
+			break;
+
+		ret = rco->rco_recv_msg(rco, frame, len, fds, nfds);
+		g_free(frame);
+
+		/* Aborted from within the dispatch; conn may be gone */
+		if (g_source_is_destroyed(source))
+			return (G_SOURCE_REMOVE);
+
+		if (ret != 0) {
+			ret = -1;
+			break;
+		}
+	}
+
+	if (ret >= 0)
+		return (G_SOURCE_CONTINUE);
+
+	g_source_destroy(source);
+	rco->rco_close(rco);
+	return (G_SOURCE_REMOVE);
+}
+
+static gboolean
+socket_reader_stop(gpointer arg)
+{
+	struct socket_connection *conn = arg;
+	struct rpc_connection *rco = conn->sc_parent;
+
+	/* Runs on the loop owning the reader source */
+	if (!g_source_is_destroyed(conn->sc_reader_source)) {
+		g_source_destroy(conn->sc_reader_source);
+		rco->rco_close(rco);
+	}
+
+	g_mutex_lock(&conn->sc_abort_mtx);
+	conn->sc_reader_stopped = true;
+	g_cond_broadcast(&conn->sc_abort_cv);
+	g_mutex_unlock(&conn->sc_abort_mtx);
+	return (G_SOURCE_REMOVE);
+}
+
 static bool
 socket_supports_fd_passing(struct rpc_connection *rpc_conn)
 {
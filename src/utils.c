@@ -39,6 +39,29 @@ SET_DECLARE(vr_set, struct rpct_validator);
 SET_DECLARE(cs_set, struct rpct_class_handler);
 static GPrivate rpc_last_error = G_PRIVATE_INIT((GDestroyNotify)rpc_release_impl);
 
+/*
+ * Compiled regular expressions shared by query rules and validators.
+ *
+ * Entries live in rpc_regex_table, keyed by pattern. Unpinned ones are
+ * also on rpc_regex_lru, most recently used first, and the least
+ * recently used one is dropped once there are more than
+ * RPC_REGEX_CACHE_SIZE of them. Pinned entries (patterns from IDL
+ * constraints) stay around for good.
+ */
+struct rpc_regex_entry
+{
+	char *			rre_pattern;
+	GRegex *		rre_regex;
+	GList *			rre_link;
+};
+
+static GMutex rpc_regex_mtx;
+static GHashTable *rpc_regex_table;
+static GQueue rpc_regex_lru = G_QUEUE_INIT;
+static uint64_t rpc_regex_hits;
+static uint64_t rpc_regex_misses;
+static uint64_t rpc_regex_evictions;
+
 const struct rpc_transport *
 rpc_find_transport(const char *scheme)
 {
@@ -87,6 +110,17 @@ rpc_find_validator(const char *type, const char *name)
 	return (NULL);
 }
 
+void
+rpc_prepare_validators(const char *name, rpc_object_t params)
+{
+	struct rpct_validator **s;
+
+	SET_FOREACH(s, vr_set) {
+		if (!g_strcmp0((*s)->name, name) && (*s)->prepare != NULL)
+			(*s)->prepare(params);
+	}
+}
+
 const struct rpct_class_handler *
 rpc_find_class_handler(const char *name, rpct_class_t cls)
 {
@@ -280,3 +314,108 @@ rpc_ptr_array_string_index(GPtrArray *arr, const char *str)
 
 	return (-1);
 }
+
+static void
+rpc_regex_entry_free(struct rpc_regex_entry *entry)
+{
+
+	g_regex_unref(entry->rre_regex);
+	g_free(entry->rre_pattern);
+	g_free(entry);
+}
+
+static GRegex *
+rpc_regex_lookup(const char *pattern, bool pin)
+{
+	struct rpc_regex_entry *entry;
+	GRegex *regex;
+
+	g_mutex_lock(&rpc_regex_mtx);
+	if (rpc_regex_table == NULL) {
+		rpc_regex_table = g_hash_table_new_full(g_str_hash,
+		    g_str_equal, NULL, (GDestroyNotify)rpc_regex_entry_free);
+	}
+
+	entry = g_hash_table_lookup(rpc_regex_table, pattern);
+	if (entry == NULL) {
+		rpc_regex_misses++;
+		g_mutex_unlock(&rpc_regex_mtx);
+
+		/* Compile without holding the lock; it's the slow part */
+		regex = g_regex_new(pattern, G_REGEX_OPTIMIZE, 0, NULL);
+		if (regex == NULL)
+			return (NULL);
+
+		g_mutex_lock(&rpc_regex_mtx);
+		entry = g_hash_table_lookup(rpc_regex_table, pattern);
+		if (entry != NULL) {
+			/* Somebody else got there first */
+			g_regex_unref(regex);
+		} else {
+			entry = g_malloc0(sizeof(*entry));
+			entry->rre_pattern = g_strdup(pattern);
+			entry->rre_regex = regex;
+			g_hash_table_insert(rpc_regex_table,
+			    entry->rre_pattern, entry);
+			g_queue_push_head(&rpc_regex_lru, entry);
+			entry->rre_link = rpc_regex_lru.head;
+		}
+	} else {
+		rpc_regex_hits++;
+	}
+
+	if (entry->rre_link != NULL) {
+		g_queue_unlink(&rpc_regex_lru, entry->rre_link);
+		g_queue_push_head_link(&rpc_regex_lru, entry->rre_link);
+	}
+
+	if (pin && entry->rre_link != NULL) {
+		g_queue_delete_link(&rpc_regex_lru, entry->rre_link);
+		entry->rre_link = NULL;
+	}
+
+	regex = g_regex_ref(entry->rre_regex);
+
+	while (rpc_regex_lru.length > RPC_REGEX_CACHE_SIZE) {
+		entry = g_queue_pop_tail(&rpc_regex_lru);
+		g_hash_table_remove(rpc_regex_table, entry->rre_pattern);
+		rpc_regex_evictions++;
+	}
+
+	g_mutex_unlock(&rpc_regex_mtx);
+	return (regex);
+}
+
+GRegex *
+rpc_regex_get(const char *pattern)
+{
+
+	return (rpc_regex_lookup(pattern, false));
+}
+
+void
+rpc_regex_pin(const char *pattern)
+{
+	GRegex *regex;
+
+	regex = rpc_regex_lookup(pattern, true);
+	if (regex != NULL)
+		g_regex_unref(regex);
+}
+
+void
+rpc_query_regex_stats(uint64_t *hits, uint64_t *misses, uint64_t *evictions)
+{
+
+	g_mutex_lock(&rpc_regex_mtx);
+	if (hits != NULL)
+		*hits = rpc_regex_hits;
+
+	if (misses != NULL)
+		*misses = rpc_regex_misses;
+
+	if (evictions != NULL)
+		*evictions = rpc_regex_evictions;
+
+	g_mutex_unlock(&rpc_regex_mtx);
+}
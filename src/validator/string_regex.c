@@ -28,6 +28,29 @@
 #include "../linker_set.h"
 #include "../internal.h"
 
+static const char *
+string_regex_pattern(rpc_object_t params)
+{
+	const char *pattern = NULL;
+
+	/* Either a bare pattern string or a {"pattern": ...} dictionary */
+	if (rpc_get_type(params) == RPC_TYPE_STRING)
+		return (rpc_string_get_string_ptr(params));
+
+	rpc_object_unpack(params, "{s}", "pattern", &pattern);
+	return (pattern);
+}
+
+static void
+prepare_string_regex(rpc_object_t params)
+{
+	const char *pattern;
+
+	pattern = string_regex_pattern(params);
+	if (pattern != NULL)
+		rpc_regex_pin(pattern);
+}
+
 static bool
 validate_string_regex(rpc_object_t obj, rpc_object_t params,
     struct rpct_typei *typei __unused, struct rpct_error_context *errctx)
@@ -35,22 +58,36 @@ validate_string_regex(rpc_object_t obj, rpc_object_t params,
 	bool valid = true;
 	const char *pattern;
 	const char *str;
+	GRegex *regex;
 
-	rpc_object_unpack(params, "{s}", "pattern", &pattern);
+	pattern = string_regex_pattern(params);
 	str = rpc_string_get_string_ptr(obj);
 
-	if (!g_regex_match_simple(pattern, str, 0, 0)) {
+	if (pattern == NULL || str == NULL) {
+		rpct_add_error(errctx, NULL, "Invalid regex constraint");
+		return (false);
+	}
+
+	regex = rpc_regex_get(pattern);
+	if (regex == NULL) {
+		rpct_add_error(errctx, NULL, "Invalid regular expression");
+		return (false);
+	}
+
+	if (!g_regex_match(regex, str, 0, NULL)) {
 		valid = false;
 		rpct_add_error(errctx, NULL, "String doesn't match");
 	}
 
+	g_regex_unref(regex);
 	return (valid);
 }
 
 struct rpct_validator validator_string_regex = {
 	.type = "string",
 	.name = "regex",
-	.validate = validate_string_regex
+	.validate = validate_string_regex,
+	.prepare = prepare_string_regex
 };
 
 DECLARE_VALIDATOR(validator_string_regex);
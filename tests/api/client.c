@@ -151,6 +151,7 @@ SCENARIO("RPC_CLIENT", "Create a simple RPC server and connect to it") {
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
+#include <poll.h>
 #include <rpc/object.h>
 #include <rpc/service.h>
 #include <rpc/server.h>
@@ -201,6 +202,90 @@ struct work_item {
 	client_fixture *	fx;
 };
 
+/*
+ * Counter that test threads can wait on, so tests block on the event
+ * they expect instead of sleeping for a while and hoping for the best.
+ */
+struct client_signal
+{
+	GMutex		mtx;
+	GCond		cv;
+	int		value;
+};
+
+static void
+client_signal_init(struct client_signal *sig)
+{
+
+	g_mutex_init(&sig->mtx);
+	g_cond_init(&sig->cv);
+	sig->value = 0;
+}
+
+static void
+client_signal_clear(struct client_signal *sig)
+{
+
+	g_mutex_clear(&sig->mtx);
+	g_cond_clear(&sig->cv);
+}
+
+static void
+client_signal_add(struct client_signal *sig, int n)
+{
+
+	g_mutex_lock(&sig->mtx);
+	sig->value += n;
+	g_cond_broadcast(&sig->cv);
+	g_mutex_unlock(&sig->mtx);
+}
+
+static int
+client_signal_get(struct client_signal *sig)
+{
+	int value;
+
+	g_mutex_lock(&sig->mtx);
+	value = sig->value;
+	g_mutex_unlock(&sig->mtx);
+	return (value);
+}
+
+/* Waits up to 10 seconds for the counter to reach value */
+static bool
+client_signal_wait(struct client_signal *sig, int value)
+{
+	gint64 deadline;
+	bool ret = true;
+
+	deadline = g_get_monotonic_time() + 10 * G_USEC_PER_SEC;
+	g_mutex_lock(&sig->mtx);
+	while (sig->value < value) {
+		if (!g_cond_wait_until(&sig->cv, &sig->mtx, deadline)) {
+			ret = sig->value >= value;
+			break;
+		}
+	}
+	g_mutex_unlock(&sig->mtx);
+	return (ret);
+}
+
+static struct client_signal stall_entered;
+static struct client_signal stall_gate;
+
+/* Runs on the reader thread of the client and blocks it until released */
+static rpc_object_t
+stall_reader(void *cookie __unused, rpc_object_t args __unused)
+{
+
+	client_signal_add(&stall_entered, 1);
+	client_signal_wait(&stall_gate, 1);
+	return (rpc_null_create());
+}
+
+static const struct rpc_if_member stall_member =
+    RPC_METHOD_INLINE(stall, stall_reader);
+
 static gpointer
 thread_func (gpointer data)
 {
@@ -395,6 +480,145 @@ client_server_calls_test(client_fixture *fixture, gconstpointer user_data)
 	rpc_context_unregister_member(fixture->ctx, NULL, "callyou");
 }
 
+static void
+client_batch_test(client_fixture *fixture, gconstpointer user_data)
+{
+	rpc_client_t client;
+	rpc_connection_t conn;
+	rpc_object_t calls;
+	rpc_object_t result;
+	rpc_call_t call;
+
+	rpc_server_resume(fixture->srv);
+	client = rpc_client_create(uris_[fixture->iuri].cli, 0);
+	g_assert(client != NULL);
+
+	conn = rpc_client_get_connection(client);
+	calls = rpc_object_pack(
+	    "[[n, n, s, [s]], [n, n, s, [s]], [n, n, s, [s]]]",
+	    "hi", "world", "nonexistent", "x", "hi", "batch");
+
+	call = rpc_connection_call_batch(conn, calls, NULL);
+	g_assert(call != NULL);
+	rpc_call_wait(call);
+	g_assert_cmpint(rpc_call_status(call), ==, RPC_CALL_DONE);
+
+	result = rpc_call_result(call);
+	g_assert_cmpint(rpc_array_get_count(result), ==, 3);
+	g_assert_cmpstr(rpc_array_get_string(result, 0), ==, "hello world!");
+	g_assert(rpc_is_error(rpc_array_get_value(result, 1)));
+	g_assert_cmpstr(rpc_array_get_string(result, 2), ==, "hello batch!");
+	g_assert_cmpint(fixture->count, ==, 2);
+
+	rpc_call_free(call);
+	rpc_release(calls);
+	rpc_client_close(client);
+}
+
+struct batch_abort_state
+{
+	GMutex	mtx;
+	GCond	cv;
+	int	running;
+	int	aborted;
+};
+
+static void
+client_batch_abort_test(client_fixture *fixture, gconstpointer user_data)
+{
+	struct batch_abort_state state = { .running = 0, .aborted = 0 };
+	struct batch_abort_state *st = &state;
+	__block rpc_connection_t sconn = NULL;
+	rpc_client_t client;
+	rpc_connection_t conn;
+	rpc_object_t calls;
+	rpc_object_t result;
+	rpc_call_t call;
+	gint64 deadline;
+
+	g_mutex_init(&st->mtx);
+	g_cond_init(&st->cv);
+	rpc_context_register_block(fixture->ctx, NULL, "spin", NULL,
+	    ^rpc_object_t (void *cookie, rpc_object_t args __unused) {
+		gint64 end = g_get_monotonic_time() + 10 * G_USEC_PER_SEC;
+
+		g_mutex_lock(&st->mtx);
+		st->running++;
+		g_cond_broadcast(&st->cv);
+		g_mutex_unlock(&st->mtx);
+
+		while (!rpc_function_should_abort(cookie) &&
+		    g_get_monotonic_time() < end)
+			g_usleep(1000);
+
+		g_mutex_lock(&st->mtx);
+		if (rpc_function_should_abort(cookie))
+			st->aborted++;
+		g_cond_broadcast(&st->cv);
+		g_mutex_unlock(&st->mtx);
+		return (rpc_null_create());
+	    });
+
+	rpc_server_set_event_handler(fixture->srv,
+	    ^(rpc_connection_t c, rpc_server_event_t event) {
+		if (event == RPC_SERVER_CLIENT_CONNECT)
+			sconn = c;
+	    });
+
+	rpc_server_resume(fixture->srv);
+	client = rpc_client_create(uris_[fixture->iuri].cli, 0);
+	g_assert(client != NULL);
+	conn = rpc_client_get_connection(client);
+
+	result = rpc_connection_call_simple(conn, "hi", "[s]", "world");
+	g_assert_cmpstr(rpc_string_get_string_ptr(result), ==, "hello world!");
+	rpc_release(result);
+	g_assert(sconn != NULL);
+
+	/* Entries are admitted one by one against the in-flight cap */
+	rpc_connection_set_max_inflight(sconn, 1);
+	calls = rpc_object_pack("[[n, n, s, [s]], [n, n, s, [s]]]",
+	    "hi", "one", "hi", "two");
+	call = rpc_connection_call_batch(conn, calls, NULL);
+	g_assert(call != NULL);
+	rpc_call_wait(call);
+	g_assert_cmpint(rpc_call_status(call), ==, RPC_CALL_DONE);
+	result = rpc_call_result(call);
+	g_assert_cmpstr(rpc_array_get_string(result, 0), ==, "hello one!");
+	g_assert_cmpstr(rpc_array_get_string(result, 1), ==, "hello two!");
+	rpc_call_free(call);
+	rpc_release(calls);
+
+	/* Aborting the batch reaches every running entry */
+	rpc_connection_set_max_inflight(sconn, 0);
+	calls = rpc_object_pack("[[n, n, s, []], [n, n, s, []]]",
+	    "spin", "spin");
+	call = rpc_connection_call_batch(conn, calls, NULL);
+	g_assert(call != NULL);
+
+	deadline = g_get_monotonic_time() + 10 * G_USEC_PER_SEC;
+	g_mutex_lock(&st->mtx);
+	while (st->running < 2 &&
+	    g_cond_wait_until(&st->cv, &st->mtx, deadline));
+	g_assert_cmpint(st->running, ==, 2);
+	g_mutex_unlock(&st->mtx);
+
+	g_assert_cmpint(rpc_call_abort(call), ==, 0);
+
+	g_mutex_lock(&st->mtx);
+	while (st->aborted < 2 &&
+	    g_cond_wait_until(&st->cv, &st->mtx, deadline));
+	g_assert_cmpint(st->aborted, ==, 2);
+	g_mutex_unlock(&st->mtx);
+
+	rpc_call_free(call);
+	rpc_release(calls);
+	rpc_client_close(client);
+	rpc_context_unregister_member(fixture->ctx, NULL, "spin");
+	g_cond_clear(&st->cv);
+	g_mutex_clear(&st->mtx);
+}
+
 static int
 do_stream_work(struct work_item *item)
 {
@@ -510,6 +734,608 @@ client_multi_streams_test(client_fixture *fixture, gconstpointer user_data)
 	rpc_context_unregister_member(fixture->ctx, NULL, "stream-me");
 }
 
+static void
+client_cq_test(client_fixture *fixture,
+    gconstpointer user_data __unused)
+{
+	rpc_client_t client;
+	rpc_connection_t conn;
+	rpc_completion_queue_t cq;
+	rpc_call_t calls[16];
+	struct rpc_cq_event events[4];
+	size_t n;
+	int i, done = 0;
+
+	rpc_server_resume(fixture->srv);
+	client = rpc_client_create(uris_[fixture->iuri].cli, 0);
+	g_assert(client != NULL);
+
+	cq = rpc_cq_create();
+	g_assert_nonnull(cq);
+
+	conn = rpc_client_get_connection(client);
+	rpc_connection_set_completion_queue(conn, cq);
+
+	for (i = 0; i < 16; i++) {
+		calls[i] = rpc_connection_call(conn, NULL, NULL, "hi",
+		    rpc_object_pack("[s]", "world"), NULL);
+		g_assert_nonnull(calls[i]);
+	}
+
+	while (done < 16) {
+		n = rpc_cq_next_batch(cq, events, 4, 5 * G_USEC_PER_SEC);
+		g_assert_cmpint(n, >, 0);
+		g_assert_cmpint(n, <=, 4);
+
+		for (i = 0; i < (int)n; i++) {
+			g_assert_cmpint(events[i].status, ==, RPC_CALL_DONE);
+			g_assert_cmpstr(rpc_string_get_string_ptr(
+			    rpc_call_result(events[i].call)), ==,
+			    "hello world!");
+			done++;
+		}
+
+		/* Events keep their calls alive past rpc_call_free() */
+		if (done == 16) {
+			for (i = 0; i < 16; i++)
+				rpc_call_free(calls[i]);
+		}
+
+		for (i = 0; i < (int)n; i++) {
+			rpc_cq_event_release(&events[i]);
+			g_assert_null(events[i].call);
+		}
+	}
+
+	g_assert_cmpint(rpc_cq_next_batch(cq, events, 4, 0), ==, 0);
+
+	rpc_cq_free(cq);
+	rpc_client_close(client);
+}
+
+static bool
+client_cq_fd_readable(int fd, int timeout)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+	return (poll(&pfd, 1, timeout) == 1 && (pfd.revents & POLLIN) != 0);
+}
+
+static void
+client_cq_fd_test(client_fixture *fixture, gconstpointer user_data __unused)
+{
+	rpc_client_t client;
+	rpc_connection_t conn;
+	rpc_completion_queue_t cq;
+	rpc_call_t calls[4];
+	struct rpc_cq_event events[4];
+	size_t n;
+	int fd;
+	int i, done = 0;
+
+	cq = rpc_cq_create();
+	g_assert_nonnull(cq);
+
+	fd = rpc_cq_get_fd(cq);
+	if (fd == -1) {
+		rpc_cq_free(cq);
+		g_test_skip("No completion queue descriptor on this platform");
+		return;
+	}
+
+	g_assert_cmpint(rpc_cq_get_fd(cq), ==, fd);
+	g_assert(!client_cq_fd_readable(fd, 0));
+
+	rpc_server_resume(fixture->srv);
+	client = rpc_client_create(uris_[fixture->iuri].cli, 0);
+	g_assert(client != NULL);
+
+	conn = rpc_client_get_connection(client);
+	rpc_connection_set_completion_queue(conn, cq);
+
+	for (i = 0; i < 4; i++) {
+		calls[i] = rpc_connection_call(conn, NULL, NULL, "hi",
+		    rpc_object_pack("[s]", "world"), NULL);
+		g_assert_nonnull(calls[i]);
+	}
+
+	/* Readable while anything is pending, quiet once it is drained */
+	while (done < 4) {
+		g_assert(client_cq_fd_readable(fd, 5000));
+		n = rpc_cq_next_batch(cq, events, 4, 0);
+		g_assert_cmpint(n, >, 0);
+
+		for (i = 0; i < (int)n; i++) {
+			g_assert_cmpint(events[i].status, ==, RPC_CALL_DONE);
+			rpc_cq_event_release(&events[i]);
+			done++;
+		}
+	}
+
+	g_assert(!client_cq_fd_readable(fd, 0));
+
+	/* Waiters polling the descriptor must notice a shutdown too */
+	rpc_cq_shutdown(cq);
+	g_assert(client_cq_fd_readable(fd, 0));
+	g_assert_cmpint(rpc_cq_next_batch(cq, events, 4, -1), ==, 0);
+
+	for (i = 0; i < 4; i++)
+		rpc_call_free(calls[i]);
+
+	rpc_cq_free(cq);
+	rpc_client_close(client);
+}
+
+static void
+client_runtime_test(client_fixture *fixture,
+    gconstpointer user_data __unused)
+{
+	rpc_runtime_t runtime;
+	rpc_client_t clients[8];
+	rpc_object_t result;
+	int i;
+
+	rpc_server_resume(fixture->srv);
+	runtime = rpc_runtime_create(2, 2);
+	g_assert_nonnull(runtime);
+
+	for (i = 0; i < 8; i++) {
+		clients[i] = rpc_client_create_with_runtime(runtime,
+		    uris_[fixture->iuri].cli, 0);
+		g_assert_nonnull(clients[i]);
+	}
+
+	for (i = 0; i < 8; i++) {
+		result = rpc_connection_call_simple(
+		    rpc_client_get_connection(clients[i]), "hi", "[s]",
+		    "world");
+		g_assert_nonnull(result);
+		g_assert_cmpstr(rpc_string_get_string_ptr(result), ==,
+		    "hello world!");
+	}
+
+	/* Clients are still attached */
+	g_assert(rpc_runtime_free(runtime) != 0);
+
+	for (i = 0; i < 8; i++)
+		rpc_client_close(clients[i]);
+
+	g_assert(rpc_runtime_free(runtime) == 0);
+}
+
+static void
+client_runtime_isolation_test(client_fixture *fixture,
+    gconstpointer user_data __unused)
+{
+	__block rpc_connection_t sconn = NULL;
+	rpc_runtime_t runtime;
+	rpc_client_t slow, fast;
+	rpc_context_t context;
+	rpc_call_t stall;
+	rpc_object_t result;
+
+	client_signal_init(&stall_entered);
+	client_signal_init(&stall_gate);
+
+	rpc_server_set_event_handler(fixture->srv,
+	    ^(rpc_connection_t c, rpc_server_event_t event) {
+		if (event == RPC_SERVER_CLIENT_CONNECT && sconn == NULL)
+			sconn = c;
+	    });
+
+	rpc_server_resume(fixture->srv);
+
+	/* A single loop, so both clients are read by the same thread */
+	runtime = rpc_runtime_create(1, 2);
+	g_assert_nonnull(runtime);
+
+	slow = rpc_client_create_with_runtime(runtime,
+	    uris_[fixture->iuri].cli, 0);
+	g_assert_nonnull(slow);
+	context = rpc_context_create();
+	g_assert(rpc_connection_set_context(rpc_client_get_connection(slow),
+	    context) == 0);
+	g_assert(rpc_context_register_member(context, NULL,
+	    &stall_member) == 0);
+
+	result = rpc_connection_call_simple(rpc_client_get_connection(slow),
+	    "hi", "[s]", "world");
+	g_assert_nonnull(result);
+	rpc_release(result);
+	g_assert_nonnull(sconn);
+
+	fast = rpc_client_create_with_runtime(runtime,
+	    uris_[fixture->iuri].cli, 0);
+	g_assert_nonnull(fast);
+
+	/* Block a handler of the first client... */
+	stall = rpc_connection_call(sconn, NULL, NULL, "stall",
+	    rpc_array_create(), NULL);
+	g_assert_nonnull(stall);
+	g_assert(client_signal_wait(&stall_entered, 1));
+
+	/* ...which must not keep the loop from serving the second one */
+	result = rpc_connection_call_simple(rpc_client_get_connection(fast),
+	    "hi", "[s]", "world");
+	g_assert_nonnull(result);
+	g_assert_cmpstr(rpc_string_get_string_ptr(result), ==,
+	    "hello world!");
+	rpc_release(result);
+
+	client_signal_add(&stall_gate, 1);
+	rpc_call_wait(stall);
+	g_assert_cmpint(rpc_call_status(stall), ==, RPC_CALL_DONE);
+	rpc_call_free(stall);
+
+	rpc_client_close(fast);
+	rpc_client_close(slow);
+	g_assert(rpc_runtime_free(runtime) == 0);
+	rpc_context_unregister_member(context, NULL, "stall");
+	rpc_context_free(context);
+	client_signal_clear(&stall_gate);
+	client_signal_clear(&stall_entered);
+}
+
+static void
+client_sync_spin_test(client_fixture *fixture,
+    gconstpointer user_data __unused)
+{
+	rpc_client_t client;
+	rpc_connection_t conn;
+	rpc_object_t result;
+	int i;
+
+	rpc_server_resume(fixture->srv);
+	client = rpc_client_create(uris_[fixture->iuri].cli, 0);
+	g_assert(client != NULL);
+
+	conn = rpc_client_get_connection(client);
+	g_assert(rpc_connection_set_sync_spin(conn, 200) == 0);
+
+	for (i = 0; i < 100; i++) {
+		result = rpc_connection_call_simple(conn, "hi", "[s]", "world");
+		g_assert_nonnull(result);
+		g_assert_cmpstr(rpc_string_get_string_ptr(result), ==,
+		    "hello world!");
+		rpc_release(result);
+	}
+
+	g_assert_cmpint(fixture->count, ==, 100);
+	rpc_client_close(client);
+}
+
+static void
+client_sync_spin_adapt_test(client_fixture *fixture,
+    gconstpointer user_data __unused)
+{
+	struct client_signal gate;
+	struct client_signal *gatep = &gate;
+	rpc_client_t client;
+	rpc_connection_t conn;
+	rpc_object_t result;
+	gint64 start;
+	int i;
+
+	client_signal_init(&gate);
+	rpc_context_register_block(fixture->ctx, NULL, "slow", NULL,
+	    ^(void *cookie __unused, rpc_object_t args __unused) {
+		g_usleep(20000);
+		return (rpc_string_create("slow"));
+	    });
+
+	rpc_context_register_block(fixture->ctx, NULL, "gate", NULL,
+	    ^(void *cookie __unused, rpc_object_t args __unused) {
+		client_signal_wait(gatep, 1);
+		return (rpc_null_create());
+	    });
+
+	rpc_server_resume(fixture->srv);
+	client = rpc_client_create(uris_[fixture->iuri].cli, 0);
+	g_assert(client != NULL);
+	conn = rpc_client_get_connection(client);
+
+	/* A generous budget: fast calls are answered while spinning */
+	g_assert(rpc_connection_set_sync_spin(conn, 1000000) == 0);
+	for (i = 0; i < 20; i++) {
+		result = rpc_connection_call_simple(conn, "hi", "[s]", "world");
+		g_assert_cmpstr(rpc_string_get_string_ptr(result), ==,
+		    "hello world!");
+		rpc_release(result);
+	}
+
+	g_assert_cmpint(g_atomic_int_get(&conn->rco_sync_latency), >, 0);
+	g_assert_cmpint(g_atomic_int_get(&conn->rco_sync_latency), <,
+	    1000000);
+
+	/*
+	 * A tight budget: the first slow call spins, then parks and must
+	 * still be woken up. The latency average then rises above the
+	 * budget, after which calls park right away.
+	 */
+	g_assert(rpc_connection_set_sync_spin(conn, 100) == 0);
+	g_assert_cmpint(g_atomic_int_get(&conn->rco_sync_latency), ==, 0);
+	for (i = 0; i < 3; i++) {
+		result = rpc_connection_call_simple(conn, "slow",
+		    RPC_NULL_FORMAT);
+		g_assert_cmpstr(rpc_string_get_string_ptr(result), ==, "slow");
+		rpc_release(result);
+		g_assert_cmpint(g_atomic_int_get(&conn->rco_sync_latency), >=,
+		    20000);
+	}
+
+	/* Parked past the deadline: the call times out */
+	conn->rco_rpc_timeout = 1;
+	start = g_get_monotonic_time();
+	result = rpc_connection_call_simple(conn, "gate", RPC_NULL_FORMAT);
+	g_assert_nonnull(result);
+	g_assert_cmpint(rpc_get_type(result), ==, RPC_TYPE_ERROR);
+	g_assert_cmpint(rpc_error_get_code(result), ==, ETIMEDOUT);
+	g_assert_cmpint(g_get_monotonic_time() - start, >=, 900000);
+	rpc_release(result);
+
+	client_signal_add(&gate, 1);
+	rpc_client_close(client);
+	rpc_context_unregister_member(fixture->ctx, NULL, "slow");
+	rpc_context_unregister_member(fixture->ctx, NULL, "gate");
+	client_signal_clear(&gate);
+}
+
+static void
+client_pool_test(client_fixture *fixture,
+    gconstpointer user_data __unused)
+{
+	const char *uri_list[] = { uris_[fixture->iuri].cli, NULL };
+	rpc_client_pool_t pool;
+	rpc_call_t calls[32];
+	rpc_object_t result;
+	int i;
+
+	rpc_server_resume(fixture->srv);
+	pool = rpc_client_pool_create(uri_list, 4, NULL, NULL);
+	g_assert_nonnull(pool);
+	g_assert_cmpint(rpc_client_pool_get_size(pool), ==, 4);
+
+	for (i = 0; i < 32; i++) {
+		calls[i] = rpc_client_pool_call(pool, NULL, NULL, "hi",
+		    rpc_object_pack("[s]", "world"), NULL);
+		g_assert_nonnull(calls[i]);
+	}
+
+	for (i = 0; i < 32; i++) {
+		rpc_call_wait(calls[i]);
+		g_assert_cmpint(rpc_call_status(calls[i]), ==, RPC_CALL_DONE);
+		rpc_call_free(calls[i]);
+	}
+
+	result = rpc_client_pool_call_syncp(pool, NULL, NULL, "hi", "[s]",
+	    "world");
+	g_assert_nonnull(result);
+	g_assert_cmpstr(rpc_string_get_string_ptr(result), ==, "hello world!");
+	rpc_release(result);
+
+	g_assert_cmpint(fixture->count, ==, 33);
+	rpc_client_pool_free(pool);
+}
+
+struct pool_conns
+{
+	GMutex				mtx;
+	GPtrArray *			conns;
+	struct client_signal		connects;
+};
+
+static void
+client_pool_balance_test(client_fixture *fixture,
+    gconstpointer user_data __unused)
+{
+	const char *uri_list[] = {
+		uris_[fixture->iuri].cli, uris_[fixture->iuri].cli, NULL
+	};
+	struct pool_conns pc;
+	struct pool_conns *pcp = &pc;
+	struct client_signal gate;
+	struct client_signal *gatep = &gate;
+	rpc_client_pool_t pool;
+	rpc_connection_t sconn;
+	rpc_call_t calls[4];
+	rpc_object_t result;
+	int i, j;
+
+	g_mutex_init(&pc.mtx);
+	pc.conns = g_ptr_array_new();
+	client_signal_init(&pc.connects);
+	client_signal_init(&gate);
+
+	rpc_server_set_event_handler(fixture->srv,
+	    ^(rpc_connection_t c, rpc_server_event_t event) {
+		if (event != RPC_SERVER_CLIENT_CONNECT)
+			return;
+
+		g_mutex_lock(&pcp->mtx);
+		g_ptr_array_add(pcp->conns, c);
+		g_mutex_unlock(&pcp->mtx);
+		client_signal_add(&pcp->connects, 1);
+	    });
+
+	rpc_context_register_block(fixture->ctx, NULL, "gate", NULL,
+	    ^(void *cookie __unused, rpc_object_t args __unused) {
+		client_signal_wait(gatep, 1);
+		return (rpc_null_create());
+	    });
+
+	rpc_server_resume(fixture->srv);
+	pool = rpc_client_pool_create(uri_list, 4, NULL, NULL);
+	g_assert_nonnull(pool);
+	g_assert(client_signal_wait(&pc.connects, 4));
+
+	/* Each busy connection is skipped until every one has a call */
+	for (i = 0; i < 4; i++) {
+		calls[i] = rpc_client_pool_call(pool, NULL, NULL, "gate",
+		    rpc_array_create(), NULL);
+		g_assert_nonnull(calls[i]);
+		for (j = 0; j < i; j++)
+			g_assert(calls[i]->rc_conn != calls[j]->rc_conn);
+	}
+
+	client_signal_add(&gate, 1);
+	for (i = 0; i < 4; i++) {
+		rpc_call_wait(calls[i]);
+		g_assert_cmpint(rpc_call_status(calls[i]), ==, RPC_CALL_DONE);
+		rpc_call_free(calls[i]);
+	}
+
+	/* Drop one member; the pool must route around it and reconnect */
+	g_mutex_lock(&pc.mtx);
+	sconn = g_ptr_array_index(pc.conns, 0);
+	g_mutex_unlock(&pc.mtx);
+	rpc_connection_close(sconn);
+
+	for (i = 0; i < 1000 && client_signal_get(&pc.connects) < 5; i++) {
+		result = rpc_client_pool_call_syncp(pool, NULL, NULL, "hi",
+		    "[s]", "world");
+		g_assert_nonnull(result);
+		rpc_release(result);
+		g_usleep(10000);
+	}
+
+	g_assert_cmpint(client_signal_get(&pc.connects), ==, 5);
+
+	for (i = 0; i < 8; i++) {
+		result = rpc_client_pool_call_syncp(pool, NULL, NULL, "hi",
+		    "[s]", "world");
+		g_assert_nonnull(result);
+		g_assert_cmpstr(rpc_string_get_string_ptr(result), ==,
+		    "hello world!");
+		rpc_release(result);
+	}
+
+	rpc_client_pool_free(pool);
+	rpc_context_unregister_member(fixture->ctx, NULL, "gate");
+	g_ptr_array_free(pc.conns, true);
+	g_mutex_clear(&pc.mtx);
+	client_signal_clear(&pc.connects);
+	client_signal_clear(&gate);
+}
+
+static void
+client_property_cache_test(client_fixture *fixture,
+    gconstpointer user_data __unused)
+{
+	rpc_instance_t root = rpc_context_get_root(fixture->ctx);
+	rpc_client_t client;
+	rpc_connection_t conn;
+	rpc_object_t value;
+	__block gint counter = 1;
+	__block gint reads = 0;
+	int i;
+
+	g_assert(rpc_instance_register_property(root, NULL, "cached", NULL,
+	    ^(void *cookie __unused) {
+		g_atomic_int_inc(&reads);
+		return (rpc_int64_create(g_atomic_int_get(&counter)));
+	    }, NULL) == 0);
+
+	rpc_server_resume(fixture->srv);
+	client = rpc_client_create(uris_[fixture->iuri].cli, 0);
+	g_assert(client != NULL);
+
+	conn = rpc_client_get_connection(client);
+	g_assert(rpc_connection_set_property_cache(conn, true, 0) == 0);
+
+	for (i = 0; i < 10; i++) {
+		value = rpc_connection_get_property(conn, "/",
+		    RPC_DEFAULT_INTERFACE, "cached");
+		g_assert_cmpint(rpc_int64_get_value(value), ==, 1);
+		rpc_release(value);
+	}
+
+	g_assert_cmpint(g_atomic_int_get(&reads), ==, 1);
+
+	/* A change event must update the cached value in place */
+	g_atomic_int_set(&counter, 2);
+	rpc_instance_property_changed(root, RPC_DEFAULT_INTERFACE, "cached",
+	    NULL);
+
+	for (i = 0; i < 50; i++) {
+		value = rpc_connection_get_property(conn, "/",
+		    RPC_DEFAULT_INTERFACE, "cached");
+		if (rpc_int64_get_value(value) == 2) {
+			rpc_release(value);
+			break;
+		}
+
+		rpc_release(value);
+		g_usleep(100000);
+	}
+
+	g_assert_cmpint(i, <, 50);
+	g_assert(rpc_connection_set_property_cache(conn, false, 0) == 0);
+	rpc_client_close(client);
+	rpc_instance_unregister_member(root, NULL, "cached");
+}
+
+static void
+client_proxy_test(client_fixture *fixture, gconstpointer user_data __unused)
+{
+	rpc_instance_t root = rpc_context_get_root(fixture->ctx);
+	rpc_client_t client;
+	rpc_connection_t conn;
+	rpc_proxy_t proxy;
+	rpc_object_t value;
+	struct client_signal changes;
+	struct client_signal *changesp = &changes;
+	__block gint counter = 1;
+	__block gint reads = 0;
+	int i;
+
+	client_signal_init(&changes);
+	g_assert(rpc_instance_register_property(root, NULL, "mirrored", NULL,
+	    ^(void *cookie __unused) {
+		g_atomic_int_inc(&reads);
+		return (rpc_int64_create(g_atomic_int_get(&counter)));
+	    }, NULL) == 0);
+
+	rpc_server_resume(fixture->srv);
+	client = rpc_client_create(uris_[fixture->iuri].cli, 0);
+	g_assert(client != NULL);
+
+	conn = rpc_client_get_connection(client);
+	proxy = rpc_proxy_create(conn, "/");
+	g_assert(proxy != NULL);
+
+	rpc_proxy_watch(proxy, RPC_DEFAULT_INTERFACE, "mirrored",
+	    ^(const char *interface __unused, const char *name __unused,
+	    rpc_object_t v __unused) {
+		client_signal_add(changesp, 1);
+	    });
+
+	for (i = 0; i < 10; i++) {
+		value = rpc_proxy_get(proxy, RPC_DEFAULT_INTERFACE,
+		    "mirrored");
+		g_assert(value != NULL);
+		g_assert_cmpint(rpc_int64_get_value(value), ==, 1);
+		rpc_release(value);
+	}
+
+	g_assert_cmpint(g_atomic_int_get(&reads), ==, 1);
+	g_assert(rpc_proxy_get(proxy, RPC_DEFAULT_INTERFACE, "nope") == NULL);
+
+	g_atomic_int_set(&counter, 2);
+	rpc_instance_property_changed(root, RPC_DEFAULT_INTERFACE, "mirrored",
+	    NULL);
+
+	/* The handler runs after the new value has become visible */
+	g_assert(client_signal_wait(&changes, 1));
+	value = rpc_proxy_get(proxy, RPC_DEFAULT_INTERFACE, "mirrored");
+	g_assert_cmpint(rpc_int64_get_value(value), ==, 2);
+	g_assert_cmpint(g_atomic_int_get(&reads), ==, 2);
+	rpc_release(value);
+	rpc_proxy_free(proxy);
+	rpc_client_close(client);
+	rpc_instance_unregister_member(root, NULL, "mirrored");
+	client_signal_clear(&changes);
+}
+
 static void
 client_test_single_set_up(client_fixture *fixture, gconstpointer user_data)
 {
@@ -557,6 +1383,54 @@ client_test_register()
 	    client_test_single_set_up, client_multi_streams_test,
 	    client_test_tear_down);
 
+	g_test_add("/client/batch/tcp", client_fixture, (void *)0,
+	    client_test_single_set_up, client_batch_test,
+	    client_test_tear_down);
+
+	g_test_add("/client/batch-abort/tcp", client_fixture, (void *)0,
+	    client_test_single_set_up, client_batch_abort_test,
+	    client_test_tear_down);
+
+	g_test_add("/client/cq/tcp", client_fixture, (void *)0,
+	    client_test_single_set_up, client_cq_test,
+	    client_test_tear_down);
+
+	g_test_add("/client/cq-fd/tcp", client_fixture, (void *)0,
+	    client_test_single_set_up, client_cq_fd_test,
+	    client_test_tear_down);
+
+	g_test_add("/client/runtime/tcp", client_fixture, (void *)0,
+	    client_test_single_set_up, client_runtime_test,
+	    client_test_tear_down);
+
+	g_test_add("/client/runtime-isolation/tcp", client_fixture, (void *)0,
+	    client_test_single_set_up, client_runtime_isolation_test,
+	    client_test_tear_down);
+
+	g_test_add("/client/sync-spin/tcp", client_fixture, (void *)0,
+	    client_test_single_set_up, client_sync_spin_test,
+	    client_test_tear_down);
+
+	g_test_add("/client/sync-spin-adapt/tcp", client_fixture, (void *)0,
+	    client_test_single_set_up, client_sync_spin_adapt_test,
+	    client_test_tear_down);
+
+	g_test_add("/client/pool/tcp", client_fixture, (void *)0,
+	    client_test_single_set_up, client_pool_test,
+	    client_test_tear_down);
+
+	g_test_add("/client/pool-balance/tcp", client_fixture, (void *)0,
+	    client_test_single_set_up, client_pool_balance_test,
+	    client_test_tear_down);
+
+	g_test_add("/client/property-cache/tcp", client_fixture, (void *)0,
+	    client_test_single_set_up, client_property_cache_test,
+	    client_test_tear_down);
+
+	g_test_add("/client/proxy/tcp", client_fixture, (void *)0,
+	    client_test_single_set_up, client_proxy_test,
+	    client_test_tear_down);
+
 }
 
 static struct librpc_test client = {
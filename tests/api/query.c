@@ -27,35 +27,773 @@
 
 #include "../tests.h"
 #include "../../src/linker_set.h"
+#include "../../src/internal.h"
 #include <glib.h>
 
 
-typedef struct {
+#include <rpc/object.h>
+#include <rpc/query.h>
+#include <rpc/typing.h>
+
+#define	QUERY_TEST_ITEMS	1000
+#define	QUERY_TEST_NS		"com.twoporeguys.librpc.test"
+#define	QUERY_TEST_IDL_PATTERN	"^query-test-[a-z]+$"
+#define	QUERY_TEST_THREADS	4
+#define	QUERY_TEST_ROUNDS	50
+#define	QUERY_TEST_LOOKUPS	10
 
+typedef struct {
+	rpc_object_t	source;
 } query_fixture;
 
+static size_t
+query_test_count(rpc_query_iter_t iter)
+{
+	rpc_object_t chunk;
+	size_t count = 0;
+
+	while (rpc_query_next(iter, &chunk)) {
+		count++;
+		rpc_release(chunk);
+	}
+
+	rpc_query_iter_free(iter);
+	return (count);
+}
+
+static void
+query_test_compile(query_fixture *fixture, gconstpointer user_data)
+{
+	rpc_query_plan_t plan;
+	rpc_object_t rules;
+	size_t i;
+
+	rules = rpc_object_pack("[[s,s,i],[s,[[s,s,s],[s,s,i]]]]",
+	    "a.value", ">=", (int64_t)100,
+	    "or",
+	    "a.name", "~", "^item-1",
+	    "a.value", "=", (int64_t)500);
+
+	plan = rpc_query_compile(rules);
+	g_assert_nonnull(plan);
+
+	/* 100..199 match both the range and the regex, 500 by value */
+	for (i = 0; i < 3; i++) {
+		g_assert_cmpuint(query_test_count(rpc_query_compiled(
+		    fixture->source, NULL, plan)), ==, 101);
+	}
+
+	g_assert_cmpuint(query_test_count(rpc_query(fixture->source, NULL,
+	    rules)), ==, 101);
+
+	g_assert_true(rpc_query_plan_match(plan,
+	    rpc_array_get_value(fixture->source, 500)));
+	g_assert_false(rpc_query_plan_match(plan,
+	    rpc_array_get_value(fixture->source, 501)));
+
+	rpc_query_plan_free(plan);
+	rpc_release(rules);
+
+	/* A missing field never matches a positive operator */
+	rules = rpc_object_pack("[[s,s,i]]", "a.missing", "=", (int64_t)1);
+	g_assert_cmpuint(query_test_count(rpc_query(fixture->source, NULL,
+	    rules)), ==, 0);
+	rpc_release(rules);
+
+	rules = rpc_string_create("bogus");
+	g_assert_null(rpc_query_compile(rules));
+	rpc_release(rules);
+}
+
+static rpc_query_plan_t
+query_test_regex_plan(const char *pattern)
+{
+	rpc_query_plan_t plan;
+	rpc_object_t rules;
+
+	rules = rpc_object_pack("[[s,s,s]]", "a.name", "~", pattern);
+	plan = rpc_query_compile(rules);
+	g_assert_nonnull(plan);
+	rpc_release(rules);
+	return (plan);
+}
+
+static void
+query_test_regex_churn(const char *prefix, size_t count)
+{
+	char pattern[64];
+	size_t i;
+
+	/* Push distinct, unpinned patterns through the cache */
+	for (i = 0; i < count; i++) {
+		g_snprintf(pattern, sizeof(pattern), "^%s-%zu$", prefix, i);
+		rpc_query_plan_free(query_test_regex_plan(pattern));
+	}
+}
+
+static void
+query_test_load_types(void)
+{
+	rpc_object_t idl;
+
+	g_assert_cmpint(rpct_init(false), ==, 0);
+	if (rpct_get_type(QUERY_TEST_NS ".QueryTestRecord") != NULL)
+		return;
+
+	/* Two files, so that the member type exists before the struct */
+	idl = rpc_object_pack("{v,v}",
+	    "meta", rpc_object_pack("{i,s,s}",
+	        "version", (int64_t)1,
+	        "namespace", QUERY_TEST_NS,
+	        "description", "Query test types"),
+	    "type QueryTestName", rpc_object_pack("{s}",
+	        "type", "string"));
+
+	g_assert_cmpint(rpct_read_idl("query-test-types", idl), ==, 0);
+	g_assert_cmpint(rpct_load_types("query-test-types"), ==, 0);
+	rpc_release(idl);
+
+	/* The constraint is a bare pattern string, as in the bundled IDL */
+	idl = rpc_object_pack("{v,v}",
+	    "meta", rpc_object_pack("{i,s,s}",
+	        "version", (int64_t)1,
+	        "namespace", QUERY_TEST_NS,
+	        "description", "Query test records"),
+	    "struct QueryTestRecord", rpc_object_pack("{v}",
+	        "members", rpc_object_pack("{v}",
+	        "name", rpc_object_pack("{s,v}",
+	            "type", "QueryTestName",
+	            "constraints", rpc_object_pack("{s}",
+	                "regex", QUERY_TEST_IDL_PATTERN)))));
+
+	g_assert_cmpint(rpct_read_idl("query-test-records", idl), ==, 0);
+	g_assert_cmpint(rpct_load_types("query-test-records"), ==, 0);
+	rpc_release(idl);
+}
+
+static bool
+query_test_validate_name(const char *name, size_t *nerrors)
+{
+	rpct_typei_t typei;
+	rpc_object_t record;
+	rpc_object_t object;
+	rpc_object_t errors = NULL;
+	bool valid;
+
+	typei = rpct_new_typei(QUERY_TEST_NS ".QueryTestRecord");
+	g_assert_nonnull(typei);
+
+	object = rpc_object_pack("{s}", "name", name);
+	record = rpct_newi(typei, object);
+	g_assert_nonnull(record);
+
+	valid = rpct_validate(typei, record, &errors);
+	*nerrors = rpc_array_get_count(errors);
+
+	rpc_release(errors);
+	rpc_release(record);
+	rpc_release(object);
+	return (valid);
+}
+
+static void
+query_test_regex_cache(query_fixture *fixture, gconstpointer user_data)
+{
+	rpc_query_plan_t first;
+	rpc_query_plan_t second;
+	uint64_t hits[3];
+	uint64_t misses[3];
+
+	rpc_query_regex_stats(&hits[0], &misses[0], NULL);
+	first = query_test_regex_plan("^item-4[0-9]$");
+	rpc_query_regex_stats(&hits[1], &misses[1], NULL);
+	second = query_test_regex_plan("^item-4[0-9]$");
+	rpc_query_regex_stats(&hits[2], &misses[2], NULL);
+
+	/* Compiled on first use, served from the cache afterwards */
+	g_assert_cmpuint(misses[1], ==, misses[0] + 1);
+	g_assert_cmpuint(hits[1], ==, hits[0]);
+	g_assert_cmpuint(misses[2], ==, misses[1]);
+	g_assert_cmpuint(hits[2], ==, hits[1] + 1);
+
+	g_assert_cmpuint(query_test_count(rpc_query_compiled(fixture->source,
+	    NULL, first)), ==, 10);
+	g_assert_cmpuint(query_test_count(rpc_query_compiled(fixture->source,
+	    NULL, second)), ==, 10);
+
+	rpc_query_plan_free(first);
+	rpc_query_plan_free(second);
+}
+
+static void
+query_test_regex_evict(query_fixture *fixture, gconstpointer user_data)
+{
+	rpc_query_plan_t plan;
+	uint64_t hits[2];
+	uint64_t misses[2];
+	uint64_t evictions[2];
+
+	rpc_query_plan_free(query_test_regex_plan("^item-5[0-9]$"));
+	rpc_query_regex_stats(NULL, NULL, &evictions[0]);
+
+	/* A full cache worth of newer patterns pushes the first one out */
+	query_test_regex_churn("query-test-evict", RPC_REGEX_CACHE_SIZE);
+	rpc_query_regex_stats(&hits[0], &misses[0], &evictions[1]);
+	g_assert_cmpuint(evictions[1], >, evictions[0]);
+
+	plan = query_test_regex_plan("^item-5[0-9]$");
+	rpc_query_regex_stats(&hits[1], &misses[1], NULL);
+	g_assert_cmpuint(misses[1], ==, misses[0] + 1);
+	g_assert_cmpuint(hits[1], ==, hits[0]);
+
+	g_assert_cmpuint(query_test_count(rpc_query_compiled(fixture->source,
+	    NULL, plan)), ==, 10);
+
+	rpc_query_plan_free(plan);
+}
+
+static void
+query_test_regex_live_plan(query_fixture *fixture, gconstpointer user_data)
+{
+	rpc_query_plan_t plan;
+	uint64_t misses[2];
+
+	plan = query_test_regex_plan("^item-6[0-9]$");
+	query_test_regex_churn("query-test-live", RPC_REGEX_CACHE_SIZE);
+
+	/* The cache entry is gone, but the plan holds on to its regex */
+	rpc_query_regex_stats(NULL, &misses[0], NULL);
+	rpc_query_plan_free(query_test_regex_plan("^item-6[0-9]$"));
+	rpc_query_regex_stats(NULL, &misses[1], NULL);
+	g_assert_cmpuint(misses[1], ==, misses[0] + 1);
+
+	g_assert_cmpuint(query_test_count(rpc_query_compiled(fixture->source,
+	    NULL, plan)), ==, 10);
+	g_assert_true(rpc_query_plan_match(plan, rpc_array_get_value(
+	    fixture->source, 60)));
+
+	rpc_query_plan_free(plan);
+}
+
+static void
+query_test_regex_prepare(query_fixture *fixture, gconstpointer user_data)
+{
+	uint64_t hits[2];
+	uint64_t misses[2];
+	size_t nerrors;
+
+	/* Loading the struct runs the validator's prepare hook */
+	query_test_load_types();
+	query_test_regex_churn("query-test-prepare", RPC_REGEX_CACHE_SIZE);
+
+	/* The IDL pattern was pinned, so the churn didn't evict it */
+	rpc_query_regex_stats(&hits[0], &misses[0], NULL);
+	g_assert_true(query_test_validate_name("query-test-name", &nerrors));
+	rpc_query_regex_stats(&hits[1], &misses[1], NULL);
+
+	g_assert_cmpuint(misses[1], ==, misses[0]);
+	g_assert_cmpuint(hits[1], ==, hits[0] + 1);
+}
+
+static void
+query_test_regex_constraint(query_fixture *fixture, gconstpointer user_data)
+{
+	size_t nerrors;
+
+	query_test_load_types();
+
+	g_assert_true(query_test_validate_name("query-test-name", &nerrors));
+	g_assert_cmpuint(nerrors, ==, 0);
+
+	g_assert_false(query_test_validate_name("Query-Test-Name", &nerrors));
+	g_assert_cmpuint(nerrors, ==, 1);
+
+	g_assert_false(query_test_validate_name("query-test-", &nerrors));
+	g_assert_cmpuint(nerrors, ==, 1);
+}
+
+static void
+query_test_index(query_fixture *fixture, gconstpointer user_data)
+{
+	struct rpc_query_params params = { .offset = 1 };
+	rpc_query_index_t hash;
+	rpc_query_index_t sorted;
+	rpc_object_t rules;
+	size_t expected;
+
+	/* Ordering follows hashes, so take the unindexed count as reference */
+	rules = rpc_object_pack("[[s,s,i]]", "a.value", ">=", (int64_t)100);
+	expected = query_test_count(rpc_query(fixture->source, NULL, rules));
+
+	sorted = rpc_query_index_create(fixture->source, "a.value",
+	    RPC_QUERY_INDEX_SORTED);
+	g_assert_nonnull(sorted);
+	g_assert_cmpuint(query_test_count(rpc_query(fixture->source, NULL,
+	    rules)), ==, expected);
+	rpc_release(rules);
+
+	hash = rpc_query_index_create(fixture->source, "a.value",
+	    RPC_QUERY_INDEX_HASH);
+	g_assert_nonnull(hash);
+
+	rules = rpc_object_pack("[[s,s,[i,i,i]]]", "a.value", "in",
+	    (int64_t)3, (int64_t)7, (int64_t)7);
+	g_assert_cmpuint(query_test_count(rpc_query(fixture->source, NULL,
+	    rules)), ==, 2);
+	g_assert_cmpuint(query_test_count(rpc_query(fixture->source, &params,
+	    rules)), ==, 1);
+	rpc_release(rules);
+
+	/* Shifting elements and appending new ones keeps indexes usable */
+	rpc_array_remove_index(fixture->source, 0);
+	rpc_array_append_stolen_value(fixture->source, rpc_object_pack("{v}",
+	    "a", rpc_object_pack("{i}", "value", (int64_t)7)));
+
+	rules = rpc_object_pack("[[s,s,i]]", "a.value", "=", (int64_t)7);
+	g_assert_cmpuint(query_test_count(rpc_query(fixture->source, NULL,
+	    rules)), ==, 2);
+	rpc_release(rules);
+
+	rules = rpc_object_pack("[[s,s,i],[s,s,s]]", "a.value", "=",
+	    (int64_t)7, "a.name", "=", "item-7");
+	g_assert_cmpuint(query_test_count(rpc_query(fixture->source, NULL,
+	    rules)), ==, 1);
+	rpc_release(rules);
+
+	rpc_query_index_free(hash);
+	rpc_query_index_free(sorted);
+}
+
+static int64_t
+query_test_value(rpc_object_t item)
+{
+
+	return (rpc_dictionary_get_int64(rpc_dictionary_get_value(item, "a"),
+	    "value"));
+}
+
+/* Runs a single indexed rule and checks every result against it */
+static size_t
+query_test_lookup(rpc_object_t source, const char *op, int64_t value)
+{
+	rpc_query_iter_t iter;
+	rpc_object_t rules;
+	rpc_object_t chunk;
+	size_t count = 0;
+
+	rules = rpc_object_pack("[[s,s,i]]", "a.value", op, value);
+	iter = rpc_query(source, NULL, rules);
+	while (rpc_query_next(iter, &chunk)) {
+		if (g_strcmp0(op, "=") == 0)
+			g_assert_cmpint(query_test_value(chunk), ==, value);
+		else
+			g_assert_cmpint(query_test_value(chunk), >=, value);
+
+		count++;
+		rpc_release(chunk);
+	}
+
+	rpc_query_iter_free(iter);
+	rpc_release(rules);
+	return (count);
+}
+
+static void
+query_test_index_remove(query_fixture *fixture, gconstpointer user_data)
+{
+	rpc_query_index_t hash;
+	rpc_query_index_t sorted;
+	rpc_object_t item;
+
+	hash = rpc_query_index_create(fixture->source, "a.value",
+	    RPC_QUERY_INDEX_HASH);
+	g_assert_nonnull(hash);
+	sorted = rpc_query_index_create(fixture->source, "a.value",
+	    RPC_QUERY_INDEX_SORTED);
+	g_assert_nonnull(sorted);
+
+	/*
+	 * Changing an element in place goes unnoticed until a rebuild,
+	 * so this value only shows up in queries if something rebuilds.
+	 */
+	item = rpc_dictionary_get_value(rpc_array_get_value(fixture->source,
+	    10), "a");
+	rpc_dictionary_set_int64(item, "value", QUERY_TEST_ITEMS * 10);
+
+	/* Single rules trust the index, so stale positions would show */
+	rpc_array_remove_index(fixture->source, QUERY_TEST_ITEMS / 2);
+	rpc_array_remove_index(fixture->source, QUERY_TEST_ITEMS / 4);
+
+	g_assert_cmpuint(query_test_lookup(fixture->source, "=",
+	    QUERY_TEST_ITEMS / 2), ==, 0);
+	g_assert_cmpuint(query_test_lookup(fixture->source, "=",
+	    QUERY_TEST_ITEMS / 2 + 1), ==, 1);
+	g_assert_cmpuint(query_test_lookup(fixture->source, "=",
+	    QUERY_TEST_ITEMS / 4 - 1), ==, 1);
+	g_assert_cmpuint(query_test_lookup(fixture->source, "=",
+	    QUERY_TEST_ITEMS - 1), ==, 1);
+	g_assert_cmpuint(query_test_lookup(fixture->source, ">=",
+	    QUERY_TEST_ITEMS - 10), ==, 10);
+
+	/* Neither index was rebuilt to get there */
+	g_assert_cmpuint(query_test_lookup(fixture->source, "=",
+	    QUERY_TEST_ITEMS * 10), ==, 0);
+	g_assert_cmpuint(query_test_lookup(fixture->source, ">=",
+	    QUERY_TEST_ITEMS * 10), ==, 0);
+
+	rpc_query_index_rebuild(hash);
+	rpc_query_index_rebuild(sorted);
+	g_assert_cmpuint(query_test_lookup(fixture->source, "=",
+	    QUERY_TEST_ITEMS * 10), ==, 1);
+	g_assert_cmpuint(query_test_lookup(fixture->source, ">=",
+	    QUERY_TEST_ITEMS * 10), ==, 1);
+
+	rpc_query_index_free(hash);
+	rpc_query_index_free(sorted);
+}
+
+static gpointer
+query_test_index_worker(gpointer arg)
+{
+	rpc_object_t source = arg;
+	rpc_object_t rules;
+	size_t matched = 0;
+	size_t i;
+
+	rules = rpc_object_pack("[[s,s,i]]", "a.value", "=", (int64_t)500);
+	for (i = 0; i < QUERY_TEST_LOOKUPS; i++)
+		matched += query_test_count(rpc_query(source, NULL, rules));
+
+	rpc_release(rules);
+	return (GSIZE_TO_POINTER(matched));
+}
+
+static void
+query_test_index_concurrent(query_fixture *fixture, gconstpointer user_data)
+{
+	GThread *threads[QUERY_TEST_THREADS];
+	rpc_query_index_t hash;
+	size_t round;
+	size_t i;
+
+	hash = rpc_query_index_create(fixture->source, "a.value",
+	    RPC_QUERY_INDEX_HASH);
+	g_assert_nonnull(hash);
+
+	/* Sorting leaves the index stale for the queries to rebuild */
+	for (round = 0; round < QUERY_TEST_ROUNDS; round++) {
+		rpc_array_remove_index(fixture->source, 0);
+		rpc_array_sort(fixture->source,
+		    ^(rpc_object_t o1, rpc_object_t o2) {
+			int64_t v1 = query_test_value(o1);
+			int64_t v2 = query_test_value(o2);
+
+			return (v1 < v2 ? -1 : v1 > v2);
+		    });
+
+		for (i = 0; i < QUERY_TEST_THREADS; i++) {
+			threads[i] = g_thread_new("query",
+			    query_test_index_worker, fixture->source);
+		}
+
+		for (i = 0; i < QUERY_TEST_THREADS; i++) {
+			g_assert_cmpuint(GPOINTER_TO_SIZE(g_thread_join(
+			    threads[i])), ==, QUERY_TEST_LOOKUPS);
+		}
+	}
+
+	rpc_query_index_free(hash);
+}
+
 static void
-query_test(query_fixture *fixture, gconstpointer user_data)
+query_test_sort(query_fixture *fixture, gconstpointer user_data)
 {
+	struct rpc_query_params params = {
+	    .offset = 2,
+	    .limit = 5,
+	    .reverse = true,
+	    .sort = ^(rpc_object_t o1, rpc_object_t o2) {
+		int64_t v1 = rpc_int64_get_value(
+		    rpc_query_get(o1, "a.value", NULL));
+		int64_t v2 = rpc_int64_get_value(
+		    rpc_query_get(o2, "a.value", NULL));
+
+		/* Descending, then reversed back */
+		return ((v2 > v1) - (v2 < v1));
+	    }
+	};
+	rpc_query_iter_t iter;
+	rpc_object_t chunk;
+	int64_t expected = 2;
+
+	iter = rpc_query_fmt(fixture->source, &params, "[[s,s,s]]",
+	    "a.name", "~", "^item-");
+
+	while (rpc_query_next(iter, &chunk)) {
+		g_assert_cmpint(rpc_int64_get_value(rpc_query_get(chunk,
+		    "a.value", NULL)), ==, expected++);
+		rpc_release(chunk);
+	}
+
+	rpc_query_iter_free(iter);
+	g_assert_cmpint(expected, ==, 7);
 
+	/* The source keeps its own order */
+	g_assert_cmpint(rpc_int64_get_value(rpc_query_get(fixture->source,
+	    "0.a.value", NULL)), ==, 0);
+}
+
+static void
+query_test_parallel(query_fixture *fixture, gconstpointer user_data)
+{
+	struct rpc_query_params params = { .parallelism = 4 };
+	rpc_query_iter_t iter;
+	rpc_object_t source;
+	rpc_object_t rules;
+	rpc_object_t chunk;
+	int64_t expected = 30;
+	size_t i;
+
+	/* Large enough to be split between workers */
+	source = rpc_array_create();
+	for (i = 0; i < 10000; i++) {
+		rpc_array_append_stolen_value(source, rpc_object_pack("{i,i}",
+		    "idx", (int64_t)i,
+		    "mod", (int64_t)(i % 3)));
+	}
+
+	rules = rpc_object_pack("[[s,s,i]]", "mod", "=", (int64_t)0);
+	g_assert_cmpuint(query_test_count(rpc_query(source, &params, rules)),
+	    ==, 3334);
+
+	params.offset = 10;
+	params.limit = 3;
+	iter = rpc_query(source, &params, rules);
+	while (rpc_query_next(iter, &chunk)) {
+		g_assert_cmpint(rpc_dictionary_get_int64(chunk, "idx"), ==,
+		    expected);
+		expected += 3;
+		rpc_release(chunk);
+	}
+
+	rpc_query_iter_free(iter);
+	g_assert_cmpint(expected, ==, 39);
+
+	rpc_release(rules);
+	rpc_release(source);
+}
+
+/*
+ * Runs the rules with count, single and callback set in turn and
+ * returns what each of them produced.
+ */
+static rpc_object_t
+query_test_parallel_modes(rpc_object_t source, rpc_object_t rules,
+    uint32_t parallelism)
+{
+	struct rpc_query_params params = { .parallelism = parallelism };
+	GThread *self = g_thread_self();
+	rpc_query_iter_t iter;
+	rpc_object_t results;
+	rpc_object_t chunk;
+	rpc_object_t count;
+	rpc_object_t single;
+
+	params.count = true;
+	iter = rpc_query(source, &params, rules);
+	g_assert_false(rpc_query_next(iter, &count));
+	g_assert_nonnull(count);
+	rpc_query_iter_free(iter);
+
+	params.count = false;
+	params.single = true;
+	params.offset = 5;
+	iter = rpc_query(source, &params, rules);
+	g_assert_false(rpc_query_next(iter, &single));
+	g_assert_nonnull(single);
+	rpc_query_iter_free(iter);
+
+	/* Callbacks run on the calling thread and may drop matches */
+	params.single = false;
+	params.offset = 0;
+	params.callback = ^(rpc_object_t o) {
+		g_assert(g_thread_self() == self);
+		if (rpc_dictionary_get_int64(o, "idx") % 2 != 0)
+			return ((rpc_object_t)NULL);
+
+		return (rpc_dictionary_get_value(o, "idx"));
+	};
+
+	results = rpc_array_create();
+	iter = rpc_query(source, &params, rules);
+	while (rpc_query_next(iter, &chunk))
+		rpc_array_append_stolen_value(results, chunk);
+
+	rpc_query_iter_free(iter);
+	return (rpc_object_pack("{v,v,v}",
+	    "count", count,
+	    "single", single,
+	    "callback", results));
+}
+
+static void
+query_test_parallel_options(query_fixture *fixture, gconstpointer user_data)
+{
+	rpc_object_t expected;
+	rpc_object_t result;
+	rpc_object_t source;
+	rpc_object_t rules;
+	size_t i;
+
+	source = rpc_array_create();
+	for (i = 0; i < 10000; i++) {
+		rpc_array_append_stolen_value(source, rpc_object_pack("{i,i}",
+		    "idx", (int64_t)i,
+		    "mod", (int64_t)(i % 3)));
+	}
+
+	/* Two rules, so the index-free path evaluates every element */
+	rules = rpc_object_pack("[[s,s,i],[s,s,i]]",
+	    "mod", "=", (int64_t)0,
+	    "idx", ">=", (int64_t)100);
+
+	expected = query_test_parallel_modes(source, rules, 0);
+	g_assert_cmpint(rpc_dictionary_get_int64(rpc_dictionary_get_value(
+	    expected, "single"), "idx"), ==, 117);
+	g_assert_cmpuint(rpc_array_get_count(rpc_dictionary_get_value(
+	    expected, "callback")), ==, 1650);
+
+	for (i = 2; i <= 8; i *= 2) {
+		result = query_test_parallel_modes(source, rules, (uint32_t)i);
+		g_assert_true(rpc_equal(result, expected));
+		rpc_release(result);
+	}
+
+	rpc_release(expected);
+	rpc_release(rules);
+	rpc_release(source);
+}
+
+static gpointer
+query_test_parallel_worker(gpointer arg)
+{
+	struct rpc_query_params params = { .parallelism = 4 };
+	rpc_object_t source = arg;
+	rpc_object_t rules;
+	size_t matched;
+
+	rules = rpc_object_pack("[[s,s,i]]", "mod", "=", (int64_t)0);
+	matched = query_test_count(rpc_query(source, &params, rules));
+	rpc_release(rules);
+	return (GSIZE_TO_POINTER(matched));
+}
+
+static void
+query_test_parallel_shared(query_fixture *fixture, gconstpointer user_data)
+{
+	GThread *threads[QUERY_TEST_THREADS];
+	rpc_object_t source;
+	size_t i;
+
+	source = rpc_array_create();
+	for (i = 0; i < 10000; i++) {
+		rpc_array_append_stolen_value(source, rpc_object_pack("{i,i}",
+		    "idx", (int64_t)i,
+		    "mod", (int64_t)(i % 3)));
+	}
+
+	/* Queries share one pool; each must only wait for its own slices */
+	for (i = 0; i < QUERY_TEST_THREADS; i++) {
+		threads[i] = g_thread_new("query", query_test_parallel_worker,
+		    source);
+	}
+
+	for (i = 0; i < QUERY_TEST_THREADS; i++) {
+		g_assert_cmpuint(GPOINTER_TO_SIZE(g_thread_join(threads[i])),
+		    ==, 3334);
+	}
+
+	rpc_release(source);
 }
 
 static void
 query_test_single_set_up(query_fixture *fixture, gconstpointer user_data)
 {
+	char name[32];
+	size_t i;
 
+	fixture->source = rpc_array_create();
+	for (i = 0; i < QUERY_TEST_ITEMS; i++) {
+		g_snprintf(name, sizeof(name), "item-%zu", i);
+		rpc_array_append_stolen_value(fixture->source,
+		    rpc_object_pack("{v}", "a", rpc_object_pack("{s,i}",
+		    "name", name,
+		    "value", (int64_t)i)));
+	}
 }
 
 static void
 query_test_tear_down(query_fixture *fixture, gconstpointer user_data)
 {
 
+	rpc_release(fixture->source);
 }
 
 static void
 query_test_register()
 {
 
+	g_test_add("/query/compile", query_fixture, NULL,
+	    query_test_single_set_up, query_test_compile,
+	    query_test_tear_down);
+
+	g_test_add("/query/regex/cache", query_fixture, NULL,
+	    query_test_single_set_up, query_test_regex_cache,
+	    query_test_tear_down);
+
+	g_test_add("/query/regex/evict", query_fixture, NULL,
+	    query_test_single_set_up, query_test_regex_evict,
+	    query_test_tear_down);
+
+	g_test_add("/query/regex/live_plan", query_fixture, NULL,
+	    query_test_single_set_up, query_test_regex_live_plan,
+	    query_test_tear_down);
+
+	g_test_add("/query/regex/prepare", query_fixture, NULL,
+	    query_test_single_set_up, query_test_regex_prepare,
+	    query_test_tear_down);
+
+	g_test_add("/query/regex/constraint", query_fixture, NULL,
+	    query_test_single_set_up, query_test_regex_constraint,
+	    query_test_tear_down);
+
+	g_test_add("/query/index", query_fixture, NULL,
+	    query_test_single_set_up, query_test_index,
+	    query_test_tear_down);
+
+	g_test_add("/query/index/remove", query_fixture, NULL,
+	    query_test_single_set_up, query_test_index_remove,
+	    query_test_tear_down);
+
+	g_test_add("/query/index/concurrent", query_fixture, NULL,
+	    query_test_single_set_up, query_test_index_concurrent,
+	    query_test_tear_down);
+
+	g_test_add("/query/sort", query_fixture, NULL,
+	    query_test_single_set_up, query_test_sort,
+	    query_test_tear_down);
+
+	g_test_add("/query/parallel", query_fixture, NULL,
+	    query_test_single_set_up, query_test_parallel,
+	    query_test_tear_down);
+
+	g_test_add("/query/parallel/options", query_fixture, NULL,
+	    query_test_single_set_up, query_test_parallel_options,
+	    query_test_tear_down);
+
+	g_test_add("/query/parallel/shared", query_fixture, NULL,
+	    query_test_single_set_up, query_test_parallel_shared,
+	    query_test_tear_down);
 }
 
 static struct librpc_test query = {
@@ -63,4 +801,4 @@ static struct librpc_test query = {
     .register_f = &query_test_register
 };
 
-DECLARE_TEST(query);
\ No newline at end of file
+DECLARE_TEST(query);
@@ -29,6 +29,7 @@
 #include "../../src/linker_set.h"
 #include "../../src/internal.h"
 #include <glib.h>
+#include <errno.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
@@ -37,6 +38,7 @@
 #include <rpc/server.h>
 #include <rpc/client.h>
 #include <rpc/connection.h>
+#include <rpc/serializer.h>
 
 #define THREADS 50
 #define STREAMS 50
@@ -112,6 +114,74 @@ server_wait(rpc_context_t context, const char *uri)
 		sleep(5);
 }
 
+/*
+ * Counter that test threads can wait on, so tests block on the event
+ * they expect instead of sleeping for a while and hoping for the best.
+ */
+struct server_signal
+{
+	GMutex		mtx;
+	GCond		cv;
+	int		value;
+};
+
+static void
+server_signal_init(struct server_signal *sig)
+{
+
+	g_mutex_init(&sig->mtx);
+	g_cond_init(&sig->cv);
+	sig->value = 0;
+}
+
+static void
+server_signal_clear(struct server_signal *sig)
+{
+
+	g_mutex_clear(&sig->mtx);
+	g_cond_clear(&sig->cv);
+}
+
+static void
+server_signal_add(struct server_signal *sig, int n)
+{
+
+	g_mutex_lock(&sig->mtx);
+	sig->value += n;
+	g_cond_broadcast(&sig->cv);
+	g_mutex_unlock(&sig->mtx);
+}
+
+static int
+server_signal_get(struct server_signal *sig)
+{
+	int value;
+
+	g_mutex_lock(&sig->mtx);
+	value = sig->value;
+	g_mutex_unlock(&sig->mtx);
+	return (value);
+}
+
+/* Waits up to 10 seconds for the counter to reach value */
+static bool
+server_signal_wait(struct server_signal *sig, int value)
+{
+	gint64 deadline;
+	bool ret = true;
+
+	deadline = g_get_monotonic_time() + 10 * G_USEC_PER_SEC;
+	g_mutex_lock(&sig->mtx);
+	while (sig->value < value) {
+		if (!g_cond_wait_until(&sig->cv, &sig->mtx, deadline)) {
+			ret = sig->value >= value;
+			break;
+		}
+	}
+	g_mutex_unlock(&sig->mtx);
+	return (ret);
+}
+
 static void
 server_test_basic_set_up(server_fixture *fixture, gconstpointer user_data)
 {
@@ -157,6 +227,17 @@ valid_server_set_up(server_fixture *fixture, gconstpointer u_data)
 	fixture->srv = rpc_server_create(uris[fixture->iuri].srv, fixture->ctx);
 }
 
+static rpc_object_t
+inline_hi(void *cookie __unused, rpc_object_t args)
+{
+
+	return (rpc_string_create_with_format("inline %s!",
+	    rpc_array_get_string(args, 0)));
+}
+
+static const struct rpc_if_member inline_hi_member =
+    RPC_METHOD_INLINE(inline_hi, inline_hi);
+
 static gpointer
 thread_kill_call (gpointer data)
 {
@@ -645,73 +726,1712 @@ server_test_all_listen(void)
 }
 
 static void
-server_test_register()
+server_test_inline(server_fixture *fixture, gconstpointer user_data)
 {
+	rpc_client_t client;
+	rpc_connection_t conn;
+	rpc_object_t result;
 
-	g_test_add("/server/resume/tcp", server_fixture, (void *)TCP_GOOD,
-	    server_test_valid_server_set_up, server_test_resume,
-	    server_test_valid_server_tear_down);
+	g_assert(rpc_context_register_member(fixture->ctx, NULL,
+	    &inline_hi_member) == 0);
 
-	g_test_add("/server/resume/v6", server_fixture, (void *)V6_GOOD,
-	    server_test_valid_server_set_up, server_test_resume,
-	    server_test_valid_server_tear_down);
+	rpc_server_resume(fixture->srv);
+	client = rpc_client_create(uris[fixture->iuri].cli, 0);
+	g_assert(client != NULL);
 
-#ifndef __linux__
-	g_test_add("/server/resume/ws", server_fixture, (void *)WS_GOOD,
-	    server_test_valid_server_set_up, server_test_resume,
-	    server_test_valid_server_tear_down);
-#endif
+	conn = rpc_client_get_connection(client);
+	result = rpc_connection_call_simple(conn, "inline_hi", "[s]", "world");
+	g_assert(result != NULL && !(rpc_is_error(result)));
+	g_assert_cmpstr("inline world!", ==, rpc_string_get_string_ptr(result));
+	rpc_release(result);
 
-	g_test_add("/server/resume/loopback", server_fixture, (void *)LB_GOOD,
-	    server_test_valid_server_set_up, server_test_resume,
-	    server_test_valid_server_tear_down);
+	rpc_client_close(client);
+	rpc_context_unregister_member(fixture->ctx, NULL, "inline_hi");
+}
 
-	g_test_add("/server/listen/fail", server_fixture, (void *)PROTO_BAD,
-	    server_test_basic_set_up, server_test_failed_listen,
-	    server_test_basic_tear_down);
+#define	BURST_EVENTS	20
 
-	g_test_add("/server/nullables/null", server_fixture, (void *)TCP_GOOD,
-	    server_test_valid_server_set_up, server_test_nullables,
-	    server_test_valid_server_tear_down);
+static rpc_recv_msg_fn_t burst_recv_next;
+static GMutex burst_mtx;
+static GArray *burst_sizes;
 
-	g_test_add("/server/nullables/notnull", server_fixture, (void *)TCP_GOOD,
-	    server_test_alt_server_set_up, server_test_nullables,
-	    server_test_valid_server_tear_down);
+/* Sits in front of the client's receive path and notes every burst */
+static int
+burst_recv_msg(struct rpc_connection *conn, const void *frame, size_t len,
+    int *fds, size_t nfds)
+{
+	rpc_object_t msg;
+	guint count;
+
+	msg = rpc_serializer_load("msgpack", frame, len);
+	if (msg != NULL) {
+		if (!g_strcmp0(rpc_dictionary_get_string(msg, "namespace"),
+		    "events") && !g_strcmp0(rpc_dictionary_get_string(msg,
+		    "name"), "event_burst")) {
+			count = (guint)rpc_array_get_count(
+			    rpc_dictionary_get_value(msg, "args"));
+			g_mutex_lock(&burst_mtx);
+			g_array_append_val(burst_sizes, count);
+			g_mutex_unlock(&burst_mtx);
+		}
 
-	g_test_add_func("/server/listen/all", server_test_all_listen);
+		rpc_release(msg);
+	}
 
-	g_test_add("/server/flush/tcp", server_fixture, (void *)TCP_GOOD,
-	    server_test_valid_server_set_up, server_test_flush,
-	    server_test_valid_server_tear_down);
+	return (burst_recv_next(conn, frame, len, fds, nfds));
+}
 
-#ifndef __linux__
-	g_test_add("/server/flush/ws", server_fixture, (void *)WS_GOOD,
-	    server_test_valid_server_set_up, server_test_flush,
-	    server_test_valid_server_tear_down);
-#endif
+/*
+ * Broadcasts BURST_EVENTS events with a payload of the given size
+ * and checks they all arrive in order. Returns the sizes of the burst
+ * frames that carried them.
+ */
+static GArray *
+server_event_burst_run(server_fixture *fixture, uint64_t usec, size_t bytes,
+    size_t payload_size)
+{
+	struct server_signal received;
+	struct server_signal *recvp = &received;
+	__block gint ordered = 1;
+	rpc_client_t client;
+	rpc_connection_t conn;
+	rpc_object_t result;
+	GArray *sizes;
+	char *payload;
+	void *handle;
 
-	g_test_add("/server/flush/event", server_fixture, (void *)TCP_GOOD,
-	    server_test_valid_server_set_up, server_test_event,
-	    server_test_valid_server_tear_down);
+	server_signal_init(&received);
+	burst_sizes = g_array_new(false, false, sizeof(guint));
 
-	g_test_add("/server/stream/one", server_fixture, (void *)LB_GOOD,
-	    server_test_stream_setup, server_test_stream_run,
-	    server_test_stream_tear_down);
+	payload = g_malloc(payload_size + 1);
+	memset(payload, 'x', payload_size);
+	payload[payload_size] = '\0';
 
-	g_test_add("/server/stream/close", server_fixture, (void *)TCP_GOOD,
-	    server_test_stream_setup, server_test_stream_close,
-	    server_test_stream_tear_down);
+	rpc_server_set_event_window(fixture->srv, usec, bytes);
+	rpc_context_register_block(fixture->ctx, NULL, "burst",
+	    NULL, ^(void *cookie __unused, rpc_object_t args __unused) {
+		for (int64_t n = 0; n < BURST_EVENTS; n++)
+			rpc_server_broadcast_event(fixture->srv, NULL, NULL,
+			    "server.tick", rpc_object_pack("[i,s]", n,
+			    payload));
+		return (rpc_null_create());
+	    });
 
-	g_test_add("/server/stream/abort", server_fixture, (void *)TCP_GOOD,
-	    server_test_stream_setup, server_test_stream_abort,
-	    server_test_stream_tear_down);
+	rpc_server_resume(fixture->srv);
+	client = rpc_client_create(uris[fixture->iuri].cli, 0);
+	g_assert(client != NULL);
 
-	g_test_add("/server/stream/kill", server_fixture, (void *)TCP_GOOD,
-	    server_test_stream_setup, server_test_stream_kill,
-	    server_test_stream_tear_down);
+	conn = rpc_client_get_connection(client);
+	burst_recv_next = conn->rco_recv_msg;
+	conn->rco_recv_msg = burst_recv_msg;
+
+	handle = rpc_connection_register_event_handler(conn, NULL, NULL,
+	    "server.tick", ^(const char *path __unused,
+	    const char *interface __unused, const char *name __unused,
+	    rpc_object_t args) {
+		if (rpc_array_get_int64(args, 0) != server_signal_get(recvp))
+			g_atomic_int_set(&ordered, 0);
+		server_signal_add(recvp, 1);
+	    });
+	g_assert_nonnull(handle);
 
-	g_test_add("/server/flush/loopback", server_fixture, (void *)LB_GOOD,
-	    server_test_valid_server_set_up, server_test_flush,
+	result = rpc_connection_call_simple(conn, "burst", RPC_NULL_FORMAT);
+	g_assert(result != NULL && !(rpc_is_error(result)));
+	rpc_release(result);
+
+	g_assert(server_signal_wait(&received, BURST_EVENTS));
+	g_assert_cmpint(server_signal_get(&received), ==, BURST_EVENTS);
+	g_assert_cmpint(g_atomic_int_get(&ordered), ==, 1);
+
+	rpc_client_close(client);
+	rpc_context_unregister_member(fixture->ctx, NULL, "burst");
+	server_signal_clear(&received);
+	g_free(payload);
+
+	g_mutex_lock(&burst_mtx);
+	sizes = burst_sizes;
+	burst_sizes = NULL;
+	g_mutex_unlock(&burst_mtx);
+	return (sizes);
+}
+
+static void
+server_test_event_burst(server_fixture *fixture, gconstpointer user_data)
+{
+	GArray *sizes;
+
+	/* All the events fit in one window and go out as one frame */
+	sizes = server_event_burst_run(fixture, 100000, 0, 0);
+	g_assert_cmpuint(sizes->len, ==, 1);
+	g_assert_cmpuint(g_array_index(sizes, guint, 0), ==, BURST_EVENTS);
+	g_array_free(sizes, true);
+}
+
+static void
+server_test_event_burst_bytes(server_fixture *fixture,
+    gconstpointer user_data)
+{
+	GArray *sizes;
+	guint i;
+
+	/*
+	 * Each event is estimated at a bit over 1000 bytes, so the byte
+	 * limit flushes every fourth one, long before the 10 second
+	 * window would.
+	 */
+	sizes = server_event_burst_run(fixture, 10 * G_USEC_PER_SEC, 4000,
+	    1000);
+	g_assert_cmpuint(sizes->len, ==, BURST_EVENTS / 4);
+	for (i = 0; i < sizes->len; i++)
+		g_assert_cmpuint(g_array_index(sizes, guint, i), ==, 4);
+
+	g_array_free(sizes, true);
+}
+
+static void
+server_test_event_wildcard(server_fixture *fixture, gconstpointer user_data)
+{
+	rpc_client_t client;
+	rpc_connection_t conn;
+	rpc_object_t result;
+	void *handle;
+	__block volatile gint received = 0;
+	int i;
+
+	rpc_context_register_block(fixture->ctx, NULL, "jobs",
+	    NULL, ^(void *cookie __unused, rpc_object_t args __unused) {
+		rpc_context_emit_event(fixture->ctx, "/jobs/1", "com.test",
+		    "tick", rpc_null_create());
+		rpc_context_emit_event(fixture->ctx, "/other/1", "com.test",
+		    "tick", rpc_null_create());
+		rpc_context_emit_event(fixture->ctx, "/jobs/2", "com.test",
+		    "tick", rpc_null_create());
+		rpc_context_emit_event(fixture->ctx, "/jobs/2/log", "com.test",
+		    "tick", rpc_null_create());
+		return (rpc_null_create());
+	    });
+
+	rpc_server_resume(fixture->srv);
+	client = rpc_client_create(uris[fixture->iuri].cli, 0);
+	g_assert(client != NULL);
+
+	conn = rpc_client_get_connection(client);
+	handle = rpc_connection_register_event_handler(conn, "/jobs/*",
+	    "com.test", "tick", ^(const char *path,
+	    const char *interface __unused, const char *name __unused,
+	    rpc_object_t args __unused) {
+		g_assert(g_str_has_prefix(path, "/jobs/"));
+		g_atomic_int_inc(&received);
+	    });
+	g_assert_nonnull(handle);
+
+	result = rpc_connection_call_simple(conn, "jobs", RPC_NULL_FORMAT);
+	g_assert(result != NULL && !(rpc_is_error(result)));
+	rpc_release(result);
+
+	for (i = 0; i < 50 && g_atomic_int_get(&received) < 2; i++)
+		g_usleep(100000);
+
+	/* Give a stray event a chance to show up */
+	g_usleep(200000);
+	g_assert_cmpint(received, ==, 2);
+
+	rpc_client_close(client);
+	rpc_context_unregister_member(fixture->ctx, NULL, "jobs");
+}
+
+#define	SHARED_CLIENTS	4
+
+static rpc_recv_msg_fn_t shared_recv_next;
+static rpc_connection_t shared_conns[SHARED_CLIENTS];
+static gint shared_frames[SHARED_CLIENTS];
+static GBytes *shared_bytes[SHARED_CLIENTS];
+
+/* Counts the "server.shared" event frames each subscriber reads */
+static int
+shared_recv_msg(struct rpc_connection *conn, const void *frame, size_t len,
+    int *fds, size_t nfds)
+{
+	rpc_object_t msg;
+	rpc_object_t args;
+	int i;
+
+	msg = rpc_serializer_load("msgpack", frame, len);
+	if (msg != NULL) {
+		args = rpc_dictionary_get_value(msg, "args");
+		if (!g_strcmp0(rpc_dictionary_get_string(msg, "name"),
+		    "event") && args != NULL &&
+		    rpc_get_type(args) == RPC_TYPE_DICTIONARY &&
+		    !g_strcmp0(rpc_dictionary_get_string(args, "name"),
+		    "server.shared")) {
+			for (i = 0; i < SHARED_CLIENTS; i++) {
+				if (shared_conns[i] != conn)
+					continue;
+
+				if (shared_bytes[i] == NULL)
+					shared_bytes[i] = g_bytes_new(frame,
+					    len);
+				g_atomic_int_inc(&shared_frames[i]);
+			}
+		}
+
+		rpc_release(msg);
+	}
+
+	return (shared_recv_next(conn, frame, len, fds, nfds));
+}
+
+static void
+server_test_event_shared(server_fixture *fixture, gconstpointer user_data)
+{
+	struct server_signal received;
+	struct server_signal *recvp = &received;
+	rpc_client_t clients[SHARED_CLIENTS];
+	rpc_object_t expected;
+	rpc_object_t result;
+	__block gint mismatched = 0;
+	void *handle;
+	int i;
+
+	server_signal_init(&received);
+	rpc_context_register_block(fixture->ctx, NULL, "ping",
+	    NULL, ^(void *cookie __unused, rpc_object_t args __unused) {
+		return (rpc_null_create());
+	    });
+
+	expected = rpc_object_pack("{s,i,s}",
+	    "value", "shared",
+	    "n", (int64_t)42,
+	    "origin", "server");
+
+	rpc_server_resume(fixture->srv);
+	for (i = 0; i < SHARED_CLIENTS; i++) {
+		clients[i] = rpc_client_create(uris[fixture->iuri].cli, 0);
+		g_assert(clients[i] != NULL);
+
+		shared_conns[i] = rpc_client_get_connection(clients[i]);
+		shared_frames[i] = 0;
+		shared_recv_next = shared_conns[i]->rco_recv_msg;
+		shared_conns[i]->rco_recv_msg = shared_recv_msg;
+
+		handle = rpc_connection_register_event_handler(shared_conns[i],
+		    NULL, NULL, "server.shared", ^(const char *path __unused,
+		    const char *interface __unused, const char *name __unused,
+		    rpc_object_t args) {
+			if (!rpc_equal(args, expected))
+				g_atomic_int_set(&mismatched, 1);
+			server_signal_add(recvp, 1);
+		    });
+		g_assert_nonnull(handle);
+
+		/* The subscription is in place once the reply is back */
+		result = rpc_connection_call_simple(shared_conns[i], "ping",
+		    RPC_NULL_FORMAT);
+		g_assert(result != NULL && !(rpc_is_error(result)));
+		rpc_release(result);
+	}
+
+	g_assert_cmpint(expected->ro_refcnt, ==, 1);
+	rpc_server_broadcast_event(fixture->srv, NULL, NULL, "server.shared",
+	    expected);
+
+	/* Nothing may keep the shared frame, or its args, alive */
+	g_assert_cmpint(expected->ro_refcnt, ==, 1);
+
+	g_assert(server_signal_wait(&received, SHARED_CLIENTS));
+	g_assert_cmpint(g_atomic_int_get(&mismatched), ==, 0);
+
+	/*
+	 * The event frame precedes the reply on each connection, so once
+	 * the reply is back a duplicate would already have been read.
+	 */
+	for (i = 0; i < SHARED_CLIENTS; i++) {
+		result = rpc_connection_call_simple(shared_conns[i], "ping",
+		    RPC_NULL_FORMAT);
+		g_assert(result != NULL && !(rpc_is_error(result)));
+		rpc_release(result);
+		g_assert_cmpint(g_atomic_int_get(&shared_frames[i]), ==, 1);
+	}
+
+	/* One frame was encoded and every subscriber got the same bytes */
+	for (i = 1; i < SHARED_CLIENTS; i++)
+		g_assert(g_bytes_equal(shared_bytes[0], shared_bytes[i]));
+
+	g_assert_cmpint(server_signal_get(&received), ==, SHARED_CLIENTS);
+
+	for (i = 0; i < SHARED_CLIENTS; i++) {
+		rpc_client_close(clients[i]);
+		shared_conns[i] = NULL;
+		g_bytes_unref(shared_bytes[i]);
+		shared_bytes[i] = NULL;
+	}
+
+	rpc_release(expected);
+	rpc_context_unregister_member(fixture->ctx, NULL, "ping");
+	server_signal_clear(&received);
+}
+
+#define	BACKLOG_EVENTS	256
+#define	BACKLOG_SIZE	(128 * 1024)
+
+static struct server_signal stall_entered;
+static struct server_signal stall_gate;
+
+/*
+ * Runs on the reader thread of the client, so while it waits nothing
+ * is read from the socket and the server ends up with a slow consumer.
+ */
+static rpc_object_t
+stall_reader(void *cookie __unused, rpc_object_t args __unused)
+{
+
+	server_signal_add(&stall_entered, 1);
+	server_signal_wait(&stall_gate, 1);
+	return (rpc_null_create());
+}
+
+static const struct rpc_if_member stall_member =
+    RPC_METHOD_INLINE(stall, stall_reader);
+
+struct event_backlog
+{
+	rpc_client_t			client;
+	rpc_context_t			context;
+	rpc_call_t			stall;
+	struct server_signal		received;
+	struct server_signal		last;
+	struct rpc_context_event_stats	stats;
+};
+
+/*
+ * Emits BACKLOG_EVENTS big events to a client that isn't reading and
+ * fills bl->stats once all of them went through the emitter.
+ */
+static void
+server_event_backlog(server_fixture *fixture, struct event_backlog *bl)
+{
+	__block rpc_connection_t sconn = NULL;
+	struct event_backlog *blp = bl;
+	rpc_connection_t conn;
+	rpc_object_t result;
+	char *payload;
+	void *handle;
+	int i;
+
+	server_signal_init(&stall_entered);
+	server_signal_init(&stall_gate);
+	server_signal_init(&bl->received);
+	server_signal_init(&bl->last);
+
+	rpc_server_set_event_handler(fixture->srv,
+	    ^(rpc_connection_t c, rpc_server_event_t event) {
+		if (event == RPC_SERVER_CLIENT_CONNECT)
+			sconn = c;
+	    });
+
+	rpc_server_resume(fixture->srv);
+	bl->client = rpc_client_create(uris[fixture->iuri].cli, 0);
+	g_assert_nonnull(bl->client);
+	conn = rpc_client_get_connection(bl->client);
+
+	bl->context = rpc_context_create();
+	g_assert(rpc_connection_set_context(conn, bl->context) == 0);
+	g_assert(rpc_context_register_member(bl->context, NULL,
+	    &stall_member) == 0);
+
+	handle = rpc_connection_register_event_handler(conn, "/",
+	    RPC_DEFAULT_INTERFACE, "big", ^(const char *path __unused,
+	    const char *interface __unused, const char *name __unused,
+	    rpc_object_t args) {
+		server_signal_add(&blp->received, 1);
+		if (rpc_array_get_int64(args, 0) == BACKLOG_EVENTS - 1)
+			server_signal_add(&blp->last, 1);
+	    });
+	g_assert_nonnull(handle);
+
+	/* Round trip, so the subscription is in place on the server */
+	result = rpc_connection_call_simple(conn, "hi", "[s]", "world");
+	g_assert_cmpstr(rpc_string_get_string_ptr(result), ==, "hello world!");
+	rpc_release(result);
+	g_assert_nonnull(sconn);
+
+	bl->stall = rpc_connection_call(sconn, NULL, NULL, "stall",
+	    rpc_array_create(), NULL);
+	g_assert_nonnull(bl->stall);
+	g_assert(server_signal_wait(&stall_entered, 1));
+
+	payload = g_malloc(BACKLOG_SIZE);
+	memset(payload, 'x', BACKLOG_SIZE - 1);
+	payload[BACKLOG_SIZE - 1] = '\0';
+
+	for (i = 0; i < BACKLOG_EVENTS; i++) {
+		rpc_context_emit_event(fixture->ctx, "/", RPC_DEFAULT_INTERFACE,
+		    "big", rpc_object_pack("[i,s]", (int64_t)i, payload));
+	}
+
+	g_free(payload);
+	for (i = 0; i < 1000; i++) {
+		rpc_context_get_event_stats(fixture->ctx, &bl->stats);
+		if (bl->stats.emitted == BACKLOG_EVENTS)
+			break;
+
+		g_usleep(10000);
+	}
+
+	g_assert_cmpuint(bl->stats.emitted, ==, BACKLOG_EVENTS);
+}
+
+static void
+server_event_backlog_free(struct event_backlog *bl)
+{
+
+	rpc_call_free(bl->stall);
+	rpc_client_close(bl->client);
+	rpc_context_unregister_member(bl->context, NULL, "stall");
+	rpc_context_free(bl->context);
+	server_signal_clear(&bl->last);
+	server_signal_clear(&bl->received);
+	server_signal_clear(&stall_gate);
+	server_signal_clear(&stall_entered);
+}
+
+static void
+server_test_event_lossless(server_fixture *fixture,
+    gconstpointer user_data __unused)
+{
+	struct event_backlog bl;
+
+	/* No emitter settings: the default must not lose anything */
+	server_event_backlog(fixture, &bl);
+	g_assert_cmpuint(bl.stats.dropped, ==, 0);
+	g_assert_cmpuint(bl.stats.disconnects, ==, 0);
+	g_assert_cmpuint(bl.stats.queue_hwm, >, 1);
+
+	server_signal_add(&stall_gate, 1);
+	rpc_call_wait(bl.stall);
+	g_assert(server_signal_wait(&bl.last, 1));
+	g_assert_cmpint(server_signal_get(&bl.received), ==, BACKLOG_EVENTS);
+
+	server_event_backlog_free(&bl);
+}
+
+static void
+server_test_event_drop_oldest(server_fixture *fixture,
+    gconstpointer user_data __unused)
+{
+	struct rpc_context_emitter emitter = {
+		.threads = 0,
+		.queue_limit = 8,
+		.policy = RPC_SLOW_CONSUMER_DROP_OLDEST
+	};
+	struct event_backlog bl;
+
+	rpc_context_set_emitter(fixture->ctx, &emitter);
+	server_event_backlog(fixture, &bl);
+	g_assert_cmpuint(bl.stats.dropped, >, 0);
+	g_assert_cmpuint(bl.stats.queue_hwm, <=, 8);
+
+	/* The newest events survive, the oldest queued ones are gone */
+	server_signal_add(&stall_gate, 1);
+	rpc_call_wait(bl.stall);
+	g_assert(server_signal_wait(&bl.last, 1));
+	g_assert_cmpint(server_signal_get(&bl.received), ==,
+	    BACKLOG_EVENTS - (int)bl.stats.dropped);
+
+	server_event_backlog_free(&bl);
+}
+
+static void
+server_test_event_disconnect(server_fixture *fixture,
+    gconstpointer user_data __unused)
+{
+	struct rpc_context_emitter emitter = {
+		.threads = 0,
+		.queue_limit = 8,
+		.policy = RPC_SLOW_CONSUMER_DISCONNECT
+	};
+	struct event_backlog bl;
+
+	rpc_context_set_emitter(fixture->ctx, &emitter);
+	server_event_backlog(fixture, &bl);
+	g_assert_cmpuint(bl.stats.disconnects, ==, 1);
+	g_assert_cmpuint(bl.stats.dropped, ==, 0);
+
+	/* The server gave up on the client instead of dropping events */
+	server_signal_add(&stall_gate, 1);
+	rpc_call_wait(bl.stall);
+	g_assert_cmpint(rpc_call_status(bl.stall), !=, RPC_CALL_DONE);
+	g_assert_cmpint(server_signal_get(&bl.received), <, BACKLOG_EVENTS);
+
+	server_event_backlog_free(&bl);
+}
+
+static void
+server_test_event_recursive(server_fixture *fixture,
+    gconstpointer user_data __unused)
+{
+	struct server_signal received;
+	struct server_signal *recvp = &received;
+	rpc_client_t client;
+	rpc_connection_t conn;
+	rpc_object_t result;
+	void *handle;
+
+	server_signal_init(&received);
+	rpc_context_register_block(fixture->ctx, NULL, "tree",
+	    NULL, ^(void *cookie __unused, rpc_object_t args __unused) {
+		const char *paths[] = {
+			"/jobs", "/jobs/1", "/jobs//1", "/jobs/1/log",
+			"/other/1", "/jobs/last"
+		};
+
+		for (size_t i = 0; i < G_N_ELEMENTS(paths); i++) {
+			rpc_context_emit_event(fixture->ctx, paths[i],
+			    "com.test", "tick", rpc_string_create(paths[i]));
+		}
+
+		return (rpc_null_create());
+	    });
+
+	rpc_server_resume(fixture->srv);
+	client = rpc_client_create(uris[fixture->iuri].cli, 0);
+	g_assert_nonnull(client);
+	conn = rpc_client_get_connection(client);
+
+	/* "**" is only allowed as the last component */
+	g_assert_null(rpc_connection_register_event_handler(conn,
+	    "/jobs/**/log", "com.test", "tick", ^(const char *path __unused,
+	    const char *interface __unused, const char *name __unused,
+	    rpc_object_t args __unused) {}));
+	g_assert_cmpint(rpc_error_get_code(rpc_get_last_error()), ==, EINVAL);
+	g_assert(rpc_connection_subscribe_event(conn, "/**/x", "com.test",
+	    "tick") != 0);
+
+	/*
+	 * Descendants of /jobs match, /jobs itself doesn't, and neither
+	 * does /jobs//1, whose empty component isn't collapsed.
+	 */
+	handle = rpc_connection_register_event_handler(conn, "/jobs/**",
+	    "com.test", "tick", ^(const char *path,
+	    const char *interface __unused, const char *name __unused,
+	    rpc_object_t args) {
+		g_assert_cmpstr(path, ==, rpc_string_get_string_ptr(args));
+		g_assert(g_strcmp0(path, "/jobs/1") == 0 ||
+		    g_strcmp0(path, "/jobs/1/log") == 0 ||
+		    g_strcmp0(path, "/jobs/last") == 0);
+		server_signal_add(recvp, 1);
+	    });
+	g_assert_nonnull(handle);
+
+	result = rpc_connection_call_simple(conn, "tree", RPC_NULL_FORMAT);
+	g_assert(result != NULL && !(rpc_is_error(result)));
+	rpc_release(result);
+
+	/* Events for other paths trip the assertion in the handler */
+	g_assert(server_signal_wait(&received, 3));
+	g_assert_cmpint(server_signal_get(&received), ==, 3);
+
+	rpc_client_close(client);
+	rpc_context_unregister_member(fixture->ctx, NULL, "tree");
+	server_signal_clear(&received);
+}
+
+static void
+server_test_stream_window(server_fixture *fixture, gconstpointer user_data)
+{
+	static char chunk[1024];
+	rpc_client_t client;
+	rpc_connection_t conn;
+	rpc_call_t call;
+	int received = 0;
+	bool done = false;
+
+	rpc_context_register_block(fixture->ctx, NULL, "window",
+	    NULL, ^(void *cookie, rpc_object_t args __unused) {
+		rpc_function_start_stream(cookie);
+		for (int n = 0; n < 200; n++) {
+			if (rpc_function_yield(cookie, rpc_data_create(chunk,
+			    sizeof(chunk), NULL)) != 0)
+				break;
+		}
+
+		rpc_function_end(cookie);
+		return (RPC_FUNCTION_STILL_RUNNING);
+	    });
+
+	rpc_server_resume(fixture->srv);
+	client = rpc_client_create(uris[fixture->iuri].cli, 0);
+	g_assert(client != NULL);
+
+	conn = rpc_client_get_connection(client);
+	call = rpc_connection_call(conn, NULL, NULL, "window",
+	    rpc_array_create(), NULL);
+	g_assert_nonnull(call);
+	g_assert(rpc_call_set_window(call, 4096, 65536, 0) == 0);
+
+	while (!done) {
+		rpc_call_wait(call);
+
+		switch (rpc_call_status(call)) {
+		case RPC_CALL_STREAM_START:
+			rpc_call_continue(call, false);
+			break;
+
+		case RPC_CALL_MORE_AVAILABLE:
+			g_assert_cmpint(rpc_data_get_length(
+			    rpc_call_result(call)), ==, sizeof(chunk));
+			received++;
+			rpc_call_continue(call, false);
+			break;
+
+		default:
+			done = true;
+			break;
+		}
+	}
+
+	g_assert_cmpint(rpc_call_status(call), ==, RPC_CALL_ENDED);
+	g_assert_cmpint(received, ==, 200);
+
+	rpc_call_free(call);
+	rpc_client_close(client);
+	rpc_context_unregister_member(fixture->ctx, NULL, "window");
+}
+
+static void
+server_test_stream_window_stall(server_fixture *fixture,
+    gconstpointer user_data)
+{
+	static char chunk[1024];
+	rpc_client_t client;
+	rpc_connection_t conn;
+	rpc_call_t call;
+	__block gint sent = 0;
+	int received = 0;
+	bool done = false;
+
+	rpc_context_register_block(fixture->ctx, NULL, "window",
+	    NULL, ^(void *cookie, rpc_object_t args __unused) {
+		rpc_function_start_stream(cookie);
+		for (int n = 0; n < 64; n++) {
+			if (rpc_function_yield(cookie, rpc_data_create(chunk,
+			    sizeof(chunk), NULL)) != 0)
+				break;
+
+			g_atomic_int_inc(&sent);
+		}
+
+		rpc_function_end(cookie);
+		return (RPC_FUNCTION_STILL_RUNNING);
+	    });
+
+	rpc_server_resume(fixture->srv);
+	client = rpc_client_create(uris[fixture->iuri].cli, 0);
+	g_assert(client != NULL);
+
+	conn = rpc_client_get_connection(client);
+	call = rpc_connection_call(conn, NULL, NULL, "window",
+	    rpc_array_create(), NULL);
+	g_assert_nonnull(call);
+
+	/* Fixed 4k window and no item cap: bytes alone must hold it back */
+	g_assert(rpc_call_set_window(call, 4096, 0, 0) == 0);
+
+	rpc_call_wait(call);
+	g_assert_cmpint(rpc_call_status(call), ==, RPC_CALL_STREAM_START);
+	rpc_call_continue(call, true);
+	g_assert_cmpint(rpc_call_status(call), ==, RPC_CALL_MORE_AVAILABLE);
+
+	/*
+	 * Stop consuming. The producer may overshoot the window by one
+	 * fragment, but must not get anywhere near the end of the stream.
+	 */
+	g_usleep(300000);
+	g_assert_cmpint(g_atomic_int_get(&sent), >=, 1);
+	g_assert_cmpint(g_atomic_int_get(&sent), <=,
+	    4096 / sizeof(chunk) + 1);
+
+	while (!done) {
+		switch (rpc_call_status(call)) {
+		case RPC_CALL_MORE_AVAILABLE:
+			received++;
+			rpc_call_continue(call, true);
+			break;
+
+		default:
+			done = true;
+			break;
+		}
+	}
+
+	g_assert_cmpint(rpc_call_status(call), ==, RPC_CALL_ENDED);
+	g_assert_cmpint(received, ==, 64);
+	g_assert_cmpint(g_atomic_int_get(&sent), ==, 64);
+
+	rpc_call_free(call);
+	rpc_client_close(client);
+	rpc_context_unregister_member(fixture->ctx, NULL, "window");
+}
+
+static void
+server_test_stream_batch(server_fixture *fixture, gconstpointer user_data)
+{
+	rpc_client_t client;
+	rpc_connection_t conn;
+	rpc_call_t call;
+	rpc_object_t batch;
+	__block int64_t expected = 0;
+	bool done = false;
+
+	rpc_context_register_block(fixture->ctx, NULL, "batch",
+	    NULL, ^(void *cookie, rpc_object_t args __unused) {
+		rpc_function_set_fragment_batch(cookie, 16, 10000);
+		rpc_function_start_stream(cookie);
+		for (int64_t n = 0; n < 100; n++) {
+			if (rpc_function_yield(cookie,
+			    rpc_int64_create(n)) != 0)
+				break;
+		}
+
+		rpc_function_end(cookie);
+		return (RPC_FUNCTION_STILL_RUNNING);
+	    });
+
+	rpc_server_resume(fixture->srv);
+	client = rpc_client_create(uris[fixture->iuri].cli, 0);
+	g_assert(client != NULL);
+
+	conn = rpc_client_get_connection(client);
+	call = rpc_connection_call(conn, NULL, NULL, "batch",
+	    rpc_array_create(), NULL);
+	g_assert_nonnull(call);
+	rpc_call_set_prefetch(call, 64);
+
+	while (!done) {
+		rpc_call_wait(call);
+
+		switch (rpc_call_status(call)) {
+		case RPC_CALL_STREAM_START:
+			rpc_call_continue(call, false);
+			break;
+
+		case RPC_CALL_MORE_AVAILABLE:
+			batch = rpc_call_result_batch(call, 0);
+			g_assert_nonnull(batch);
+			g_assert_cmpint(rpc_array_get_count(batch), >, 0);
+			rpc_array_apply(batch, ^(size_t idx __unused,
+			    rpc_object_t v) {
+				g_assert_cmpint(rpc_int64_get_value(v), ==,
+				    expected);
+				expected++;
+				return ((bool)true);
+			});
+			rpc_release(batch);
+			break;
+
+		default:
+			done = true;
+			break;
+		}
+	}
+
+	g_assert_cmpint(rpc_call_status(call), ==, RPC_CALL_ENDED);
+	g_assert_cmpint(expected, ==, 100);
+
+	rpc_call_free(call);
+	rpc_client_close(client);
+	rpc_context_unregister_member(fixture->ctx, NULL, "batch");
+}
+
+static void
+server_test_stream_upload(server_fixture *fixture, gconstpointer user_data)
+{
+	rpc_client_t client;
+	rpc_connection_t conn;
+	rpc_call_t call;
+	int64_t n;
+
+	rpc_context_register_block(fixture->ctx, NULL, "sum",
+	    NULL, ^(void *cookie, rpc_object_t args __unused) {
+		rpc_object_t fragment;
+		int64_t sum = 0;
+
+		/* Small window so the client has to wait for credit */
+		rpc_function_set_upload_window(cookie, 256, 8);
+		while ((fragment = rpc_function_next_fragment(cookie)) != NULL) {
+			sum += rpc_int64_get_value(fragment);
+			rpc_release(fragment);
+		}
+
+		return (rpc_int64_create(sum));
+	    });
+
+	rpc_server_resume(fixture->srv);
+	client = rpc_client_create(uris[fixture->iuri].cli, 0);
+	g_assert(client != NULL);
+
+	conn = rpc_client_get_connection(client);
+	call = rpc_connection_call_stream(conn, NULL, NULL, "sum", NULL);
+	g_assert_nonnull(call);
+
+	for (n = 1; n <= 1000; n++)
+		g_assert(rpc_call_send_fragment(call, rpc_int64_create(n)) == 0);
+
+	g_assert(rpc_call_end_stream(call) == 0);
+	g_assert(rpc_call_send_fragment(call, rpc_int64_create(0)) != 0);
+
+	rpc_call_wait(call);
+	g_assert_cmpint(rpc_call_status(call), ==, RPC_CALL_DONE);
+	g_assert_cmpint(rpc_int64_get_value(rpc_call_result(call)), ==,
+	    500500);
+
+	rpc_call_free(call);
+	rpc_client_close(client);
+	rpc_context_unregister_member(fixture->ctx, NULL, "sum");
+}
+
+static void
+server_test_deadline_expired(server_fixture *fixture,
+    gconstpointer user_data __unused)
+{
+	struct rpc_context_stats stats;
+	rpc_client_t client;
+	rpc_connection_t conn;
+	rpc_call_t call;
+	int i;
+
+	/* Don't resume the server yet, so the call sits in its queue */
+	client = rpc_client_create(uris[fixture->iuri].cli, 0);
+	g_assert_nonnull(client);
+	conn = rpc_client_get_connection(client);
+	conn->rco_rpc_timeout = 1;
+
+	call = rpc_connection_call(conn, NULL, NULL, "hi",
+	    rpc_object_pack("[s]", "world"), NULL);
+	g_assert_nonnull(call);
+
+	/* Let the one second budget run out on the server side */
+	g_usleep(1500 * 1000);
+	rpc_server_resume(fixture->srv);
+
+	for (i = 0; i < 100; i++) {
+		rpc_context_get_stats(fixture->ctx, &stats);
+		if (stats.shed_expired > 0)
+			break;
+
+		g_usleep(10000);
+	}
+
+	g_assert_cmpuint(stats.shed_expired, ==, 1);
+	g_assert_cmpint(fixture->count, ==, 0);
+
+	rpc_call_wait(call);
+	g_assert_cmpint(rpc_call_status(call), ==, RPC_CALL_ERROR);
+	g_assert_cmpint(rpc_error_get_code(rpc_call_result(call)), ==,
+	    ETIMEDOUT);
+
+	rpc_call_free(call);
+	rpc_client_close(client);
+}
+
+static void
+server_test_deadline_nested(server_fixture *fixture,
+    gconstpointer user_data __unused)
+{
+	__block rpc_connection_t inner_conn;
+	rpc_client_t client;
+	rpc_client_t inner;
+	rpc_connection_t conn;
+	rpc_object_t result;
+	int64_t outer_left;
+	int64_t inner_left;
+
+	rpc_context_register_block(fixture->ctx, NULL, "inner",
+	    NULL, ^(void *cookie, rpc_object_t args __unused) {
+		int64_t deadline = rpc_function_get_deadline(cookie);
+
+		g_assert_cmpint(deadline, !=, 0);
+		return (rpc_int64_create(deadline - g_get_monotonic_time()));
+	    });
+
+	rpc_context_register_block(fixture->ctx, NULL, "outer",
+	    NULL, ^(void *cookie, rpc_object_t args __unused) {
+		int64_t deadline = rpc_function_get_deadline(cookie);
+		rpc_object_t res;
+
+		g_assert_cmpint(deadline, !=, 0);
+		res = rpc_connection_call_simple(inner_conn, "inner",
+		    RPC_NULL_FORMAT);
+
+		return (rpc_object_pack("[i,v]",
+		    deadline - g_get_monotonic_time(), res));
+	    });
+
+	rpc_server_resume(fixture->srv);
+	client = rpc_client_create(uris[fixture->iuri].cli, 0);
+	inner = rpc_client_create(uris[fixture->iuri].cli, 0);
+	g_assert_nonnull(client);
+	g_assert_nonnull(inner);
+
+	/*
+	 * The inner connection has the default 60 second timeout, yet
+	 * the nested call may only use what is left of the outer one.
+	 */
+	conn = rpc_client_get_connection(client);
+	inner_conn = rpc_client_get_connection(inner);
+	conn->rco_rpc_timeout = 5;
+
+	result = rpc_connection_call_simple(conn, "outer", RPC_NULL_FORMAT);
+	g_assert_cmpint(rpc_get_type(result), ==, RPC_TYPE_ARRAY);
+	outer_left = rpc_array_get_int64(result, 0);
+	inner_left = rpc_array_get_int64(result, 1);
+
+	g_assert_cmpint(outer_left, >, 0);
+	g_assert_cmpint(outer_left, <=, 5 * G_USEC_PER_SEC);
+	g_assert_cmpint(inner_left, >, 0);
+	g_assert_cmpint(inner_left, <=, 5 * G_USEC_PER_SEC);
+
+	rpc_release(result);
+	rpc_client_close(inner);
+	rpc_client_close(client);
+	rpc_context_unregister_member(fixture->ctx, NULL, "outer");
+	rpc_context_unregister_member(fixture->ctx, NULL, "inner");
+}
+
+static void
+server_test_queue_limit(server_fixture *fixture,
+    gconstpointer user_data __unused)
+{
+	struct server_signal entered;
+	struct server_signal gate;
+	struct rpc_context_limits limits = { .max_queued = 2 };
+	struct rpc_context_stats stats;
+	rpc_client_t client;
+	rpc_connection_t conn;
+	rpc_call_t calls[5];
+	int i;
+
+	server_signal_init(&entered);
+	server_signal_init(&gate);
+	rpc_context_set_threads(fixture->ctx, 1);
+	rpc_context_set_limits(fixture->ctx, &limits);
+	rpc_context_register_block(fixture->ctx, NULL, "gate",
+	    NULL, ^(void *cookie __unused, rpc_object_t args __unused) {
+		server_signal_add(&entered, 1);
+		server_signal_wait(&gate, 1);
+		return (rpc_null_create());
+	    });
+
+	rpc_server_resume(fixture->srv);
+	client = rpc_client_create(uris[fixture->iuri].cli, 0);
+	g_assert_nonnull(client);
+	conn = rpc_client_get_connection(client);
+
+	calls[0] = rpc_connection_call(conn, NULL, NULL, "gate",
+	    rpc_array_create(), NULL);
+	g_assert(server_signal_wait(&entered, 1));
+
+	for (i = 1; i < 5; i++) {
+		calls[i] = rpc_connection_call(conn, NULL, NULL, "hi",
+		    rpc_object_pack("[s]", "world"), NULL);
+		g_assert_nonnull(calls[i]);
+	}
+
+	/* Two calls fit in the queue, the rest is rejected right away */
+	for (i = 3; i < 5; i++) {
+		rpc_call_wait(calls[i]);
+		g_assert_cmpint(rpc_call_status(calls[i]), ==, RPC_CALL_ERROR);
+		g_assert_cmpint(rpc_error_get_code(rpc_call_result(calls[i])),
+		    ==, EAGAIN);
+	}
+
+	rpc_context_get_stats(fixture->ctx, &stats);
+	g_assert_cmpuint(stats.shed_queue_full, ==, 2);
+	g_assert_cmpuint(stats.queued, ==, 2);
+
+	server_signal_add(&gate, 1);
+	for (i = 0; i < 3; i++) {
+		rpc_call_wait(calls[i]);
+		g_assert_cmpint(rpc_call_status(calls[i]), ==, RPC_CALL_DONE);
+	}
+
+	g_assert_cmpint(fixture->count, ==, 2);
+	for (i = 0; i < 5; i++)
+		rpc_call_free(calls[i]);
+
+	rpc_client_close(client);
+	rpc_context_unregister_member(fixture->ctx, NULL, "gate");
+	server_signal_clear(&gate);
+	server_signal_clear(&entered);
+}
+
+static void
+server_test_codel_shed(server_fixture *fixture,
+    gconstpointer user_data __unused)
+{
+	struct server_signal entered;
+	struct server_signal gate;
+	struct rpc_context_limits limits = {
+		.target_delay = 1000,
+		.interval = 1000
+	};
+	struct rpc_context_stats stats;
+	rpc_client_t client;
+	rpc_connection_t conn;
+	rpc_call_t calls[21];
+	rpc_object_t err;
+	uint64_t shed = 0;
+	int i;
+
+	server_signal_init(&entered);
+	server_signal_init(&gate);
+	rpc_context_set_threads(fixture->ctx, 1);
+	rpc_context_set_limits(fixture->ctx, &limits);
+	rpc_context_register_block(fixture->ctx, NULL, "gate",
+	    NULL, ^(void *cookie __unused, rpc_object_t args __unused) {
+		server_signal_add(&entered, 1);
+		server_signal_wait(&gate, 1);
+		return (rpc_null_create());
+	    });
+
+	rpc_context_register_block(fixture->ctx, NULL, "slow",
+	    NULL, ^(void *cookie __unused, rpc_object_t args __unused) {
+		g_usleep(2000);
+		return (rpc_null_create());
+	    });
+
+	rpc_server_resume(fixture->srv);
+	client = rpc_client_create(uris[fixture->iuri].cli, 0);
+	g_assert_nonnull(client);
+	conn = rpc_client_get_connection(client);
+
+	calls[0] = rpc_connection_call(conn, NULL, NULL, "gate",
+	    rpc_array_create(), NULL);
+	g_assert(server_signal_wait(&entered, 1));
+
+	for (i = 1; i < 21; i++) {
+		calls[i] = rpc_connection_call(conn, NULL, NULL, "slow",
+		    rpc_array_create(), NULL);
+		g_assert_nonnull(calls[i]);
+	}
+
+	/* Keep the queue well above the target delay for a while */
+	g_usleep(50000);
+	server_signal_add(&gate, 1);
+
+	for (i = 0; i < 21; i++) {
+		rpc_call_wait(calls[i]);
+		if (rpc_call_status(calls[i]) == RPC_CALL_ERROR) {
+			err = rpc_call_result(calls[i]);
+			g_assert_cmpint(rpc_error_get_code(err), ==, EAGAIN);
+			shed++;
+		} else
+			g_assert_cmpint(rpc_call_status(calls[i]), ==,
+			    RPC_CALL_DONE);
+
+		rpc_call_free(calls[i]);
+	}
+
+	/* Some calls were shed, but not the whole queue */
+	rpc_context_get_stats(fixture->ctx, &stats);
+	g_assert_cmpuint(shed, >, 0);
+	g_assert_cmpuint(shed, <, 20);
+	g_assert_cmpuint(stats.shed_delay, ==, shed);
+	g_assert_cmpuint(stats.queued, ==, 0);
+
+	rpc_client_close(client);
+	rpc_context_unregister_member(fixture->ctx, NULL, "slow");
+	rpc_context_unregister_member(fixture->ctx, NULL, "gate");
+	server_signal_clear(&gate);
+	server_signal_clear(&entered);
+}
+
+static void
+server_test_method_cache(server_fixture *fixture,
+    gconstpointer user_data __unused)
+{
+	__block rpc_connection_t sconn = NULL;
+	rpc_client_t client;
+	rpc_connection_t conn;
+	rpc_object_t result;
+	uint64_t hits;
+	char name[32];
+	int i;
+
+	rpc_server_set_event_handler(fixture->srv,
+	    ^(rpc_connection_t c, rpc_server_event_t event) {
+		if (event == RPC_SERVER_CLIENT_CONNECT)
+			sconn = c;
+	    });
+
+	rpc_server_resume(fixture->srv);
+	client = rpc_client_create(uris[fixture->iuri].cli, 0);
+	g_assert_nonnull(client);
+	conn = rpc_client_get_connection(client);
+
+	/* The first call resolves the method, the second one hits */
+	result = rpc_connection_call_simple(conn, "hi", "[s]", "world");
+	g_assert_cmpstr(rpc_string_get_string_ptr(result), ==, "hello world!");
+	rpc_release(result);
+	g_assert_nonnull(sconn);
+	g_assert_cmpuint(g_hash_table_size(sconn->rco_method_cache), ==, 1);
+
+	hits = sconn->rco_method_cache_hits;
+	result = rpc_connection_call_simple(conn, "hi", "[s]", "world");
+	g_assert_cmpstr(rpc_string_get_string_ptr(result), ==, "hello world!");
+	rpc_release(result);
+	g_assert_cmpuint(sconn->rco_method_cache_hits, ==, hits + 1);
+
+	/* Unknown methods are never cached */
+	result = rpc_connection_call_simple(conn, "nope", RPC_NULL_FORMAT);
+	g_assert_cmpint(rpc_get_type(result), ==, RPC_TYPE_ERROR);
+	g_assert_cmpint(rpc_error_get_code(result), ==, ENOENT);
+	rpc_release(result);
+
+	rpc_context_register_block(fixture->ctx, NULL, "method_missing",
+	    NULL, ^(void *cookie __unused, rpc_object_t args __unused) {
+		return (rpc_string_create("missing"));
+	    });
+
+	for (i = 0; i < 2; i++) {
+		result = rpc_connection_call_simple(conn, "nope",
+		    RPC_NULL_FORMAT);
+		g_assert_cmpstr(rpc_string_get_string_ptr(result), ==,
+		    "missing");
+		rpc_release(result);
+	}
+
+	/* Registering method_missing flushed the cache */
+	g_assert_cmpuint(g_hash_table_size(sconn->rco_method_cache), ==, 0);
+	rpc_context_unregister_member(fixture->ctx, NULL, "method_missing");
+
+	/* Replacing a method must not leave the old handle behind */
+	rpc_context_unregister_member(fixture->ctx, NULL, "hi");
+	result = rpc_connection_call_simple(conn, "hi", "[s]", "world");
+	g_assert_cmpint(rpc_get_type(result), ==, RPC_TYPE_ERROR);
+	g_assert_cmpint(rpc_error_get_code(result), ==, ENOENT);
+	rpc_release(result);
+
+	rpc_context_register_block(fixture->ctx, NULL, "hi", NULL,
+	    ^(void *cookie __unused, rpc_object_t args __unused) {
+		return (rpc_string_create("replaced"));
+	    });
+
+	result = rpc_connection_call_simple(conn, "hi", "[s]", "world");
+	g_assert_cmpstr(rpc_string_get_string_ptr(result), ==, "replaced");
+	rpc_release(result);
+
+	/* The cache is bounded no matter how many methods get called */
+	for (i = 0; i < 200; i++) {
+		g_snprintf(name, sizeof(name), "method%d", i);
+		rpc_context_register_block(fixture->ctx, NULL, name, NULL,
+		    ^(void *cookie __unused, rpc_object_t args __unused) {
+			return (rpc_null_create());
+		    });
+	}
+
+	for (i = 0; i < 200; i++) {
+		g_snprintf(name, sizeof(name), "method%d", i);
+		result = rpc_connection_call_simple(conn, name,
+		    RPC_NULL_FORMAT);
+		g_assert_cmpint(rpc_get_type(result), ==, RPC_TYPE_NULL);
+		rpc_release(result);
+	}
+
+	g_assert_cmpuint(g_hash_table_size(sconn->rco_method_cache), <=, 128);
+	g_assert_cmpuint(g_queue_get_length(&sconn->rco_method_lru), ==,
+	    g_hash_table_size(sconn->rco_method_cache));
+
+	for (i = 0; i < 200; i++) {
+		g_snprintf(name, sizeof(name), "method%d", i);
+		rpc_context_unregister_member(fixture->ctx, NULL, name);
+	}
+
+	rpc_client_close(client);
+}
+
+static void
+server_test_inflight_stream(server_fixture *fixture,
+    gconstpointer user_data __unused)
+{
+	rpc_client_t client;
+	rpc_connection_t conn;
+	rpc_call_t stream;
+	rpc_call_t other;
+	int64_t expected = 0;
+	bool done = false;
+
+	rpc_context_register_block(fixture->ctx, NULL, "ticker",
+	    NULL, ^(void *cookie, rpc_object_t args __unused) {
+		rpc_function_start_stream(cookie);
+		for (int64_t n = 0; n < 20; n++) {
+			if (rpc_function_yield(cookie,
+			    rpc_int64_create(n)) != 0)
+				break;
+		}
+
+		rpc_function_end(cookie);
+		return (RPC_FUNCTION_STILL_RUNNING);
+	    });
+
+	rpc_server_set_event_handler(fixture->srv,
+	    ^(rpc_connection_t sconn, rpc_server_event_t event) {
+		if (event == RPC_SERVER_CLIENT_CONNECT)
+			rpc_connection_set_max_inflight(sconn, 1);
+	    });
+
+	rpc_server_resume(fixture->srv);
+	client = rpc_client_create(uris[fixture->iuri].cli, 0);
+	g_assert(client != NULL);
+
+	conn = rpc_client_get_connection(client);
+	stream = rpc_connection_call(conn, NULL, NULL, "ticker",
+	    rpc_array_create(), NULL);
+	g_assert_nonnull(stream);
+
+	/* The stream now holds the only slot */
+	rpc_call_wait(stream);
+	g_assert_cmpint(rpc_call_status(stream), ==, RPC_CALL_STREAM_START);
+
+	/* Held back by the server until the stream is done */
+	other = rpc_connection_call(conn, NULL, NULL, "hi",
+	    rpc_object_pack("[s]", "world"), NULL);
+	g_assert_nonnull(other);
+
+	/* Continuations for the running stream must still get through */
+	rpc_call_continue(stream, false);
+	while (!done) {
+		rpc_call_wait(stream);
+
+		switch (rpc_call_status(stream)) {
+		case RPC_CALL_MORE_AVAILABLE:
+			g_assert_cmpint(rpc_int64_get_value(
+			    rpc_call_result(stream)), ==, expected);
+			expected++;
+			rpc_call_continue(stream, false);
+			break;
+
+		default:
+			done = true;
+			break;
+		}
+	}
+
+	g_assert_cmpint(rpc_call_status(stream), ==, RPC_CALL_ENDED);
+	g_assert_cmpint(expected, ==, 20);
+
+	rpc_call_wait(other);
+	g_assert_cmpint(rpc_call_status(other), ==, RPC_CALL_DONE);
+	g_assert_cmpstr(rpc_string_get_string_ptr(rpc_call_result(other)), ==,
+	    "hello world!");
+
+	rpc_call_free(other);
+	rpc_call_free(stream);
+	rpc_client_close(client);
+	rpc_context_unregister_member(fixture->ctx, NULL, "ticker");
+}
+
+#define	FLOOD_CALLS	64
+#define	FLOOD_QUEUED	4
+
+static void
+server_test_inflight_flood(server_fixture *fixture,
+    gconstpointer user_data __unused)
+{
+	__block rpc_connection_t sconn = NULL;
+	struct server_signal entered;
+	struct server_signal gate;
+	rpc_client_t client;
+	rpc_connection_t conn;
+	rpc_call_t calls[FLOOD_CALLS];
+	rpc_object_t result;
+	guint depth;
+	int rejected = 0;
+	int i;
+
+	server_signal_init(&entered);
+	server_signal_init(&gate);
+	rpc_context_register_block(fixture->ctx, NULL, "gate",
+	    NULL, ^(void *cookie __unused, rpc_object_t args __unused) {
+		server_signal_add(&entered, 1);
+		server_signal_wait(&gate, 1);
+		return (rpc_null_create());
+	    });
+
+	rpc_server_set_event_handler(fixture->srv,
+	    ^(rpc_connection_t c, rpc_server_event_t event) {
+		if (event == RPC_SERVER_CLIENT_CONNECT) {
+			rpc_connection_set_max_inflight(c, 1);
+			rpc_connection_set_max_queued(c, FLOOD_QUEUED);
+			sconn = c;
+		}
+	    });
+
+	rpc_server_resume(fixture->srv);
+	client = rpc_client_create(uris[fixture->iuri].cli, 0);
+	g_assert_nonnull(client);
+	conn = rpc_client_get_connection(client);
+
+	calls[0] = rpc_connection_call(conn, NULL, NULL, "gate",
+	    rpc_array_create(), NULL);
+	g_assert(server_signal_wait(&entered, 1));
+	g_assert_nonnull(sconn);
+
+	for (i = 1; i < FLOOD_CALLS; i++) {
+		calls[i] = rpc_connection_call(conn, NULL, NULL, "hi",
+		    rpc_object_pack("[s]", "world"), NULL);
+		g_assert_nonnull(calls[i]);
+	}
+
+	/* Everything past the parking queue is turned away right away */
+	for (i = FLOOD_QUEUED + 1; i < FLOOD_CALLS; i++) {
+		rpc_call_wait(calls[i]);
+		g_assert_cmpint(rpc_call_status(calls[i]), ==, RPC_CALL_ERROR);
+		result = rpc_call_result(calls[i]);
+		g_assert_cmpint(rpc_error_get_code(result), ==, EAGAIN);
+		rejected++;
+	}
+
+	g_mutex_lock(&sconn->rco_inflight_mtx);
+	depth = sconn->rco_admit_queue.length;
+	g_mutex_unlock(&sconn->rco_inflight_mtx);
+	g_assert_cmpuint(depth, <=, FLOOD_QUEUED);
+	g_assert_cmpint(rejected, ==, FLOOD_CALLS - FLOOD_QUEUED - 1);
+
+	/* The parked calls still run once the slot frees up */
+	server_signal_add(&gate, 1);
+	for (i = 0; i <= FLOOD_QUEUED; i++) {
+		rpc_call_wait(calls[i]);
+		g_assert_cmpint(rpc_call_status(calls[i]), ==, RPC_CALL_DONE);
+	}
+
+	g_assert_cmpint(g_atomic_int_get(&fixture->count), ==, FLOOD_QUEUED);
+	for (i = 0; i < FLOOD_CALLS; i++)
+		rpc_call_free(calls[i]);
+
+	rpc_client_close(client);
+	rpc_context_unregister_member(fixture->ctx, NULL, "gate");
+	server_signal_clear(&gate);
+	server_signal_clear(&entered);
+}
+
+static void
+server_test_call_weight(server_fixture *fixture,
+    gconstpointer user_data __unused)
+{
+	struct server_signal entered;
+	struct server_signal gate;
+	struct rpc_context_stats stats;
+	rpc_client_t clients[2];
+	rpc_connection_t conns[2];
+	rpc_call_t calls[13];
+	GString *order;
+	GMutex order_mtx;
+	__block volatile gint connected = 0;
+	int i, j;
+
+	server_signal_init(&entered);
+	server_signal_init(&gate);
+	g_mutex_init(&order_mtx);
+	order = g_string_new(NULL);
+
+	/* A single worker, so every other call has to queue */
+	rpc_context_set_threads(fixture->ctx, 1);
+	rpc_context_register_block(fixture->ctx, NULL, "gate",
+	    NULL, ^(void *cookie __unused, rpc_object_t args __unused) {
+		server_signal_add(&entered, 1);
+		server_signal_wait(&gate, 1);
+		return (rpc_null_create());
+	    });
+
+	rpc_context_register_block(fixture->ctx, NULL, "tick",
+	    NULL, ^(void *cookie __unused, rpc_object_t args) {
+		g_mutex_lock(&order_mtx);
+		g_string_append(order, rpc_array_get_string(args, 0));
+		g_mutex_unlock(&order_mtx);
+		return (rpc_null_create());
+	    });
+
+	/* The first client gets three calls per round */
+	rpc_server_set_event_handler(fixture->srv,
+	    ^(rpc_connection_t sconn, rpc_server_event_t event) {
+		if (event == RPC_SERVER_CLIENT_CONNECT &&
+		    g_atomic_int_add(&connected, 1) == 0)
+			rpc_connection_set_weight(sconn, 3);
+	    });
+
+	rpc_server_resume(fixture->srv);
+	for (i = 0; i < 2; i++) {
+		clients[i] = rpc_client_create(uris[fixture->iuri].cli, 0);
+		g_assert_nonnull(clients[i]);
+		conns[i] = rpc_client_get_connection(clients[i]);
+	}
+
+	calls[12] = rpc_connection_call(conns[0], NULL, NULL, "gate",
+	    rpc_array_create(), NULL);
+	g_assert(server_signal_wait(&entered, 1));
+
+	for (i = 0; i < 2; i++) {
+		for (j = 0; j < 6; j++) {
+			calls[i * 6 + j] = rpc_connection_call(conns[i], NULL,
+			    NULL, "tick", rpc_object_pack("[s]",
+			    i == 0 ? "a" : "b"), NULL);
+		}
+
+		/* Queue all of a's calls before any of b's */
+		for (j = 0; j < 100; j++) {
+			rpc_context_get_stats(fixture->ctx, &stats);
+			if (stats.queued == (size_t)(i + 1) * 6)
+				break;
+
+			g_usleep(10000);
+		}
+
+		g_assert_cmpuint(stats.queued, ==, (i + 1) * 6);
+	}
+
+	server_signal_add(&gate, 1);
+	for (i = 0; i < 13; i++) {
+		rpc_call_wait(calls[i]);
+		g_assert_cmpint(rpc_call_status(calls[i]), ==, RPC_CALL_DONE);
+		rpc_call_free(calls[i]);
+	}
+
+	g_assert_cmpstr(order->str, ==, "aaabaaabbbbb");
+
+	for (i = 0; i < 2; i++)
+		rpc_client_close(clients[i]);
+
+	rpc_context_unregister_member(fixture->ctx, NULL, "gate");
+	rpc_context_unregister_member(fixture->ctx, NULL, "tick");
+	g_string_free(order, true);
+	g_mutex_clear(&order_mtx);
+	server_signal_clear(&gate);
+	server_signal_clear(&entered);
+}
+
+static void
+server_test_property_coalesce(server_fixture *fixture,
+    gconstpointer user_data)
+{
+	rpc_instance_t root = rpc_context_get_root(fixture->ctx);
+	rpc_client_t client;
+	rpc_connection_t conn;
+	rpc_object_t result;
+	struct server_signal done;
+	void *handle;
+	__block gint counter = 0;
+	__block gint received = 0;
+	gint64 start, elapsed;
+	int i;
+
+	server_signal_init(&done);
+	g_assert(rpc_instance_register_property(root, NULL, "counter", NULL,
+	    ^(void *cookie __unused) {
+		return (rpc_int64_create(g_atomic_int_get(&counter)));
+	    }, NULL) == 0);
+	g_assert(rpc_instance_set_property_interval(root, NULL, "counter",
+	    100000) == 0);
+
+	rpc_server_resume(fixture->srv);
+	client = rpc_client_create(uris[fixture->iuri].cli, 0);
+	g_assert(client != NULL);
+
+	conn = rpc_client_get_connection(client);
+	handle = rpc_connection_watch_property(conn, "/",
+	    RPC_DEFAULT_INTERFACE, "counter", ^(rpc_object_t value) {
+		g_atomic_int_inc(&received);
+		if (rpc_int64_get_value(value) == 999)
+			server_signal_add(&done, 1);
+	    });
+	g_assert_nonnull(handle);
+
+	/* A round trip makes sure the subscription reached the server */
+	result = rpc_connection_call_syncp(conn, "/", RPC_DEFAULT_INTERFACE,
+	    "hi", "[s]", "world");
+	g_assert_nonnull(result);
+	rpc_release(result);
+	g_atomic_int_set(&received, 0);
+
+	/* 1000 changes spread over about half a second */
+	start = g_get_monotonic_time();
+	for (i = 0; i < 1000; i++) {
+		g_atomic_int_set(&counter, i);
+		rpc_instance_property_changed(root, RPC_DEFAULT_INTERFACE,
+		    "counter", NULL);
+		g_usleep(500);
+	}
+
+	/* The latest value is always delivered */
+	g_assert(server_signal_wait(&done, 1));
+	elapsed = g_get_monotonic_time() - start;
+
+	/* ...and at most one notification per interval */
+	g_assert_cmpint(g_atomic_int_get(&received), <=,
+	    elapsed / 100000 + 2);
+
+	rpc_client_close(client);
+	rpc_instance_unregister_member(root, NULL, "counter");
+	server_signal_clear(&done);
+}
+
+static void
+server_test_register()
+{
+
+	g_test_add("/server/resume/tcp", server_fixture, (void *)TCP_GOOD,
+	    server_test_valid_server_set_up, server_test_resume,
+	    server_test_valid_server_tear_down);
+
+	g_test_add("/server/resume/v6", server_fixture, (void *)V6_GOOD,
+	    server_test_valid_server_set_up, server_test_resume,
+	    server_test_valid_server_tear_down);
+
+#ifndef __linux__
+	g_test_add("/server/resume/ws", server_fixture, (void *)WS_GOOD,
+	    server_test_valid_server_set_up, server_test_resume,
+	    server_test_valid_server_tear_down);
+#endif
+
+	g_test_add("/server/resume/loopback", server_fixture, (void *)LB_GOOD,
+	    server_test_valid_server_set_up, server_test_resume,
+	    server_test_valid_server_tear_down);
+
+	g_test_add("/server/listen/fail", server_fixture, (void *)PROTO_BAD,
+	    server_test_basic_set_up, server_test_failed_listen,
+	    server_test_basic_tear_down);
+
+	g_test_add("/server/nullables/null", server_fixture, (void *)TCP_GOOD,
+	    server_test_valid_server_set_up, server_test_nullables,
+	    server_test_valid_server_tear_down);
+
+	g_test_add("/server/nullables/notnull", server_fixture, (void *)TCP_GOOD,
+	    server_test_alt_server_set_up, server_test_nullables,
+	    server_test_valid_server_tear_down);
+
+	g_test_add_func("/server/listen/all", server_test_all_listen);
+
+	g_test_add("/server/flush/tcp", server_fixture, (void *)TCP_GOOD,
+	    server_test_valid_server_set_up, server_test_flush,
+	    server_test_valid_server_tear_down);
+
+#ifndef __linux__
+	g_test_add("/server/flush/ws", server_fixture, (void *)WS_GOOD,
+	    server_test_valid_server_set_up, server_test_flush,
+	    server_test_valid_server_tear_down);
+#endif
+
+	g_test_add("/server/flush/event", server_fixture, (void *)TCP_GOOD,
+	    server_test_valid_server_set_up, server_test_event,
+	    server_test_valid_server_tear_down);
+
+	g_test_add("/server/stream/one", server_fixture, (void *)LB_GOOD,
+	    server_test_stream_setup, server_test_stream_run,
+	    server_test_stream_tear_down);
+
+	g_test_add("/server/stream/close", server_fixture, (void *)TCP_GOOD,
+	    server_test_stream_setup, server_test_stream_close,
+	    server_test_stream_tear_down);
+
+	g_test_add("/server/stream/abort", server_fixture, (void *)TCP_GOOD,
+	    server_test_stream_setup, server_test_stream_abort,
+	    server_test_stream_tear_down);
+
+	g_test_add("/server/stream/kill", server_fixture, (void *)TCP_GOOD,
+	    server_test_stream_setup, server_test_stream_kill,
+	    server_test_stream_tear_down);
+
+	g_test_add("/server/stream/window", server_fixture, (void *)TCP_GOOD,
+	    server_test_valid_server_set_up, server_test_stream_window,
+	    server_test_valid_server_tear_down);
+
+	g_test_add("/server/stream/window_stall", server_fixture,
+	    (void *)TCP_GOOD, server_test_valid_server_set_up,
+	    server_test_stream_window_stall,
+	    server_test_valid_server_tear_down);
+
+	g_test_add("/server/stream/batch", server_fixture, (void *)TCP_GOOD,
+	    server_test_valid_server_set_up, server_test_stream_batch,
+	    server_test_valid_server_tear_down);
+
+	g_test_add("/server/stream/upload", server_fixture, (void *)TCP_GOOD,
+	    server_test_valid_server_set_up, server_test_stream_upload,
+	    server_test_valid_server_tear_down);
+
+	g_test_add("/server/flush/loopback", server_fixture, (void *)LB_GOOD,
+	    server_test_valid_server_set_up, server_test_flush,
+	    server_test_valid_server_tear_down);
+
+	g_test_add("/server/inline/tcp", server_fixture, (void *)TCP_GOOD,
+	    server_test_valid_server_set_up, server_test_inline,
+	    server_test_valid_server_tear_down);
+
+	g_test_add("/server/event/burst", server_fixture, (void *)TCP_GOOD,
+	    server_test_valid_server_set_up, server_test_event_burst,
+	    server_test_valid_server_tear_down);
+
+	g_test_add("/server/event/burst_bytes", server_fixture,
+	    (void *)TCP_GOOD, server_test_valid_server_set_up,
+	    server_test_event_burst_bytes, server_test_valid_server_tear_down);
+
+	g_test_add("/server/event/shared", server_fixture, (void *)TCP_GOOD,
+	    server_test_valid_server_set_up, server_test_event_shared,
+	    server_test_valid_server_tear_down);
+
+	g_test_add("/server/event/wildcard", server_fixture, (void *)TCP_GOOD,
+	    server_test_valid_server_set_up, server_test_event_wildcard,
+	    server_test_valid_server_tear_down);
+
+	g_test_add("/server/property/coalesce", server_fixture,
+	    (void *)TCP_GOOD, server_test_valid_server_set_up,
+	    server_test_property_coalesce, server_test_valid_server_tear_down);
+
+	g_test_add("/server/call/deadline_expired", server_fixture,
+	    (void *)TCP_GOOD, server_test_valid_server_set_up,
+	    server_test_deadline_expired, server_test_valid_server_tear_down);
+
+	g_test_add("/server/call/deadline_nested", server_fixture,
+	    (void *)TCP_GOOD, server_test_valid_server_set_up,
+	    server_test_deadline_nested, server_test_valid_server_tear_down);
+
+	g_test_add("/server/limits/queue", server_fixture, (void *)TCP_GOOD,
+	    server_test_valid_server_set_up, server_test_queue_limit,
+	    server_test_valid_server_tear_down);
+
+	g_test_add("/server/limits/codel", server_fixture, (void *)TCP_GOOD,
+	    server_test_valid_server_set_up, server_test_codel_shed,
+	    server_test_valid_server_tear_down);
+
+	g_test_add("/server/event/lossless", server_fixture, (void *)TCP_GOOD,
+	    server_test_valid_server_set_up, server_test_event_lossless,
+	    server_test_valid_server_tear_down);
+
+	g_test_add("/server/event/drop_oldest", server_fixture,
+	    (void *)TCP_GOOD, server_test_valid_server_set_up,
+	    server_test_event_drop_oldest, server_test_valid_server_tear_down);
+
+	g_test_add("/server/event/disconnect", server_fixture,
+	    (void *)TCP_GOOD, server_test_valid_server_set_up,
+	    server_test_event_disconnect, server_test_valid_server_tear_down);
+
+	g_test_add("/server/event/recursive", server_fixture,
+	    (void *)TCP_GOOD, server_test_valid_server_set_up,
+	    server_test_event_recursive, server_test_valid_server_tear_down);
+
+	g_test_add("/server/call/method_cache", server_fixture,
+	    (void *)TCP_GOOD, server_test_valid_server_set_up,
+	    server_test_method_cache, server_test_valid_server_tear_down);
+
+	g_test_add("/server/call/inflight_stream", server_fixture,
+	    (void *)TCP_GOOD, server_test_valid_server_set_up,
+	    server_test_inflight_stream, server_test_valid_server_tear_down);
+
+	g_test_add("/server/call/inflight_flood", server_fixture,
+	    (void *)TCP_GOOD, server_test_valid_server_set_up,
+	    server_test_inflight_flood, server_test_valid_server_tear_down);
+
+	g_test_add("/server/call/weight", server_fixture, (void *)TCP_GOOD,
+	    server_test_valid_server_set_up, server_test_call_weight,
 	    server_test_valid_server_tear_down);
 }
 
@@ -35,8 +35,13 @@
 #include <rpc/object.h>
 #include <rpc/client.h>
 
+#define	BENCHMARK_INTERFACE	"com.twoporeguys.librpc.Benchmark"
+
 static void timespec_diff(struct timespec *, struct timespec *,
     struct timespec *);
+static int compare_double(const void *, const void *);
+static int run_latency(rpc_connection_t, int64_t, bool, double *);
+static void print_latency(const char *, double *, int64_t, bool);
 void usage(const char *);
 int main(int, char * const[]);
 
@@ -53,11 +58,90 @@ timespec_diff(struct timespec *start, struct timespec *stop,
 	}
 }
 
+static int
+compare_double(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+
+	return ((x > y) - (x < y));
+}
+
+static int
+run_latency(rpc_connection_t connection, int64_t ncycles, bool fast,
+    double *samples)
+{
+	struct timespec start;
+	struct timespec end;
+	struct timespec diff;
+	rpc_object_t result;
+	rpc_call_t call;
+	int64_t i;
+
+	for (i = 0; i < ncycles; i++) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+
+		if (fast) {
+			result = rpc_connection_call_syncp(connection, "/",
+			    BENCHMARK_INTERFACE, "ping", "[i]", i);
+			if (result == NULL || rpc_is_error(result)) {
+				fprintf(stderr, "Ping failed\n");
+				return (-1);
+			}
+
+			rpc_release(result);
+		} else {
+			call = rpc_connection_call(connection, "/",
+			    BENCHMARK_INTERFACE, "ping",
+			    rpc_object_pack("[i]", i), NULL);
+			if (call == NULL) {
+				fprintf(stderr, "Ping failed\n");
+				return (-1);
+			}
+
+			rpc_call_wait(call);
+			if (rpc_call_status(call) != RPC_CALL_DONE) {
+				fprintf(stderr, "Ping failed\n");
+				rpc_call_free(call);
+				return (-1);
+			}
+
+			rpc_call_free(call);
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		timespec_diff(&start, &end, &diff);
+		samples[i] = diff.tv_sec + diff.tv_nsec / 1E9;
+	}
+
+	return (0);
+}
+
+static void
+print_latency(const char *mode, double *samples, int64_t n, bool quiet)
+{
+
+	qsort(samples, (size_t)n, sizeof(*samples), compare_double);
+
+	if (quiet) {
+		printf("mode=%s calls=%" PRId64 " p50=%f p99=%f\n", mode, n,
+		    samples[n / 2], samples[n * 99 / 100]);
+		return;
+	}
+
+	printf("%s calls: %" PRId64 "\n", mode, n);
+	printf("  p50 latency: %.08fs\n", samples[n / 2]);
+	printf("  p99 latency: %.08fs\n", samples[n * 99 / 100]);
+}
+
 void
 usage(const char *argv0)
 {
 
-	fprintf(stderr, "Usage: %s -u URI [-c CYCLES] [-m]\n", argv0);
+	fprintf(stderr, "Usage: %s -u URI [-c CYCLES] [-w MIN[:MAX]] [-m]\n",
+	    argv0);
+	fprintf(stderr, "       %s -u URI -l [-c CYCLES] [-s SPIN_USEC]\n",
+	    argv0);
 	fprintf(stderr, "       %s -h\n", argv0);
 }
 
@@ -79,13 +163,19 @@ main(int argc, char * const argv[])
 	int64_t cycles = 0;
 	int64_t bytes = 0;
 	int64_t ncycles = 1000;
+	size_t window_min = 0;
+	size_t window_max = 0;
+	unsigned int spin = 0;
+	double *samples;
+	bool latency = false;
 	bool shmem = false;
 	bool quiet = false;
 	char *uri = NULL;
+	char *end_ptr;
 	int c;
 
 	for (;;) {
-		c = getopt(argc, argv, "u:c:mhq");
+		c = getopt(argc, argv, "u:c:w:s:lmhq");
 		if (c == -1)
 			break;
 
@@ -98,6 +188,20 @@ main(int argc, char * const argv[])
 			ncycles = strtoll(optarg, NULL, 10);
 			break;
 
+		case 'w':
+			window_min = strtoull(optarg, &end_ptr, 10);
+			if (*end_ptr == ':')
+				window_max = strtoull(end_ptr + 1, NULL, 10);
+			break;
+
+		case 's':
+			spin = (unsigned int)strtoul(optarg, NULL, 10);
+			break;
+
+		case 'l':
+			latency = true;
+			break;
+
 		case 'm':
 			shmem = true;
 			break;
@@ -127,8 +231,31 @@ main(int argc, char * const argv[])
 	}
 
 	connection = rpc_client_get_connection(client);
+
+	if (latency) {
+		if (ncycles < 1) {
+			fprintf(stderr, "Error: need at least one cycle\n");
+			return (EXIT_FAILURE);
+		}
+
+		/* Regular calls first, then the synchronous fast path */
+		samples = calloc((size_t)ncycles, sizeof(*samples));
+		if (run_latency(connection, ncycles, false, samples) != 0)
+			goto error;
+
+		print_latency("wait", samples, ncycles, quiet);
+
+		rpc_connection_set_sync_spin(connection, spin);
+		if (run_latency(connection, ncycles, true, samples) != 0)
+			goto error;
+
+		print_latency("sync", samples, ncycles, quiet);
+		free(samples);
+		return (EXIT_SUCCESS);
+	}
+
 	call = rpc_connection_call(connection, "/",
-	    "com.twoporeguys.librpc.Benchmark", "stream",
+	    BENCHMARK_INTERFACE, "stream",
 	    rpc_object_pack("[i]", ncycles), NULL);
 	if (call == NULL) {
 		error = rpc_get_last_error();
@@ -140,7 +267,11 @@ main(int argc, char * const argv[])
 	clock_gettime(CLOCK_REALTIME, &start);
 	lat_start = start;
 
-	rpc_call_set_prefetch(call, 128);
+	if (window_min != 0)
+		rpc_call_set_window(call, window_min, window_max, 0);
+	else
+		rpc_call_set_prefetch(call, 128);
+
 	rpc_call_wait(call);
 
 next:
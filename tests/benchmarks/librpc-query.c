@@ -0,0 +1,231 @@
+/*
+ * Copyright 2015-2017 Two Pore Guys, Inc.
+ * All rights reserved
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted providing that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <inttypes.h>
+#include <rpc/object.h>
+#include <rpc/query.h>
+
+static void timespec_diff(struct timespec *, struct timespec *,
+    struct timespec *);
+static rpc_object_t create_source(int64_t);
+static int64_t run_query(rpc_object_t, rpc_object_t, rpc_query_plan_t,
+    rpc_query_params_t);
+void usage(const char *);
+int main(int, char * const[]);
+
+static void
+timespec_diff(struct timespec *start, struct timespec *stop,
+    struct timespec *result)
+{
+	if ((stop->tv_nsec - start->tv_nsec) < 0) {
+		result->tv_sec = stop->tv_sec - start->tv_sec - 1;
+		result->tv_nsec = stop->tv_nsec - start->tv_nsec + 1000000000;
+	} else {
+		result->tv_sec = stop->tv_sec - start->tv_sec;
+		result->tv_nsec = stop->tv_nsec - start->tv_nsec;
+	}
+}
+
+static rpc_object_t
+create_source(int64_t nitems)
+{
+	rpc_object_t source;
+	char name[32];
+	int64_t i;
+
+	source = rpc_array_create();
+	for (i = 0; i < nitems; i++) {
+		snprintf(name, sizeof(name), "item-%" PRId64, i);
+		rpc_array_append_stolen_value(source,
+		    rpc_object_pack("{v}", "a", rpc_object_pack("{s,i,b}",
+		    "name", name,
+		    "value", i,
+		    "enabled", (bool)(i % 2 == 0))));
+	}
+
+	return (source);
+}
+
+static int64_t
+run_query(rpc_object_t source, rpc_object_t rules, rpc_query_plan_t plan,
+    rpc_query_params_t params)
+{
+	rpc_query_iter_t iter;
+	rpc_object_t chunk;
+	int64_t count = 0;
+
+	/* Interpreted when no plan is given, as in rpc_query() callers */
+	if (plan != NULL)
+		iter = rpc_query_compiled(source, params, plan);
+	else
+		iter = rpc_query(source, params, rules);
+
+	if (iter == NULL)
+		return (-1);
+
+	while (rpc_query_next(iter, &chunk)) {
+		count++;
+		rpc_release(chunk);
+	}
+
+	rpc_query_iter_free(iter);
+	return (count);
+}
+
+void
+usage(const char *argv0)
+{
+
+	fprintf(stderr, "Usage: %s [-n ITEMS] [-c CYCLES] [-j SLICES] [-p] "
+	    "[-q]\n", argv0);
+	fprintf(stderr, "       %s -h\n", argv0);
+}
+
+int
+main(int argc, char * const argv[])
+{
+	struct timespec start;
+	struct timespec end;
+	struct timespec diff;
+	struct rpc_query_params params = { .parallelism = 1 };
+	double elapsed;
+	rpc_object_t source;
+	rpc_object_t rules;
+	rpc_query_plan_t plan = NULL;
+	int64_t nitems = 1000000;
+	int64_t ncycles = 10;
+	int64_t matched = 0;
+	int64_t count;
+	int64_t i;
+	bool compiled = false;
+	bool quiet = false;
+	int c;
+
+	for (;;) {
+		c = getopt(argc, argv, "n:c:j:pqh");
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'n':
+			nitems = strtoll(optarg, NULL, 10);
+			break;
+
+		case 'c':
+			ncycles = strtoll(optarg, NULL, 10);
+			break;
+
+		case 'j':
+			params.parallelism = (uint32_t)strtoul(optarg, NULL,
+			    10);
+			break;
+
+		case 'p':
+			compiled = true;
+			break;
+
+		case 'q':
+			quiet = true;
+			break;
+
+		case 'h':
+			usage(argv[0]);
+			return (EXIT_SUCCESS);
+		}
+	}
+
+	if (nitems < 1 || ncycles < 1 || params.parallelism < 1) {
+		fprintf(stderr, "Error: need at least one item, cycle and "
+		    "slice\n");
+		usage(argv[0]);
+		return (EXIT_FAILURE);
+	}
+
+	/*
+	 * A typical rule set: a range on one field, a boolean flag and
+	 * an alternative of a regular expression and an equality test.
+	 */
+	source = create_source(nitems);
+	rules = rpc_object_pack("[[s,s,i],[s,s,b],[s,[[s,s,s],[s,s,i]]]]",
+	    "a.value", ">=", nitems / 4,
+	    "a.enabled", "=", true,
+	    "or",
+	    "a.name", "~", "^item-[0-9]*7$",
+	    "a.value", "=", nitems / 2);
+
+	if (compiled) {
+		plan = rpc_query_compile(rules);
+		if (plan == NULL) {
+			fprintf(stderr, "Cannot compile query rules\n");
+			return (EXIT_FAILURE);
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < ncycles; i++) {
+		count = run_query(source, rules, plan, &params);
+		if (count < 0) {
+			fprintf(stderr, "Query failed\n");
+			return (EXIT_FAILURE);
+		}
+
+		matched += count;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	timespec_diff(&start, &end, &diff);
+	elapsed = diff.tv_sec + diff.tv_nsec / 1E9;
+
+	if (quiet) {
+		printf("mode=%s items=%" PRId64 " cycles=%" PRId64
+		    " slices=%" PRIu32 " elapsed=%f per_item=%.09f\n",
+		    compiled ? "compiled" : "query", nitems, ncycles,
+		    params.parallelism, elapsed, elapsed / (nitems * ncycles));
+	} else {
+		printf("Mode: %s\n", compiled ? "compiled" : "query");
+		printf("Items: %" PRId64 "\n", nitems);
+		printf("Cycles: %" PRId64 "\n", ncycles);
+		printf("Slices: %" PRIu32 "\n", params.parallelism);
+		printf("Matched per cycle: %" PRId64 "\n", matched / ncycles);
+		printf("Elapsed time: %fs\n", elapsed);
+		printf("Time per item: %.09fs\n",
+		    elapsed / (nitems * ncycles));
+	}
+
+	if (plan != NULL)
+		rpc_query_plan_free(plan);
+
+	rpc_release(rules);
+	rpc_release(source);
+	return (EXIT_SUCCESS);
+}
@@ -40,11 +40,13 @@ static size_t msgsize = 4096;
 static bool shmem = false;
 
 static rpc_object_t benchmark_stream(void *, rpc_object_t);
+static rpc_object_t benchmark_ping(void *, rpc_object_t);
 void usage(const char *);
 int main(int, char * const []);
 
 static const struct rpc_if_member benchmark_vtable[] = {
 	RPC_METHOD(stream, benchmark_stream),
+	RPC_METHOD(ping, benchmark_ping),
 	RPC_MEMBER_END
 };
 
@@ -80,6 +82,14 @@ benchmark_stream(void *cookie, rpc_object_t args)
 	return (NULL);
 }
 
+static rpc_object_t
+benchmark_ping(void *cookie, rpc_object_t args)
+{
+
+	(void)cookie;
+	return (rpc_retain(args));
+}
+
 void
 usage(const char *argv0)
 {